@@ -54,167 +54,116 @@ static void usage(const char *progname)
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max "
                   "height>,--bpp <bpp>,--hq <0|1|true|false>,--upscale <0|1|true|false>,--verbose] [--core <darktable options>]\n",
           progname);
+  fprintf(stderr, "       %s --batch <manifest file|-> [--jobs <n>] [options] [--core <darktable options>]\n", progname);
 }
 
-int main(int argc, char *arg[])
+typedef struct dt_cli_options_t
 {
-  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
-  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
-  textdomain(GETTEXT_PACKAGE);
-
-  if(!gtk_parse_args(&argc, &arg)) exit(1);
+  int width, height;
+  gboolean verbose, high_quality, upscale;
+} dt_cli_options_t;
 
-  // parse command line arguments
-  char *input_filename = NULL;
-  char *xmp_filename = NULL;
-  char *output_filename = NULL;
-  int file_counter = 0;
-  int width = 0, height = 0, bpp = 0;
-  gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE;
+// one line of a batch manifest
+typedef struct dt_cli_batch_item_t
+{
+  char *input_filename, *xmp_filename, *output_filename;
+  int line;
+} dt_cli_batch_item_t;
 
-  int k;
-  for(k = 1; k < argc; k++)
-  {
-    if(arg[k][0] == '-')
-    {
-      if(!strcmp(arg[k], "--help"))
-      {
-        usage(arg[0]);
-        exit(1);
-      }
-      else if(!strcmp(arg[k], "--version"))
-      {
-        printf("this is darktable-cli %s\ncopyright (c) 2012-%s johannes hanika, tobias ellinghaus\n",
-               darktable_package_version, darktable_last_commit_year);
-        exit(0);
-      }
-      else if(!strcmp(arg[k], "--width") && argc > k + 1)
-      {
-        k++;
-        width = MAX(atoi(arg[k]), 0);
-      }
-      else if(!strcmp(arg[k], "--height") && argc > k + 1)
-      {
-        k++;
-        height = MAX(atoi(arg[k]), 0);
-      }
-      else if(!strcmp(arg[k], "--bpp") && argc > k + 1)
-      {
-        k++;
-        bpp = MAX(atoi(arg[k]), 0);
-        fprintf(stderr, "%s %d\n",
-                _("TODO: sorry, due to API restrictions we currently cannot set the BPP to"), bpp);
-      }
-      else if(!strcmp(arg[k], "--hq") && argc > k + 1)
-      {
-        k++;
-        gchar *str = g_ascii_strup(arg[k], -1);
-        if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
-          high_quality = FALSE;
-        else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
-          high_quality = TRUE;
-        else
-        {
-          fprintf(stderr, "%s: %s\n", _("unknown option for --hq"), arg[k]);
-          usage(arg[0]);
-          exit(1);
-        }
-        g_free(str);
-      }
-      else if(!strcmp(arg[k], "--upscale") && argc > k + 1)
-      {
-        k++;
-        gchar *str = g_ascii_strup(arg[k], -1);
-        if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
-          upscale = FALSE;
-        else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
-          upscale= TRUE;
-        else
-        {
-          fprintf(stderr, "%s: %s\n", _("unknown option for --upscale"), arg[k]);
-          usage(arg[0]);
-          exit(1);
-        }
-        g_free(str);
-      }
-      else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
-      {
-        verbose = TRUE;
-      }
-      else if(!strcmp(arg[k], "--core"))
-      {
-        // everything from here on should be passed to the core
-        k++;
-        break;
-      }
-    }
-    else
-    {
-      if(file_counter == 0)
-        input_filename = arg[k];
-      else if(file_counter == 1)
-        xmp_filename = arg[k];
-      else if(file_counter == 2)
-        output_filename = arg[k];
-      file_counter++;
-    }
-  }
+typedef struct dt_cli_batch_t
+{
+  const dt_cli_options_t *options;
+  dt_pthread_mutex_t mutex;
+  GList *items;
+  int num, total, failed;
+  int omp_threads;
+} dt_cli_batch_t;
+
+// serializes importing and attaching the xmp. film rolls are looked up by folder, so two threads
+// importing from the same folder would otherwise race to create it
+static dt_pthread_mutex_t _import_mutex;
+// all lines share one library: images a line has already worked on, and the ones being exported right now.
+// both only under _import_mutex
+static GHashTable *_seen_ids = NULL, *_busy_ids = NULL;
+static pthread_cond_t _busy_cond;
+
+static gboolean _any_busy(GList *id_list)
+{
+  for(GList *iter = id_list; iter; iter = g_list_next(iter))
+    if(g_hash_table_contains(_busy_ids, iter->data)) return TRUE;
+  return FALSE;
+}
 
-  int m_argc = 0;
-  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
-  m_arg[m_argc++] = "darktable-cli";
-  m_arg[m_argc++] = "--library";
-  m_arg[m_argc++] = ":memory:";
-  m_arg[m_argc++] = "--conf";
-  m_arg[m_argc++] = "write_sidecar_files=FALSE";
-  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
-  m_arg[m_argc] = NULL;
+static void _release_ids(GList *id_list)
+{
+  dt_pthread_mutex_lock(&_import_mutex);
+  for(GList *iter = id_list; iter; iter = g_list_next(iter)) g_hash_table_remove(_busy_ids, iter->data);
+  pthread_cond_broadcast(&_busy_cond);
+  dt_pthread_mutex_unlock(&_import_mutex);
+}
 
-  if(file_counter < 2 || file_counter > 3)
-  {
-    usage(arg[0]);
-    free(m_arg);
-    exit(1);
-  }
-  else if(file_counter == 2)
+// an earlier line left its history on the image. go back to what the import gave us: the sidecar or nothing
+static void _reset_history(const int id)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.mask WHERE imgid = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET history_end = 0 WHERE id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  char xmp_filename[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(id, xmp_filename, sizeof(xmp_filename), &from_cache);
+  dt_image_path_append_version(id, xmp_filename, sizeof(xmp_filename));
+  g_strlcat(xmp_filename, ".xmp", sizeof(xmp_filename));
+  if(g_file_test(xmp_filename, G_FILE_TEST_EXISTS))
   {
-    // no xmp file given
-    output_filename = xmp_filename;
-    xmp_filename = NULL;
+    dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+    (void)dt_exif_xmp_read(image, xmp_filename, 0);
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
   }
+}
 
-  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
+// export one input (file or folder) with an optional xmp to output_filename. returns 0 on success
+static int _process(const dt_cli_options_t *options, const char *input_filename, const char *xmp_filename,
+                    const char *output)
+{
+  if(g_file_test(output, G_FILE_TEST_IS_DIR))
   {
     fprintf(stderr, _("error: output file is a directory. please specify file name"));
     fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
+    return 1;
   }
 
   // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  if(g_file_test(output, G_FILE_TEST_EXISTS))
   {
     fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
   }
 
-  // init dt without gui and without data.db:
-  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
-  {
-    free(m_arg);
-    exit(1);
-  }
-
   GList *id_list = NULL;
 
+  dt_pthread_mutex_lock(&_import_mutex);
   if(g_file_test(input_filename, G_FILE_TEST_IS_DIR))
   {
     int filmid = dt_film_import(input_filename);
     if(!filmid)
     {
+      dt_pthread_mutex_unlock(&_import_mutex);
       fprintf(stderr, _("error: can't open folder %s"), input_filename);
       fprintf(stderr, "\n");
-      free(m_arg);
-      exit(1);
+      return 1;
     }
     id_list = dt_film_get_image_ids(filmid);
   }
@@ -227,14 +176,14 @@ int main(int argc, char *arg[])
     gchar *directory = g_path_get_dirname(input_filename);
     filmid = dt_film_new(&film, directory);
     id = dt_image_import(filmid, input_filename, TRUE);
+    g_free(directory);
     if(!id)
     {
+      dt_pthread_mutex_unlock(&_import_mutex);
       fprintf(stderr, _("error: can't open file %s"), input_filename);
       fprintf(stderr, "\n");
-      free(m_arg);
-      exit(1);
+      return 1;
     }
-    g_free(directory);
 
     id_list = g_list_append(id_list, GINT_TO_POINTER(id));
   }
@@ -243,9 +192,20 @@ int main(int argc, char *arg[])
 
   if(total == 0)
   {
+    dt_pthread_mutex_unlock(&_import_mutex);
     fprintf(stderr, _("no images to export, aborting\n"));
-    free(m_arg);
-    exit(1);
+    return 1;
+  }
+
+  // another line might be exporting some of the images right now, wait for it. after that they are ours
+  while(_any_busy(id_list)) dt_pthread_cond_wait(&_busy_cond, &_import_mutex);
+  for(GList *iter = id_list; iter; iter = g_list_next(iter))
+  {
+    g_hash_table_add(_busy_ids, iter->data);
+    if(g_hash_table_contains(_seen_ids, iter->data))
+      _reset_history(GPOINTER_TO_INT(iter->data));
+    else
+      g_hash_table_add(_seen_ids, iter->data);
   }
 
   // attach xmp, if requested:
@@ -255,20 +215,24 @@ int main(int argc, char *arg[])
     {
       int id = GPOINTER_TO_INT(iter->data);
       dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
-      if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
+      const int err = dt_exif_xmp_read(image, xmp_filename, 1);
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      if(err != 0)
       {
+        dt_pthread_mutex_unlock(&_import_mutex);
         fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
         fprintf(stderr, "\n");
-        free(m_arg);
-        exit(1);
+        _release_ids(id_list);
+        g_list_free(id_list);
+        return 1;
       }
-      // don't write new xmp:
-      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
     }
   }
+  dt_pthread_mutex_unlock(&_import_mutex);
 
   // print the history stack. only look at the first image and assume all got the same processing applied
-  if(verbose)
+  if(options->verbose)
   {
     int id = GPOINTER_TO_INT(id_list->data);
     gchar *history = dt_history_get_items_as_string(id);
@@ -276,9 +240,11 @@ int main(int argc, char *arg[])
       printf("%s\n", history);
     else
       printf("[%s]\n", _("empty history stack"));
+    g_free(history);
   }
 
   // try to find out the export format from the output_filename
+  char *output_filename = g_strdup(output);
   char *ext = output_filename + strlen(output_filename);
   while(ext > output_filename && *ext != '.') ext--;
   *ext = '\0';
@@ -299,16 +265,20 @@ int main(int argc, char *arg[])
     fprintf(
         stderr, "%s\n",
         _("cannot find disk storage module. please check your installation, something seems to be broken."));
-    free(m_arg);
-    exit(1);
+    g_free(output_filename);
+    _release_ids(id_list);
+    g_list_free(id_list);
+    return 1;
   }
 
   sdata = storage->get_params(storage);
   if(sdata == NULL)
   {
     fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
-    free(m_arg);
-    exit(1);
+    g_free(output_filename);
+    _release_ids(id_list);
+    g_list_free(id_list);
+    return 1;
   }
 
   // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
@@ -321,16 +291,22 @@ int main(int argc, char *arg[])
   {
     fprintf(stderr, _("unknown extension '.%s'"), ext);
     fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
+    storage->free_params(storage, sdata);
+    g_free(output_filename);
+    _release_ids(id_list);
+    g_list_free(id_list);
+    return 1;
   }
 
   fdata = format->get_params(format);
   if(fdata == NULL)
   {
     fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
-    free(m_arg);
-    exit(1);
+    storage->free_params(storage, sdata);
+    g_free(output_filename);
+    _release_ids(id_list);
+    g_list_free(id_list);
+    return 1;
   }
 
   uint32_t w, h, fw, fh, sw, sh;
@@ -348,8 +324,8 @@ int main(int argc, char *arg[])
   else
     h = sh < fh ? sh : fh;
 
-  fdata->max_width = width;
-  fdata->max_height = height;
+  fdata->max_width = options->width;
+  fdata->max_height = options->height;
   fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
   fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
   fdata->style[0] = '\0';
@@ -357,7 +333,7 @@ int main(int argc, char *arg[])
 
   if(storage->initialize_store)
   {
-    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, high_quality, upscale);
+    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, options->high_quality, options->upscale);
 
     format->set_params(format, fdata, format->params_size(format));
     storage->set_params(storage, sdata, storage->params_size(storage));
@@ -371,23 +347,348 @@ int main(int argc, char *arg[])
 
   // TODO: add a callback to set the bpp without going through the config
 
+  int res = 0;
   int num = 1;
   for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
   {
     int id = GPOINTER_TO_INT(iter->data);
-    storage->store(storage, sdata, id, format, fdata, num, total, high_quality, upscale, icc_type, icc_filename,
-                   icc_intent);
+    if(storage->store(storage, sdata, id, format, fdata, num, total, options->high_quality, options->upscale,
+                      icc_type, icc_filename, icc_intent))
+      res = 1;
   }
 
   // cleanup time
   if(storage->finalize_store) storage->finalize_store(storage, sdata);
   storage->free_params(storage, sdata);
   format->free_params(format, fdata);
+  _release_ids(id_list);
   g_list_free(id_list);
+  g_free(output_filename);
+
+  return res;
+}
+
+static void _batch_item_free(gpointer data)
+{
+  dt_cli_batch_item_t *item = (dt_cli_batch_item_t *)data;
+  g_free(item->input_filename);
+  g_free(item->xmp_filename);
+  g_free(item->output_filename);
+  free(item);
+}
+
+/* read the manifest: one image per line, `<input> [<xmp>] <output>`. fields are separated by tabs,
+   lines without a tab are split at spaces instead. empty lines and lines starting with # are skipped. */
+static GList *_batch_read_manifest(const char *filename)
+{
+  gchar *contents = NULL;
+  if(!strcmp(filename, "-"))
+  {
+    GString *str = g_string_new(NULL);
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), stdin)) > 0) g_string_append_len(str, buf, n);
+    contents = g_string_free(str, FALSE);
+  }
+  else if(!g_file_get_contents(filename, &contents, NULL, NULL))
+  {
+    fprintf(stderr, _("error: can't open manifest %s"), filename);
+    fprintf(stderr, "\n");
+    return NULL;
+  }
+
+  GList *items = NULL;
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for(int l = 0; lines[l]; l++)
+  {
+    gchar *line = g_strstrip(lines[l]);
+    if(!*line || *line == '#') continue;
+
+    gchar **fields = g_strsplit_set(line, strchr(line, '\t') ? "\t" : " ", -1);
+    char *f[3] = { NULL };
+    int n = 0;
+    for(int i = 0; fields[i]; i++)
+    {
+      if(!*fields[i]) continue;
+      if(n < 3) f[n] = fields[i];
+      n++;
+    }
+    if(n < 2 || n > 3)
+    {
+      fprintf(stderr, _("error: can't parse line %d of the manifest"), l + 1);
+      fprintf(stderr, "\n");
+      g_strfreev(fields);
+      continue;
+    }
+
+    dt_cli_batch_item_t *item = (dt_cli_batch_item_t *)calloc(1, sizeof(dt_cli_batch_item_t));
+    item->line = l + 1;
+    item->input_filename = g_strdup(f[0]);
+    item->xmp_filename = n == 3 ? g_strdup(f[1]) : NULL;
+    item->output_filename = g_strdup(f[n - 1]);
+    items = g_list_prepend(items, item);
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  return g_list_reverse(items);
+}
+
+static void *_batch_worker(void *ptr)
+{
+  dt_cli_batch_t *batch = (dt_cli_batch_t *)ptr;
+#ifdef _OPENMP
+  // share the cores between the images in flight
+  omp_set_num_threads(batch->omp_threads);
+#endif
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&batch->mutex);
+    if(!batch->items)
+    {
+      dt_pthread_mutex_unlock(&batch->mutex);
+      break;
+    }
+    dt_cli_batch_item_t *item = (dt_cli_batch_item_t *)batch->items->data;
+    batch->items = g_list_delete_link(batch->items, batch->items);
+    const int num = ++batch->num;
+    dt_pthread_mutex_unlock(&batch->mutex);
+
+    const double start = dt_get_wtime();
+    const int err = _process(batch->options, item->input_filename, item->xmp_filename, item->output_filename);
+    const double end = dt_get_wtime();
+
+    dt_pthread_mutex_lock(&batch->mutex);
+    if(err) batch->failed++;
+    printf("[%d/%d] %s -> %s: %s %.3f s\n", num, batch->total, item->input_filename, item->output_filename,
+           err ? "failed" : "ok", end - start);
+    fflush(stdout);
+    dt_pthread_mutex_unlock(&batch->mutex);
+
+    _batch_item_free(item);
+  }
+  return NULL;
+}
+
+// export all lines of the manifest with one initialized core. returns the number of failed lines
+static int _process_batch(const dt_cli_options_t *options, GList *items, const int jobs)
+{
+  dt_cli_batch_t batch = { 0 };
+  batch.options = options;
+  batch.items = items;
+  batch.total = g_list_length(items);
+  const int threads = CLAMP(jobs, 1, MAX(batch.total, 1));
+  batch.omp_threads = MAX(1, darktable.num_openmp_threads / threads);
+  dt_pthread_mutex_init(&batch.mutex, NULL);
+
+  const double start = dt_get_wtime();
+  if(threads == 1)
+    _batch_worker(&batch);
+  else
+  {
+    pthread_t *thread = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    int started = 0;
+    for(int k = 0; k < threads; k++)
+      if(!dt_pthread_create(&thread[started], _batch_worker, &batch)) started++;
+    // couldn't start any thread, just do it ourselves
+    if(!started) _batch_worker(&batch);
+    for(int k = 0; k < started; k++) pthread_join(thread[k], NULL);
+    free(thread);
+  }
+  printf("%d images in %.3f s, %d failed\n", batch.total, dt_get_wtime() - start, batch.failed);
+
+  dt_pthread_mutex_destroy(&batch.mutex);
+  return batch.failed;
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+
+  if(!gtk_parse_args(&argc, &arg)) exit(1);
+
+  // parse command line arguments
+  char *input_filename = NULL;
+  char *xmp_filename = NULL;
+  char *output_filename = NULL;
+  char *batch_filename = NULL;
+  int file_counter = 0;
+  int bpp = 0, jobs = 1;
+  dt_cli_options_t options = { 0 };
+  options.high_quality = TRUE;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--version"))
+      {
+        printf("this is darktable-cli %s\ncopyright (c) 2012-%s johannes hanika, tobias ellinghaus\n",
+               darktable_package_version, darktable_last_commit_year);
+        exit(0);
+      }
+      else if(!strcmp(arg[k], "--width") && argc > k + 1)
+      {
+        k++;
+        options.width = MAX(atoi(arg[k]), 0);
+      }
+      else if(!strcmp(arg[k], "--height") && argc > k + 1)
+      {
+        k++;
+        options.height = MAX(atoi(arg[k]), 0);
+      }
+      else if(!strcmp(arg[k], "--bpp") && argc > k + 1)
+      {
+        k++;
+        bpp = MAX(atoi(arg[k]), 0);
+        fprintf(stderr, "%s %d\n",
+                _("TODO: sorry, due to API restrictions we currently cannot set the BPP to"), bpp);
+      }
+      else if(!strcmp(arg[k], "--hq") && argc > k + 1)
+      {
+        k++;
+        gchar *str = g_ascii_strup(arg[k], -1);
+        if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
+          options.high_quality = FALSE;
+        else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
+          options.high_quality = TRUE;
+        else
+        {
+          fprintf(stderr, "%s: %s\n", _("unknown option for --hq"), arg[k]);
+          usage(arg[0]);
+          exit(1);
+        }
+        g_free(str);
+      }
+      else if(!strcmp(arg[k], "--upscale") && argc > k + 1)
+      {
+        k++;
+        gchar *str = g_ascii_strup(arg[k], -1);
+        if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
+          options.upscale = FALSE;
+        else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
+          options.upscale = TRUE;
+        else
+        {
+          fprintf(stderr, "%s: %s\n", _("unknown option for --upscale"), arg[k]);
+          usage(arg[0]);
+          exit(1);
+        }
+        g_free(str);
+      }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--jobs") && argc > k + 1)
+      {
+        k++;
+        jobs = MAX(atoi(arg[k]), 1);
+      }
+      else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
+      {
+        options.verbose = TRUE;
+      }
+      else if(!strcmp(arg[k], "--core"))
+      {
+        // everything from here on should be passed to the core
+        k++;
+        break;
+      }
+    }
+    else
+    {
+      if(file_counter == 0)
+        input_filename = arg[k];
+      else if(file_counter == 1)
+        xmp_filename = arg[k];
+      else if(file_counter == 2)
+        output_filename = arg[k];
+      file_counter++;
+    }
+  }
+
+  int m_argc = 0;
+  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+  m_arg[m_argc++] = "darktable-cli";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  GList *batch_items = NULL;
+  if(batch_filename)
+  {
+    if(file_counter != 0)
+    {
+      usage(arg[0]);
+      free(m_arg);
+      exit(1);
+    }
+    // parse the manifest before paying for dt_init()
+    batch_items = _batch_read_manifest(batch_filename);
+    if(!batch_items)
+    {
+      fprintf(stderr, _("no images to export, aborting\n"));
+      free(m_arg);
+      exit(1);
+    }
+  }
+  else if(file_counter < 2 || file_counter > 3)
+  {
+    usage(arg[0]);
+    free(m_arg);
+    exit(1);
+  }
+  else if(file_counter == 2)
+  {
+    // no xmp file given
+    output_filename = xmp_filename;
+    xmp_filename = NULL;
+  }
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  {
+    g_list_free_full(batch_items, _batch_item_free);
+    free(m_arg);
+    exit(1);
+  }
+
+  dt_pthread_mutex_init(&_import_mutex, NULL);
+  pthread_cond_init(&_busy_cond, NULL);
+  _seen_ids = g_hash_table_new(NULL, NULL);
+  _busy_ids = g_hash_table_new(NULL, NULL);
+
+  int res;
+  if(batch_items)
+    res = _process_batch(&options, batch_items, jobs) ? 1 : 0;
+  else
+    res = _process(&options, input_filename, xmp_filename, output_filename);
+
+  g_hash_table_destroy(_busy_ids);
+  g_hash_table_destroy(_seen_ids);
+  pthread_cond_destroy(&_busy_cond);
+  dt_pthread_mutex_destroy(&_import_mutex);
 
   dt_cleanup();
 
   free(m_arg);
+
+  return res;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -0,0 +1,58 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifdef HAVE_AVX_CODEPATHS
+
+#include <immintrin.h>
+
+/*
+ * the whole tree is built for sse2 only. functions marked with these are compiled for the wider
+ * instruction sets on their own, and may only be called if darktable.codepath.AVX2 (or AVX512) is set.
+ * that is what the process_avx2() and process_avx512() slots of the iops are for.
+ *
+ * the helpers below work on 4-channel pixels, one per 128-bit lane: two pixels per __m256,
+ * four per __m512.
+ */
+#define DT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define DT_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+
+/** load two pixels that are not next to each other. */
+DT_TARGET_AVX2 static inline __m256 dt_mm256_load2_ps(const float *const lo, const float *const hi)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(lo)), _mm_load_ps(hi), 1);
+}
+
+/** one value per pixel, broadcast to all four channels of its lane. */
+DT_TARGET_AVX2 static inline __m256 dt_mm256_set2_ps(const float lo, const float hi)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(lo)), _mm_set1_ps(hi), 1);
+}
+
+/** mask for the first n (0..3) pixels of a __m512, for the ends of rows. */
+static inline __mmask16 dt_mm512_pixel_mask(const int n)
+{
+  return (__mmask16)((1u << (4 * n)) - 1u);
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -22,6 +22,9 @@
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
 #include <string.h>           // for memset
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
@@ -30,6 +33,12 @@
 #define DT_COMMON_BILATERAL_MAX_RES_S 6000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
 
+// number of slices the image rows are split into for splatting, see dt_bilateral_splat()
+static inline int bilateral_slices(const size_t size_y)
+{
+  return MAX(1, MIN(dt_get_num_threads(), (int)size_y - 1));
+}
+
 #ifndef HAVE_OPENCL
 // function definition on opencl path takes precedence
 size_t dt_bilateral_memory_use(const int width,     // width of input image
@@ -120,129 +129,377 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
+/** grid row of image row j, and the position inside it. */
+static inline int image_to_grid_row(const dt_bilateral_t *const b, const int j, float *yf)
+{
+  const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+  const int yi = MIN((int)y, b->size_y - 2);
+  *yf = y - yi;
+  return yi;
+}
+
+#if defined(__SSE2__)
+/** image_to_grid() for the four pixels at columns i..i+3 of the row in: grid cells xi, zi and the positions
+ * inside them. */
+static inline void image_to_grid_sse2(const dt_bilateral_t *const b, const int i, const float *const in,
+                                      int xi[4], int zi[4], __m128 *xf, __m128 *zf)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 x = _mm_min_ps(_mm_max_ps(_mm_set_ps(i + 3, i + 2, i + 1, i) / _mm_set1_ps(b->sigma_s), zero),
+                              _mm_set1_ps(b->size_x - 1));
+  const __m128 L = _mm_set_ps(in[12], in[8], in[4], in[0]);
+  // max() returns the second operand for NaN, like CLAMPS() does
+  const __m128 z = _mm_min_ps(_mm_max_ps(L / _mm_set1_ps(b->sigma_r), zero), _mm_set1_ps(b->size_z - 1));
+  const __m128 xt = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(x)), _mm_set1_ps(b->size_x - 2));
+  const __m128 zt = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(z)), _mm_set1_ps(b->size_z - 2));
+  *xf = x - xt;
+  *zf = z - zt;
+  _mm_storeu_si128((__m128i *)xi, _mm_cvttps_epi32(xt));
+  _mm_storeu_si128((__m128i *)zi, _mm_cvttps_epi32(zt));
+}
+#endif
+
+/** splat one image row into the grid rows row0 (at yi) and row1 (at yi + 1), with strides oz0 and oz1 between
+ * their z planes. */
+static void splat_row(const dt_bilateral_t *const b, const float *in, float *const row0, const size_t oz0,
+                      float *const row1, const size_t oz1, const float yf, const float norm)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  if(darktable.codepath.SSE2)
+  {
+    const __m128 wy0 = _mm_set1_ps((1.0f - yf) * norm), wy1 = _mm_set1_ps(yf * norm);
+    for(; i + 4 <= b->width; i += 4, in += 16)
+    {
+      int xi[4], zi[4];
+      __m128 xf, zf;
+      image_to_grid_sse2(b, i, in, xi, zi, &xf, &zf);
+      const __m128 one = _mm_set1_ps(1.0f);
+      // weights of the four corners in the x/z plane, for the four pixels
+      const __m128 w00 = (one - xf) * (one - zf), w10 = xf * (one - zf);
+      const __m128 w01 = (one - xf) * zf, w11 = xf * zf;
+      float c[8][4];
+      _mm_storeu_ps(c[0], w00 * wy0);
+      _mm_storeu_ps(c[1], w10 * wy0);
+      _mm_storeu_ps(c[2], w01 * wy0);
+      _mm_storeu_ps(c[3], w11 * wy0);
+      _mm_storeu_ps(c[4], w00 * wy1);
+      _mm_storeu_ps(c[5], w10 * wy1);
+      _mm_storeu_ps(c[6], w01 * wy1);
+      _mm_storeu_ps(c[7], w11 * wy1);
+      for(int k = 0; k < 4; k++)
+      {
+        float *const g0 = row0 + xi[k] + zi[k] * oz0;
+        float *const g1 = row1 + xi[k] + zi[k] * oz1;
+        g0[0] += c[0][k];
+        g0[1] += c[1][k];
+        g0[oz0] += c[2][k];
+        g0[oz0 + 1] += c[3][k];
+        g1[0] += c[4][k];
+        g1[1] += c[5][k];
+        g1[oz1] += c[6][k];
+        g1[oz1 + 1] += c[7][k];
+      }
+    }
+  }
+#endif
+  for(; i < b->width; i++, in += 4)
+  {
+    float x, y, z;
+    const float L = in[0];
+    image_to_grid(b, i, 0, L, &x, &y, &z);
+    const int xi = MIN((int)x, b->size_x - 2);
+    const int zi = MIN((int)z, b->size_z - 2);
+    const float xf = x - xi;
+    const float zf = z - zi;
+    // nearest neighbour splatting:
+    // sum up payload here, doesn't have to be same as edge stopping data
+    // for cross bilateral applications.
+    // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
+    // should not cause clipping here.
+    for(int k = 0; k < 8; k++)
+    {
+      float *const g = (k & 2) ? row1 + xi + ((k & 4) ? (zi + 1) * oz1 : zi * oz1)
+                               : row0 + xi + ((k & 4) ? (zi + 1) * oz0 : zi * oz0);
+      const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                            * ((k & 4) ? zf : (1.0f - zf)) * norm;
+      g[(k & 1) ? 1 : 0] += contrib;
+    }
+  }
+}
+
 void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
 {
-  const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
-// splat into downsampled grid
+  const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+  // splat into downsampled grid.
+  // the image rows are cut into slices by the grid row they start in. every slice writes to its own band of
+  // grid rows, so no atomics are needed. only the row after the band is shared with the next slice, that goes
+  // to a buffer of its own and is added afterwards.
+  const int nslices = bilateral_slices(b->size_y);
+  float *const edges = dt_alloc_align(64, sizeof(float) * nslices * b->size_x * b->size_z);
+  if(!edges)
+  {
+    // one slice owning all grid rows needs no edge buffer, it just can't run in parallel
+    fprintf(stderr, "[bilateral] not able to allocate the splat buffers, splatting single threaded\n");
+    for(int j = 0; j < b->height; j++)
+    {
+      float yf;
+      const int yi = image_to_grid_row(b, j, &yf);
+      float *const row0 = b->buf + (size_t)yi * oy;
+      splat_row(b, in + (size_t)4 * j * b->width, row0, oz, row0 + oy, oz, yf, norm);
+    }
+    return;
+  }
+  memset(edges, 0, sizeof(float) * nslices * b->size_x * b->size_z);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
+#pragma omp parallel for schedule(static) default(none) shared(b)
 #endif
-  for(int j = 0; j < b->height; j++)
+  for(int slice = 0; slice < nslices; slice++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    const int y0 = slice * (b->size_y - 1) / nslices;
+    const int y1 = (slice + 1) * (b->size_y - 1) / nslices;
+    float *const edge = edges + (size_t)slice * b->size_x * b->size_z;
+    for(int j = 0; j < b->height; j++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
-      // sum up payload here, doesn't have to be same as edge stopping data
-      // for cross bilateral applications.
-      // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
-      // should not cause clipping here.
-      for(int k = 0; k < 8; k++)
-      {
-        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
+      float yf;
+      const int yi = image_to_grid_row(b, j, &yf);
+      if(yi < y0 || yi >= y1) continue;
+      float *const row0 = b->buf + (size_t)yi * oy;
+      if(yi + 1 < y1)
+        splat_row(b, in + (size_t)4 * j * b->width, row0, oz, row0 + oy, oz, yf, norm);
+      else
+        splat_row(b, in + (size_t)4 * j * b->width, row0, oz, edge, b->size_x, yf, norm);
+    }
+  }
+  // merge the edges, they all go to different grid rows
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for schedule(static) default(none) shared(b) collapse(2)
 #endif
-        b->buf[ii] += contrib;
-      }
-      index += 4;
+  for(int slice = 0; slice < nslices; slice++)
+  {
+    for(int z = 0; z < b->size_z; z++)
+    {
+      const int y1 = (slice + 1) * (b->size_y - 1) / nslices;
+      float *const row = b->buf + (size_t)z * oz + (size_t)y1 * oy;
+      const float *const edge = edges + ((size_t)slice * b->size_z + z) * b->size_x;
+      int x = 0;
+#if defined(__SSE2__)
+      for(; x + 4 <= b->size_x; x += 4) _mm_storeu_ps(row + x, _mm_loadu_ps(row + x) + _mm_loadu_ps(edge + x));
+#endif
+      for(; x < b->size_x; x++) row[x] += edge[x];
     }
   }
+  dt_free_align(edges);
 }
 
-static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
-                        const int size2, const int size3)
+/** blur one line of size elements, offset apart. */
+static inline void blur_line_1(float *buf, const size_t offset, const int size)
+{
+  const float w0 = 6.f / 16.f;
+  const float w1 = 4.f / 16.f;
+  const float w2 = 1.f / 16.f;
+  size_t index = 0;
+  float tmp1 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * buf[index + offset] + w2 * buf[index + 2 * offset];
+  index += offset;
+  float tmp2 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * (buf[index + offset] + tmp1) + w2 * buf[index + 2 * offset];
+  index += offset;
+  for(int i = 2; i < size - 2; i++)
+  {
+    const float tmp3 = buf[index];
+    buf[index] = buf[index] * w0 + w1 * (buf[index + offset] + tmp2) + w2 * (buf[index + 2 * offset] + tmp1);
+    index += offset;
+    tmp1 = tmp2;
+    tmp2 = tmp3;
+  }
+  const float tmp3 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * (buf[index + offset] + tmp2) + w2 * tmp1;
+  index += offset;
+  buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
+}
+
+/** blur_line_1() for the derivative. */
+static inline void blur_line_z_1(float *buf, const size_t offset, const int size)
 {
   const float w1 = 4.f / 16.f;
   const float w2 = 2.f / 16.f;
+  size_t index = 0;
+  float tmp1 = buf[index];
+  buf[index] = w1 * buf[index + offset] + w2 * buf[index + 2 * offset];
+  index += offset;
+  float tmp2 = buf[index];
+  buf[index] = w1 * (buf[index + offset] - tmp1) + w2 * buf[index + 2 * offset];
+  index += offset;
+  for(int i = 2; i < size - 2; i++)
+  {
+    const float tmp3 = buf[index];
+    buf[index] = +w1 * (buf[index + offset] - tmp2) + w2 * (buf[index + 2 * offset] - tmp1);
+    index += offset;
+    tmp1 = tmp2;
+    tmp2 = tmp3;
+  }
+  const float tmp3 = buf[index];
+  buf[index] = w1 * (buf[index + offset] - tmp2) - w2 * tmp1;
+  index += offset;
+  buf[index] = -w1 * tmp3 - w2 * tmp2;
+}
+
+static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
+                        const int size2, const int size3)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(buf)
+#endif
+  for(int k = 0; k < size1; k++)
+    for(int j = 0; j < size2; j++) blur_line_z_1(buf + (size_t)k * offset1 + (size_t)j * offset2, offset3, size3);
+}
+
+static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
+                      const int size2, const int size3)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(buf)
+#endif
+  for(int k = 0; k < size1; k++)
+    for(int j = 0; j < size2; j++) blur_line_1(buf + (size_t)k * offset1 + (size_t)j * offset2, offset3, size3);
+}
+
+#if defined(__SSE2__)
+/** blur_line() for lines that are next to each other in memory (offset2 == 1), four lines at a time. */
+static void blur_line_sse2(float *buf, const int offset1, const int offset3, const int size1, const int size2,
+                           const int size3)
+{
+  const __m128 w0 = _mm_set1_ps(6.f / 16.f);
+  const __m128 w1 = _mm_set1_ps(4.f / 16.f);
+  const __m128 w2 = _mm_set1_ps(1.f / 16.f);
+  const size_t o = offset3;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(buf)
 #endif
   for(int k = 0; k < size1; k++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    int j = 0;
+    for(; j + 4 <= size2; j += 4)
     {
-      float tmp1 = buf[index];
-      buf[index] = w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
+      float *p = buf + (size_t)k * offset1 + j;
+      __m128 tmp1 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, tmp1 * w0 + w1 * _mm_loadu_ps(p + o) + w2 * _mm_loadu_ps(p + 2 * o));
+      p += o;
+      __m128 tmp2 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, tmp2 * w0 + w1 * (_mm_loadu_ps(p + o) + tmp1) + w2 * _mm_loadu_ps(p + 2 * o));
+      p += o;
       for(int i = 2; i < size3 - 2; i++)
       {
-        const float tmp3 = buf[index];
-        buf[index] = +w1 * (buf[index + offset3] - tmp2) + w2 * (buf[index + 2 * offset3] - tmp1);
-        index += offset3;
+        const __m128 tmp3 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, tmp3 * w0 + w1 * (_mm_loadu_ps(p + o) + tmp2) + w2 * (_mm_loadu_ps(p + 2 * o) + tmp1));
+        p += o;
         tmp1 = tmp2;
         tmp2 = tmp3;
       }
-      const float tmp3 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp2) - w2 * tmp1;
-      index += offset3;
-      buf[index] = -w1 * tmp3 - w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+      const __m128 tmp3 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, tmp3 * w0 + w1 * (_mm_loadu_ps(p + o) + tmp2) + w2 * tmp1);
+      p += o;
+      _mm_storeu_ps(p, _mm_loadu_ps(p) * w0 + w1 * tmp3 + w2 * tmp2);
     }
+    for(; j < size2; j++) blur_line_1(buf + (size_t)k * offset1 + j, o, size3);
   }
 }
 
-static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
-                      const int size2, const int size3)
+/** blur_line_z() for lines that are next to each other in memory (offset2 == 1), four lines at a time. */
+static void blur_line_z_sse2(float *buf, const int offset1, const int offset3, const int size1, const int size2,
+                             const int size3)
 {
-  const float w0 = 6.f / 16.f;
-  const float w1 = 4.f / 16.f;
-  const float w2 = 1.f / 16.f;
+  const __m128 w1 = _mm_set1_ps(4.f / 16.f);
+  const __m128 w2 = _mm_set1_ps(2.f / 16.f);
+  const __m128 mw1 = _mm_set1_ps(-4.f / 16.f);
+  const size_t o = offset3;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(buf)
 #endif
   for(int k = 0; k < size1; k++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    int j = 0;
+    for(; j + 4 <= size2; j += 4)
     {
-      float tmp1 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
+      float *p = buf + (size_t)k * offset1 + j;
+      __m128 tmp1 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, w1 * _mm_loadu_ps(p + o) + w2 * _mm_loadu_ps(p + 2 * o));
+      p += o;
+      __m128 tmp2 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, w1 * (_mm_loadu_ps(p + o) - tmp1) + w2 * _mm_loadu_ps(p + 2 * o));
+      p += o;
       for(int i = 2; i < size3 - 2; i++)
       {
-        const float tmp3 = buf[index];
-        buf[index]
-            = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * (buf[index + 2 * offset3] + tmp1);
-        index += offset3;
+        const __m128 tmp3 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, w1 * (_mm_loadu_ps(p + o) - tmp2) + w2 * (_mm_loadu_ps(p + 2 * o) - tmp1));
+        p += o;
         tmp1 = tmp2;
         tmp2 = tmp3;
       }
-      const float tmp3 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * tmp1;
-      index += offset3;
-      buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+      const __m128 tmp3 = _mm_loadu_ps(p);
+      _mm_storeu_ps(p, w1 * (_mm_loadu_ps(p + o) - tmp2) - w2 * tmp1);
+      p += o;
+      _mm_storeu_ps(p, mw1 * tmp3 - w2 * tmp2);
     }
+    for(; j < size2; j++) blur_line_z_1(buf + (size_t)k * offset1 + j, o, size3);
   }
 }
 
+/** blur_line() for lines that are contiguous themselves (offset3 == 1). every line is copied to a zero padded
+ * buffer first, then the filter runs over four elements at a time. */
+static void blur_line_x_sse2(float *buf, const int offset1, const int offset2, const int size1, const int size2,
+                             const int size3)
+{
+  const __m128 w0 = _mm_set1_ps(6.f / 16.f);
+  const __m128 w1 = _mm_set1_ps(4.f / 16.f);
+  const __m128 w2 = _mm_set1_ps(1.f / 16.f);
+  const size_t padded = (size3 + 4 + 15) & ~15;
+  float *const tmpbuf = dt_alloc_align(64, sizeof(float) * padded * dt_get_num_threads());
+  if(!tmpbuf)
+  {
+    fprintf(stderr, "[bilateral] not able to allocate the blur buffers, using the plain code\n");
+    blur_line(buf, offset1, offset2, 1, size1, size2, size3);
+    return;
+  }
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(buf) collapse(2)
+#endif
+  for(int k = 0; k < size1; k++)
+  {
+    for(int j = 0; j < size2; j++)
+    {
+      float *const line = buf + (size_t)k * offset1 + (size_t)j * offset2;
+      float *const t = tmpbuf + padded * dt_get_thread_num();
+      t[0] = t[1] = t[size3 + 2] = t[size3 + 3] = 0.0f;
+      memcpy(t + 2, line, sizeof(float) * size3);
+      int i = 0;
+      for(; i + 4 <= size3; i += 4)
+        _mm_storeu_ps(line + i, _mm_loadu_ps(t + i + 2) * w0
+                                    + w1 * (_mm_loadu_ps(t + i + 3) + _mm_loadu_ps(t + i + 1))
+                                    + w2 * (_mm_loadu_ps(t + i + 4) + _mm_loadu_ps(t + i)));
+      for(; i < size3; i++)
+        line[i] = t[i + 2] * (6.f / 16.f) + (4.f / 16.f) * (t[i + 3] + t[i + 1]) + (1.f / 16.f) * (t[i + 4] + t[i]);
+    }
+  }
+  dt_free_align(tmpbuf);
+}
+#endif
 
 void dt_bilateral_blur(dt_bilateral_t *b)
 {
+#if defined(__SSE2__)
+  if(darktable.codepath.SSE2)
+  {
+    // same as below, the lines of the y and z blur are walked along x to run four of them at once
+    blur_line_x_sse2(b->buf, b->size_x * b->size_y, b->size_x, b->size_z, b->size_y, b->size_x);
+    blur_line_sse2(b->buf, b->size_x * b->size_y, b->size_x, b->size_z, b->size_x, b->size_y);
+    blur_line_z_sse2(b->buf, b->size_x, b->size_x * b->size_y, b->size_y, b->size_x, b->size_z);
+    return;
+  }
+#endif
   // gaussian up to 3 sigma
   blur_line(b->buf, b->size_x * b->size_y, b->size_x, 1, b->size_z, b->size_y, b->size_x);
   // gaussian up to 3 sigma
@@ -251,6 +508,35 @@ void dt_bilateral_blur(dt_bilateral_t *b)
   blur_line_z(b->buf, 1, b->size_x, b->size_x * b->size_y, b->size_x, b->size_y, b->size_z);
 }
 
+#if defined(__SSE2__)
+/** trilinear lookup of the four pixels at columns i..i+3 of an image row in grid row yi, in is the first of
+ * them. */
+static inline __m128 slice_sse2(const dt_bilateral_t *const b, const int i, const int yi, const __m128 yf,
+                                const float *const in)
+{
+  const int ox = 1;
+  const int oy = b->size_x;
+  const int oz = b->size_y * b->size_x;
+  int xi[4], zi[4];
+  __m128 xf, zf;
+  image_to_grid_sse2(b, i, in, xi, zi, &xf, &zf);
+  const __m128 one = _mm_set1_ps(1.0f);
+  size_t gi[4];
+  for(int k = 0; k < 4; k++) gi[k] = xi[k] + b->size_x * (yi + b->size_y * zi[k]);
+#define GRID(o) _mm_set_ps(b->buf[gi[3] + (o)], b->buf[gi[2] + (o)], b->buf[gi[1] + (o)], b->buf[gi[0] + (o)])
+  // same order of operations as the scalar code, so both give the same results
+  const __m128 sum = GRID(0) * (one - xf) * (one - yf) * (one - zf)
+                     + GRID(ox) * (xf) * (one - yf) * (one - zf)
+                     + GRID(oy) * (one - xf) * (yf) * (one - zf)
+                     + GRID(ox + oy) * (xf) * (yf) * (one - zf)
+                     + GRID(oz) * (one - xf) * (one - yf) * (zf)
+                     + GRID(ox + oz) * (xf) * (one - yf) * (zf)
+                     + GRID(oy + oz) * (one - xf) * (yf) * (zf)
+                     + GRID(ox + oy + oz) * (xf) * (yf) * (zf);
+#undef GRID
+  return sum;
+}
+#endif
 
 void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
 {
@@ -265,7 +551,28 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
   for(int j = 0; j < b->height; j++)
   {
     size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    int i = 0;
+#if defined(__SSE2__)
+    if(darktable.codepath.SSE2)
+    {
+      float yf;
+      const int yi = image_to_grid_row(b, j, &yf);
+      for(; i + 4 <= b->width; i += 4, index += 16)
+      {
+        const __m128 L = _mm_set_ps(in[index + 12], in[index + 8], in[index + 4], in[index]);
+        const __m128 Lout = L + _mm_set1_ps(norm) * slice_sse2(b, i, yi, _mm_set1_ps(yf), in + index);
+        // and copy color and mask
+        _mm_storeu_ps(out + index, _mm_move_ss(_mm_loadu_ps(in + index), Lout));
+        _mm_storeu_ps(out + index + 4, _mm_move_ss(_mm_loadu_ps(in + index + 4),
+                                                   _mm_shuffle_ps(Lout, Lout, _MM_SHUFFLE(1, 1, 1, 1))));
+        _mm_storeu_ps(out + index + 8, _mm_move_ss(_mm_loadu_ps(in + index + 8),
+                                                   _mm_shuffle_ps(Lout, Lout, _MM_SHUFFLE(2, 2, 2, 2))));
+        _mm_storeu_ps(out + index + 12, _mm_move_ss(_mm_loadu_ps(in + index + 12),
+                                                    _mm_shuffle_ps(Lout, Lout, _MM_SHUFFLE(3, 3, 3, 3))));
+      }
+    }
+#endif
+    for(; i < b->width; i++)
     {
       float x, y, z;
       const float L = in[index];
@@ -311,7 +618,24 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
   for(int j = 0; j < b->height; j++)
   {
     size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    int i = 0;
+#if defined(__SSE2__)
+    if(darktable.codepath.SSE2)
+    {
+      float yf;
+      const int yi = image_to_grid_row(b, j, &yf);
+      for(; i + 4 <= b->width; i += 4, index += 16)
+      {
+        const __m128 Lout = _mm_set1_ps(norm) * slice_sse2(b, i, yi, _mm_set1_ps(yf), in + index);
+        const __m128 o = _mm_set_ps(out[index + 12], out[index + 8], out[index + 4], out[index]);
+        // max() returns the second operand for NaN, like MAX() does
+        float res[4];
+        _mm_storeu_ps(res, _mm_max_ps(_mm_setzero_ps(), o + Lout));
+        for(int k = 0; k < 4; k++) out[index + 4 * k] = res[k];
+      }
+    }
+#endif
+    for(; i < b->width; i++)
     {
       float x, y, z;
       const float L = in[index];
@@ -28,7 +28,8 @@ typedef struct dt_cache_entry_t
   void *data;
   size_t data_size;
   size_t cost;
-  GList *link;
+  struct dt_cache_entry_t *lru_prev; // intrusive per-shard lru list, O(1) to bubble up
+  struct dt_cache_entry_t *lru_next;
   dt_pthread_rwlock_t lock;
   int _lock_demoting;
   uint32_t key;
@@ -38,16 +39,27 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
-typedef struct dt_cache_t
+// one independently locked part of the cache. keys are distributed over the
+// shards by hash, so concurrent lookups of different keys mostly don't contend.
+typedef struct dt_cache_shard_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_pthread_mutex_t lock; // protects hashtable, lru list and cost of this shard only.
+
+  GHashTable *hashtable;     // stores (key, entry) pairs
+  dt_cache_entry_t *lru;     // first element, about to be kicked from cache.
+  dt_cache_entry_t *lru_mru; // last element, most recently used.
+  size_t cost;               // sum of the cost of all entries in this shard
+}
+__attribute__((aligned(64))) dt_cache_shard_t;
 
+typedef struct dt_cache_t
+{
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
+  size_t cost;       // user supplied cost per cache line (bytes?), sum over all shards.
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
+  uint32_t num_shards; // always a power of two
+  dt_cache_shard_t *shards;
 
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
@@ -59,6 +71,9 @@ dt_cache_t;
 
 // entry size is only used if alloc callback is 0
 void dt_cache_init(dt_cache_t *cache, size_t entry_size, size_t cost_quota);
+// same, but split the cache into num_shards (rounded up to a power of two) independently locked parts.
+// the cost quota is still enforced for the cache as a whole.
+void dt_cache_init_sharded(dt_cache_t *cache, size_t entry_size, size_t cost_quota, uint32_t num_shards);
 void dt_cache_cleanup(dt_cache_t *cache);
 
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache, dt_cache_allocate_t allocate_cb,
@@ -87,9 +102,9 @@ void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, co
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
+// removes from the tip of the lru lists, until the fill ratio of the hashtable
 // goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
+// will never block and never fail, but sometimes not free memory (in case all
 // is locked)
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
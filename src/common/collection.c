@@ -42,6 +42,9 @@
 #define ORDER_BY_QUERY "ORDER BY %s"
 #define LIMIT_QUERY "LIMIT ?1, ?2"
 
+/* more changed images than this are cheaper to handle by running the collection query once */
+#define MAX_INCREMENTAL_IMAGES 64
+
 static const char *comparators[] = {
   "<",  // DT_COLLECTION_RATING_COMP_LT = 0,
   "<=", // DT_COLLECTION_RATING_COMP_LEQ,
@@ -55,6 +58,12 @@ static const char *comparators[] = {
 static int _dt_collection_store(const dt_collection_t *collection, gchar *query, gchar *query_no_group);
 /* Counts the number of images in the current collection */
 static uint32_t _dt_collection_compute_count(const dt_collection_t *collection, gboolean no_group);
+/* runs the collection query and keeps its result in ids and offsets */
+static void _collection_materialize(dt_collection_t *collection);
+/* drops the materialized result, it is run again on next use */
+static void _collection_invalidate(dt_collection_t *collection);
+/* removes the images that left the collection from the selection */
+static void _collection_update_selection(const dt_collection_t *collection);
 /* signal handlers to update the cached count when something interesting might have happened.
  * we need 2 different since there are different kinds of signals we need to listen to. */
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data);
@@ -68,6 +77,8 @@ static void _collection_update_aspect_ratio(const dt_collection_t *collection);
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  collection->offsets = g_hash_table_new(NULL, NULL);
+  dt_pthread_mutex_init(&collection->lock, NULL);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -77,9 +88,21 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->where_ext = g_strdupv(clone->where_ext);
     collection->query = g_strdup(clone->query);
     collection->query_no_group = g_strdup(clone->query_no_group);
+    collection->where = g_strdup(clone->where);
+    collection->where_no_group = g_strdup(clone->where_no_group);
     collection->clone = 1;
-    collection->count = clone->count;
     collection->count_no_group = clone->count_no_group;
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)&clone->lock);
+    collection->count = clone->count;
+    if(clone->ids_valid)
+    {
+      collection->ids = g_memdup(clone->ids, sizeof(int32_t) * MAX(clone->count, 1));
+      collection->ids_alloc = MAX(clone->count, 1);
+      for(uint32_t k = 0; k < collection->count; k++)
+        g_hash_table_insert(collection->offsets, GINT_TO_POINTER(collection->ids[k]), GINT_TO_POINTER(k + 1));
+      collection->ids_valid = 1;
+    }
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&clone->lock);
   }
   else /* else we just initialize using the reset */
     dt_collection_reset(collection);
@@ -110,7 +133,12 @@ void dt_collection_free(const dt_collection_t *collection)
 
   g_free(collection->query);
   g_free(collection->query_no_group);
+  g_free(collection->where);
+  g_free(collection->where_no_group);
   g_strfreev(collection->where_ext);
+  g_free(collection->ids);
+  g_hash_table_destroy(collection->offsets);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&collection->lock);
   g_free((dt_collection_t *)collection);
 }
 
@@ -226,21 +254,25 @@ int dt_collection_update(const dt_collection_t *collection)
   query_no_group
       = dt_util_dstrcat(query_no_group, "%s%s%s %s%s", selq_pre, wq_no_group, selq_post ? selq_post : "", sq ? sq : "",
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
+  dt_database_explain_query_plan(darktable.db, query);
   result = _dt_collection_store(collection, query, query_no_group);
 
+  /* keep the where parts, dt_collection_update_images() tests single images against them */
+  g_free(collection->where);
+  g_free(collection->where_no_group);
+  ((dt_collection_t *)collection)->where = wq;
+  ((dt_collection_t *)collection)->where_no_group = wq_no_group;
+
   /* free memory used */
   g_free(sq);
-  g_free(wq);
-  g_free(wq_no_group);
   g_free(selq_pre);
   g_free(selq_post);
   g_free(query);
   g_free(query_no_group);
 
-  /* update the cached count. collection isn't a real const anyway, we are writing to it in
-   * _dt_collection_store, too. */
-  ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection, FALSE);
-  ((dt_collection_t *)collection)->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  /* the cached count comes with the materialized result now. collection isn't a real const anyway, we are
+   * writing to it in _dt_collection_store, too. */
+  _collection_invalidate((dt_collection_t *)collection);
   dt_collection_hint_message(collection);
 
   _collection_update_aspect_ratio(collection);
@@ -587,6 +619,7 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
   else
     count_query = dt_util_dstrcat(count_query, "SELECT COUNT(DISTINCT id) %s", fq);
 
+  dt_database_explain_query_plan(darktable.db, count_query);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
   if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
      && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
@@ -601,16 +634,132 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
   return count;
 }
 
+static void _collection_materialize(dt_collection_t *collection)
+{
+  /* building the query might update the collection and invalidate it again, so do that first */
+  const gchar *query = dt_collection_get_query(collection);
+  dt_pthread_mutex_lock(&collection->lock);
+  const uint32_t generation = collection->generation;
+  dt_pthread_mutex_unlock(&collection->lock);
+  sqlite3_stmt *stmt = NULL;
+  uint32_t count = 0, ids_alloc = 0;
+  int32_t *ids = NULL;
+  GHashTable *offsets = g_hash_table_new(NULL, NULL);
+
+  /* readers keep using the old result while the query runs, it is swapped in under the lock */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+  }
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(count == ids_alloc)
+    {
+      ids_alloc = MAX(1024, 2 * ids_alloc);
+      ids = g_realloc(ids, sizeof(int32_t) * ids_alloc);
+    }
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    ids[count++] = imgid;
+    g_hash_table_insert(offsets, GINT_TO_POINTER(imgid), GINT_TO_POINTER(count));
+  }
+  sqlite3_finalize(stmt);
+
+  /* something changed while the query ran, the result may miss it: drop it and let the readers retry */
+  dt_pthread_mutex_lock(&collection->lock);
+  int32_t *old_ids = ids;
+  GHashTable *old_offsets = offsets;
+  if(collection->generation == generation)
+  {
+    old_ids = collection->ids;
+    old_offsets = collection->offsets;
+    collection->ids = ids;
+    collection->ids_alloc = ids_alloc;
+    collection->offsets = offsets;
+    collection->count = count;
+    collection->ids_valid = 1;
+    collection->version++;
+  }
+  dt_pthread_mutex_unlock(&collection->lock);
+
+  g_free(old_ids);
+  g_hash_table_destroy(old_offsets);
+}
+
+/* materializes the result if needed and returns with the lock held */
+static void _collection_lock_valid(const dt_collection_t *collection)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->lock);
+  while(!c->ids_valid)
+  {
+    dt_pthread_mutex_unlock(&c->lock);
+    _collection_materialize(c);
+    dt_pthread_mutex_lock(&c->lock);
+  }
+}
+
+static void _collection_invalidate(dt_collection_t *collection)
+{
+  dt_pthread_mutex_lock(&collection->lock);
+  collection->generation++;
+  collection->ids_valid = 0;
+  dt_pthread_mutex_unlock(&collection->lock);
+
+  /* without grouping both queries are the same */
+  if(darktable.gui && darktable.gui->grouping)
+    collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
+}
+
+/* needs the lock held */
+static void _collection_remove_id(dt_collection_t *collection, const int32_t imgid)
+{
+  const int pos = GPOINTER_TO_INT(g_hash_table_lookup(collection->offsets, GINT_TO_POINTER(imgid))) - 1;
+  if(pos < 0) return;
+
+  collection->generation++;
+  g_hash_table_remove(collection->offsets, GINT_TO_POINTER(imgid));
+  memmove(collection->ids + pos, collection->ids + pos + 1, sizeof(int32_t) * (collection->count - pos - 1));
+  collection->count--;
+  for(uint32_t k = pos; k < collection->count; k++)
+    g_hash_table_insert(collection->offsets, GINT_TO_POINTER(collection->ids[k]), GINT_TO_POINTER(k + 1));
+}
+
 uint32_t dt_collection_get_count(const dt_collection_t *collection)
 {
-  return collection->count;
+  _collection_lock_valid(collection);
+  const uint32_t count = collection->count;
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+  return count;
+}
+
+uint32_t dt_collection_get_version(const dt_collection_t *collection)
+{
+  _collection_lock_valid(collection);
+  const uint32_t version = collection->version;
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+  return version;
 }
 
 uint32_t dt_collection_get_count_no_group(const dt_collection_t *collection)
 {
+  if(!(darktable.gui && darktable.gui->grouping)) return dt_collection_get_count(collection);
   return collection->count_no_group;
 }
 
+uint32_t dt_collection_get_ids(const dt_collection_t *collection, int32_t *ids, uint32_t offset, uint32_t count)
+{
+  _collection_lock_valid(collection);
+  if(offset >= collection->count)
+    count = 0;
+  else
+    count = MIN(count, collection->count - offset);
+  if(count) memcpy(ids, collection->ids + offset, sizeof(int32_t) * count);
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+  return count;
+}
+
 uint32_t dt_collection_get_selected_count(const dt_collection_t *collection)
 {
   sqlite3_stmt *stmt = NULL;
@@ -676,24 +825,10 @@ GList *dt_collection_get_all(const dt_collection_t *collection, int limit)
 
 int dt_collection_get_nth(const dt_collection_t *collection, int nth)
 {
-  if(nth < 0 || nth >= dt_collection_get_count(collection))
+  int32_t imgid;
+  if(nth < 0 || !dt_collection_get_ids(collection, &imgid, nth, 1))
     return -1;
-  const gchar *query = dt_collection_get_query(collection);
-  sqlite3_stmt *stmt = NULL;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
-
-  int result = -1;
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    result  = sqlite3_column_int(stmt, 0);
-  }
-
-  sqlite3_finalize(stmt);
-
-  return result;
-
+  return imgid;
 }
 
 GList *dt_collection_get_selected(const dt_collection_t *collection, int limit)
@@ -1098,17 +1233,18 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
     break;
 
     case DT_COLLECTION_PROP_CAMERA: // camera
-      // Start query with a false statement to avoid special casing the first condition
-      query = dt_util_dstrcat(query, "((1=0)");
+      // no (1=0) in front of the ORed cameras, it keeps sqlite from using images_maker_model_index
+      query = dt_util_dstrcat(query, "(");
       GList *lists = NULL;
       dt_collection_get_makermodels(text, NULL, &lists);
+      if(!lists) query = dt_util_dstrcat(query, "1=0");
       GList *element = lists;
       while (element)
       {
         GList *tuple = element->data;
         char *mk = sqlite3_mprintf("%q", tuple->data);
         char *md = sqlite3_mprintf("%q", tuple->next->data);
-        query = dt_util_dstrcat(query, " OR (maker = '%s' AND model = '%s')", mk, md);
+        query = dt_util_dstrcat(query, "%s(maker = '%s' AND model = '%s')", element == lists ? "" : " OR ", mk, md);
         sqlite3_free(mk);
         sqlite3_free(md);
         g_free(tuple->data);
@@ -1120,8 +1256,9 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
       query = dt_util_dstrcat(query, ")");
       break;
     case DT_COLLECTION_PROP_TAG: // tag
-      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
+      // look up the (few) matching tags first, then their images through tagged_images_tagid_index
+      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                     "(SELECT id FROM data.tags WHERE name LIKE '%s')))",
                               escaped_text);
       break;
 
@@ -1432,6 +1569,115 @@ void dt_collection_update_query(const dt_collection_t *collection)
   /* update query and at last the visual */
   dt_collection_update(collection);
 
+  _collection_update_selection(collection);
+
+  /* raise signal of collection change, only if this is an original */
+  if(!collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+}
+
+void dt_collection_update_images(const dt_collection_t *collection, const GList *imgids)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  gboolean rebuild = !c->where || !c->where_no_group
+                     || (c->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+                     || g_list_length((GList *)imgids) > MAX_INCREMENTAL_IMAGES;
+
+  /* images that stay in the collection keep their place unless the change touches the sort key */
+  const gboolean keep_order = !(c->params.query_flags & COLLECTION_QUERY_USE_SORT)
+                              || (c->params.sort != DT_COLLECTION_SORT_RATING
+                                  && c->params.sort != DT_COLLECTION_SORT_COLOR
+                                  && c->params.sort != DT_COLLECTION_SORT_GROUP);
+
+  dt_pthread_mutex_lock(&c->lock);
+  if(!c->ids_valid) rebuild = TRUE;
+  dt_pthread_mutex_unlock(&c->lock);
+
+  if(!rebuild)
+  {
+    /* the representative of a collapsed group depends on which of its images pass the filters, so test the
+     * whole group of every changed image. images can only leave the collection here, newly matching ones
+     * need their place in the order and that is left to the query. */
+    sqlite3_stmt *stmt = NULL, *sel_stmt = NULL, *col_stmt = NULL;
+    gchar *query = g_strdup_printf("SELECT id, (%s), (%s) FROM main.images WHERE group_id = "
+                                   "(SELECT group_id FROM main.images WHERE id = ?1)",
+                                   c->where, c->where_no_group);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "DELETE FROM main.selected_images WHERE imgid = ?1", -1, &sel_stmt, NULL);
+    /* the lighttable keeps a copy of the main collection for the queries joining it, keep it in step */
+    if(!c->clone)
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "DELETE FROM memory.collected_images WHERE imgid = ?1", -1, &col_stmt, NULL);
+    GHashTable *done = g_hash_table_new(NULL, NULL);
+
+    for(const GList *l = imgids; l && !rebuild; l = g_list_next(l))
+    {
+      DT_DEBUG_SQLITE3_RESET(stmt);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        const int32_t imgid = sqlite3_column_int(stmt, 0);
+        if(g_hash_table_contains(done, GINT_TO_POINTER(imgid))) continue;
+        g_hash_table_add(done, GINT_TO_POINTER(imgid));
+
+        const gboolean member = sqlite3_column_int(stmt, 1);
+        gboolean removed = FALSE;
+        dt_pthread_mutex_lock(&c->lock);
+        /* another thread might have invalidated it meanwhile */
+        const gboolean was_member = g_hash_table_contains(c->offsets, GINT_TO_POINTER(imgid));
+        if(!c->ids_valid || (member && (!was_member || !keep_order)))
+          rebuild = TRUE;
+        else if(!member && was_member)
+        {
+          _collection_remove_id(c, imgid);
+          removed = TRUE;
+        }
+        dt_pthread_mutex_unlock(&c->lock);
+        if(rebuild) break;
+
+        if(removed && col_stmt)
+        {
+          DT_DEBUG_SQLITE3_RESET(col_stmt);
+          DT_DEBUG_SQLITE3_BIND_INT(col_stmt, 1, imgid);
+          sqlite3_step(col_stmt);
+        }
+
+        if(!sqlite3_column_int(stmt, 2))
+        {
+          DT_DEBUG_SQLITE3_RESET(sel_stmt);
+          DT_DEBUG_SQLITE3_BIND_INT(sel_stmt, 1, imgid);
+          sqlite3_step(sel_stmt);
+        }
+      }
+    }
+
+    g_hash_table_destroy(done);
+    if(col_stmt) sqlite3_finalize(col_stmt);
+    sqlite3_finalize(sel_stmt);
+    sqlite3_finalize(stmt);
+    g_free(query);
+  }
+
+  if(rebuild)
+  {
+    /* a query started before the change must not be published */
+    dt_pthread_mutex_lock(&c->lock);
+    c->generation++;
+    c->ids_valid = 0;
+    dt_pthread_mutex_unlock(&c->lock);
+    _collection_lock_valid(c);
+    dt_pthread_mutex_unlock(&c->lock);
+    _collection_update_selection(collection);
+  }
+  if(darktable.gui && darktable.gui->grouping)
+    c->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  dt_collection_hint_message(collection);
+
+  if(!collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+}
+
+static void _collection_update_selection(const dt_collection_t *collection)
+{
   // remove from selected images where not in this query.
   sqlite3_stmt *stmt = NULL;
   const gchar *cquery = dt_collection_get_query_no_group(collection);
@@ -1449,9 +1695,6 @@ void dt_collection_update_query(const dt_collection_t *collection)
     /* free allocated strings */
     g_free(complete_query);
   }
-
-  /* raise signal of collection change, only if this is an original */
-  if(!collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
 }
 
 gboolean dt_collection_hint_message_internal(void *message)
@@ -1499,39 +1742,12 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid)
 {
   if(imgid == -1) return 0;
-  const gchar *qin = dt_collection_get_query(collection);
-  int offset = 0;
-  sqlite3_stmt *stmt;
-
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-
-    // was the limit portion of the query tacked on?
-    if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-    {
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-    }
-
-    gboolean found = FALSE;
+  _collection_lock_valid(collection);
 
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
-      if(imgid == id)
-      {
-        found = TRUE;
-        break;
-      }
-      offset++;
-    }
-
-    if(!found) offset = 0;
-
-    sqlite3_finalize(stmt);
-  }
-  return offset;
+  // positions are stored + 1, so an image not in the collection gives offset 0
+  const int pos = GPOINTER_TO_INT(g_hash_table_lookup(collection->offsets, GINT_TO_POINTER(imgid)));
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+  return pos > 0 ? pos - 1 : 0;
 }
 
 int dt_collection_image_offset(int imgid)
@@ -1542,12 +1758,13 @@ int dt_collection_image_offset(int imgid)
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
-  int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection, FALSE);
-  collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  dt_pthread_mutex_lock(&collection->lock);
+  const int old_count = collection->count;
+  dt_pthread_mutex_unlock(&collection->lock);
+  _collection_invalidate(collection);
   if(!collection->clone)
   {
-    if(old_count != collection->count) dt_collection_hint_message(collection);
+    if(old_count != dt_collection_get_count(collection)) dt_collection_hint_message(collection);
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
   }
 }
@@ -1555,12 +1772,13 @@ static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_da
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
-  int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection, FALSE);
-  collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  dt_pthread_mutex_lock(&collection->lock);
+  const int old_count = collection->count;
+  dt_pthread_mutex_unlock(&collection->lock);
+  _collection_invalidate(collection);
   if(!collection->clone)
   {
-    if(old_count != collection->count) dt_collection_hint_message(collection);
+    if(old_count != dt_collection_get_count(collection)) dt_collection_hint_message(collection);
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
   }
 }
@@ -1594,7 +1812,7 @@ int64_t dt_collection_get_image_position(const int32_t image_id)
 
 void dt_collection_shift_image_positions(const unsigned int length, const int64_t image_position)
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
   sqlite3_stmt *stmt = NULL;
 
   // shift image positions to make some space
@@ -1608,7 +1826,7 @@ void dt_collection_shift_image_positions(const unsigned int length, const int64_
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 /* move images with drag and drop
@@ -1654,7 +1872,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     dt_collection_shift_image_positions(selected_images_length, target_image_pos);
 
     sqlite3_stmt *stmt = NULL;
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    dt_database_start_transaction(darktable.db);
 
     // move images to their intended positons
     int64_t new_image_pos = target_image_pos;
@@ -1676,7 +1894,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
       new_image_pos++;
     }
     sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
   }
   else
   {
@@ -1698,7 +1916,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     sqlite3_finalize(stmt);
     sqlite3_stmt *update_stmt = NULL;
 
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    dt_database_start_transaction(darktable.db);
 
     // move images to last position in custom image order table
     gchar *update_query = "UPDATE main.images SET position = ?1 WHERE id = ?2";
@@ -1717,7 +1935,10 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     }
 
     sqlite3_finalize(update_stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
+
+    /* the images kept their place in the materialized result */
+    _collection_invalidate((dt_collection_t *)darktable.collection);
   }
 }
 
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
 #include <glib.h>
 #include <inttypes.h>
 
@@ -135,8 +136,19 @@ typedef struct dt_collection_t
 {
   int clone;
   gchar *query, *query_no_group;
+  gchar *where, *where_no_group;
   gchar **where_ext;
   unsigned int count, count_no_group;
+  /* the result of query, kept in collection order: image ids and imgid -> position + 1. jobs update the
+   * collection too, so count, ids, offsets and ids_valid are only touched under lock. generation counts
+   * changes to the result, a query only gets published if none happened while it ran. version counts the
+   * published results. */
+  int32_t *ids;
+  uint32_t ids_alloc;
+  GHashTable *offsets;
+  int ids_valid;
+  uint32_t generation, version;
+  dt_pthread_mutex_t lock;
   dt_collection_params_t params;
   dt_collection_params_t store;
 } dt_collection_t;
@@ -202,6 +214,9 @@ uint32_t dt_collection_get_count(const dt_collection_t *collection);
 uint32_t dt_collection_get_count_no_group(const dt_collection_t *collection);
 /** get the nth image in the query */
 int dt_collection_get_nth(const dt_collection_t *collection, int nth);
+/** copy at most count image ids of the collection in collection order, starting at offset, into ids.
+ * @return the number of ids copied */
+uint32_t dt_collection_get_ids(const dt_collection_t *collection, int32_t *ids, uint32_t offset, uint32_t count);
 /** get all image ids order as current selection. no more than limit many images are returned, <0 ==
  * unlimited */
 GList *dt_collection_get_all(const dt_collection_t *collection, int limit);
@@ -210,9 +225,14 @@ GList *dt_collection_get_all(const dt_collection_t *collection, int limit);
 GList *dt_collection_get_selected(const dt_collection_t *collection, int limit);
 /** get the count of selected images */
 uint32_t dt_collection_get_selected_count(const dt_collection_t *collection);
+/** changes whenever the result is built again, not on incremental removals */
+uint32_t dt_collection_get_version(const dt_collection_t *collection);
 
 /** update query by conf vars */
 void dt_collection_update_query(const dt_collection_t *collection);
+/** the rating, color labels or tags of some images changed: update the collection for just these images
+ * and raise DT_SIGNAL_COLLECTION_CHANGED, falling back to running the whole query where that is needed */
+void dt_collection_update_images(const dt_collection_t *collection, const GList *imgids);
 
 /** updates the hint message for collection */
 void dt_collection_hint_message(const dt_collection_t *collection);
@@ -40,33 +40,32 @@ void dt_colorlabels_remove_labels_selection()
 void dt_colorlabels_remove_labels(const int imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.color_labels WHERE imgid=?1", -1,
-                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "DELETE FROM main.color_labels WHERE imgid=?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_set_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_remove_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_toggle_label_selection(const int color)
@@ -111,30 +110,29 @@ void dt_colorlabels_toggle_label(const int imgid, const int color)
 {
   if(imgid <= 0) return;
   sqlite3_stmt *stmt, *stmt2;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt2, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", &stmt2);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_cached(darktable.db, stmt2);
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt2, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", &stmt2);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_cached(darktable.db, stmt2);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   dt_collection_hint_message(darktable.collection);
 }
@@ -143,19 +141,18 @@ int dt_colorlabels_check_label(const int imgid, const int color)
 {
   if(imgid <= 0) return 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return 1;
   }
   else
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return 0;
   }
 }
@@ -205,7 +202,11 @@ gboolean dt_colorlabels_key_accel_callback(GtkAccelGroup *accel_group, GObject *
   // synch to file:
   // TODO: move color labels to image_t cache and sync via write_get!
   dt_image_synch_xmp(selected);
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
+  // only the labelled images can join or leave the collection
+  GList *imgids = selected > 0 ? g_list_append(NULL, GINT_TO_POINTER(selected))
+                               : dt_collection_get_selected(darktable.collection, -1);
+  dt_collection_update_images(darktable.collection, imgids);
+  g_list_free(imgids);
   dt_control_queue_redraw_center();
   return TRUE;
 }
@@ -159,6 +159,105 @@ static inline __m128 dt_prophotoRGB_to_XYZ_sse2(__m128 rgb)
 }
 #endif
 
+#ifdef HAVE_AVX_CODEPATHS
+#include "common/avx.h"
+
+// same as the sse2 versions above, for two (avx2) or four (avx512) pixels at a time
+
+DT_TARGET_AVX2 static inline __m256 lab_f_inv_m_avx2(const __m256 x)
+{
+  const __m256 epsilon = _mm256_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
+  const __m256 kappa_rcp_x16 = _mm256_set1_ps(16.0f * 27.0f / 24389.0f);
+  const __m256 kappa_rcp_x116 = _mm256_set1_ps(116.0f * 27.0f / 24389.0f);
+
+  const __m256 res_big = x * x * x;
+  const __m256 res_small = kappa_rcp_x116 * x - kappa_rcp_x16;
+  return _mm256_blendv_ps(res_small, res_big, _mm256_cmp_ps(x, epsilon, _CMP_GT_OQ));
+}
+
+/** uses D50 white point. */
+DT_TARGET_AVX2 static inline __m256 dt_Lab_to_XYZ_avx2(const __m256 Lab)
+{
+  const __m256 d50 = _mm256_setr_ps(0.9642f, 1.0f, 0.8249f, 0.0f, 0.9642f, 1.0f, 0.8249f, 0.0f);
+  const __m256 coef = _mm256_setr_ps(1.0f / 500.0f, 1.0f / 116.0f, -1.0f / 200.0f, 0.0f, 1.0f / 500.0f,
+                                     1.0f / 116.0f, -1.0f / 200.0f, 0.0f);
+  const __m256 offset = _mm256_set1_ps(0.137931034f);
+
+  const __m256 f = _mm256_shuffle_ps(Lab, Lab, _MM_SHUFFLE(0, 2, 0, 1)) * coef;
+  return d50 * lab_f_inv_m_avx2(f + _mm256_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 3, 1)) + offset);
+}
+
+DT_TARGET_AVX2 static inline __m256 lab_f_m_avx2(const __m256 x)
+{
+  const __m256 epsilon = _mm256_set1_ps(216.0f / 24389.0f);
+  const __m256 kappa = _mm256_set1_ps(24389.0f / 27.0f);
+
+  // approximate cbrtf(x):
+  const __m256 a = _mm256_castsi256_ps(
+      _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_cvtepi32_ps(_mm256_castps_si256(x)) / _mm256_set1_ps(3.0f)),
+                       _mm256_set1_epi32(709921077)));
+  const __m256 a3 = a * a * a;
+  const __m256 res_big = a * (a3 + x + x) / (a3 + a3 + x);
+  const __m256 res_small = (kappa * x + _mm256_set1_ps(16.0f)) / _mm256_set1_ps(116.0f);
+  return _mm256_blendv_ps(res_small, res_big, _mm256_cmp_ps(x, epsilon, _CMP_GT_OQ));
+}
+
+/** uses D50 white point. */
+DT_TARGET_AVX2 static inline __m256 dt_XYZ_to_Lab_avx2(const __m256 XYZ)
+{
+  const __m256 d50_inv = _mm256_setr_ps(0.9642f, 1.0f, 0.8249f, 1.0f, 0.9642f, 1.0f, 0.8249f, 1.0f);
+  const __m256 coef = _mm256_setr_ps(116.0f, 500.0f, 200.0f, 0.0f, 116.0f, 500.0f, 200.0f, 0.0f);
+  const __m256 f = lab_f_m_avx2(XYZ / d50_inv);
+  return coef * (_mm256_shuffle_ps(f, f, _MM_SHUFFLE(3, 1, 0, 1)) - _mm256_shuffle_ps(f, f, _MM_SHUFFLE(3, 2, 1, 3)));
+}
+
+DT_TARGET_AVX512 static inline __m512 lab_f_inv_m_avx512(const __m512 x)
+{
+  const __m512 epsilon = _mm512_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
+  const __m512 kappa_rcp_x16 = _mm512_set1_ps(16.0f * 27.0f / 24389.0f);
+  const __m512 kappa_rcp_x116 = _mm512_set1_ps(116.0f * 27.0f / 24389.0f);
+
+  const __m512 res_big = x * x * x;
+  const __m512 res_small = kappa_rcp_x116 * x - kappa_rcp_x16;
+  return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, epsilon, _CMP_GT_OQ), res_small, res_big);
+}
+
+/** uses D50 white point. */
+DT_TARGET_AVX512 static inline __m512 dt_Lab_to_XYZ_avx512(const __m512 Lab)
+{
+  const __m512 d50 = _mm512_broadcast_f32x4(_mm_setr_ps(0.9642f, 1.0f, 0.8249f, 0.0f));
+  const __m512 coef = _mm512_broadcast_f32x4(_mm_setr_ps(1.0f / 500.0f, 1.0f / 116.0f, -1.0f / 200.0f, 0.0f));
+  const __m512 offset = _mm512_set1_ps(0.137931034f);
+
+  const __m512 f = _mm512_shuffle_ps(Lab, Lab, _MM_SHUFFLE(0, 2, 0, 1)) * coef;
+  return d50 * lab_f_inv_m_avx512(f + _mm512_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 3, 1)) + offset);
+}
+
+DT_TARGET_AVX512 static inline __m512 lab_f_m_avx512(const __m512 x)
+{
+  const __m512 epsilon = _mm512_set1_ps(216.0f / 24389.0f);
+  const __m512 kappa = _mm512_set1_ps(24389.0f / 27.0f);
+
+  // approximate cbrtf(x):
+  const __m512 a = _mm512_castsi512_ps(
+      _mm512_add_epi32(_mm512_cvtps_epi32(_mm512_cvtepi32_ps(_mm512_castps_si512(x)) / _mm512_set1_ps(3.0f)),
+                       _mm512_set1_epi32(709921077)));
+  const __m512 a3 = a * a * a;
+  const __m512 res_big = a * (a3 + x + x) / (a3 + a3 + x);
+  const __m512 res_small = (kappa * x + _mm512_set1_ps(16.0f)) / _mm512_set1_ps(116.0f);
+  return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, epsilon, _CMP_GT_OQ), res_small, res_big);
+}
+
+/** uses D50 white point. */
+DT_TARGET_AVX512 static inline __m512 dt_XYZ_to_Lab_avx512(const __m512 XYZ)
+{
+  const __m512 d50_inv = _mm512_broadcast_f32x4(_mm_setr_ps(0.9642f, 1.0f, 0.8249f, 1.0f));
+  const __m512 coef = _mm512_broadcast_f32x4(_mm_setr_ps(116.0f, 500.0f, 200.0f, 0.0f));
+  const __m512 f = lab_f_m_avx512(XYZ / d50_inv);
+  return coef * (_mm512_shuffle_ps(f, f, _MM_SHUFFLE(3, 1, 0, 1)) - _mm512_shuffle_ps(f, f, _MM_SHUFFLE(3, 2, 1, 3)));
+}
+#endif
+
 static inline float cbrt_5f(float f)
 {
   uint32_t *p = (uint32_t *)&f;
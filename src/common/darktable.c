@@ -45,6 +45,7 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/interpolation.h"
 #include "common/l10n.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
@@ -112,10 +113,11 @@ static int usage(const char *argv0)
   printf("options:\n");
   printf("\n");
   printf("  --cachedir <user cache directory>\n");
+  printf("  --codepath {plain,sse2,avx2,avx512}\n");
   printf("  --conf <key>=<value>\n");
   printf("  --configdir <user config directory>\n");
   printf("  -d {all,cache,camctl,camsupport,control,dev,fswatch,input,lighttable,\n");
-  printf("      lua, masks,memory,nan,opencl,perf,pwstorage,print,sql}\n");
+  printf("      lua, masks,memory,nan,opencl,perf,pwstorage,print,sql,sqlplan}\n");
   printf("  --datadir <data directory>\n");
 #ifdef HAVE_OPENCL
   printf("  --disable-opencl\n");
@@ -283,7 +285,7 @@ int dt_load_from_string(const gchar *input, gboolean open_image_in_dr, gboolean
   return id;
 }
 
-static void dt_codepaths_init()
+static void dt_codepaths_init(const char *codepath)
 {
 #ifdef HAVE_BUILTIN_CPU_SUPPORTS
   __builtin_cpu_init();
@@ -298,12 +300,37 @@ static void dt_codepaths_init()
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#endif
+#ifdef HAVE_AVX_CODEPATHS
+    // __builtin_cpu_supports() of older compilers doesn't know about avx512 or ask the os, so use our own
+    const dt_cpu_flags_t avx_flags = dt_detect_cpu_features();
+    darktable.codepath.AVX2 = (avx_flags & CPU_FLAG_AVX2) && (avx_flags & CPU_FLAG_FMA);
+    darktable.codepath.AVX512 = darktable.codepath.AVX2 && (avx_flags & CPU_FLAG_AVX512F);
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx2")) darktable.codepath.AVX2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx512")) darktable.codepath.AVX512 = 0;
+
+  // --codepath caps the widest tier for this session, to benchmark the tiers against each other
+  if(codepath)
+  {
+    if(!strcmp(codepath, "plain"))
+      darktable.codepath.SSE2 = 0;
+    else if(!strcmp(codepath, "sse2"))
+      darktable.codepath.AVX2 = 0;
+    else if(!strcmp(codepath, "avx2"))
+      darktable.codepath.AVX512 = 0;
+    else if(strcmp(codepath, "avx512"))
+      fprintf(stderr, "[dt_codepaths_init] unknown codepath `%s', ignoring it\n", codepath);
+  }
+
+  // the wide tiers build on top of sse2
+  if(!darktable.codepath.SSE2) darktable.codepath.AVX2 = 0;
+  if(!darktable.codepath.AVX2) darktable.codepath.AVX512 = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
@@ -328,6 +355,11 @@ static void dt_codepaths_init()
     fprintf(stderr,
             "[dt_codepaths_init] expect a LOT of functionality to be broken. you have been warned.\n");
   }
+
+  dt_print(DT_DEBUG_PERF, "[dt_codepaths_init] using %s codepath\n",
+           darktable.codepath.OPENMP_SIMD ? "plain"
+                                          : darktable.codepath.AVX512 ? "avx512"
+                                                                      : darktable.codepath.AVX2 ? "avx2" : "sse2");
 }
 
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
@@ -444,6 +476,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   char *tmpdir_from_command = NULL;
   char *configdir_from_command = NULL;
   char *cachedir_from_command = NULL;
+  const char *codepath = NULL;
 
 #ifdef HAVE_OPENCL
   gboolean exclude_opencl = FALSE;
@@ -615,6 +648,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted |= DT_DEBUG_OPENCL; // gpu accel via opencl
         else if(!strcmp(argv[k + 1], "sql"))
           darktable.unmuted |= DT_DEBUG_SQL; // SQLite3 queries
+        else if(!strcmp(argv[k + 1], "sqlplan"))
+          darktable.unmuted |= DT_DEBUG_SQL_PLAN; // query plans of the collection queries
         else if(!strcmp(argv[k + 1], "memory"))
           darktable.unmuted |= DT_DEBUG_MEMORY; // some stats on mem usage now and then.
         else if(!strcmp(argv[k + 1], "lighttable"))
@@ -676,6 +711,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--codepath") && argc > k + 1)
+      {
+        codepath = argv[++k];
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--disable-opencl"))
       {
 #ifdef HAVE_OPENCL
@@ -795,7 +836,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   }
 
   // detect cpu features and decide which codepaths to enable
-  dt_codepaths_init();
+  dt_codepaths_init(codepath);
+
+  // resampling plans are cached across pipes and threads
+  dt_interpolation_init();
 
   // get the list of color profiles
   darktable.color_profiles = dt_colorspaces_init();
@@ -840,15 +884,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
-  // Make sure that the database and xmp files are in sync
-  // We need conf and db to be up and running for that which is the case here.
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-  {
-    changed_xmp_files = dt_control_crawler_run();
-  }
-
   if(init_gui)
   {
     dt_control_init(darktable.control);
@@ -1027,11 +1062,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #endif
   }
 
-  // last but not least construct the popup that asks the user about images whose xmp files are newer than the
-  // db entry
-  if(init_gui && changed_xmp_files)
+  // last but not least make sure that the database and xmp files are in sync. this runs in the background and
+  // pops up a dialog asking the user about images whose xmp files are newer than the db entry.
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
   {
-    dt_control_crawler_show_image_list(changed_xmp_files);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, dt_control_crawler_job_create());
   }
 
   dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
@@ -1086,6 +1122,7 @@ void dt_cleanup()
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
+  dt_interpolation_cleanup();
   dt_iop_unload_modules_so();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
@@ -185,11 +185,14 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_INPUT = 1 << 14,
   DT_DEBUG_PRINT = 1 << 15,
   DT_DEBUG_CAMERA_SUPPORT = 1 << 16,
+  DT_DEBUG_SQL_PLAN = 1 << 17,
 } dt_debug_thread_t;
 
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1;   // with FMA, implies SSE2
+  unsigned int AVX512 : 1; // AVX-512F, implies AVX2
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
@@ -37,9 +37,22 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 17
+#define CURRENT_DATABASE_VERSION_LIBRARY 19
 #define CURRENT_DATABASE_VERSION_DATA 1
 
+// idle statements kept around per query, and the number of different queries we keep statements for
+#define DT_DATABASE_STMT_CACHE_IDLE 4
+#define DT_DATABASE_STMT_CACHE_QUERIES 512
+
+/* statements handed out by dt_database_prepare_cached(). a statement belongs to whoever prepared it until it
+ * is given back with dt_database_release_cached(), so two threads (or a caller and its callees) running the
+ * same query never share one. the mutex only protects the lists of idle statements. */
+typedef struct dt_database_stmt_cache_t
+{
+  dt_pthread_mutex_t mutex;
+  GHashTable *idle; // sql text -> GPtrArray of reset sqlite3_stmt
+} dt_database_stmt_cache_t;
+
 typedef struct dt_database_t
 {
   gboolean lock_acquired;
@@ -54,6 +67,14 @@ typedef struct dt_database_t
   sqlite3 *handle;
 
   gchar *error_message, *error_dbfilename;
+
+  /* prepared statements of the frequent queries */
+  dt_database_stmt_cache_t *stmt_cache;
+
+  /* explicit transactions on the shared handle, see dt_database_start_transaction() */
+  dt_pthread_mutex_t transaction_mutex;
+  pthread_t transaction_owner;
+  int transaction_depth;
 } dt_database_t;
 
 
@@ -1003,6 +1024,50 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 17;
   }
+  else if(version == 17)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    ////////////////////////////// mtime of the folder when the crawler last looked at it
+    TRY_EXEC("ALTER TABLE main.film_rolls ADD COLUMN scan_mtime INTEGER",
+             "[init] can't add `scan_mtime' column to film_rolls table in database\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 18;
+  }
+  else if(version == 18)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    ////////////////////////////// indexes for the collection filters and the collect module
+    TRY_EXEC("CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)",
+             "[init] can't create datetime_taken index on images table\n");
+    TRY_EXEC("CREATE INDEX main.images_maker_model_index ON images (maker, model, id)",
+             "[init] can't create maker/model index on images table\n");
+    TRY_EXEC("CREATE INDEX main.images_lens_index ON images (lens)",
+             "[init] can't create lens index on images table\n");
+    TRY_EXEC("CREATE INDEX main.images_exposure_index ON images (exposure)",
+             "[init] can't create exposure index on images table\n");
+    TRY_EXEC("CREATE INDEX main.images_iso_index ON images (iso)",
+             "[init] can't create iso index on images table\n");
+    TRY_EXEC("CREATE INDEX main.images_focal_length_index ON images (focal_length)",
+             "[init] can't create focal_length index on images table\n");
+    // the aperture filter compares ROUND(aperture,1), indexes on expressions need sqlite 3.9
+    if(sqlite3_libversion_number() >= 3009000)
+      TRY_EXEC("CREATE INDEX main.images_aperture_index ON images (ROUND(aperture,1))",
+               "[init] can't create aperture index on images table\n");
+    // the tag filter looks up images by tag id, this covers it without touching the table
+    TRY_EXEC("DROP INDEX IF EXISTS main.tagged_images_tagid_index",
+             "[init] can't drop tagged_images_tagid_index\n");
+    TRY_EXEC("CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create tagid index on tagged_images table\n");
+    // color_labels_idx is (imgid, color), the filter needs it the other way round
+    TRY_EXEC("CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)",
+             "[init] can't create color index on color_labels table\n");
+    TRY_EXEC("CREATE INDEX main.metadata_key_index ON meta_data (key, value, id)",
+             "[init] can't create key index on meta_data table\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 19;
+  }
   // maybe in the future, see commented out code elsewhere
   //   else if(version == XXX)
   //   {
@@ -1104,7 +1169,7 @@ static void _create_library_schema(dt_database_t *db)
                //                        "folder VARCHAR(1024), external_drive VARCHAR(1024))", //
                //                        FIXME: make sure to bump CURRENT_DATABASE_VERSION_LIBRARY and add a
                //                        case to _upgrade_library_schema_step when adding this!
-               "folder VARCHAR(1024) NOT NULL)",
+               "folder VARCHAR(1024) NOT NULL, scan_mtime INTEGER)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.film_rolls_folder_index ON film_rolls (folder)", NULL, NULL, NULL);
   ////////////////////////////// images
@@ -1126,6 +1191,17 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_index ON images (film_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_filename_index ON images (filename)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.image_position_index ON images (position)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_maker_model_index ON images (maker, model, id)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_lens_index ON images (lens)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_exposure_index ON images (exposure)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_iso_index ON images (iso)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_focal_length_index ON images (focal_length)", NULL, NULL, NULL);
+  if(sqlite3_libversion_number() >= 3009000)
+    sqlite3_exec(db->handle, "CREATE INDEX main.images_aperture_index ON images (ROUND(aperture,1))", NULL, NULL,
+                 NULL);
 
   ////////////////////////////// selected_images
   sqlite3_exec(db->handle, "CREATE TABLE main.selected_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
@@ -1145,7 +1221,8 @@ static void _create_library_schema(dt_database_t *db)
   ////////////////////////////// tagged_images
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, "
                            "PRIMARY KEY (imgid, tagid))", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// used_tags
   sqlite3_exec(db->handle, "CREATE TABLE main.used_tags (id INTEGER, name VARCHAR NOT NULL)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.used_tags_idx ON used_tags (id, name)", NULL, NULL, NULL);
@@ -1153,9 +1230,12 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.color_labels_idx ON color_labels (imgid, color)", NULL, NULL,
                NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// meta_data
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index ON meta_data (id, key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_index ON meta_data (key, value, id)", NULL, NULL, NULL);
 }
 
 /* create the current database schema and set the version in db_info accordingly */
@@ -1533,6 +1613,23 @@ static gboolean _lock_databases(dt_database_t *db)
   return TRUE;
 }
 
+static dt_database_stmt_cache_t *_database_stmt_cache_new()
+{
+  dt_database_stmt_cache_t *cache = g_malloc0(sizeof(dt_database_stmt_cache_t));
+  dt_pthread_mutex_init(&cache->mutex, NULL);
+  cache->idle = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+  return cache;
+}
+
+static void _database_stmt_cache_free(dt_database_stmt_cache_t *cache)
+{
+  if(!cache) return;
+  // finalizes all idle statements. the ones still handed out are leaked, and sqlite3_close() will complain
+  g_hash_table_destroy(cache->idle);
+  dt_pthread_mutex_destroy(&cache->mutex);
+  g_free(cache);
+}
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data)
 {
   /*  set the threading mode to Serialized */
@@ -1584,6 +1681,7 @@ start:
 
   /* create database */
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  dt_pthread_mutex_init(&db->transaction_mutex, NULL);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
 
@@ -1869,6 +1967,8 @@ start:
     goto error;
   }
 
+  db->stmt_cache = _database_stmt_cache_new();
+
 error:
   g_free(dbname);
 
@@ -1877,6 +1977,11 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  // let sqlite refresh the statistics the query planner uses to pick between the indexes, if it thinks the
+  // queries of this session would profit. a no-op before sqlite 3.18. only for fully set up databases.
+  if(db->stmt_cache) sqlite3_exec(db->handle, "PRAGMA optimize", NULL, NULL, NULL);
+  // cached statements would keep the connection from closing
+  _database_stmt_cache_free(db->stmt_cache);
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -1890,11 +1995,99 @@ void dt_database_destroy(const dt_database_t *db)
   }
   g_free(db->dbfilename_data);
   g_free(db->dbfilename_library);
+  dt_pthread_mutex_destroy(&((dt_database_t *)db)->transaction_mutex);
   g_free((dt_database_t *)db);
 
   sqlite3_shutdown();
 }
 
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  // the thread holding the transaction just nests, only the outermost call begins and commits
+  if(d->transaction_depth > 0 && pthread_equal(d->transaction_owner, pthread_self()))
+  {
+    d->transaction_depth++;
+    return;
+  }
+  dt_pthread_mutex_lock(&d->transaction_mutex);
+  d->transaction_owner = pthread_self();
+  d->transaction_depth = 1;
+  sqlite3_exec(d->handle, "BEGIN", NULL, NULL, NULL);
+}
+
+void dt_database_release_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(--d->transaction_depth > 0) return;
+  sqlite3_exec(d->handle, "COMMIT", NULL, NULL, NULL);
+  dt_pthread_mutex_unlock(&d->transaction_mutex);
+}
+
+int dt_database_prepare_cached(const dt_database_t *db, const char *query, sqlite3_stmt **stmt)
+{
+  dt_database_stmt_cache_t *cache = db->stmt_cache;
+  *stmt = NULL;
+  if(cache)
+  {
+    dt_pthread_mutex_lock(&cache->mutex);
+    GPtrArray *idle = g_hash_table_lookup(cache->idle, query);
+    if(idle && idle->len > 0) *stmt = g_ptr_array_remove_index_fast(idle, idle->len - 1);
+    dt_pthread_mutex_unlock(&cache->mutex);
+    if(*stmt) return SQLITE_OK;
+  }
+  // a miss, prepare outside of the lock
+  return sqlite3_prepare_v2(db->handle, query, -1, stmt, NULL);
+}
+
+void dt_database_release_cached(const dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  dt_database_stmt_cache_t *cache = db->stmt_cache;
+  // drop the result set, the bindings and the read lock right away, as sqlite3_finalize() would
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if(cache)
+  {
+    const char *query = sqlite3_sql(stmt);
+    dt_pthread_mutex_lock(&cache->mutex);
+    GPtrArray *idle = g_hash_table_lookup(cache->idle, query);
+    // don't let queries built on the fly fill the cache
+    if(!idle && g_hash_table_size(cache->idle) < DT_DATABASE_STMT_CACHE_QUERIES)
+    {
+      idle = g_ptr_array_new_with_free_func((GDestroyNotify)sqlite3_finalize);
+      g_hash_table_insert(cache->idle, g_strdup(query), idle);
+    }
+    if(idle && idle->len < DT_DATABASE_STMT_CACHE_IDLE)
+    {
+      g_ptr_array_add(idle, stmt);
+      stmt = NULL;
+    }
+    dt_pthread_mutex_unlock(&cache->mutex);
+  }
+  sqlite3_finalize(stmt);
+}
+
+void dt_database_explain_query_plan(const dt_database_t *db, const char *query)
+{
+  if(!(darktable.unmuted & DT_DEBUG_SQL_PLAN) || !query) return;
+  gchar *explain = g_strdup_printf("EXPLAIN QUERY PLAN %s", query);
+  sqlite3_stmt *stmt;
+  // unbound parameters are fine here, they are taken as NULL
+  if(sqlite3_prepare_v2(db->handle, explain, -1, &stmt, NULL) == SQLITE_OK)
+  {
+    dt_print(DT_DEBUG_SQL_PLAN, "[sql] query plan of \"%s\"\n", query);
+    // the columns are id, parent, unused and detail (selectid, order, from and detail before sqlite 3.24)
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      dt_print(DT_DEBUG_SQL_PLAN, "[sql]   %3d %3d  %s\n", sqlite3_column_int(stmt, 0),
+               sqlite3_column_int(stmt, 1), (const char *)sqlite3_column_text(stmt, 3));
+    sqlite3_finalize(stmt);
+  }
+  else
+    dt_print(DT_DEBUG_SQL_PLAN, "[sql] can't explain \"%s\": %s\n", query, sqlite3_errmsg(db->handle));
+  g_free(explain);
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db ? db->handle : NULL;
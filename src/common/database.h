@@ -21,6 +21,7 @@
 #include <glib.h>
 
 struct dt_database_t;
+struct sqlite3_stmt;
 
 /** allocates and initializes database */
 struct dt_database_t *dt_database_init(const char *alternative, const gboolean load_data);
@@ -28,6 +29,20 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/** prepare a statement for query, reusing an idle one from an earlier call with the same sql text if there is
+ * one. only use this with constant queries and give the statement back with dt_database_release_cached() instead
+ * of finalizing it. returns the sqlite3 result code. */
+int dt_database_prepare_cached(const struct dt_database_t *db, const char *query, struct sqlite3_stmt **stmt);
+/** reset the statement, clear its bindings and keep it for the next dt_database_prepare_cached() */
+void dt_database_release_cached(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
+/** begin a transaction on the shared connection. explicit transactions of different threads would end up in
+ * each other, so this holds a database-wide lock until the matching dt_database_release_transaction(), which
+ * commits. calls nest within one thread. keep them short, every other thread wanting one waits. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+/** commit the transaction started by dt_database_start_transaction() and let the next thread have one */
+void dt_database_release_transaction(const struct dt_database_t *db);
+/** with -d sqlplan, print what EXPLAIN QUERY PLAN says about query */
+void dt_database_explain_query_plan(const struct dt_database_t *db, const char *query);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
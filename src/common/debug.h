@@ -99,6 +99,17 @@
     __DT_DEBUG_SQL_QUERY__(b)                                                                                     \
   } while(0)
 
+// like DT_DEBUG_SQLITE3_PREPARE_V2() but through the statement cache of the database a, see
+// dt_database_prepare_cached(). the statement has to be given back with dt_database_release_cached().
+#define DT_DEBUG_SQLITE3_PREPARE_CACHED(a, b, d)                                                                  \
+  do                                                                                                              \
+  {                                                                                                               \
+    dt_print(DT_DEBUG_SQL, "[sql] %s:%d, function %s(): prepare cached \"%s\"\n", __FILE__, __LINE__,           \
+             __FUNCTION__, (b));                                                                                  \
+    __DT_DEBUG_ASSERT_WITH_QUERY__(dt_database_prepare_cached(a, b, d), (b));                                     \
+    __DT_DEBUG_SQL_QUERY__(b)                                                                                     \
+  } while(0)
+
 #define DT_DEBUG_SQLITE3_BIND_INT(a, b, c) __DT_DEBUG_ASSERT__(sqlite3_bind_int(a, b, c))
 #define DT_DEBUG_SQLITE3_BIND_INT64(a, b, c) __DT_DEBUG_ASSERT__(sqlite3_bind_int64(a, b, c))
 #define DT_DEBUG_SQLITE3_BIND_DOUBLE(a, b, c) __DT_DEBUG_ASSERT__(sqlite3_bind_double(a, b, c))
@@ -71,7 +71,14 @@ extern "C" {
 
 // exiv2's readMetadata is not thread safe in 0.26. so we lock it. since readMetadata might throw an exception we
 // wrap it into some c++ magic to make sure we unlock in all cases. well, actually not magic but basic raii.
-// FIXME: check again once we rely on 0.27
+// 0.27 reads different images in parallel just fine, as long as its xmp toolkit has a lock of its own, which it
+// gets in dt_exif_init(). so the import's readers really parse their files in parallel there.
+#if EXIV2_TEST_VERSION(0, 27, 0)
+#define read_metadata_threadsafe(image)                       \
+{                                                             \
+  image->readMetadata();                                      \
+}
+#else
 class Lock
 {
 public:
@@ -84,6 +91,18 @@ public:
   Lock lock;                                                  \
   image->readMetadata();                                      \
 }
+#endif
+
+// the xmp toolkit isn't thread safe at all, exiv2 calls this around everything it does with it
+static dt_pthread_mutex_t _exif_xmp_mutex;
+
+static void _exif_xmp_lock(void *data, bool lock)
+{
+  if(lock)
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)data);
+  else
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)data);
+}
 
 static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos);
 
@@ -1020,10 +1039,9 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
-int dt_exif_read(dt_image_t *img, const char *path)
+// at least set datetime taken to something useful in case there is no exif data in this file (pfm, png, ...)
+static void _exif_datetime_from_mtime(dt_image_t *img, const char *path)
 {
-  // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
-  // ...)
   struct stat statbuf;
 
   if(!stat(path, &statbuf))
@@ -1031,39 +1049,96 @@ int dt_exif_read(dt_image_t *img, const char *path)
     struct tm result;
     strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&statbuf.st_mtime, &result));
   }
+}
+
+// store the metadata of an opened image to the image struct. throws exiv2 exceptions.
+static int _exif_read_image(dt_image_t *img, Exiv2::Image *image)
+{
+  bool res = true;
+
+  // EXIF metadata
+  Exiv2::ExifData &exifData = image->exifData();
+  if(!exifData.empty())
+    res = dt_exif_read_exif_data(img, exifData);
+  else
+    img->exif_inited = 1;
+
+  // these get overwritten by IPTC and XMP. is that how it should work?
+  dt_exif_apply_global_overwrites(img);
+
+  // IPTC metadata.
+  Exiv2::IptcData &iptcData = image->iptcData();
+  if(!iptcData.empty()) res = dt_exif_read_iptc_data(img, iptcData) && res;
+
+  // XMP metadata
+  Exiv2::XmpData &xmpData = image->xmpData();
+  if(!xmpData.empty()) res = dt_exif_read_xmp_data(img, xmpData, -1, true) && res;
+
+  // Initialize size - don't wait for full raw to be loaded to get this
+  // information. If use_embedded_thumbnail is set, it will take a
+  // change in development history to have this information
+  img->height = image->pixelHeight();
+  img->width = image->pixelWidth();
+
+  return res ? 0 : 1;
+}
+
+int dt_exif_read(dt_image_t *img, const char *path)
+{
+  _exif_datetime_from_mtime(img, path);
 
   try
   {
     std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
     assert(image.get() != 0);
     read_metadata_threadsafe(image);
-    bool res = true;
-
-    // EXIF metadata
-    Exiv2::ExifData &exifData = image->exifData();
-    if(!exifData.empty())
-      res = dt_exif_read_exif_data(img, exifData);
-    else
-      img->exif_inited = 1;
+    return _exif_read_image(img, image.get());
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+    return 1;
+  }
+}
 
-    // these get overwritten by IPTC and XMP. is that how it should work?
-    dt_exif_apply_global_overwrites(img);
+struct dt_exif_file_t
+{
+  std::unique_ptr<Exiv2::Image> image;
+};
 
-    // IPTC metadata.
-    Exiv2::IptcData &iptcData = image->iptcData();
-    if(!iptcData.empty()) res = dt_exif_read_iptc_data(img, iptcData) && res;
+dt_exif_file_t *dt_exif_file_read(const char *path)
+{
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    assert(image.get() != 0);
+    read_metadata_threadsafe(image);
+    dt_exif_file_t *file = new dt_exif_file_t;
+    file->image = std::move(image);
+    return file;
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+    return NULL;
+  }
+}
 
-    // XMP metadata
-    Exiv2::XmpData &xmpData = image->xmpData();
-    if(!xmpData.empty()) res = dt_exif_read_xmp_data(img, xmpData, -1, true) && res;
+void dt_exif_file_free(dt_exif_file_t *file)
+{
+  delete file;
+}
 
-    // Initialize size - don't wait for full raw to be loaded to get this
-    // information. If use_embedded_thumbnail is set, it will take a
-    // change in development history to have this information
-    img->height = image->pixelHeight();
-    img->width = image->pixelWidth();
+int dt_exif_read_file(dt_image_t *img, const char *path, dt_exif_file_t *file)
+{
+  _exif_datetime_from_mtime(img, path);
+  if(!file) return 1;
 
-    return res ? 0 : 1;
+  try
+  {
+    return _exif_read_image(img, file->image.get());
   }
   catch(Exiv2::AnyError &e)
   {
@@ -2101,223 +2176,237 @@ static void add_mask_entries_to_db(int imgid, GHashTable *mask_entries, int mask
   add_mask_entry_to_db(imgid, entry);
 }
 
-// need a write lock on *img (non-const) to write stars (and soon color labels).
-int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+// apply the xmp data of an opened sidecar to the image struct and the database. throws exiv2 exceptions.
+static int _exif_xmp_read_image(dt_image_t *img, Exiv2::Image *image, const char *filename,
+                                const int history_only)
 {
-  // exclude pfm to avoid stupid errors on the console
-  const char *c = filename + strlen(filename) - 4;
-  if(c >= filename && !strcmp(c, ".pfm")) return 1;
-  try
+  Exiv2::XmpData &xmpData = image->xmpData();
+
+  sqlite3_stmt *stmt;
+
+  Exiv2::XmpData::iterator pos;
+
+  int version = 0;
+  if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.xmp_version"))) != xmpData.end())
+    version = pos->toLong();
+
+  if(!history_only)
   {
-    // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
-    Exiv2::XmpData &xmpData = image->xmpData();
+    // otherwise we ignore title, description, ... from non-dt xmp files :(
+    size_t ns_pos = image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"");
+    bool is_a_dt_xmp = (ns_pos != std::string::npos);
+    dt_exif_read_xmp_data(img, xmpData, is_a_dt_xmp ? version : -1, false);
+  }
 
-    sqlite3_stmt *stmt;
 
-    Exiv2::XmpData::iterator pos;
+  // convert legacy flip bits (will not be written anymore, convert to flip history item here):
+  if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.raw_params"))) != xmpData.end())
+  {
+    int32_t i = pos->toLong();
+    dt_image_raw_parameters_t raw_params = *(dt_image_raw_parameters_t *)&i;
+    int32_t user_flip = raw_params.user_flip;
+    img->legacy_flip.user_flip = user_flip;
+    img->legacy_flip.legacy = 0;
+  }
 
-    int version = 0;
-    if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.xmp_version"))) != xmpData.end())
-      version = pos->toLong();
+  if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.auto_presets_applied"))) != xmpData.end())
+  {
+    int32_t i = pos->toLong();
+    // set or clear bit in image struct
+    if(i == 1) img->flags |= DT_IMAGE_AUTO_PRESETS_APPLIED;
+    if(i == 0) img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
+    // in any case, this is no legacy image.
+    img->flags |= DT_IMAGE_NO_LEGACY_PRESETS;
+  }
+  else
+  {
+    // not found means 0 (old xmp)
+    img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
+    // so we are legacy (thus have to clear the no-legacy flag)
+    img->flags &= ~DT_IMAGE_NO_LEGACY_PRESETS;
+  }
+  // when we are reading the xmp data it doesn't make sense to flag the image as removed
+  img->flags &= ~DT_IMAGE_REMOVE;
 
-    if(!history_only)
-    {
-      // otherwise we ignore title, description, ... from non-dt xmp files :(
-      size_t ns_pos = image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"");
-      bool is_a_dt_xmp = (ns_pos != std::string::npos);
-      dt_exif_read_xmp_data(img, xmpData, is_a_dt_xmp ? version : -1, false);
-    }
 
+  // masks
+  // clean all old masks for this image
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.mask WHERE imgid = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 
-    // convert legacy flip bits (will not be written anymore, convert to flip history item here):
-    if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.raw_params"))) != xmpData.end())
-    {
-      int32_t i = pos->toLong();
-      dt_image_raw_parameters_t raw_params = *(dt_image_raw_parameters_t *)&i;
-      int32_t user_flip = raw_params.user_flip;
-      img->legacy_flip.user_flip = user_flip;
-      img->legacy_flip.legacy = 0;
-    }
+  // read the masks from the file first so we can add them to the db while reading history entries
+  GHashTable *mask_entries = read_masks(xmpData, filename);
 
-    if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.auto_presets_applied"))) != xmpData.end())
-    {
-      int32_t i = pos->toLong();
-      // set or clear bit in image struct
-      if(i == 1) img->flags |= DT_IMAGE_AUTO_PRESETS_APPLIED;
-      if(i == 0) img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
-      // in any case, this is no legacy image.
-      img->flags |= DT_IMAGE_NO_LEGACY_PRESETS;
-    }
-    else
-    {
-      // not found means 0 (old xmp)
-      img->flags &= ~DT_IMAGE_AUTO_PRESETS_APPLIED;
-      // so we are legacy (thus have to clear the no-legacy flag)
-      img->flags &= ~DT_IMAGE_NO_LEGACY_PRESETS;
-    }
-    // when we are reading the xmp data it doesn't make sense to flag the image as removed
-    img->flags &= ~DT_IMAGE_REMOVE;
+  // now add all masks that are not used for cloning. keeping them might be useful.
+  // TODO: make this configurable? or remove it altogether?
+  dt_database_start_transaction(darktable.db);
+  sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_masks", NULL, NULL, NULL);
+  g_hash_table_foreach(mask_entries, add_non_clone_mask_entries_to_db, &img->id);
+  sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_masks", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 
+  // history
+  int num = 0;
+  gboolean all_ok = TRUE;
+  GList *history_entries = NULL;
 
-    // masks
-    // clean all old masks for this image
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.mask WHERE imgid = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+  if(version < 2)
+  {
+    std::string &xmpPacket = image->xmpPacket();
+    history_entries = read_history_v1(xmpPacket, filename, 0);
+    if(!history_entries) // didn't work? try super old version with rdf:Bag
+      history_entries = read_history_v1(xmpPacket, filename, 1);
+  }
+  else if(version == 2)
+    history_entries = read_history_v2(xmpData, filename);
+  else
+  {
+    std::cerr << "error: Xmp schema version " << version << " in " << filename << " not supported" << std::endl;
+    g_hash_table_destroy(mask_entries);
+    return 1;
+  }
+
+  // the savepoint can be rolled back inside the transaction of a batch of imports, too
+  dt_database_start_transaction(darktable.db);
+  sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_history", NULL, NULL, NULL);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+  if(sqlite3_step(stmt) != SQLITE_DONE)
+  {
+    fprintf(stderr, "[exif] error deleting history for image %d\n", img->id);
+    fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
+    all_ok = FALSE;
+    goto end;
+  }
+
+  sqlite3_finalize(stmt);
 
-    // read the masks from the file first so we can add them to the db while reading history entries
-    GHashTable *mask_entries = read_masks(xmpData, filename);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.history (imgid, num, module, operation, op_params, enabled, "
+                              "blendop_params, blendop_version, multi_priority, multi_name) "
+                              "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &stmt, NULL);
 
-    // now add all masks that are not used for cloning. keeping them might be useful.
-    // TODO: make this configurable? or remove it altogether?
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
-    g_hash_table_foreach(mask_entries, add_non_clone_mask_entries_to_db, &img->id);
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  for(GList *iter = history_entries; iter; iter = g_list_next(iter))
+  {
+    history_entry_t *entry = (history_entry_t *)iter->data;
+//       print_history_entry(entry);
 
-    // history
-    int num = 0;
-    gboolean all_ok = TRUE;
-    GList *history_entries = NULL;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, entry->modversion);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, entry->operation, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 5, entry->params, entry->params_len, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 6, entry->enabled);
+    if(entry->blendop_params)
+    {
+      DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 7, entry->blendop_params, entry->blendop_params_len, SQLITE_TRANSIENT);
 
-    if(version < 2)
+      // check what mask entries belong to this iop and add them to the db
+      const dt_develop_blend_params_t *blendop_params = (dt_develop_blend_params_t *)entry->blendop_params;
+      add_mask_entries_to_db(img->id, mask_entries, blendop_params->mask_id);
+    }
+    else
     {
-      std::string &xmpPacket = image->xmpPacket();
-      history_entries = read_history_v1(xmpPacket, filename, 0);
-      if(!history_entries) // didn't work? try super old version with rdf:Bag
-        history_entries = read_history_v1(xmpPacket, filename, 1);
+      sqlite3_bind_null(stmt, 7);
+    }
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 8, entry->blendop_version);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, entry->multi_priority);
+    if(entry->multi_name)
+    {
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, entry->multi_name, -1, SQLITE_TRANSIENT);
     }
-    else if(version == 2)
-      history_entries = read_history_v2(xmpData, filename);
     else
     {
-      std::cerr << "error: Xmp schema version " << version << " in " << filename << " not supported" << std::endl;
-      g_hash_table_destroy(mask_entries);
-      return 1;
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, "", -1, SQLITE_TRANSIENT); // "" instead of " " should be fine now
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
     if(sqlite3_step(stmt) != SQLITE_DONE)
     {
-      fprintf(stderr, "[exif] error deleting history for image %d\n", img->id);
+      fprintf(stderr, "[exif] error adding history entry for image %d\n", img->id);
       fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
       all_ok = FALSE;
       goto end;
     }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
 
-    sqlite3_finalize(stmt);
+    num++;
+  }
+  sqlite3_finalize(stmt);
 
+  // we shouldn't change history_end when no history was read!
+  if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_end"))) != xmpData.end() && num > 0)
+  {
+    int history_end = MIN(pos->toLong(), num);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history (imgid, num, module, operation, op_params, enabled, "
-                                "blendop_params, blendop_version, multi_priority, multi_name) "
-                                "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &stmt, NULL);
-
-    for(GList *iter = history_entries; iter; iter = g_list_next(iter))
-    {
-      history_entry_t *entry = (history_entry_t *)iter->data;
-//       print_history_entry(entry);
-
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, entry->modversion);
-      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, entry->operation, -1, SQLITE_TRANSIENT);
-      DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 5, entry->params, entry->params_len, SQLITE_TRANSIENT);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 6, entry->enabled);
-      if(entry->blendop_params)
-      {
-        DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 7, entry->blendop_params, entry->blendop_params_len, SQLITE_TRANSIENT);
-
-        // check what mask entries belong to this iop and add them to the db
-        const dt_develop_blend_params_t *blendop_params = (dt_develop_blend_params_t *)entry->blendop_params;
-        add_mask_entries_to_db(img->id, mask_entries, blendop_params->mask_id);
-      }
-      else
-      {
-        sqlite3_bind_null(stmt, 7);
-      }
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 8, entry->blendop_version);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, entry->multi_priority);
-      if(entry->multi_name)
-      {
-        DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, entry->multi_name, -1, SQLITE_TRANSIENT);
-      }
-      else
-      {
-        DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, "", -1, SQLITE_TRANSIENT); // "" instead of " " should be fine now
-      }
-
-      if(sqlite3_step(stmt) != SQLITE_DONE)
-      {
-        fprintf(stderr, "[exif] error adding history entry for image %d\n", img->id);
-        fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
-        all_ok = FALSE;
-        goto end;
-      }
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
-
-      num++;
-    }
-    sqlite3_finalize(stmt);
-
-    // we shouldn't change history_end when no history was read!
-    if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_end"))) != xmpData.end() && num > 0)
+                                "UPDATE main.images SET history_end = ?1 WHERE id = ?2", -1,
+                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, history_end);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->id);
+    if(sqlite3_step(stmt) != SQLITE_DONE)
     {
-      int history_end = MIN(pos->toLong(), num);
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "UPDATE main.images SET history_end = ?1 WHERE id = ?2", -1,
-                                  &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, history_end);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->id);
-      if(sqlite3_step(stmt) != SQLITE_DONE)
-      {
-        fprintf(stderr, "[exif] error writing history_end for image %d\n", img->id);
-        fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
-        all_ok = FALSE;
-        goto end;
-      }
+      fprintf(stderr, "[exif] error writing history_end for image %d\n", img->id);
+      fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
+      all_ok = FALSE;
+      goto end;
     }
-    else
+  }
+  else
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "UPDATE main.images SET history_end = (SELECT IFNULL(MAX(num) + 1, 0) "
+                                "FROM main.history WHERE imgid = ?1) WHERE id = ?1", -1,
+                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+    if(sqlite3_step(stmt) != SQLITE_DONE)
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "UPDATE main.images SET history_end = (SELECT IFNULL(MAX(num) + 1, 0) "
-                                  "FROM main.history WHERE imgid = ?1) WHERE id = ?1", -1,
-                                  &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
-      if(sqlite3_step(stmt) != SQLITE_DONE)
-      {
-        fprintf(stderr, "[exif] error writing history_end for image %d\n", img->id);
-        fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
-        all_ok = FALSE;
-        goto end;
-      }
+      fprintf(stderr, "[exif] error writing history_end for image %d\n", img->id);
+      fprintf(stderr, "[exif]   %s\n", sqlite3_errmsg(dt_database_get(darktable.db)));
+      all_ok = FALSE;
+      goto end;
     }
+  }
 
 end:
-    sqlite3_finalize(stmt);
+  sqlite3_finalize(stmt);
 
-    g_list_free_full(history_entries, free_history_entry);
-    g_hash_table_destroy(mask_entries);
+  g_list_free_full(history_entries, free_history_entry);
+  g_hash_table_destroy(mask_entries);
 
-    if(all_ok)
-    {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
-    }
-    else
-    {
-      std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
-      return 1;
-    }
+  if(all_ok)
+  {
+    sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
+  }
+  else
+  {
+    std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
+    sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TO xmp_history", NULL, NULL, NULL);
+    sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
+    return 1;
+  }
+  return 0;
+}
 
+// need a write lock on *img (non-const) to write stars (and soon color labels).
+int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+{
+  // exclude pfm to avoid stupid errors on the console
+  const char *c = filename + strlen(filename) - 4;
+  if(c >= filename && !strcmp(c, ".pfm")) return 1;
+  try
+  {
+    // read xmp sidecar
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
+    assert(image.get() != 0);
+    read_metadata_threadsafe(image);
+    return _exif_xmp_read_image(img, image.get(), filename, history_only);
   }
   catch(Exiv2::AnyError &e)
   {
@@ -2326,7 +2415,19 @@ end:
     // std::cerr << "[exiv2] " << filename << ": " << s << std::endl;
     return 1;
   }
-  return 0;
+}
+
+int dt_exif_xmp_read_file(dt_image_t *img, const char *filename, dt_exif_file_t *file, const int history_only)
+{
+  if(!file) return 1;
+  try
+  {
+    return _exif_xmp_read_image(img, file->image.get(), filename, history_only);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    return 1;
+  }
 }
 
 // helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
@@ -2338,10 +2439,9 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   gchar *filename = NULL;
   // get stars and raw params from db
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT filename, flags, raw_parameters, "
-                                                             "longitude, latitude, altitude, history_end "
-                                                             "FROM main.images WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT filename, flags, raw_parameters, "
+                                                "longitude, latitude, altitude, history_end "
+                                                "FROM main.images WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -2400,11 +2500,10 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
     xmpData["Xmp.exif.GPSAltitude"] = ele_str;
     g_free(ele_str);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   // the meta data
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT key, value FROM main.meta_data WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT key, value FROM main.meta_data WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -2428,7 +2527,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
         break;
     }
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   xmpData["Xmp.darktable.xmp_version"] = xmp_version;
   xmpData["Xmp.darktable.raw_params"] = raw_params;
@@ -2466,15 +2565,14 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   std::unique_ptr<Exiv2::Value> v(Exiv2::Value::create(Exiv2::xmpSeq)); // or xmpBag or xmpAlt.
 
   /* Already initialized v = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT color FROM main.color_labels WHERE imgid=?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT color FROM main.color_labels WHERE imgid=?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
     snprintf(val, sizeof(val), "%d", sqlite3_column_int(stmt, 0));
     v->read(val);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   if(v->count() > 0) xmpData.add(Exiv2::XmpKey("Xmp.darktable.colorlabels"), v.get());
 
   // masks:
@@ -2495,10 +2593,10 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   // reset tv
   tvm.setXmpArrayType(Exiv2::XmpValue::xaNone);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "SELECT imgid, formid, form, name, version, points, points_count, source FROM main.mask WHERE imgid = ?1",
-      -1, &stmt, NULL);
+      &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -2547,7 +2645,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
 
     num++;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
 
   // history stack:
@@ -2558,11 +2656,10 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   tv.setXmpArrayType(Exiv2::XmpValue::xaSeq);
   xmpData.add(Exiv2::XmpKey("Xmp.darktable.history"), &tv);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "SELECT module, operation, op_params, enabled, blendop_params, "
-      "blendop_version, multi_priority, multi_name FROM main.history WHERE imgid = ?1 ORDER BY num",
-      -1, &stmt, NULL);
+      "blendop_version, multi_priority, multi_name FROM main.history WHERE imgid = ?1 ORDER BY num", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -2614,7 +2711,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   else history_end = MIN(history_end, num - 1); // safeguard for some old buggy libraries
   xmpData["Xmp.darktable.history_end"] = history_end;
 
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   g_list_free_full(tags, g_free);
   g_list_free_full(hierarchical, g_free);
 }
@@ -2944,7 +3041,8 @@ void dt_exif_init()
   // preface the exiv2 messages with "[exiv2] "
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
-  Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&_exif_xmp_mutex, NULL);
+  Exiv2::XmpParser::initialize(_exif_xmp_lock, &_exif_xmp_mutex);
   // this has to stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   Exiv2::XmpProperties::registerNs("http://ns.adobe.com/lightroom/1.0/", "lr");
@@ -2954,6 +3052,7 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+  dt_pthread_mutex_destroy(&_exif_xmp_mutex);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
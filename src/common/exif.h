@@ -30,6 +30,19 @@ extern "C" {
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
 
+/** metadata of one file, read by exiv2 but not yet stored anywhere. */
+typedef struct dt_exif_file_t dt_exif_file_t;
+
+/** read the metadata of the file with full path name, without touching the image or the database. can be
+ * called for many files in parallel. returns NULL on failure. */
+dt_exif_file_t *dt_exif_file_read(const char *path);
+
+/** free metadata read by dt_exif_file_read(). */
+void dt_exif_file_free(dt_exif_file_t *file);
+
+/** dt_exif_read() with the metadata read in advance from path. file may be NULL if that failed. */
+int dt_exif_read_file(dt_image_t *img, const char *path, dt_exif_file_t *file);
+
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
@@ -53,6 +66,9 @@ char *dt_exif_xmp_read_string(const int imgid);
 /** read xmp sidecar file. */
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only);
 
+/** dt_exif_xmp_read() with the sidecar read in advance. file may be NULL if that failed. */
+int dt_exif_xmp_read_file(dt_image_t *img, const char *filename, dt_exif_file_t *file, const int history_only);
+
 /** fetch largest exif thumbnail jpg bytestream into buffer*/
 int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char **mime_type);
 
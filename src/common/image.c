@@ -167,15 +167,14 @@ const char *dt_image_film_roll_name(const char *path)
 void dt_image_film_roll_directory(const dt_image_t *img, char *pathname, size_t pathname_len)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT folder FROM main.film_rolls WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT folder FROM main.film_rolls WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->film_id);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     char *f = (char *)sqlite3_column_text(stmt, 0);
     snprintf(pathname, pathname_len, "%s", f);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   pathname[pathname_len - 1] = '\0';
 }
 
@@ -183,8 +182,7 @@ void dt_image_film_roll_directory(const dt_image_t *img, char *pathname, size_t
 void dt_image_film_roll(const dt_image_t *img, char *pathname, size_t pathname_len)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT folder FROM main.film_rolls WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT folder FROM main.film_rolls WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->film_id);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -196,7 +194,7 @@ void dt_image_film_roll(const dt_image_t *img, char *pathname, size_t pathname_l
   {
     snprintf(pathname, pathname_len, "%s", _("orphaned image"));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   pathname[pathname_len - 1] = '\0';
 }
 
@@ -226,16 +224,15 @@ gboolean dt_image_safe_remove(const int32_t imgid)
 void dt_image_full_path(const int imgid, char *pathname, size_t pathname_len, gboolean *from_cache)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT folder || '" G_DIR_SEPARATOR_S "' || filename FROM main.images i, main.film_rolls f WHERE "
-                              "i.film_id = f.id and i.id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT folder || '" G_DIR_SEPARATOR_S "' || filename FROM main.images i, main.film_rolls f WHERE "
+                                  "i.film_id = f.id and i.id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     g_strlcpy(pathname, (char *)sqlite3_column_text(stmt, 0), pathname_len);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if(*from_cache)
   {
@@ -254,10 +251,9 @@ static void _image_local_copy_full_path(const int imgid, char *pathname, size_t
   sqlite3_stmt *stmt;
 
   *pathname = '\0';
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT folder || '" G_DIR_SEPARATOR_S "' || filename FROM main.images i, main.film_rolls f "
-                              "WHERE i.film_id = f.id AND i.id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT folder || '" G_DIR_SEPARATOR_S "' || filename FROM main.images i, main.film_rolls f "
+                                  "WHERE i.film_id = f.id AND i.id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -284,7 +280,7 @@ static void _image_local_copy_full_path(const int imgid, char *pathname, size_t
 
     g_free(md5_filename);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_image_path_append_version_no_db(int version, char *pathname, size_t pathname_len)
@@ -311,12 +307,11 @@ void dt_image_path_append_version(int imgid, char *pathname, size_t pathname_len
   // get duplicate suffix
   int version = 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT version FROM main.images WHERE id = ?1", -1,
-                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT version FROM main.images WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
 
   if(sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   dt_image_path_append_version_no_db(version, pathname, pathname_len);
 }
@@ -466,10 +461,9 @@ dt_image_orientation_t dt_image_get_orientation(const int imgid)
   if(flip && flip->get_p)
   {
     sqlite3_stmt *stmt;
-    DT_DEBUG_SQLITE3_PREPARE_V2(
-        dt_database_get(darktable.db),
-        "SELECT op_params FROM main.history WHERE imgid=?1 AND operation='flip' ORDER BY num DESC LIMIT 1", -1,
-        &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(
+        darktable.db,
+        "SELECT op_params FROM main.history WHERE imgid=?1 AND operation='flip' ORDER BY num DESC LIMIT 1", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     if(sqlite3_step(stmt) == SQLITE_ROW)
     {
@@ -477,7 +471,7 @@ dt_image_orientation_t dt_image_get_orientation(const int imgid)
       const void *params = sqlite3_column_blob(stmt, 0);
       orientation = *((dt_image_orientation_t *)flip->get_p(params, "orientation"));
     }
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 
   if(orientation == ORIENTATION_NULL)
@@ -753,8 +747,7 @@ int dt_image_altered(const uint32_t imgid)
   int altered = 0;
   sqlite3_stmt *stmt;
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT operation FROM main.history WHERE imgid = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT operation FROM main.history WHERE imgid = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -771,7 +764,7 @@ int dt_image_altered(const uint32_t imgid)
     altered = 1;
     break;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   return altered;
 }
@@ -876,13 +869,14 @@ void dt_image_read_duplicates(const uint32_t id, const char *filename)
 }
 
 
-static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs, gboolean lua_locking)
+void dt_image_import_file_read(dt_image_import_file_t *file, const char *filename, gboolean override_ignore_jpegs)
 {
+  memset(file, 0, sizeof(*file));
   char *normalized_filename = dt_util_normalize_path(filename);
   if(!normalized_filename || !g_file_test(normalized_filename, G_FILE_TEST_IS_REGULAR) || dt_util_get_file_size(normalized_filename) == 0)
   {
     g_free(normalized_filename);
-    return 0;
+    return;
   }
   const char *cc = normalized_filename + strlen(normalized_filename);
   for(; *cc != '.' && cc > normalized_filename; cc--)
@@ -890,7 +884,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   if(!strcasecmp(cc, ".dt") || !strcasecmp(cc, ".dttags") || !strcasecmp(cc, ".xmp"))
   {
     g_free(normalized_filename);
-    return 0;
+    return;
   }
   char *ext = g_ascii_strdown(cc + 1, -1);
   if(override_ignore_jpegs == FALSE && (!strcmp(ext, "jpg") || !strcmp(ext, "jpeg"))
@@ -898,7 +892,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   {
     g_free(normalized_filename);
     g_free(ext);
-    return 0;
+    return;
   }
   int supported = 0;
   for(const char **i = dt_supported_extensions; *i != NULL; i++)
@@ -911,33 +905,124 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   {
     g_free(normalized_filename);
     g_free(ext);
-    return 0;
+    return;
+  }
+  file->filename = normalized_filename;
+  file->ext = ext;
+
+  // set the bits in flags that indicate if any of the extra files (.txt, .wav) are present
+  char *extra_file = dt_image_get_audio_path_from_path(normalized_filename);
+  if(extra_file)
+  {
+    file->flags |= DT_IMAGE_HAS_WAV;
+    g_free(extra_file);
+  }
+  extra_file = dt_image_get_text_path_from_path(normalized_filename);
+  if(extra_file)
+  {
+    file->flags |= DT_IMAGE_HAS_TXT;
+    g_free(extra_file);
+  }
+
+  // read dttags and exif for database queries!
+  file->exif = dt_exif_file_read(normalized_filename);
+  char dtfilename[PATH_MAX] = { 0 };
+  g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
+  g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
+  if(g_file_test(dtfilename, G_FILE_TEST_IS_REGULAR)) file->xmp = dt_exif_file_read(dtfilename);
+}
+
+void dt_image_import_file_cleanup(dt_image_import_file_t *file)
+{
+  if(file->exif) dt_exif_file_free(file->exif);
+  if(file->xmp) dt_exif_file_free(file->xmp);
+  g_free(file->filename);
+  g_free(file->ext);
+  memset(file, 0, sizeof(*file));
+}
+
+// the statements of a batch are prepared on first use and reset for every later one
+static sqlite3_stmt *_image_import_stmt(sqlite3_stmt **stmt, const char *query)
+{
+  if(*stmt)
+  {
+    sqlite3_reset(*stmt);
+    sqlite3_clear_bindings(*stmt);
   }
+  else
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, query, stmt);
+  return *stmt;
+}
+
+static void _image_import_batch_reset(dt_image_import_batch_t *batch)
+{
+  for(int k = 0; k < DT_IMAGE_IMPORT_STMT_COUNT; k++)
+    if(batch->stmt[k]) sqlite3_reset(batch->stmt[k]);
+}
+
+static void _image_import_batch_finalize(dt_image_import_batch_t *batch)
+{
+  // back to the cache, single imports don't have to prepare everything again
+  for(int k = 0; k < DT_IMAGE_IMPORT_STMT_COUNT; k++)
+  {
+    dt_database_release_cached(darktable.db, batch->stmt[k]);
+    batch->stmt[k] = NULL;
+  }
+}
+
+static void _image_import_lua_event(uint32_t id, const gboolean lua_locking)
+{
+#ifdef USE_LUA
+  //Synchronous calling of lua post-import-image events
+  if(lua_locking)
+    dt_lua_lock();
+
+  lua_State *L = darktable.lua_state.state;
+
+  luaA_push(L, dt_lua_image_t, &id);
+  dt_lua_event_trigger(L, "post-import-image", 1);
+
+  if(lua_locking)
+    dt_lua_unlock();
+#endif
+}
+
+/** an image between the database rows written by _image_import_insert() and the rest of the import. */
+typedef struct dt_image_import_pending_t
+{
+  dt_image_import_file_t file;
+  uint32_t id;
+  int group_id;
+  gboolean existing;     // the file was imported before
+  gboolean group_rep;    // the image took over its group from a jpg
+} dt_image_import_pending_t;
+
+// only the database rows: this runs inside the transaction of a batch, so it must not wait for any image
+// cache lock. a thread holding one of those might be waiting for the transaction itself.
+static uint32_t _image_import_insert(dt_image_import_batch_t *batch, const int32_t film_id,
+                                     dt_image_import_pending_t *imp)
+{
+  const char *normalized_filename = imp->file.filename;
+  const char *ext = imp->file.ext;
   int rc;
   uint32_t id = 0;
   // select from images; if found => return
   gchar *imgfname;
   imgfname = g_path_get_basename(normalized_filename);
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2", -1, &stmt, NULL);
+  sqlite3_stmt *stmt = _image_import_stmt(&batch->stmt[DT_IMAGE_IMPORT_STMT_FIND],
+                                          "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, -1, SQLITE_STATIC);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     id = sqlite3_column_int(stmt, 0);
     g_free(imgfname);
-    sqlite3_finalize(stmt);
-    dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
-    img->flags &= ~DT_IMAGE_REMOVE;
-    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
-    dt_image_read_duplicates(id, normalized_filename);
-    dt_image_synch_all_xmp(normalized_filename);
-    g_free(ext);
-    g_free(normalized_filename);
+    sqlite3_reset(stmt);
+    imp->id = id;
+    imp->existing = TRUE;
     return id;
   }
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
 
   // also need to set the no-legacy bit, to make sure we get the right presets (new ones)
   uint32_t flags = dt_conf_get_int("ui_last/import_initial_rating");
@@ -947,19 +1032,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
     dt_conf_set_int("ui_last/import_initial_rating", 1);
   }
   flags |= DT_IMAGE_NO_LEGACY_PRESETS;
-  // set the bits in flags that indicate if any of the extra files (.txt, .wav) are present
-  char *extra_file = dt_image_get_audio_path_from_path(normalized_filename);
-  if(extra_file)
-  {
-    flags |= DT_IMAGE_HAS_WAV;
-    g_free(extra_file);
-  }
-  extra_file = dt_image_get_text_path_from_path(normalized_filename);
-  if(extra_file)
-  {
-    flags |= DT_IMAGE_HAS_TXT;
-    g_free(extra_file);
-  }
+  flags |= imp->file.flags;
 
   // insert dummy image entry in database
 
@@ -975,13 +1048,12 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
    * next image position
    * 0000 0003 0000 0000
    */
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  stmt = _image_import_stmt(
+      &batch->stmt[DT_IMAGE_IMPORT_STMT_INSERT],
       "INSERT INTO main.images (id, film_id, filename, caption, description, license, sha1sum, flags, version, "
       "max_version, history_end, position) "
       "SELECT NULL, ?1, ?2, '', '', '', '', ?3, 0, 0, 0, (IFNULL(MAX(position),0) & (4294967295 << 32))  + (1 << 32) "
-      "FROM images",
-      -1, &stmt, NULL);
+      "FROM images");
 
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, -1, SQLITE_TRANSIENT);
@@ -989,14 +1061,14 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
 
   rc = sqlite3_step(stmt);
   if(rc != SQLITE_DONE) fprintf(stderr, "sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2", -1, &stmt, NULL);
+  stmt = _image_import_stmt(&batch->stmt[DT_IMAGE_IMPORT_STMT_FIND],
+                            "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, -1, SQLITE_STATIC);
   if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
 
   // Try to find out if this should be grouped already.
   gchar *basename = g_strdup(imgfname);
@@ -1009,64 +1081,51 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   // in case we are not a jpg check if we need to change group representative
   if(strcmp(ext, "jpg") != 0 && strcmp(ext, "jpeg") != 0)
   {
-    sqlite3_stmt *stmt2;
-    DT_DEBUG_SQLITE3_PREPARE_V2(
-        dt_database_get(darktable.db),
-        "SELECT group_id FROM main.images WHERE film_id = ?1 AND filename LIKE ?2 AND id = group_id", -1, &stmt2,
-        NULL);
+    sqlite3_stmt *stmt2 = _image_import_stmt(
+        &batch->stmt[DT_IMAGE_IMPORT_STMT_GROUP],
+        "SELECT group_id, filename FROM main.images WHERE film_id = ?1 AND filename LIKE ?2 AND id = group_id");
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, film_id);
     DT_DEBUG_SQLITE3_BIND_TEXT(stmt2, 2, sql_pattern, -1, SQLITE_TRANSIENT);
     // if we have a group already
     if(sqlite3_step(stmt2) == SQLITE_ROW)
     {
-      int other_id = sqlite3_column_int(stmt2, 0);
-      dt_image_t *other_img = dt_image_cache_get(darktable.image_cache, other_id, 'w');
-      gchar *other_basename = g_strdup(other_img->filename);
-      gchar *cc3 = other_basename + strlen(other_img->filename);
-      for(; *cc3 != '.' && cc3 > other_basename; cc3--)
+      const int other_id = sqlite3_column_int(stmt2, 0);
+      const char *other_filename = (const char *)sqlite3_column_text(stmt2, 1);
+      const char *cc3 = other_filename + strlen(other_filename);
+      for(; *cc3 != '.' && cc3 > other_filename; cc3--)
         ;
       ++cc3;
       gchar *ext_lowercase = g_ascii_strdown(cc3, -1);
-      // if the group representative is a jpg, change group representative to this new imported image
+      // if the group representative is a jpg, change group representative to this new imported image.
+      // the cached image structs of the group follow in _image_import_finish().
       if(!strcmp(ext_lowercase, "jpg") || !strcmp(ext_lowercase, "jpeg"))
       {
-        other_img->group_id = id;
-        dt_image_cache_write_release(darktable.image_cache, other_img, DT_IMAGE_CACHE_SAFE);
         sqlite3_stmt *stmt3;
         DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "SELECT id FROM main.images WHERE group_id = ?1 AND id != ?1", -1, &stmt3,
+                                    "UPDATE main.images SET group_id = ?1 WHERE group_id = ?2", -1, &stmt3,
                                     NULL);
-        DT_DEBUG_SQLITE3_BIND_INT(stmt3, 1, other_id);
-        while(sqlite3_step(stmt3) == SQLITE_ROW)
-        {
-          other_id = sqlite3_column_int(stmt3, 0);
-          dt_image_t *group_img = dt_image_cache_get(darktable.image_cache, other_id, 'w');
-          group_img->group_id = id;
-          dt_image_cache_write_release(darktable.image_cache, group_img, DT_IMAGE_CACHE_SAFE);
-        }
-        group_id = id;
+        DT_DEBUG_SQLITE3_BIND_INT(stmt3, 1, id);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt3, 2, other_id);
+        sqlite3_step(stmt3);
         sqlite3_finalize(stmt3);
+        group_id = id;
+        imp->group_rep = TRUE;
       }
       else
-      {
-        dt_image_cache_write_release(darktable.image_cache, other_img, DT_IMAGE_CACHE_RELAXED);
         group_id = other_id;
-      }
       g_free(ext_lowercase);
-      g_free(other_basename);
     }
     else
     {
       group_id = id;
     }
-    sqlite3_finalize(stmt2);
+    sqlite3_reset(stmt2);
   }
   else
   {
-    sqlite3_stmt *stmt2;
-    DT_DEBUG_SQLITE3_PREPARE_V2(
-        dt_database_get(darktable.db),
-        "SELECT group_id FROM main.images WHERE film_id = ?1 AND filename LIKE ?2 AND id != ?3", -1, &stmt2, NULL);
+    sqlite3_stmt *stmt2 = _image_import_stmt(
+        &batch->stmt[DT_IMAGE_IMPORT_STMT_GROUP_JPG],
+        "SELECT group_id FROM main.images WHERE film_id = ?1 AND filename LIKE ?2 AND id != ?3");
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, film_id);
     DT_DEBUG_SQLITE3_BIND_TEXT(stmt2, 2, sql_pattern, -1, SQLITE_TRANSIENT);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 3, id);
@@ -1074,29 +1133,71 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
       group_id = sqlite3_column_int(stmt2, 0);
     else
       group_id = id;
-    sqlite3_finalize(stmt2);
+    sqlite3_reset(stmt2);
   }
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "UPDATE main.images SET group_id = ?1 WHERE id = ?2",
-                              -1, &stmt, NULL);
+  stmt = _image_import_stmt(&batch->stmt[DT_IMAGE_IMPORT_STMT_SET_GROUP],
+                            "UPDATE main.images SET group_id = ?1 WHERE id = ?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, group_id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, id);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
 
   // printf("[image_import] importing `%s' to img id %d\n", imgfname, id);
 
+  g_free(imgfname);
+  g_free(basename);
+  g_free(sql_pattern);
+
+  imp->id = id;
+  imp->group_id = group_id;
+  return id;
+}
+
+// everything that needs the image cache, outside of any batch's transaction
+static void _image_import_finish(dt_image_import_pending_t *imp, gboolean lua_locking)
+{
+  const char *normalized_filename = imp->file.filename;
+  const uint32_t id = imp->id;
+
+  if(imp->existing)
+  {
+    dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
+    img->flags &= ~DT_IMAGE_REMOVE;
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_image_read_duplicates(id, normalized_filename);
+    dt_image_synch_all_xmp(normalized_filename);
+    return;
+  }
+
+  if(imp->group_rep)
+  {
+    // the database already has the new group, bring the cached images of the old one along
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT id FROM main.images WHERE group_id = ?1 AND id != ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const int other_id = sqlite3_column_int(stmt, 0);
+      dt_image_t *group_img = dt_image_cache_get(darktable.image_cache, other_id, 'w');
+      group_img->group_id = id;
+      dt_image_cache_write_release(darktable.image_cache, group_img, DT_IMAGE_CACHE_SAFE);
+    }
+    sqlite3_finalize(stmt);
+  }
+
   // lock as shortly as possible:
   dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
-  img->group_id = group_id;
+  img->group_id = imp->group_id;
 
   // read dttags and exif for database queries!
-  (void)dt_exif_read(img, normalized_filename);
+  (void)dt_exif_read_file(img, normalized_filename, imp->file.exif);
   char dtfilename[PATH_MAX] = { 0 };
   g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
   // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
   g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-  int res = dt_exif_xmp_read(img, dtfilename, 0);
+  int res = dt_exif_xmp_read_file(img, dtfilename, imp->file.xmp, 0);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -1110,8 +1211,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   // add a tag with the file extension
   guint tagid = 0;
   char tagname[512];
-  snprintf(tagname, sizeof(tagname), "darktable|format|%s", ext);
-  g_free(ext);
+  snprintf(tagname, sizeof(tagname), "darktable|format|%s", imp->file.ext);
   dt_tag_new(tagname, &tagid);
   dt_tag_attach(tagid, id);
 
@@ -1122,33 +1222,85 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   dt_image_read_duplicates(id, normalized_filename);
   dt_image_synch_all_xmp(normalized_filename);
 
-  g_free(imgfname);
-  g_free(basename);
-  g_free(sql_pattern);
-  g_free(normalized_filename);
-
-#ifdef USE_LUA
-  //Synchronous calling of lua post-import-image events
-  if(lua_locking)
-    dt_lua_lock();
-
-  lua_State *L = darktable.lua_state.state;
-
-  luaA_push(L, dt_lua_image_t, &id);
-  dt_lua_event_trigger(L, "post-import-image", 1);
-
-  if(lua_locking)
-    dt_lua_unlock();
-#endif
+  _image_import_lua_event(id, lua_locking);
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
   // the following line would look logical with new_tags_set being the return value
   // from dt_tag_new above, but this could lead to too rapid signals, being able to lock up the
   // keywords side pane when trying to use it, which can lock up the whole dt GUI ..
   // if (new_tags_set) dt_control_signal_raise(darktable.signals,DT_SIGNAL_TAG_CHANGED);
+}
+
+static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs, gboolean lua_locking)
+{
+  dt_image_import_pending_t imp = { { 0 } };
+  dt_image_import_file_read(&imp.file, filename, override_ignore_jpegs);
+  if(!imp.file.filename) return 0;
+  dt_image_import_batch_t batch = { { NULL } };
+  const uint32_t id = _image_import_insert(&batch, film_id, &imp);
+  _image_import_batch_finalize(&batch);
+  _image_import_finish(&imp, lua_locking);
+  dt_image_import_file_cleanup(&imp.file);
+  return id;
+}
+
+void dt_image_import_batch_begin(dt_image_import_batch_t *batch)
+{
+  memset(batch, 0, sizeof(*batch));
+}
+
+uint32_t dt_image_import_batch_add(dt_image_import_batch_t *batch, const int32_t film_id,
+                                   dt_image_import_file_t *file)
+{
+  if(!file->filename)
+  {
+    dt_image_import_file_cleanup(file);
+    return 0;
+  }
+  // the transaction holds the database-wide lock, so it is opened only right before the writes
+  if(batch->pending == 0)
+  {
+    dt_database_start_transaction(darktable.db);
+    batch->started = dt_get_wtime();
+  }
+  dt_image_import_pending_t *imp = g_malloc0(sizeof(dt_image_import_pending_t));
+  imp->file = *file;
+  memset(file, 0, sizeof(*file));
+  const uint32_t id = _image_import_insert(batch, film_id, imp);
+  batch->imported = g_list_prepend(batch->imported, imp);
+  if(++batch->pending >= DT_IMAGE_IMPORT_BATCH_SIZE
+     || dt_get_wtime() - batch->started > DT_IMAGE_IMPORT_BATCH_TIME)
+    dt_image_import_batch_commit(batch);
   return id;
 }
 
+void dt_image_import_batch_commit(dt_image_import_batch_t *batch)
+{
+  if(batch->pending == 0) return;
+  _image_import_batch_reset(batch);
+  dt_database_release_transaction(darktable.db);
+  batch->pending = 0;
+  batch->started = 0.0;
+
+  // the image cache locks are only taken now that the transaction is gone
+  batch->imported = g_list_reverse(batch->imported);
+  for(GList *l = batch->imported; l; l = g_list_next(l))
+  {
+    dt_image_import_pending_t *imp = (dt_image_import_pending_t *)l->data;
+    _image_import_finish(imp, TRUE);
+    dt_image_import_file_cleanup(&imp->file);
+    g_free(imp);
+  }
+  g_list_free(batch->imported);
+  batch->imported = NULL;
+}
+
+void dt_image_import_batch_end(dt_image_import_batch_t *batch)
+{
+  dt_image_import_batch_commit(batch);
+  _image_import_batch_finalize(batch);
+}
+
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
 {
   return dt_image_import_internal(film_id, filename, override_ignore_jpegs, TRUE);
@@ -214,6 +214,53 @@ void dt_image_path_append_version(int imgid, char *pathname, size_t pathname_len
 void dt_image_print_exif(const dt_image_t *img, char *line, size_t line_len);
 /** look for duplicate's xmp files and read them. */
 void dt_image_read_duplicates(uint32_t id, const char *filename);
+/** a file to be imported, with everything that can be found out without the database: whether it's
+ * importable at all, its extra files and its exif and xmp sidecar data. */
+typedef struct dt_image_import_file_t
+{
+  char *filename;                     // normalized full path, NULL if the file won't be imported
+  char *ext;                          // lower case extension
+  uint32_t flags;                     // DT_IMAGE_HAS_WAV and DT_IMAGE_HAS_TXT
+  struct dt_exif_file_t *exif, *xmp;  // NULL if there's none or exiv2 failed
+} dt_image_import_file_t;
+
+typedef enum dt_image_import_stmt_t
+{
+  DT_IMAGE_IMPORT_STMT_FIND = 0,
+  DT_IMAGE_IMPORT_STMT_INSERT,
+  DT_IMAGE_IMPORT_STMT_GROUP,
+  DT_IMAGE_IMPORT_STMT_GROUP_JPG,
+  DT_IMAGE_IMPORT_STMT_SET_GROUP,
+  DT_IMAGE_IMPORT_STMT_COUNT
+} dt_image_import_stmt_t;
+
+// imports per transaction, and the longest a transaction stays open (in seconds) while others wait for theirs
+#define DT_IMAGE_IMPORT_BATCH_SIZE 256
+#define DT_IMAGE_IMPORT_BATCH_TIME 0.1
+
+/** a series of imports that share their prepared statements and are committed to the database in batches. */
+typedef struct dt_image_import_batch_t
+{
+  sqlite3_stmt *stmt[DT_IMAGE_IMPORT_STMT_COUNT];
+  int pending;      // imports in the open transaction
+  double started;   // when the open transaction began
+  GList *imported;  // images waiting for the commit, the image cache parts of their import happen after it
+} dt_image_import_batch_t;
+
+/** checks filename and reads its metadata for dt_image_import_batch_add(). doesn't touch the database or the
+ * caches, so it can be called for many files in parallel. */
+void dt_image_import_file_read(dt_image_import_file_t *file, const char *filename, gboolean override_ignore_jpegs);
+void dt_image_import_file_cleanup(dt_image_import_file_t *file);
+/** starts a batch of imports. */
+void dt_image_import_batch_begin(dt_image_import_batch_t *batch);
+/** imports a file read by dt_image_import_file_read() like dt_image_import(). takes over the file's data. the
+ * database rows are written in a transaction that is kept open for a few more imports, the rest of the import
+ * (which needs the image cache) follows when the batch is committed. */
+uint32_t dt_image_import_batch_add(dt_image_import_batch_t *batch, int32_t film_id, dt_image_import_file_t *file);
+/** commits the imports so far, for example before waiting for something else. */
+void dt_image_import_batch_commit(dt_image_import_batch_t *batch);
+/** commits the rest of the batch. */
+void dt_image_import_batch_end(dt_image_import_batch_t *batch);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from threads other than lua.*/
 uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from lua thread.*/
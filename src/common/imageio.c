@@ -70,7 +70,8 @@
 
 // load a full-res thumbnail:
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
-                               dt_colorspaces_color_profile_type_t *color_space)
+                               dt_colorspaces_color_profile_type_t *color_space, const int32_t max_width,
+                               const int32_t max_height)
 {
   int res = 1;
 
@@ -86,6 +87,13 @@ int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *
     // Decompress the JPG into our own memory format
     dt_imageio_jpeg_t jpg;
     if(dt_imageio_jpeg_decompress_header(buf, bufsize, &jpg)) goto error;
+    if(max_width > 0 && max_height > 0)
+    {
+      // the caller fits the result into the box, maybe rotated. don't decode smaller than that needs.
+      const float scale = MAX(MIN((float)max_width / jpg.width, (float)max_height / jpg.height),
+                              MIN((float)max_width / jpg.height, (float)max_height / jpg.width));
+      if(scale < 1.0f) dt_imageio_jpeg_set_scale(&jpg, ceilf(jpg.width * scale), ceilf(jpg.height * scale));
+    }
     *buffer = (uint8_t *)malloc((size_t)sizeof(uint8_t) * jpg.width * jpg.height * 4);
     if(!*buffer) goto error;
 
@@ -577,6 +585,104 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
                                         storage_params, num, total);
 }
 
+// downconversion of the pipe output to low-precision formats, in place. the pipe delivers 8-bit already
+// for 8 bpp, unless high quality processing was requested.
+static void _export_convert_pixels(uint8_t *const outbuf, const size_t npixels, const int bpp,
+                                   const int32_t display_byteorder, const gboolean high_quality_processing)
+{
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+        // just flip byte order
+        for(size_t k = 0; k < npixels; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place
+      for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
+    }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// bytes per pixel of the converted output
+static size_t _export_pixel_size(const int bpp)
+{
+  return bpp == 8 ? 4 * sizeof(uint8_t) : bpp == 16 ? 4 * sizeof(uint16_t) : 4 * sizeof(float);
+}
+
+typedef struct _export_strips_t
+{
+  uint8_t *outbuf;
+  int width;
+  int bpp;
+  int32_t display_byteorder;
+  gboolean high_quality_processing;
+} _export_strips_t;
+
+// converts a finished strip in the pipe's back buffer and moves it to its place in the output
+static void _export_strip_done(dt_dev_pixelpipe_t *pipe, int y, int height, void *user_data)
+{
+  const _export_strips_t *const strips = (_export_strips_t *)user_data;
+  const size_t npixels = (size_t)strips->width * height;
+  const size_t pixel_size = _export_pixel_size(strips->bpp);
+  _export_convert_pixels(pipe->backbuf, npixels, strips->bpp, strips->display_byteorder,
+                         strips->high_quality_processing);
+  memcpy(strips->outbuf + pixel_size * strips->width * y, pipe->backbuf, pixel_size * npixels);
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
@@ -618,9 +724,14 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   dt_times_t start;
   dt_get_times(&start);
+  // large exports can be processed in horizontal strips, so that the pipe never holds the whole image
+  const int strip_height = thumbnail_export ? 0 : MAX(dt_conf_get_int("plugins/lighttable/export/strip_height"), 0);
+  uint8_t *strips_buf = NULL;
+
   dt_dev_pixelpipe_t pipe;
   res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+                         : dt_dev_pixelpipe_init_export(&pipe, wd, strip_height ? MIN(ht, strip_height) : ht,
+                                                        format->levels(format_params));
   if(!res)
   {
     dt_control_log(
@@ -776,6 +887,22 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   const int bpp = format->bpp(format_params);
 
+  const gboolean use_strips = strip_height > 0 && processed_height > strip_height;
+  _export_strips_t strips = { NULL, processed_width, bpp, display_byteorder, high_quality_processing };
+  if(use_strips)
+  {
+    // the format modules still want the whole image, but only in its final, smaller pixel format
+    strips_buf = dt_alloc_align(64, _export_pixel_size(bpp) * processed_width * processed_height);
+    if(!strips_buf)
+    {
+      dt_control_log(
+          _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+          C_("noun", "export"));
+      goto error;
+    }
+    strips.outbuf = strips_buf;
+  }
+
   dt_get_times(&start);
   if(high_quality_processing)
   {
@@ -783,7 +910,14 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
      * if high quality processing was requested, downsampling will be done
      * at the very end of the pipe (just before border and watermark)
      */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    if(use_strips)
+    {
+      if(dt_dev_pixelpipe_process_strips(&pipe, &dev, processed_width, processed_height, scale, strip_height, 1,
+                                         _export_strip_done, &strips))
+        goto strips_error;
+    }
+    else
+      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
   }
   else
   {
@@ -810,7 +944,13 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     if(finalscale) finalscale->enabled = 0;
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
+    if(use_strips)
+    {
+      if(dt_dev_pixelpipe_process_strips(&pipe, &dev, processed_width, processed_height, scale, strip_height,
+                                         bpp != 8, _export_strip_done, &strips))
+        goto strips_error;
+    }
+    else if(bpp == 8)
       dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     else
       dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
@@ -823,74 +963,11 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   uint8_t *outbuf = pipe.backbuf;
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
-  // else output float, no further harm done to the pixels :)
+  if(use_strips)
+    outbuf = strips_buf; // converted strip by strip already
+  else
+    _export_convert_pixels(outbuf, (size_t)processed_width * processed_height, bpp, display_byteorder,
+                           high_quality_processing);
 
   format_params->width = processed_width;
   format_params->height = processed_height;
@@ -917,6 +994,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, NULL, 0, imgid, num, total);
   }
 
+  dt_free_align(strips_buf);
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
@@ -959,7 +1037,11 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   return res;
 
+strips_error:
+  // some strips never made it into strips_buf, don't write that out
+  dt_control_log(_("failed to process image %d for export"), imgid);
 error:
+  dt_free_align(strips_buf);
   dt_dev_pixelpipe_cleanup(&pipe);
 error_early:
   dt_dev_cleanup(&dev);
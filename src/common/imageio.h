@@ -99,8 +99,11 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
                                           const dt_image_orientation_t orientation);
 
 // allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
+// if max_width and max_height are given, the jpg may be decoded at a reduced scale, but still large
+// enough to fill that box.
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
-                               dt_colorspaces_color_profile_type_t *color_space);
+                               dt_colorspaces_color_profile_type_t *color_space, const int32_t max_width,
+                               const int32_t max_height);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
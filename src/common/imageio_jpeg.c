@@ -159,7 +159,7 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
 static int decompress_jsc(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), &tmp, 1) != 1)
     {
@@ -176,14 +176,14 @@ static int decompress_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)malloc(jpg->dinfo.output_width * jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
       free(row_pointer[0]);
       return 1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
+    for(unsigned int i = 0; i < jpg->dinfo.output_width; i++)
     {
       for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
     }
@@ -193,6 +193,22 @@ static int decompress_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   return 0;
 }
 
+void dt_imageio_jpeg_set_scale(dt_imageio_jpeg_t *jpg, const int min_width, const int min_height)
+{
+  // libjpeg can skip most of the idct work for 1/2, 1/4 and 1/8 of the size
+  int denom = 8;
+  while(denom > 1
+        && ((int)(jpg->dinfo.image_width + denom - 1) / denom < min_width
+            || (int)(jpg->dinfo.image_height + denom - 1) / denom < min_height))
+    denom /= 2;
+
+  // same rounding as jpeg_calc_output_dimensions(), which jpeg_start_decompress() will call later on
+  jpg->dinfo.scale_num = 1;
+  jpg->dinfo.scale_denom = denom;
+  jpg->width = (jpg->dinfo.image_width + denom - 1) / denom;
+  jpg->height = (jpg->dinfo.image_height + denom - 1) / denom;
+}
+
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   struct dt_imageio_jpeg_error_mgr jerr;
@@ -194,6 +194,12 @@ static int _default_storage_dimension(struct dt_imageio_module_storage_t *self,
 {
   return 0;
 }
+/** Default implementation of parallel_store, storage modules are assumed not to be reentrant */
+static int _default_storage_parallel_store(struct dt_imageio_module_storage_t *self,
+                                           dt_imageio_module_data_t *data)
+{
+  return 0;
+}
 /** a NOP for when a default should do nothing */
 static void _default_storage_nop(struct dt_imageio_module_storage_t *self)
 {
@@ -243,6 +249,8 @@ static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, c
     module->initialize_store = NULL;
   if(!g_module_symbol(module->module, "finalize_store", (gpointer) & (module->finalize_store)))
     module->finalize_store = NULL;
+  if(!g_module_symbol(module->module, "parallel_store", (gpointer) & (module->parallel_store)))
+    module->parallel_store = _default_storage_parallel_store;
   if(!g_module_symbol(module->module, "set_params", (gpointer) & (module->set_params))) goto error;
 
   if(!g_module_symbol(module->module, "supported", (gpointer) & (module->supported)))
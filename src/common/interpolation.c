@@ -17,6 +17,7 @@
 * ------------------------------------------------------------------------*/
 
 #include "common/interpolation.h"
+#include "common/avx.h"
 #include "common/darktable.h"
 #include "control/conf.h"
 
@@ -1350,20 +1351,176 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+/* The plans only depend on the interpolator, the sizes and the roi, and the
+ * export pipe and the mipmap generation keep asking for the same handful of
+ * them. So they are kept around in a small cache with lru eviction. */
+#define RESAMPLING_PLAN_CACHE_SIZE 16
+
+typedef struct dt_resampling_plan_t
+{
+  // the key
+  enum dt_interpolation_type itor;
+  int in;
+  int in_x0;
+  int out;
+  int out_x0;
+  float scale;
+  // the plan as returned by prepare_resampling_plan(), length owns the memory
+  int *length;
+  float *kernel;
+  int *index;
+  int *meta;
+  // number of resamplings currently using the plan, it must not be freed while > 0
+  int users;
+  // whether the plan is in the cache or has to be freed after use
+  int cached;
+  // stamp of the last lookup, for the lru eviction
+  uint64_t used;
+} dt_resampling_plan_t;
+
+static struct
+{
+  dt_pthread_mutex_t lock;
+  dt_resampling_plan_t *plans[RESAMPLING_PLAN_CACHE_SIZE];
+  uint64_t clock;
+} resampling_plans;
+
+static void free_resampling_plan(dt_resampling_plan_t *plan)
+{
+  dt_free_align(plan->length);
+  free(plan);
+}
+
+static inline int resampling_plan_matches(const dt_resampling_plan_t *plan, const struct dt_interpolation *itor,
+                                          const int in, const int in_x0, const int out, const int out_x0,
+                                          const float scale)
+{
+  return plan && plan->itor == itor->id && plan->in == in && plan->in_x0 == in_x0 && plan->out == out
+         && plan->out_x0 == out_x0 && plan->scale == scale;
+}
+
+/** Look up a resampling plan in the cache or prepare and insert a new one.
+ * The plan has to be handed back with release_resampling_plan() when done.
+ * @return the plan or NULL if it could not be allocated
+ */
+static dt_resampling_plan_t *get_resampling_plan(const struct dt_interpolation *itor, const int in,
+                                                 const int in_x0, const int out, const int out_x0,
+                                                 const float scale)
+{
+  dt_pthread_mutex_lock(&resampling_plans.lock);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_resampling_plan_t *plan = resampling_plans.plans[k];
+    if(resampling_plan_matches(plan, itor, in, in_x0, out, out_x0, scale))
+    {
+      plan->users++;
+      plan->used = ++resampling_plans.clock;
+      dt_pthread_mutex_unlock(&resampling_plans.lock);
+      return plan;
+    }
+  }
+  dt_pthread_mutex_unlock(&resampling_plans.lock);
+
+  // not there, prepare it without holding the lock
+  dt_resampling_plan_t *plan = calloc(1, sizeof(dt_resampling_plan_t));
+  if(!plan) return NULL;
+  if(prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan->length, &plan->kernel, &plan->index,
+                             &plan->meta))
+  {
+    free(plan);
+    return NULL;
+  }
+  plan->itor = itor->id;
+  plan->in = in;
+  plan->in_x0 = in_x0;
+  plan->out = out;
+  plan->out_x0 = out_x0;
+  plan->scale = scale;
+  plan->users = 1;
+
+  // put it into an empty slot or in place of the least recently used idle
+  // plan. if another thread was faster with the same plan, there are two of
+  // them for a while until one gets evicted.
+  dt_pthread_mutex_lock(&resampling_plans.lock);
+  int slot = -1;
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE && slot < 0; k++)
+    if(!resampling_plans.plans[k]) slot = k;
+  if(slot < 0)
+    for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+    {
+      const dt_resampling_plan_t *other = resampling_plans.plans[k];
+      if(other->users == 0 && (slot < 0 || other->used < resampling_plans.plans[slot]->used)) slot = k;
+    }
+  if(slot >= 0)
+  {
+    if(resampling_plans.plans[slot]) free_resampling_plan(resampling_plans.plans[slot]);
+    resampling_plans.plans[slot] = plan;
+    plan->cached = 1;
+    plan->used = ++resampling_plans.clock;
+  }
+  dt_pthread_mutex_unlock(&resampling_plans.lock);
+  return plan;
+}
+
+static void release_resampling_plan(dt_resampling_plan_t *plan)
+{
+  if(!plan) return;
+  dt_pthread_mutex_lock(&resampling_plans.lock);
+  plan->users--;
+  const int drop = !plan->cached;
+  dt_pthread_mutex_unlock(&resampling_plans.lock);
+  if(drop) free_resampling_plan(plan);
+}
+
+void dt_interpolation_init()
+{
+  memset(&resampling_plans, 0, sizeof(resampling_plans));
+  dt_pthread_mutex_init(&resampling_plans.lock, NULL);
+}
+
+void dt_interpolation_cleanup()
+{
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+    if(resampling_plans.plans[k]) free_resampling_plan(resampling_plans.plans[k]);
+  dt_pthread_mutex_destroy(&resampling_plans.lock);
+  memset(&resampling_plans, 0, sizeof(resampling_plans));
+}
+
+/** Resampling at scale 1, only the cropping area can change */
+static void resample_1to1(float *out, const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                          const float *const in, const int32_t in_stride)
+{
+  const int x0 = roi_out->x * 4 * sizeof(float);
+  const int l = roi_out->width * 4 * sizeof(float);
+#if DEBUG_RESAMPLING_TIMING
+  int64_t ts_resampling = getts();
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out)
+#endif
+  for(int y = 0; y < roi_out->height; y++)
+  {
+    float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
+    float *o = (float *)((char *)out + (size_t)out_stride * y);
+    memcpy(o, i, l);
+  }
+#if DEBUG_RESAMPLING_TIMING
+  ts_resampling = getts() - ts_resampling;
+  fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
+#endif
+}
+
 static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
                                             const dt_iop_roi_t *const roi_out, const int32_t out_stride,
                                             const float *const in, const dt_iop_roi_t *const roi_in,
                                             const int32_t in_stride)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
+  dt_resampling_plan_t *hplan = NULL;
+  dt_resampling_plan_t *vplan = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1372,25 +1529,7 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
   // Fast code path for 1:1 copy, only cropping area can change
   if(roi_out->scale == 1.f)
   {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-    const int l = roi_out->width * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
-    {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, l);
-    }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
+    resample_1to1(out, roi_out, out_stride, in, in_stride);
     return;
   }
 
@@ -1399,20 +1538,21 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  // Prepare resampling plans once and for all, or get them from the cache
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
-  {
-    goto exit;
-  }
+  const int *const hindex = hplan->index;
+  const int *const hlength = hplan->length;
+  const float *const hkernel = hplan->kernel;
+  const int *const vindex = vplan->index;
+  const int *const vlength = vplan->length;
+  const float *const vkernel = vplan->kernel;
+  const int *const vmeta = vplan->meta;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1424,7 +1564,7 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
 
 // Process each output line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) shared(out)
 #endif
   for(int oy = 0; oy < roi_out->height; oy++)
   {
@@ -1500,28 +1640,144 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
 
+/* --------------------------------------------------------------------------
+ * Separable resampling
+ * ------------------------------------------------------------------------*/
+
 #if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
+/* The simd resamplers run the two passes one after the other: the output is
+ * cut into bands of lines, and for each band the input lines it needs are
+ * first resampled horizontally into a per thread buffer of output width. The
+ * vertical pass then combines whole lines of that buffer, a chunk of pixels
+ * at a time, so its accumulators stay in L1 and the input is read linearly.
+ * Every horizontal tap is applied once per input line instead of once per
+ * output pixel, and the order of the operations matches the direct code. */
+#define RESAMPLING_BAND_HEIGHT 32
+#define RESAMPLING_CHUNK_WIDTH 64
+
+/** Resample one input line horizontally
+ * @param out [out] Output line, aligned, hplan->out pixels
+ * @param in [in] Input line, aligned
+ * @param hplan [in] Horizontal resampling plan
+ */
+typedef void (*resample_hline_t)(float *const out, const float *const in, const dt_resampling_plan_t *const hplan);
+
+/** Combine lines of horizontally resampled pixels to one output line
+ * @param out [out] Output line, aligned
+ * @param lines [in] Buffer of horizontally resampled lines, the first one being input line first
+ * @param first [in] Input line the buffer starts with
+ * @param stride [in] Pixels per line in the buffer, even
+ * @param width [in] Pixels per output line
+ * @param index [in] Input lines contributing to the output line
+ * @param kernel [in] Filter taps for these
+ * @param length [in] Number of contributing lines
+ */
+typedef void (*resample_vline_t)(float *const out, const float *const lines, const int first, const int stride,
+                                 const int width, const int *const index, const float *const kernel,
+                                 const int length);
+
+static void resample_hline_sse(float *const out, const float *const in, const dt_resampling_plan_t *const hplan)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+  int kidx = 0;
+  for(int ox = 0; ox < hplan->out; ox++)
+  {
+    const int hl = hplan->length[ox];
+    __m128 vhs = _mm_setzero_ps();
+    for(int ix = 0; ix < hl; ix++, kidx++)
+    {
+      const __m128 vhtap = _mm_set_ps1(hplan->kernel[kidx]);
+      vhs = _mm_add_ps(vhs, _mm_mul_ps(_mm_load_ps(in + (size_t)4 * hplan->index[kidx]), vhtap));
+    }
+    _mm_store_ps(out + 4 * ox, vhs);
+  }
+}
 
-  int r;
+static void resample_vline_sse(float *const out, const float *const lines, const int first, const int stride,
+                               const int width, const int *const index, const float *const kernel,
+                               const int length)
+{
+  for(int x0 = 0; x0 < width; x0 += RESAMPLING_CHUNK_WIDTH)
+  {
+    const int n = MIN(RESAMPLING_CHUNK_WIDTH, width - x0);
+    __m128 vs[RESAMPLING_CHUNK_WIDTH];
+    for(int j = 0; j < n; j++) vs[j] = _mm_setzero_ps();
+    for(int iy = 0; iy < length; iy++)
+    {
+      const float *const i = lines + 4 * ((size_t)(index[iy] - first) * stride + x0);
+      const __m128 vvtap = _mm_set_ps1(kernel[iy]);
+      for(int j = 0; j < n; j++) vs[j] = _mm_add_ps(vs[j], _mm_mul_ps(_mm_load_ps(i + 4 * j), vvtap));
+    }
+    for(int j = 0; j < n; j++) _mm_stream_ps(out + 4 * (x0 + j), vs[j]);
+  }
+}
+
+#if defined(HAVE_AVX_CODEPATHS)
+DT_TARGET_AVX2 static void resample_hline_avx2(float *const out, const float *const in,
+                                               const dt_resampling_plan_t *const hplan)
+{
+  int kidx = 0;
+  for(int ox = 0; ox < hplan->out; ox++)
+  {
+    const int hl = hplan->length[ox];
+    const int *const index = hplan->index + kidx;
+    const float *const kernel = hplan->kernel + kidx;
+    // two taps at a time, one per lane
+    __m256 vhs = _mm256_setzero_ps();
+    int ix = 0;
+    for(; ix + 1 < hl; ix += 2)
+      vhs = _mm256_fmadd_ps(dt_mm256_load2_ps(in + (size_t)4 * index[ix], in + (size_t)4 * index[ix + 1]),
+                            dt_mm256_set2_ps(kernel[ix], kernel[ix + 1]), vhs);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(vhs), _mm256_extractf128_ps(vhs, 1));
+    if(ix < hl) sum = _mm_fmadd_ps(_mm_load_ps(in + (size_t)4 * index[ix]), _mm_set1_ps(kernel[ix]), sum);
+    _mm_store_ps(out + 4 * ox, sum);
+    kidx += hl;
+  }
+  _mm256_zeroupper();
+}
+
+DT_TARGET_AVX2 static void resample_vline_avx2(float *const out, const float *const lines, const int first,
+                                               const int stride, const int width, const int *const index,
+                                               const float *const kernel, const int length)
+{
+  // two pixels per vector, the lines in the buffer have an even number of them
+  for(int x0 = 0; x0 < width; x0 += RESAMPLING_CHUNK_WIDTH)
+  {
+    const int n = MIN(RESAMPLING_CHUNK_WIDTH, width - x0);
+    const int n2 = (n + 1) / 2;
+    __m256 vs[RESAMPLING_CHUNK_WIDTH / 2];
+    for(int j = 0; j < n2; j++) vs[j] = _mm256_setzero_ps();
+    for(int iy = 0; iy < length; iy++)
+    {
+      const float *const i = lines + 4 * ((size_t)(index[iy] - first) * stride + x0);
+      const __m256 vvtap = _mm256_set1_ps(kernel[iy]);
+      for(int j = 0; j < n2; j++) vs[j] = _mm256_fmadd_ps(_mm256_load_ps(i + 8 * j), vvtap, vs[j]);
+    }
+    float *const o = out + 4 * x0;
+    for(int j = 0; j < n / 2; j++)
+    {
+      _mm_stream_ps(o + 8 * j, _mm256_castps256_ps128(vs[j]));
+      _mm_stream_ps(o + 8 * j + 4, _mm256_extractf128_ps(vs[j], 1));
+    }
+    if(n & 1) _mm_stream_ps(o + 4 * (n - 1), _mm256_castps256_ps128(vs[n2 - 1]));
+  }
+  _mm256_zeroupper();
+}
+#endif
+
+static void dt_interpolation_resample_separable(const struct dt_interpolation *itor, float *out,
+                                                const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                                const float *const in, const dt_iop_roi_t *const roi_in,
+                                                const int32_t in_stride, const resample_hline_t hline,
+                                                const resample_vline_t vline)
+{
+  dt_resampling_plan_t *hplan = NULL;
+  dt_resampling_plan_t *vplan = NULL;
+  int *band_first = NULL;
+  float *buf = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1530,128 +1786,77 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   // Fast code path for 1:1 copy, only cropping area can change
   if(roi_out->scale == 1.f)
   {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-    const int l = roi_out->width * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
-    {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, l);
-    }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
+    resample_1to1(out, roi_out, out_stride, in, in_stride);
     return;
   }
 
-// Generic non 1:1 case... much more complicated :D
 #if DEBUG_RESAMPLING_TIMING
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  // Find the input lines each band of output lines needs
+  const int width = roi_out->width;
+  const int stride = (width + 1) & ~1;
+  const int nbands = (roi_out->height + RESAMPLING_BAND_HEIGHT - 1) / RESAMPLING_BAND_HEIGHT;
+  band_first = malloc(sizeof(int) * 2 * nbands);
+  if(!band_first)
   {
     goto exit;
   }
+  int *const band_last = band_first + nbands;
+  int maxlines = 0;
+  for(int band = 0; band < nbands; band++)
+  {
+    band_first[band] = roi_in->height;
+    band_last[band] = -1;
+    for(int oy = band * RESAMPLING_BAND_HEIGHT; oy < MIN(roi_out->height, (band + 1) * RESAMPLING_BAND_HEIGHT); oy++)
+    {
+      const int *const index = vplan->index + vplan->meta[3 * oy + 2];
+      for(int iy = 0; iy < vplan->length[oy]; iy++)
+      {
+        band_first[band] = MIN(band_first[band], index[iy]);
+        band_last[band] = MAX(band_last[band], index[iy]);
+      }
+    }
+    maxlines = MAX(maxlines, band_last[band] - band_first[band] + 1);
+  }
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
+  const size_t bufsize = (size_t)4 * stride * maxlines;
+  buf = dt_alloc_align(64, sizeof(float) * bufsize * dt_get_num_threads());
+  if(!buf)
+  {
+    goto exit;
+  }
 
 #if DEBUG_RESAMPLING_TIMING
+  ts_plan = getts() - ts_plan;
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) schedule(static) shared(out, hplan, vplan, band_first, buf)
 #endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+  for(int band = 0; band < nbands; band++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
-    {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
-
-    // Progress in vertical context
-//     viidx += vl;
-//     vkidx += vl;
+    float *const lines = buf + bufsize * dt_get_thread_num();
+    const int first = band_first[band];
+
+    // Horizontal pass over all input lines of the band
+    for(int iy = first; iy <= band_last[band]; iy++)
+      hline(lines + (size_t)4 * stride * (iy - first), (const float *)((const char *)in + (size_t)in_stride * iy),
+            hplan);
+
+    // Vertical pass for each output line
+    for(int oy = band * RESAMPLING_BAND_HEIGHT; oy < MIN(roi_out->height, (band + 1) * RESAMPLING_BAND_HEIGHT); oy++)
+      vline((float *)((char *)out + (size_t)oy * out_stride), lines, first, stride, width,
+            vplan->index + vplan->meta[3 * oy + 2], vplan->kernel + vplan->meta[3 * oy + 1], vplan->length[oy]);
   }
 
   _mm_sfence();
@@ -1662,12 +1867,31 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  dt_free_align(buf);
+  free(band_first);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
+}
+
+static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
+                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                          const float *const in, const dt_iop_roi_t *const roi_in,
+                                          const int32_t in_stride)
+{
+  dt_interpolation_resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride, resample_hline_sse,
+                                      resample_vline_sse);
 }
+
+#if defined(HAVE_AVX_CODEPATHS)
+static void dt_interpolation_resample_avx2(const struct dt_interpolation *itor, float *out,
+                                           const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                           const float *const in, const dt_iop_roi_t *const roi_in,
+                                           const int32_t in_stride)
+{
+  dt_interpolation_resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                      resample_hline_avx2, resample_vline_avx2);
+}
+#endif
 #endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
@@ -1680,6 +1904,10 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
 {
   if(darktable.codepath.OPENMP_SIMD)
     return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+#if defined(HAVE_AVX_CODEPATHS)
+  else if(darktable.codepath.AVX2)
+    return dt_interpolation_resample_avx2(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+#endif
 #if defined(__SSE2__)
   else if(darktable.codepath.SSE2)
     return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
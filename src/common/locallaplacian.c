@@ -17,6 +17,7 @@
 */
 
 #include "common/darktable.h"
+#include "common/avx.h"
 #include "common/locallaplacian.h"
 
 #include <string.h>
@@ -25,6 +26,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 #if defined(__SSE2__)
 #include <xmmintrin.h>
 #endif
@@ -93,120 +95,200 @@ static inline void ll_fill_boundary1(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
-// helper to fill in two pixels boundary by copying it
-static inline void ll_fill_boundary2(
-    float *const input,
-    const int wd,
+// add the upsampled coarse buffer to the fine one. ll_expand_gaussian() needs a boundary of 1 or 2px, the pixels
+// in there get the expansion of their nearest neighbour inside (even ht: two px boundary. odd ht: one px).
+static inline void gauss_expand_add(
+    const float *const coarse, // coarse input
+    float *const fine,         // fine buffer to add the upsampled, blurry coarse one to
+    const int wd,              // fine res
     const int ht)
 {
-  for(int j=1;j<ht-1;j++) input[j*wd] = input[j*wd+1];
-  if(wd & 1) for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2];
-  else       for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2] = input[j*wd+wd-3];
-  memcpy(input, input+wd, sizeof(float)*wd);
-  if(!(ht & 1)) memcpy(input+wd*(ht-2), input+wd*(ht-3), sizeof(float)*wd);
-  memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0;j<ht;j++)
+  {
+    const int jj = CLAMPS(j, 1, ((ht-1)&~1)-1);
+    for(int i=0;i<wd;i++)
+      fine[j*wd+i] += ll_expand_gaussian(coarse, CLAMPS(i, 1, ((wd-1)&~1)-1), jj, wd, ht);
+  }
 }
 
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
-    const int wd,             // fine res
-    const int ht)
+// the simd versions of gauss_reduce() cut the coarse rows into bands of this many rows, one band per thread.
+// every band keeps its own ring buffer of horizontally filtered rows, only the three fine rows shared with
+// the band above are filtered twice.
+#define LL_BAND_HEIGHT 32
+
+// horizontal pass, convolve one fine row with the 1 4 6 4 1 kernel and decimate
+typedef void (*ll_reduce_hrow_t)(const float *const in, float *const row, const int cw);
+// vertical pass, convolve five filtered rows and write one coarse row
+typedef void (*ll_reduce_vrow_t)(const float *const *const rows, float *const out, const int cw);
+
+static inline void gauss_reduce_hrow(const float *const in, float *const row, const int cw)
 {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
-#endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
+  for(int i=1;i<cw-1;i++)
+    row[i] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
 }
 
-#if defined(__SSE2__)
-static inline void gauss_reduce_sse2(
+static void gauss_reduce_bands(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
     const int wd,             // fine res
-    const int ht)
+    const int ht,
+    const ll_reduce_hrow_t hrow,
+    const ll_reduce_vrow_t vrow)
 {
   // blur, store only coarse res
   const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
 
   // this version is inspired by opencv's pyrDown_ :
-  // - allocate 5 rows of ring buffer (aligned)
-  // - for coarse res y
+  // - allocate 5 rows of ring buffer (aligned) per thread
+  // - for coarse res y in the band of the thread
   //   - fill 5 coarse-res row buffers with 1 4 6 4 1 weights (reuse some from last time)
-  //   - do vertical convolution via sse and write to coarse output buf
+  //   - do vertical convolution via simd and write to coarse output buf
 
-  const int stride = ((cw+8)&~7); // assure sse alignment of rows
-  float *ringbuf = dt_alloc_align(16, sizeof(*ringbuf)*stride*5);
-  float *rows[5] = {0};
-  int rowj = 0; // we initialised this many rows so far
+  const int stride = ((cw+8)&~7); // assure simd alignment of rows
+  const int num_bands = (ch-2+LL_BAND_HEIGHT-1)/LL_BAND_HEIGHT;
+  float *const ringbufs = dt_alloc_align(64, sizeof(*ringbufs)*stride*5*dt_get_num_threads());
 
-  for(int j=1;j<ch-1;j++)
-  {
-    // horizontal pass, convolve with 1 4 6 4 1 kernel and decimate
-    for(;rowj<=2*j+2;rowj++)
-    {
-      float *const row = ringbuf + (rowj % 5)*stride;
-      const float *const in = input + rowj*wd;
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none)
 #endif
-      for(int i=1;i<cw-1;i++)
-        row[i] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
-    }
-
-    // init row pointers
-    for(int k=0;k<5;k++)
-      rows[k] = ringbuf + ((2*j-2+k)%5)*stride;
-
-    // vertical pass, convolve and decimate using SIMD:
-    // note that we're ignoring the (1..cw-1) buffer limit, we'll pull in
-    // garbage and fix it later by border filling.
-    float *const out = coarse + j*cw;
-    const float *const row0 = rows[0], *const row1 = rows[1],
-                *const row2 = rows[2], *const row3 = rows[3], *const row4 = rows[4];
-    const __m128 four = _mm_set1_ps(4.f), scale = _mm_set1_ps(1.f/256.f);
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none)
-#endif
-    for(int i=0;i<=cw-8;i+=8)
+  for(int band=0;band<num_bands;band++)
+  {
+    float *const ringbuf = ringbufs + (size_t)stride*5*dt_get_thread_num();
+    const int j0 = 1 + band*LL_BAND_HEIGHT, j1 = MIN(ch-1, j0+LL_BAND_HEIGHT);
+    int rowj = 2*j0-2; // we initialised the rows up to this one so far
+    for(int j=j0;j<j1;j++)
     {
-      __m128 r0, r1, r2, r3, r4, t0, t1;
-      r0 = _mm_load_ps(row0 + i);
-      r1 = _mm_load_ps(row1 + i);
-      r2 = _mm_load_ps(row2 + i);
-      r3 = _mm_load_ps(row3 + i);
-      r4 = _mm_load_ps(row4 + i);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t0 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      r0 = _mm_load_ps(row0 + i + 4);
-      r1 = _mm_load_ps(row1 + i + 4);
-      r2 = _mm_load_ps(row2 + i + 4);
-      r3 = _mm_load_ps(row3 + i + 4);
-      r4 = _mm_load_ps(row4 + i + 4);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t1 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      t0 = _mm_mul_ps(t0, scale);
-      t1 = _mm_mul_ps(t1, scale);
-
-      _mm_storeu_ps(out + i, t0);
-      _mm_storeu_ps(out + i + 4, t1);
+      for(;rowj<=2*j+2;rowj++)
+        hrow(input + (size_t)rowj*wd, ringbuf + (rowj % 5)*stride, cw);
+
+      const float *rows[5];
+      for(int k=0;k<5;k++)
+        rows[k] = ringbuf + ((2*j-2+k)%5)*stride;
+
+      // note that we're ignoring the (1..cw-1) buffer limit, we'll pull in
+      // garbage and fix it later by border filling.
+      vrow(rows, coarse + (size_t)j*cw, cw);
     }
-    // process the rest
-    for(int i=cw&~7;i<cw-1;i++)
-      out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
   }
-  dt_free_align(ringbuf);
+  dt_free_align(ringbufs);
   ll_fill_boundary1(coarse, cw, ch);
 }
+
+#if defined(__SSE2__)
+static void gauss_reduce_vrow_sse2(const float *const *const rows, float *const out, const int cw)
+{
+  const float *const row0 = rows[0], *const row1 = rows[1],
+              *const row2 = rows[2], *const row3 = rows[3], *const row4 = rows[4];
+  const __m128 four = _mm_set1_ps(4.f), scale = _mm_set1_ps(1.f/256.f);
+  for(int i=0;i<=cw-8;i+=8)
+  {
+    __m128 r0, r1, r2, r3, r4, t0, t1;
+    r0 = _mm_load_ps(row0 + i);
+    r1 = _mm_load_ps(row1 + i);
+    r2 = _mm_load_ps(row2 + i);
+    r3 = _mm_load_ps(row3 + i);
+    r4 = _mm_load_ps(row4 + i);
+    r0 = _mm_add_ps(r0, r4);
+    r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
+    r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
+    t0 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
+
+    r0 = _mm_load_ps(row0 + i + 4);
+    r1 = _mm_load_ps(row1 + i + 4);
+    r2 = _mm_load_ps(row2 + i + 4);
+    r3 = _mm_load_ps(row3 + i + 4);
+    r4 = _mm_load_ps(row4 + i + 4);
+    r0 = _mm_add_ps(r0, r4);
+    r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
+    r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
+    t1 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
+
+    t0 = _mm_mul_ps(t0, scale);
+    t1 = _mm_mul_ps(t1, scale);
+
+    _mm_storeu_ps(out + i, t0);
+    _mm_storeu_ps(out + i + 4, t1);
+  }
+  // process the rest
+  for(int i=cw&~7;i<cw-1;i++)
+    out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
+}
+
+static inline void gauss_reduce_sse2(
+    const float *const input, // fine input buffer
+    float *const coarse,      // coarse scale, blurred input buf
+    const int wd,             // fine res
+    const int ht)
+{
+  gauss_reduce_bands(input, coarse, wd, ht, gauss_reduce_hrow, gauss_reduce_vrow_sse2);
+}
+#endif
+
+#if defined(HAVE_AVX_CODEPATHS)
+// in[0], in[2], .. in[14] and in[1], in[3], .. in[15]
+DT_TARGET_AVX2 static inline __m256 ll_evens_avx2(const float *const in)
+{
+  const __m256 e = _mm256_shuffle_ps(_mm256_loadu_ps(in), _mm256_loadu_ps(in + 8), _MM_SHUFFLE(2, 0, 2, 0));
+  return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(e), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+DT_TARGET_AVX2 static inline __m256 ll_odds_avx2(const float *const in)
+{
+  const __m256 o = _mm256_shuffle_ps(_mm256_loadu_ps(in), _mm256_loadu_ps(in + 8), _MM_SHUFFLE(3, 1, 3, 1));
+  return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+DT_TARGET_AVX2 static void gauss_reduce_hrow_avx2(const float *const in, float *const row, const int cw)
+{
+  const __m256 four = _mm256_set1_ps(4.f), six = _mm256_set1_ps(6.f);
+  int i = 1;
+  // stay two fine pixels away from the end of the row, the last load reaches in[2*i+17]
+  for(;i<=cw-10;i+=8)
+  {
+    const float *const p = in + 2*i;
+    const __m256 e0 = ll_evens_avx2(p - 2), o0 = ll_odds_avx2(p - 2);
+    const __m256 e1 = ll_evens_avx2(p), o1 = ll_odds_avx2(p);
+    const __m256 e2 = ll_evens_avx2(p + 2);
+    const __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(six, e1), _mm256_mul_ps(four, _mm256_add_ps(o0, o1))),
+                                   _mm256_add_ps(e0, e2));
+    _mm256_storeu_ps(row + i, r);
+  }
+  // gcc does not insert this before the scalar code on its own
+  _mm256_zeroupper();
+  for(;i<cw-1;i++)
+    row[i] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
+}
+
+DT_TARGET_AVX2 static void gauss_reduce_vrow_avx2(const float *const *const rows, float *const out, const int cw)
+{
+  const float *const row0 = rows[0], *const row1 = rows[1],
+              *const row2 = rows[2], *const row3 = rows[3], *const row4 = rows[4];
+  const __m256 four = _mm256_set1_ps(4.f), scale = _mm256_set1_ps(1.f/256.f);
+  int i = 0;
+  for(;i<=cw-8;i+=8)
+  {
+    const __m256 r2 = _mm256_load_ps(row2 + i);
+    const __m256 r04 = _mm256_add_ps(_mm256_add_ps(_mm256_load_ps(row0 + i), _mm256_load_ps(row4 + i)),
+                                     _mm256_add_ps(r2, r2));
+    const __m256 r13 = _mm256_add_ps(_mm256_add_ps(_mm256_load_ps(row1 + i), _mm256_load_ps(row3 + i)), r2);
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(r04, _mm256_mul_ps(r13, four)), scale));
+  }
+  _mm256_zeroupper();
+  for(;i<cw-1;i++)
+    out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
+}
+
+static inline void gauss_reduce_avx2(
+    const float *const input, // fine input buffer
+    float *const coarse,      // coarse scale, blurred input buf
+    const int wd,             // fine res
+    const int ht)
+{
+  gauss_reduce_bands(input, coarse, wd, ht, gauss_reduce_hrow_avx2, gauss_reduce_vrow_avx2);
+}
 #endif
 
 static inline void gauss_reduce(
@@ -232,6 +314,26 @@ static inline void gauss_reduce(
   ll_fill_boundary1(coarse, cw, ch);
 }
 
+static inline void ll_gauss_reduce(
+    const float *const input, // fine input buffer
+    float *const coarse,      // coarse scale, blurred input buf
+    const int wd,             // fine res
+    const int ht,
+    const int use_sse2)
+{
+#if defined(HAVE_AVX_CODEPATHS)
+  if(use_sse2 && darktable.codepath.AVX2)
+    gauss_reduce_avx2(input, coarse, wd, ht);
+  else
+#endif
+#if defined(__SSE2__)
+  if(use_sse2)
+    gauss_reduce_sse2(input, coarse, wd, ht);
+  else
+#endif
+    gauss_reduce(input, coarse, wd, ht);
+}
+
 // allocate output buffer with monochrome brightness channel from input, padded
 // up by max_supp on all four sides, dimensions written to wd2 ht2
 static inline float *ll_pad_input(
@@ -350,6 +452,39 @@ static inline float ll_laplacian(
   return fine[j*wd+i] - c;
 }
 
+// add the laplacian coefficients of the curve for gamma[k] to one level of the output pyramid. every pixel
+// interpolates linearly between the two curves with the gamma closest to its brightness, so only those two
+// contribute to it and the pixels outside [gamma[k-1], gamma[k+1]) are skipped.
+static inline void ll_add_laplacian(
+    float *const out,            // output level, accumulates the coefficients
+    const float *const coarse,   // coarse res gaussian of the curved input
+    const float *const fine,     // fine res gaussian of the curved input
+    const float *const padded,   // gaussian of the input on the fine level
+    const float *const gamma,    // brightness the curves are centered at
+    const int num_gamma,
+    const int k,                 // the curve coarse and fine belong to
+    const int wd,                // fine width
+    const int ht)                // fine height
+{
+  // the outermost curves also take everything below and above
+  const float lower = k > 1 ? gamma[k-1] : -FLT_MAX;
+  const float upper = k < num_gamma-2 ? gamma[k+1] : FLT_MAX;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
+  {
+    const float v = padded[j*wd+i];
+    if(v < lower || v >= upper) continue;
+    float w;
+    if(k > 0 && (k == num_gamma-1 || v < gamma[k])) // between gamma[k-1] and us
+      w = CLAMPS((v - gamma[k-1])/(gamma[k]-gamma[k-1]), 0.0f, 1.0f);
+    else                                            // between us and gamma[k+1]
+      w = 1.0f - CLAMPS((v - gamma[k])/(gamma[k+1]-gamma[k]), 0.0f, 1.0f);
+    out[j*wd+i] += ll_laplacian(coarse, fine, i, j, wd, ht) * w;
+  }
+}
+
 static inline float curve_scalar(
     const float x,
     const float g,
@@ -551,40 +686,35 @@ void local_laplacian_internal(
   else
     padded[0] = ll_pad_input(input, wd, ht, max_supp, &w, &h, 0);
 
-  // allocate pyramid pointers for padded input
-  for(int l=1;l<=last_level;l++)
+  // allocate pyramid pointers for padded input. the coarsest level goes straight to the output.
+  for(int l=1;l<last_level;l++)
     padded[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
 
-  // allocate pyramid pointers for output
+  // allocate pyramid pointers for output. the finer levels collect the laplacian coefficients of
+  // all curves first, the coarser levels are only added when assembling the output.
   float *output[max_levels] = {0};
   for(int l=0;l<=last_level;l++)
+  {
     output[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+    if(l < last_level) memset(output[l], 0, sizeof(float)*dl(w,l)*dl(h,l));
+  }
 
   // create gauss pyramid of padded input, write coarse directly to output
-#if defined(__SSE2__)
-  if(use_sse2)
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
-  else
-#endif
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
+  for(int l=1;l<last_level;l++)
+    ll_gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1), use_sse2);
+  ll_gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1), use_sse2);
 
   // evenly sample brightness [0,1]:
   float gamma[num_gamma] = {0.0f};
   for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
-  // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
-    buf[k][l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+  // the gaussian pyramids of the curved input are never kept in full: as soon as the next coarser level
+  // is reduced from a level, its laplacian coefficients go to the output pyramid and the buffer is reused
+  // two levels further down. so one buffer of the finest and one of the second level do for all curves.
+  float *buf[2];
+  buf[0] = dt_alloc_align(64, sizeof(float)*dl(w,0)*dl(h,0));
+  buf[1] = dt_alloc_align(64, sizeof(float)*dl(w,1)*dl(h,1));
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
@@ -593,20 +723,27 @@ void local_laplacian_internal(
   { // process images
 #if defined(__SSE2__)
     if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
+      apply_curve_sse2(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
     else // brackets in next line needed for silly gcc warning:
 #endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    {apply_curve(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
 
-    // create gaussian pyramids
-    for(int l=1;l<=last_level;l++)
-#if defined(__SSE2__)
-      if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
-      else
-#endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+    // walk down the gaussian pyramid and collect the laplacian coefficients on the way
+    for(int l=0;l<last_level;l++)
+    {
+      const int pw = dl(w,l), ph = dl(h,l);
+      float *const fine = buf[l&1], *const coarse = buf[(l+1)&1];
+      ll_gauss_reduce(fine, coarse, pw, ph, use_sse2);
+      ll_add_laplacian(output[l], coarse, fine, padded[l], gamma, num_gamma, k, pw, ph);
+      // we could do this to save on memory (no need for finest buf[][]).
+      // unfortunately it results in a quite noticeable loss of sharpness, i think
+      // the extra level is worth it.
+      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
+      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
+    }
   }
+  dt_free_align(buf[0]);
+  dt_free_align(buf[1]);
 
   // resample output[last_level] from preview
   // requires to transform from padded/downsampled to full image and then
@@ -698,33 +835,9 @@ void local_laplacian_internal(
 
   // assemble output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
-  {
-    const int pw = dl(w,l), ph = dl(h,l);
-
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2) shared(w,h,buf,output,l,gamma,padded)
-#endif
-    for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
-    {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
-      // we could do this to save on memory (no need for finest buf[][]).
-      // unfortunately it results in a quite noticeable loss of sharpness, i think
-      // the extra level is worth it.
-      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
-      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
-    }
-  }
+    gauss_expand_add(output[l+1], output[l], dl(w,l), dl(h,l));
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) collapse(2) shared(w,output,buf)
+#pragma omp parallel for default(none) schedule(dynamic) collapse(2) shared(w,output)
 #endif
   for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
   {
@@ -747,7 +860,6 @@ void local_laplacian_internal(
   {
     if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
     if(!b || b->mode != 1)        dt_free_align(output[l]);
-    for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
   }
 #undef num_levels
 #undef num_gamma
@@ -764,10 +876,11 @@ size_t local_laplacian_memory_use(const int width,     // width of input image
   const int paddwd = width  + 2*max_supp;
   const int paddht = height + 2*max_supp;
 
-  size_t memory_use = 0;
+  // padded input and output pyramids, plus the two finest levels of the curved input
+  size_t memory_use = (size_t)(dl(paddwd, 0) * dl(paddht, 0) + dl(paddwd, 1) * dl(paddht, 1)) * sizeof(float);
 
   for(int l=0;l<num_levels;l++)
-    memory_use += (size_t)(2 + num_gamma) * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+    memory_use += (size_t)2 * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
 
   return memory_use;
 #undef num_levels
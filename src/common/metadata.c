@@ -31,45 +31,42 @@ static void dt_metadata_set_xmp(int id, const char *key, const char *value)
 
   if(id == -1)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.meta_data WHERE id IN (SELECT imgid FROM main.selected_images) "
-                                "AND key = ?1",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.meta_data WHERE id IN (SELECT imgid FROM main.selected_images) "
+                                    "AND key = ?1", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keyid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
 
     if(value != NULL && value[0] != '\0')
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "INSERT INTO main.meta_data (id, key, value) SELECT imgid, ?1, ?2 FROM "
-                                  "main.selected_images",
-                                  -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "INSERT INTO main.meta_data (id, key, value) SELECT imgid, ?1, ?2 FROM "
+                                      "main.selected_images", &stmt);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keyid);
       DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, value, -1, SQLITE_TRANSIENT);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.meta_data WHERE id = ?1 AND key = ?2", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.meta_data WHERE id = ?1 AND key = ?2", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, keyid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
 
     if(value != NULL && value[0] != '\0')
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "INSERT INTO main.meta_data (id, key, value) VALUES (?1, ?2, ?3)", -1, &stmt,
-                                  NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "INSERT INTO main.meta_data (id, key, value) VALUES (?1, ?2, ?3)", &stmt);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, keyid);
       DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, value, -1, SQLITE_TRANSIENT);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
   }
 }
@@ -98,8 +95,7 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
       }
       else // single image under mouse cursor
       {
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT flags FROM main.images WHERE id = ?1",
-                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT flags FROM main.images WHERE id = ?1", &stmt);
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
       }
       while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -109,7 +105,7 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
         stars = (stars & 0x7) - 1;
         result = g_list_append(result, GINT_TO_POINTER(stars));
       }
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
     else if(strncmp(key, "Xmp.dc.subject", 14) == 0)
     {
@@ -123,10 +119,9 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
       }
       else // single image under mouse cursor
       {
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "SELECT name FROM data.tags t JOIN main.tagged_images i ON "
-                                    "i.tagid = t.id WHERE imgid = ?1",
-                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                        "SELECT name FROM data.tags t JOIN main.tagged_images i ON "
+                                        "i.tagid = t.id WHERE imgid = ?1", &stmt);
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
       }
       while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -134,7 +129,7 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
         local_count++;
         result = g_list_append(result, g_strdup((char *)sqlite3_column_text(stmt, 0)));
       }
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
     else if(strncmp(key, "Xmp.darktable.colorlabels", 25) == 0)
     {
@@ -147,9 +142,8 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
       }
       else // single image under mouse cursor
       {
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "SELECT color FROM main.color_labels WHERE imgid=?1 ORDER BY color",
-                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                        "SELECT color FROM main.color_labels WHERE imgid=?1 ORDER BY color", &stmt);
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
       }
       while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -157,7 +151,7 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
         local_count++;
         result = g_list_append(result, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
       }
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
     }
     if(count != NULL) *count = local_count;
     return result;
@@ -174,9 +168,9 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
   }
   else // single image under mouse cursor
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT value FROM main.meta_data WHERE id = ?1 AND key = ?2 ORDER BY value", -1,
-                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "SELECT value FROM main.meta_data WHERE id = ?1 AND key = ?2 ORDER BY value",
+                                    &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, keyid);
   }
@@ -185,7 +179,7 @@ static GList *dt_metadata_get_xmp(int id, const char *key, uint32_t *count)
     local_count++;
     result = g_list_append(result, g_strdup((char *)sqlite3_column_text(stmt, 0)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   if(count != NULL) *count = local_count;
   return result;
 }
@@ -25,6 +25,7 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_pack.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
@@ -58,7 +59,9 @@ typedef enum dt_mipmap_buffer_dsc_flags
 {
   DT_MIPMAP_BUFFER_DSC_FLAG_NONE = 0,
   DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE = 1 << 0,
-  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1
+  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1,
+  // holds the embedded preview while the developed thumbnail is still being worked on. never written to disc.
+  DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW = 1 << 2
 } dt_mipmap_buffer_dsc_flags;
 
 // the embedded Exif data to tag thumbnails as sRGB or AdobeRGB
@@ -85,6 +88,8 @@ struct dt_mipmap_buffer_dsc
   size_t size;
   dt_mipmap_buffer_dsc_flags flags;
   dt_colorspaces_color_profile_type_t color_space;
+  // stamped when an embedded preview is put in, a refine only replaces the preview it started from
+  uint32_t generation;
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
   // do not touch!
@@ -238,7 +243,10 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width,
                     const uint32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
-                    const dt_mipmap_size_t size);
+                    const dt_mipmap_size_t size, int *preview);
+static int _develop_8(uint8_t *buf, const uint32_t wd, const uint32_t ht, uint32_t *width, uint32_t *height,
+                      float *iscale, dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
+                      const dt_mipmap_size_t size);
 
 // callback for the imageio core to allocate memory.
 // only needed for _F and _FULL buffers, as they change size
@@ -304,6 +312,24 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+// decode a thumbnail from the disk cache into the buffer behind dsc, returns 0 on success
+static int _decompress_thumbnail(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const uint8_t *blob,
+                                 const size_t len, struct dt_mipmap_buffer_dsc *dsc)
+{
+  dt_colorspaces_color_profile_type_t color_space;
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
+     || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
+     || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
+     || dt_imageio_jpeg_decompress(&jpg, (uint8_t *)(dsc + 1)))
+    return 1;
+  dsc->width = jpg.width;
+  dsc->height = jpg.height;
+  dsc->iscale = 1.0f;
+  dsc->color_space = color_space;
+  return 0;
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -359,7 +385,30 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
   int loaded_from_disk = 0;
   if(mip < DT_MIPMAP_F)
   {
-    if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+    if(cache->pack && dt_conf_get_bool("cache_disk_backend"))
+    {
+      // the blob is read straight from the mapped pack
+      size_t len = 0;
+      int color_space = DT_COLORSPACE_NONE;
+      const uint8_t *blob = dt_mipmap_pack_read_get(cache->pack, get_imgid(entry->key), mip, &len, &color_space);
+      if(blob)
+      {
+        const int err = _decompress_thumbnail(cache, mip, blob, len, dsc);
+        dt_mipmap_pack_read_release(cache->pack);
+        if(err)
+        {
+          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d from the pack!\n",
+                  get_imgid(entry->key));
+          dt_mipmap_pack_remove(cache->pack, get_imgid(entry->key), mip);
+        }
+        else
+        {
+          dsc->color_space = color_space;
+          loaded_from_disk = 1;
+        }
+      }
+    }
+    else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
     {
       // try and load from disk, if successful set flag
       char filename[PATH_MAX] = {0};
@@ -377,20 +426,11 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         fseek(f, 0, SEEK_SET);
         int rd = fread(blob, sizeof(uint8_t), len, f);
         if(rd != len) goto read_error;
-        dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, entry->data + sizeof(*dsc)))
+        if(_decompress_thumbnail(cache, mip, blob, len, dsc))
         {
           fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d from `%s'!\n", get_imgid(entry->key), filename);
           goto read_error;
         }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-        dsc->iscale = 1.0f;
-        dsc->color_space = color_space;
         loaded_from_disk = 1;
         if(0)
         {
@@ -417,6 +457,8 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
 {
   dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
 
+  if(cache->pack) dt_mipmap_pack_remove(cache->pack, imgid, mip);
+
   // also remove jpg backing (always try to do that, in case user just temporarily switched it off,
   // to avoid inconsistencies.
   // if(dt_conf_get_bool("cache_disk_backend"))
@@ -428,6 +470,78 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
   }
 }
 
+// serialize an 8-bit thumbnail to the disk cache, unless it is there already
+static void _write_to_disk(const dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                           const uint8_t *buf, const uint32_t width, const uint32_t height,
+                           const dt_colorspaces_color_profile_type_t color_space)
+{
+  if(!cache->cachedir[0] || !dt_conf_get_bool("cache_disk_backend")) return;
+  // don't write skulls:
+  if(width <= 8 || height <= 8) return;
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  if(cache->pack)
+  {
+    if(dt_mipmap_pack_contains(cache->pack, imgid, mip, NULL)) return;
+    // the color space is kept in the index instead of an exif blob
+    uint8_t *blob = (uint8_t *)malloc((size_t)width * height * 4 + 4096);
+    if(!blob) return;
+    const int len = dt_imageio_jpeg_compress(buf, blob, width, height, MIN(100, MAX(10, cache_quality)));
+    // returns 1 on failure, real jpegs are a lot longer than that
+    if(len > 1) dt_mipmap_pack_write(cache->pack, imgid, mip, blob, len, color_space);
+    free(blob);
+    return;
+  }
+
+  char filename[PATH_MAX] = {0};
+  snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
+  int mkd = g_mkdir_with_parents(filename, 0750);
+  if(!mkd)
+  {
+    snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, imgid);
+    // Don't write existing files as both performance and quality (lossy jpg) suffer
+    FILE *f = NULL;
+    if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
+    {
+      // first check the disk isn't full
+      struct statvfs vfsbuf;
+      if (!statvfs(filename, &vfsbuf))
+      {
+        int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+        if (free_mb < 100)
+        {
+          fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
+          goto write_error;
+        }
+      }
+      else
+      {
+        fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
+        goto write_error;
+      }
+
+      const uint8_t *exif = NULL;
+      int exif_len = 0;
+      if(color_space == DT_COLORSPACE_SRGB)
+      {
+        exif = dt_mipmap_cache_exif_data_srgb;
+        exif_len = dt_mipmap_cache_exif_data_srgb_length;
+      }
+      else if(color_space == DT_COLORSPACE_ADOBERGB)
+      {
+        exif = dt_mipmap_cache_exif_data_adobergb;
+        exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+      }
+      if(dt_imageio_jpeg_write(filename, buf, width, height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
+      {
+write_error:
+        g_unlink(filename);
+      }
+    }
+    if(f) fclose(f);
+  }
+}
+
 void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
   dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
@@ -442,57 +556,10 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       {
         dt_mipmap_cache_unlink_ondisk_thumbnail(data, get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+      else if(!(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW))
       {
-        // serialize to disk
-        char filename[PATH_MAX] = {0};
-        snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
-        int mkd = g_mkdir_with_parents(filename, 0750);
-        if(!mkd)
-        {
-          snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, get_imgid(entry->key));
-          // Don't write existing files as both performance and quality (lossy jpg) suffer
-          FILE *f = NULL;
-          if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
-          {
-            // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if (!statvfs(filename, &vfsbuf))
-            {
-              int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if (free_mb < 100)
-              {
-                fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
-                goto write_error;
-              }
-            }
-            else
-            {
-              fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
-              goto write_error;
-            }
-
-            const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
-            {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
-            }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
-            {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
-            }
-            if(dt_imageio_jpeg_write(filename, entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
-            {
-write_error:
-              g_unlink(filename);
-            }
-          }
-          if(f) fclose(f);
-        }
+        _write_to_disk(cache, get_imgid(entry->key), mip, entry->data + sizeof(*dsc), dsc->width, dsc->height,
+                       dsc->color_space);
       }
     }
   }
@@ -509,6 +576,13 @@ static uint32_t nearest_power_of_two(const uint32_t value)
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
+  cache->pack = NULL;
+  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend_pack"))
+  {
+    char dirname[PATH_MAX] = { 0 };
+    snprintf(dirname, sizeof(dirname), "%s.d/pack", cache->cachedir);
+    cache->pack = dt_mipmap_pack_open(dirname);
+  }
   // make sure static memory is initialized
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_mipmap_cache_static_dead_image;
   dead_image_f((dt_mipmap_buffer_t *)(dsc + 1));
@@ -561,8 +635,12 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_misses = 0;
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
+  cache->max_requested_mip = DT_MIPMAP_0;
 
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  // a few independently locked shards per core, so thumbnail lookups scale with the cpu count:
+  const uint32_t num_shards = 4 * dt_get_num_threads();
+
+  dt_cache_init_sharded(&cache->mip_thumbs.cache, 0, max_mem, num_shards);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
 
@@ -571,13 +649,13 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   int32_t max_mem_bufs = nearest_power_of_two(full_entries);
 
   // for this buffer, because it can be very busy during import
-  dt_cache_init(&cache->mip_full.cache, 0, max_mem_bufs);
+  dt_cache_init_sharded(&cache->mip_full.cache, 0, max_mem_bufs, num_shards);
   dt_cache_set_allocate_callback(&cache->mip_full.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_full.cache, dt_mipmap_cache_deallocate_dynamic, cache);
   cache->buffer_size[DT_MIPMAP_FULL] = 0;
 
   // same for mipf:
-  dt_cache_init(&cache->mip_f.cache, 0, max_mem_bufs);
+  dt_cache_init_sharded(&cache->mip_f.cache, 0, max_mem_bufs, num_shards);
   dt_cache_set_allocate_callback(&cache->mip_f.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_f.cache, dt_mipmap_cache_deallocate_dynamic, cache);
   cache->buffer_size[DT_MIPMAP_F] = sizeof(struct dt_mipmap_buffer_dsc)
@@ -590,6 +668,13 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  if(cache->pack)
+  {
+    // all thumbnails are flushed now. rewrite the pack once half of it is replaced or removed thumbnails.
+    dt_mipmap_pack_compact(cache->pack, 0.5f);
+    dt_mipmap_pack_close(cache->pack);
+    cache->pack = NULL;
+  }
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -714,14 +799,15 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_on_disk(cache, imgid, mip, NULL)) return;
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_BLOCKING)
   {
+    // remember how large thumbnails got lately, _init_8() develops at that size
+    if(mip < DT_MIPMAP_F && (int)mip > cache->max_requested_mip) cache->max_requested_mip = mip;
+
     // simple case: blocking get
     dt_cache_entry_t *entry =  dt_cache_get_with_caller(&_get_cache(cache, mip)->cache, key, mode, file, line);
 
@@ -798,7 +884,17 @@ void dt_mipmap_cache_get_with_caller(
       {
         // 8-bit thumbs
         ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
-        _init_8((uint8_t *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &buf->color_space, imgid, mip);
+        int preview = 0;
+        _init_8((uint8_t *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &buf->color_space, imgid, mip,
+                &preview);
+        if(preview)
+        {
+          // show the embedded preview for now and develop the real thing when there is time
+          dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW;
+          dsc->generation = __sync_add_and_fetch(&cache->generation, 1);
+          dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG,
+                             dt_image_refine_thumbnail_job_create(imgid, mip));
+        }
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
@@ -897,13 +993,8 @@ void dt_mipmap_cache_get_with_caller(
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(cache->cachedir[0] && dt_mipmap_cache_on_disk(cache, imgid, mip, NULL))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -982,6 +1073,63 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
   }
 }
 
+void dt_mipmap_cache_refine(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(mip > DT_MIPMAP_7) return;
+  const uint32_t key = get_key(imgid, mip);
+  dt_cache_t *c = &_get_cache(cache, mip)->cache;
+
+  // nothing to do if it was evicted or refined in the meantime
+  if(!dt_cache_contains(c, key)) return;
+  dt_cache_entry_t *entry = dt_cache_get(c, key, 'r');
+  ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+  int is_preview = dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW;
+  const uint32_t generation = dsc->generation;
+  dt_cache_release(c, entry);
+  if(!is_preview) return;
+
+  // develop without holding the lock, so the preview can be drawn meanwhile
+  const uint32_t wd = cache->max_width[mip], ht = cache->max_height[mip];
+  uint8_t *tmp = dt_alloc_align(64, (size_t)wd * ht * 4);
+  if(!tmp) return;
+  uint32_t width = wd, height = ht;
+  float iscale = 1.0f;
+  dt_colorspaces_color_profile_type_t color_space = DT_COLORSPACE_NONE;
+  if(_develop_8(tmp, wd, ht, &width, &height, &iscale, &color_space, imgid, mip))
+  {
+    dt_free_align(tmp);
+    return;
+  }
+
+  // evicted or removed while we were busy. we can't tell if the history changed in between, so drop the
+  // result: the next get starts over from the embedded preview.
+  if(!dt_cache_contains(c, key))
+  {
+    dt_free_align(tmp);
+    return;
+  }
+  entry = dt_cache_get(c, key, 'w');
+  ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+  dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+  // a preview put in after we started belongs to a newer history (or is already refined by its own job)
+  is_preview = (dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW) && dsc->generation == generation;
+  if(is_preview)
+  {
+    ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
+    memcpy(dsc + 1, tmp, (size_t)width * height * 4);
+    dsc->width = width;
+    dsc->height = height;
+    dsc->iscale = iscale;
+    dsc->color_space = color_space;
+    dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW;
+  }
+  dt_cache_release(c, entry);
+  dt_free_align(tmp);
+
+  if(is_preview) g_idle_add(_raise_signal_mipmap_updated, 0);
+}
+
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
 {
   for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
@@ -1115,11 +1263,119 @@ static int _write_image(dt_imageio_module_data_t *data, const char *filename, co
   return 0;
 }
 
+/* downsample a freshly developed thumbnail to level `mip'. with `in_memory' the level is put into the cache
+   as well, unless it is there already. that only ever waits for smaller levels than the one the caller holds,
+   other threads only try-lock larger ones, so this can't deadlock. without it the level only goes to the disk
+   cache. */
+static void _init_from_larger(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                              const uint8_t *in, const uint32_t in_width, const uint32_t in_height,
+                              const dt_colorspaces_color_profile_type_t color_space, const gboolean in_memory)
+{
+  if(in_memory)
+  {
+    const uint32_t key = get_key(imgid, mip);
+    if(dt_cache_contains(&cache->mip_thumbs.cache, key)) return;
+    dt_cache_entry_t *entry = dt_cache_get(&cache->mip_thumbs.cache, key, 'w');
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    // someone else might have been quicker, or it was on disc already
+    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    {
+      ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
+      dt_iop_downsample_8(in, in_width, in_height, (uint8_t *)(dsc + 1), cache->max_width[mip],
+                          cache->max_height[mip], &dsc->width, &dsc->height);
+      dsc->iscale = 1.0f;
+      dsc->color_space = color_space;
+      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      _write_to_disk(cache, imgid, mip, (uint8_t *)(dsc + 1), dsc->width, dsc->height, color_space);
+    }
+    dt_cache_release(&cache->mip_thumbs.cache, entry);
+  }
+  else
+  {
+    if(dt_mipmap_cache_on_disk(cache, imgid, mip, NULL)) return;
+    uint8_t *tmp = dt_alloc_align(64, (size_t)cache->max_width[mip] * cache->max_height[mip] * 4);
+    if(!tmp) return;
+    uint32_t width, height;
+    dt_iop_downsample_8(in, in_width, in_height, tmp, cache->max_width[mip], cache->max_height[mip], &width,
+                        &height);
+    _write_to_disk(cache, imgid, mip, tmp, width, height, color_space);
+    dt_free_align(tmp);
+  }
+}
+
+// run the pixelpipe for level `size' into buf (max wd x ht), returns 0 on success.
+// also fills the smaller levels and, with the disk cache, a few larger ones.
+static int _develop_8(uint8_t *buf, const uint32_t wd, const uint32_t ht, uint32_t *width, uint32_t *height,
+                      float *iscale, dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
+                      const dt_mipmap_size_t size)
+{
+  // develop at the largest level asked for lately, but at most cache_disk_develop_larger steps up. the larger
+  // levels only go to the disk cache, so zooming in later doesn't have to run the pipeline again.
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  dt_mipmap_size_t level = size;
+  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+  {
+    const int larger = CLAMP(dt_conf_get_int("cache_disk_develop_larger"), 0, 2);
+    level = MIN(MAX((int)size, cache->max_requested_mip), MIN((int)size + larger, (int)DT_MIPMAP_7));
+  }
+  uint8_t *out = buf;
+  if(level != size)
+  {
+    out = dt_alloc_align(64, (size_t)cache->max_width[level] * cache->max_height[level] * 4);
+    if(!out)
+    {
+      level = size;
+      out = buf;
+    }
+  }
+
+  dt_imageio_module_format_t format;
+  _dummy_data_t dat;
+  format.bpp = _bpp;
+  format.write_image = _write_image;
+  format.levels = _levels;
+  dat.head.max_width = (level == size) ? wd : cache->max_width[level];
+  dat.head.max_height = (level == size) ? ht : cache->max_height[level];
+  dat.buf = out;
+  // export with flags: ignore exif (don't load from disk), don't swap byte order, don't do hq processing,
+  // no upscaling and signal we want thumbnail export
+  const int res
+      = dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, 1, 0, 0, 0, 1,
+                                     NULL, FALSE, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL, NULL, 1, 1);
+  if(!res)
+  {
+    *iscale = 1.0f;
+    *color_space = dt_mipmap_cache_get_colorspace();
+    if(level != size)
+    {
+      dt_print(DT_DEBUG_CACHE, "[_init_8] generate mip %d for image %d from level %d\n", size, imgid, level);
+      _write_to_disk(cache, imgid, level, out, dat.head.width, dat.head.height, *color_space);
+      for(int k = level - 1; k > size; k--)
+        _init_from_larger(cache, imgid, k, out, dat.head.width, dat.head.height, *color_space, FALSE);
+      dt_iop_downsample_8(out, dat.head.width, dat.head.height, buf, wd, ht, width, height);
+    }
+    else
+    {
+      // might be smaller, or have a different aspect than what we got as input.
+      *width = dat.head.width;
+      *height = dat.head.height;
+    }
+
+    // the expensive part is done, fill all smaller levels from it as well
+    for(int k = size - 1; k >= DT_MIPMAP_0; k--)
+      _init_from_larger(cache, imgid, k, buf, *width, *height, *color_space, TRUE);
+  }
+  if(out != buf) dt_free_align(out);
+  return res;
+}
+
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
-                    const dt_mipmap_size_t size)
+                    const dt_mipmap_size_t size, int *preview)
 {
   *iscale = 1.0f;
+  *preview = 0;
   const uint32_t wd = *width, ht = *height;
   char filename[PATH_MAX] = { 0 };
   gboolean from_cache = TRUE;
@@ -1143,7 +1399,11 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
   const int incompatible = !strncmp(cimg->exif_maker, "Phase One", 9);
   dt_image_cache_read_release(darktable.image_cache, cimg);
 
-  if(!altered && !dt_conf_get_bool("never_use_embedded_thumb") && !incompatible)
+  const int use_embedded = !altered && !dt_conf_get_bool("never_use_embedded_thumb");
+  // two phases: the embedded preview right away, the developed thumbnail later from a background job
+  const int preview_first = !use_embedded && darktable.gui && dt_conf_get_bool("embedded_thumb_first");
+
+  if((use_embedded || preview_first) && !incompatible)
   {
     const dt_image_orientation_t orientation = dt_image_get_orientation(imgid);
 
@@ -1175,7 +1435,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     {
       uint8_t *tmp = 0;
       int32_t thumb_width, thumb_height;
-      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space);
+      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space, wd, ht);
       if(!res)
       {
         // scale to fit
@@ -1185,6 +1445,8 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     }
   }
 
+  if(!res && preview_first) *preview = 1;
+
   if(res)
   {
     //try to generate mip from larger mip
@@ -1196,8 +1458,11 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
         continue;
       dt_print(DT_DEBUG_CACHE, "[_init_8] generate mip %d for %s from level %d\n", size, filename, k);
       *color_space = tmp.color_space;
+      // a downscaled preview is still only a preview
+      if(((struct dt_mipmap_buffer_dsc *)tmp.cache_entry->data)->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREVIEW)
+        *preview = 1;
       // downsample
-      dt_iop_flip_and_zoom_8(tmp.buf, tmp.width, tmp.height, buf, wd, ht, ORIENTATION_NONE, width, height);
+      dt_iop_downsample_8(tmp.buf, tmp.width, tmp.height, buf, wd, ht, width, height);
 
       dt_mipmap_cache_release(darktable.mipmap_cache, &tmp);
       res = 0;
@@ -1205,30 +1470,8 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     }
   }
 
-  if(res)
-  {
-    // try the real thing: rawspeed + pixelpipe
-    dt_imageio_module_format_t format;
-    _dummy_data_t dat;
-    format.bpp = _bpp;
-    format.write_image = _write_image;
-    format.levels = _levels;
-    dat.head.max_width = wd;
-    dat.head.max_height = ht;
-    dat.buf = buf;
-    // export with flags: ignore exif (don't load from disk), don't swap byte order, don't do hq processing,
-    // no upscaling and signal we want thumbnail export
-    res = dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, 1, 0, 0, 0, 1,
-                                       NULL, FALSE, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL, NULL, 1, 1);
-    if(!res)
-    {
-      // might be smaller, or have a different aspect than what we got as input.
-      *width = dat.head.width;
-      *height = dat.head.height;
-      *iscale = 1.0f;
-      *color_space = dt_mipmap_cache_get_colorspace();
-    }
-  }
+  // try the real thing: rawspeed + pixelpipe
+  if(res) res = _develop_8(buf, wd, ht, width, height, iscale, color_space, imgid, size);
 
   // fprintf(stderr, "[mipmap init 8] export image %u finished (sizes %d %d => %d %d)!\n", imgid, wd, ht,
   // dat.head.width, dat.head.height);
@@ -1244,7 +1487,6 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
   }
 
   // TODO: various speed optimizations:
-  // TODO: also init all smaller mips!
   // TODO: use mipf, but:
   // TODO: if output is cropped, don't use mipf!
 }
@@ -1256,9 +1498,39 @@ dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace()
   return DT_COLORSPACE_DISPLAY;
 }
 
+int dt_mipmap_cache_on_disk(const dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                            int64_t *timestamp)
+{
+  if(cache->pack) return dt_mipmap_pack_contains(cache->pack, imgid, mip, timestamp);
+  if(!cache->cachedir[0]) return 0;
+
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, imgid);
+  GStatBuf statbuf;
+  if(g_stat(filename, &statbuf)) return 0;
+  if(timestamp) *timestamp = statbuf.st_mtime;
+  return 1;
+}
+
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid)
 {
-  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+  if(cache->pack && dt_conf_get_bool("cache_disk_backend"))
+  {
+    for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
+    {
+      size_t len = 0;
+      int color_space = DT_COLORSPACE_NONE;
+      const uint8_t *blob = dt_mipmap_pack_read_get(cache->pack, src_imgid, mip, &len, &color_space);
+      if(!blob) continue;
+      // can't append while the mapping is held
+      uint8_t *copy = (uint8_t *)malloc(len);
+      if(copy) memcpy(copy, blob, len);
+      dt_mipmap_pack_read_release(cache->pack);
+      if(copy) dt_mipmap_pack_write(cache->pack, dst_imgid, mip, copy, len, color_space);
+      free(copy);
+    }
+  }
+  else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
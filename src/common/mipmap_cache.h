@@ -99,6 +99,14 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // disk backend that keeps all thumbnails in one pack file, NULL when using one jpeg file per thumbnail
+  struct dt_mipmap_pack_t *pack;
+
+  // largest thumbnail level requested so far. thumbnails are developed up to cache_disk_develop_larger
+  // levels larger than asked for, to fill the disk cache for zooming in.
+  int32_t max_requested_mip;
+  // stamps the embedded previews, see dt_mipmap_cache_refine()
+  uint32_t generation;
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -142,6 +150,9 @@ void dt_mipmap_cache_release_with_caller(dt_mipmap_cache_t *cache, dt_mipmap_buf
 // remove thumbnails, so they will be regenerated:
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid);
 
+// replace the embedded preview in a thumbnail by the developed image, if it is still cached and still a preview:
+void dt_mipmap_cache_refine(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip);
+
 // evict thumbnails from cache. They will be written to disc if not existing
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid);
 
@@ -159,6 +170,10 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(
 // returns the colorspace to use for created thumbnails, takes config into account
 dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace();
 
+// returns non-zero if the disk cache holds this thumbnail, and when it was written if timestamp is not NULL
+int dt_mipmap_cache_on_disk(const dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                            int64_t *timestamp);
+
 // copy over thumbnails. used by file operation that copies raw files, to speed up thumbnail generation.
 // only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid);
@@ -0,0 +1,519 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#define DT_MIPMAP_PACK_MAGIC "dt-thumbpack"
+#define DT_MIPMAP_PACK_VERSION 1
+
+// first bytes of both the index and the pack file. the id pairs them up, so a pack is never read
+// through an index written for a different one.
+typedef struct dt_mipmap_pack_header_t
+{
+  char magic[12];
+  uint32_t version;
+  uint32_t id;
+  uint32_t padding;
+} dt_mipmap_pack_header_t;
+
+// one record per write or removal, appended to the index file
+typedef struct dt_mipmap_pack_record_t
+{
+  uint32_t imgid;
+  int32_t mip;
+  uint64_t offset;
+  uint32_t length; // 0 marks a removed thumbnail
+  int32_t color_space;
+  int64_t timestamp;
+} dt_mipmap_pack_record_t;
+
+typedef struct dt_mipmap_pack_entry_t
+{
+  int64_t key; // has to stay first, it's the key of the hash table
+  dt_mipmap_pack_record_t record;
+} dt_mipmap_pack_entry_t;
+
+typedef struct dt_mipmap_pack_t
+{
+  char pack_filename[PATH_MAX];
+  char index_filename[PATH_MAX];
+
+  // protects the index, the file descriptors and appending
+  dt_pthread_mutex_t lock;
+  int pack_fd, index_fd;
+  uint32_t id;
+  uint64_t pack_size;        // end of the data in the pack file
+  uint64_t live_size;        // bytes of it still referenced by the index
+  GHashTable *index;         // key -> dt_mipmap_pack_entry_t
+
+  // protects the mapping. always taken before lock, never after.
+  dt_pthread_rwlock_t map_lock;
+  uint8_t *map;
+  size_t map_size;
+} dt_mipmap_pack_t;
+
+static inline int64_t _key(const uint32_t imgid, const int mip)
+{
+  return ((int64_t)imgid << 8) | (mip & 0xff);
+}
+
+static int _write_all(const int fd, const void *buf, size_t length, off_t offset)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  while(length > 0)
+  {
+    const ssize_t written = pwrite(fd, p, length, offset);
+    if(written < 0 && errno == EINTR) continue;
+    if(written <= 0) return 1;
+    p += written;
+    offset += written;
+    length -= written;
+  }
+  return 0;
+}
+
+static int _write_header(const int fd, const uint32_t id)
+{
+  dt_mipmap_pack_header_t header = { { 0 }, DT_MIPMAP_PACK_VERSION, id, 0 };
+  memcpy(header.magic, DT_MIPMAP_PACK_MAGIC, sizeof(header.magic));
+  return _write_all(fd, &header, sizeof(header), 0);
+}
+
+static int _read_header(const int fd, uint32_t *id)
+{
+  dt_mipmap_pack_header_t header;
+  if(pread(fd, &header, sizeof(header), 0) != sizeof(header)) return 1;
+  if(memcmp(header.magic, DT_MIPMAP_PACK_MAGIC, sizeof(header.magic)) || header.version != DT_MIPMAP_PACK_VERSION)
+    return 1;
+  *id = header.id;
+  return 0;
+}
+
+// start over with an empty pack
+static int _reset(dt_mipmap_pack_t *pack)
+{
+  pack->id = g_random_int();
+  pack->pack_size = sizeof(dt_mipmap_pack_header_t);
+  if(ftruncate(pack->index_fd, 0) || ftruncate(pack->pack_fd, 0)) return 1;
+  return _write_header(pack->pack_fd, pack->id) || _write_header(pack->index_fd, pack->id);
+}
+
+// needs lock
+static int _append_record(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *record)
+{
+  const off_t end = lseek(pack->index_fd, 0, SEEK_END);
+  if(end < 0) return 1;
+  return _write_all(pack->index_fd, record, sizeof(*record), end);
+}
+
+// needs lock, takes ownership of nothing
+static void _index_insert(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *record)
+{
+  const int64_t key = _key(record->imgid, record->mip);
+  dt_mipmap_pack_entry_t *old = (dt_mipmap_pack_entry_t *)g_hash_table_lookup(pack->index, &key);
+  if(old)
+  {
+    pack->live_size -= old->record.length;
+    g_hash_table_remove(pack->index, &key);
+  }
+  if(record->length == 0) return;
+
+  dt_mipmap_pack_entry_t *entry = (dt_mipmap_pack_entry_t *)malloc(sizeof(dt_mipmap_pack_entry_t));
+  entry->key = key;
+  entry->record = *record;
+  g_hash_table_insert(pack->index, &entry->key, entry);
+  pack->live_size += record->length;
+}
+
+// read the index log, later records override earlier ones. records pointing past the end of the
+// pack (the data didn't make it to disc) and everything after them are dropped. removals have neither
+// offset nor length, they only drop the earlier record.
+static int _read_index(dt_mipmap_pack_t *pack)
+{
+  struct stat st;
+  if(fstat(pack->pack_fd, &st)) return 1;
+
+  uint32_t pack_id = 0, index_id = 0;
+  if(_read_header(pack->pack_fd, &pack_id) || _read_header(pack->index_fd, &index_id) || pack_id != index_id)
+  {
+    if(st.st_size > 0) fprintf(stderr, "[mipmap_pack] discarding thumbnail pack `%s'\n", pack->pack_filename);
+    return _reset(pack);
+  }
+  pack->id = pack_id;
+  pack->pack_size = st.st_size;
+
+  off_t offset = sizeof(dt_mipmap_pack_header_t);
+  dt_mipmap_pack_record_t records[256];
+  gboolean done = FALSE;
+  while(!done)
+  {
+    const ssize_t n = pread(pack->index_fd, records, sizeof(records), offset);
+    const int count = n > 0 ? n / sizeof(dt_mipmap_pack_record_t) : 0;
+    if((size_t)count < sizeof(records) / sizeof(dt_mipmap_pack_record_t)) done = TRUE;
+    for(int k = 0; k < count; k++)
+    {
+      if(records[k].length != 0
+         && (records[k].offset < sizeof(dt_mipmap_pack_header_t)
+             || records[k].offset + records[k].length > pack->pack_size))
+      {
+        done = TRUE;
+        break;
+      }
+      _index_insert(pack, records + k);
+      offset += sizeof(dt_mipmap_pack_record_t);
+    }
+  }
+  // cut off whatever didn't parse, so new records line up again
+  if(ftruncate(pack->index_fd, offset)) return 1;
+
+  return 0;
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *dirname)
+{
+  if(g_mkdir_with_parents(dirname, 0750))
+  {
+    fprintf(stderr, "[mipmap_pack] could not create directory `%s'\n", dirname);
+    return NULL;
+  }
+
+  dt_mipmap_pack_t *pack = (dt_mipmap_pack_t *)calloc(1, sizeof(dt_mipmap_pack_t));
+  snprintf(pack->pack_filename, sizeof(pack->pack_filename), "%s/thumbnails.pack", dirname);
+  snprintf(pack->index_filename, sizeof(pack->index_filename), "%s/thumbnails.idx", dirname);
+  pack->index = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+  dt_pthread_mutex_init(&pack->lock, NULL);
+  dt_pthread_rwlock_init(&pack->map_lock, NULL);
+
+  pack->pack_fd = open(pack->pack_filename, O_RDWR | O_CREAT, 0640);
+  pack->index_fd = open(pack->index_filename, O_RDWR | O_CREAT, 0640);
+  if(pack->pack_fd < 0 || pack->index_fd < 0 || _read_index(pack))
+  {
+    fprintf(stderr, "[mipmap_pack] could not open thumbnail pack in `%s'\n", dirname);
+    if(pack->pack_fd >= 0) close(pack->pack_fd);
+    if(pack->index_fd >= 0) close(pack->index_fd);
+    g_hash_table_destroy(pack->index);
+    dt_pthread_mutex_destroy(&pack->lock);
+    dt_pthread_rwlock_destroy(&pack->map_lock);
+    free(pack);
+    return NULL;
+  }
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] %u thumbnails, %.1f of %.1f MB in use\n",
+           g_hash_table_size(pack->index), pack->live_size / (1024.0 * 1024.0),
+           pack->pack_size / (1024.0 * 1024.0));
+  return pack;
+}
+
+// needs the map lock held for writing
+static void _unmap(dt_mipmap_pack_t *pack)
+{
+  if(pack->map) munmap(pack->map, pack->map_size);
+  pack->map = NULL;
+  pack->map_size = 0;
+}
+
+// needs the map lock held for writing
+static void _remap(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const size_t size = pack->pack_size;
+  dt_pthread_mutex_unlock(&pack->lock);
+  if(size <= pack->map_size) return;
+
+  _unmap(pack);
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, pack->pack_fd, 0);
+  if(map == MAP_FAILED)
+  {
+    fprintf(stderr, "[mipmap_pack] could not map `%s': %s\n", pack->pack_filename, strerror(errno));
+    return;
+  }
+  // thumbnails are read in collection order, which compaction made file order
+  madvise(map, size, MADV_SEQUENTIAL);
+  pack->map = map;
+  pack->map_size = size;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  dt_pthread_rwlock_wrlock(&pack->map_lock);
+  _unmap(pack);
+  dt_pthread_rwlock_unlock(&pack->map_lock);
+  close(pack->pack_fd);
+  close(pack->index_fd);
+  g_hash_table_destroy(pack->index);
+  dt_pthread_mutex_destroy(&pack->lock);
+  dt_pthread_rwlock_destroy(&pack->map_lock);
+  free(pack);
+}
+
+const uint8_t *dt_mipmap_pack_read_get(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip,
+                                       size_t *length, int *color_space)
+{
+  const int64_t key = _key(imgid, mip);
+  dt_pthread_mutex_lock(&pack->lock);
+  dt_mipmap_pack_entry_t *entry = (dt_mipmap_pack_entry_t *)g_hash_table_lookup(pack->index, &key);
+  if(!entry)
+  {
+    dt_pthread_mutex_unlock(&pack->lock);
+    return NULL;
+  }
+  const dt_mipmap_pack_record_t record = entry->record;
+  dt_pthread_mutex_unlock(&pack->lock);
+
+  dt_pthread_rwlock_rdlock(&pack->map_lock);
+  if(record.offset + record.length > pack->map_size)
+  {
+    // appended after the last mapping
+    dt_pthread_rwlock_unlock(&pack->map_lock);
+    dt_pthread_rwlock_wrlock(&pack->map_lock);
+    _remap(pack);
+    dt_pthread_rwlock_unlock(&pack->map_lock);
+    dt_pthread_rwlock_rdlock(&pack->map_lock);
+    if(record.offset + record.length > pack->map_size)
+    {
+      dt_pthread_rwlock_unlock(&pack->map_lock);
+      return NULL;
+    }
+  }
+
+  *length = record.length;
+  *color_space = record.color_space;
+  return pack->map + record.offset;
+}
+
+void dt_mipmap_pack_read_release(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_rwlock_unlock(&pack->map_lock);
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, const uint8_t *blob,
+                         const size_t length, const int color_space)
+{
+  if(length == 0 || length > UINT32_MAX) return 1;
+
+  // first check the disk isn't full
+  struct statvfs vfsbuf;
+  if(!statvfs(pack->pack_filename, &vfsbuf))
+  {
+    const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+    if(free_mb < 100)
+    {
+      fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb,
+              pack->pack_filename);
+      return 1;
+    }
+  }
+
+  dt_pthread_mutex_lock(&pack->lock);
+  dt_mipmap_pack_record_t record = { 0 };
+  record.imgid = imgid;
+  record.mip = mip;
+  record.offset = pack->pack_size;
+  record.length = length;
+  record.color_space = color_space;
+  record.timestamp = time(NULL);
+  // data first, a record without its data is dropped when reading the index
+  if(_write_all(pack->pack_fd, blob, length, record.offset) || _append_record(pack, &record))
+  {
+    dt_pthread_mutex_unlock(&pack->lock);
+    fprintf(stderr, "[mipmap_pack] could not write thumbnail of image %u to `%s'\n", imgid, pack->pack_filename);
+    return 1;
+  }
+  pack->pack_size += length;
+  _index_insert(pack, &record);
+  dt_pthread_mutex_unlock(&pack->lock);
+  return 0;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip)
+{
+  const int64_t key = _key(imgid, mip);
+  dt_pthread_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->index, &key))
+  {
+    dt_mipmap_pack_record_t record = { 0 };
+    record.imgid = imgid;
+    record.mip = mip;
+    record.timestamp = time(NULL);
+    _append_record(pack, &record);
+    _index_insert(pack, &record);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+int dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, int64_t *timestamp)
+{
+  const int64_t key = _key(imgid, mip);
+  dt_pthread_mutex_lock(&pack->lock);
+  dt_mipmap_pack_entry_t *entry = (dt_mipmap_pack_entry_t *)g_hash_table_lookup(pack->index, &key);
+  if(entry && timestamp) *timestamp = entry->record.timestamp;
+  dt_pthread_mutex_unlock(&pack->lock);
+  return entry != NULL;
+}
+
+static gint _entry_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_mipmap_pack_entry_t *ea = *(const dt_mipmap_pack_entry_t **)a;
+  const dt_mipmap_pack_entry_t *eb = *(const dt_mipmap_pack_entry_t **)b;
+  return (ea->key > eb->key) - (ea->key < eb->key);
+}
+
+void dt_mipmap_pack_compact(dt_mipmap_pack_t *pack, const float min_garbage)
+{
+  dt_pthread_rwlock_wrlock(&pack->map_lock);
+  _remap(pack);
+  dt_pthread_mutex_lock(&pack->lock);
+
+  const uint64_t garbage = pack->pack_size - pack->live_size;
+  if(pack->pack_size == 0 || garbage < min_garbage * pack->pack_size || pack->map_size < pack->pack_size)
+    goto done;
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] compacting, %.1f of %.1f MB are garbage\n", garbage / (1024.0 * 1024.0),
+           pack->pack_size / (1024.0 * 1024.0));
+
+  // live thumbnails in (imgid, mip) order
+  GPtrArray *entries = g_ptr_array_sized_new(g_hash_table_size(pack->index));
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pack->index);
+  while(g_hash_table_iter_next(&iter, &key, &value)) g_ptr_array_add(entries, value);
+  g_ptr_array_sort(entries, _entry_cmp);
+
+  char pack_tmp[PATH_MAX], index_tmp[PATH_MAX];
+  snprintf(pack_tmp, sizeof(pack_tmp), "%s.tmp", pack->pack_filename);
+  snprintf(index_tmp, sizeof(index_tmp), "%s.tmp", pack->index_filename);
+  const int pack_fd = open(pack_tmp, O_RDWR | O_CREAT | O_TRUNC, 0640);
+  const int index_fd = open(index_tmp, O_RDWR | O_CREAT | O_TRUNC, 0640);
+  const uint32_t id = g_random_int();
+  int err = pack_fd < 0 || index_fd < 0 || _write_header(pack_fd, id) || _write_header(index_fd, id);
+
+  uint64_t offset = sizeof(dt_mipmap_pack_header_t);
+  dt_mipmap_pack_record_t *records
+      = (dt_mipmap_pack_record_t *)malloc(sizeof(dt_mipmap_pack_record_t) * MAX(entries->len, 1));
+  for(guint k = 0; k < entries->len && !err; k++)
+  {
+    const dt_mipmap_pack_entry_t *entry = (const dt_mipmap_pack_entry_t *)g_ptr_array_index(entries, k);
+    records[k] = entry->record;
+    records[k].offset = offset;
+    err = _write_all(pack_fd, pack->map + entry->record.offset, entry->record.length, offset);
+    offset += entry->record.length;
+  }
+  if(!err)
+    err = _write_all(index_fd, records, sizeof(dt_mipmap_pack_record_t) * entries->len,
+                     sizeof(dt_mipmap_pack_header_t));
+  if(!err) err = fsync(pack_fd) || fsync(index_fd);
+  // should only one of the renames go through, the ids don't match and the pack starts over
+  if(!err) err = g_rename(pack_tmp, pack->pack_filename) || g_rename(index_tmp, pack->index_filename);
+
+  if(err)
+  {
+    fprintf(stderr, "[mipmap_pack] compacting `%s' failed\n", pack->pack_filename);
+    if(pack_fd >= 0) close(pack_fd);
+    if(index_fd >= 0) close(index_fd);
+    g_unlink(pack_tmp);
+    g_unlink(index_tmp);
+  }
+  else
+  {
+    close(pack->pack_fd);
+    close(pack->index_fd);
+    pack->pack_fd = pack_fd;
+    pack->index_fd = index_fd;
+    for(guint k = 0; k < entries->len; k++)
+      ((dt_mipmap_pack_entry_t *)g_ptr_array_index(entries, k))->record.offset = records[k].offset;
+    pack->id = id;
+    pack->pack_size = offset;
+    _unmap(pack);
+  }
+
+  free(records);
+  g_ptr_array_free(entries, TRUE);
+
+done:
+  dt_pthread_mutex_unlock(&pack->lock);
+  dt_pthread_rwlock_unlock(&pack->map_lock);
+}
+
+#else // _WIN32
+
+// no mmap here, the thumbnail cache keeps using one file per thumbnail
+
+struct dt_mipmap_pack_t *dt_mipmap_pack_open(const char *dirname)
+{
+  return NULL;
+}
+
+void dt_mipmap_pack_close(struct dt_mipmap_pack_t *pack)
+{
+}
+
+const uint8_t *dt_mipmap_pack_read_get(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip,
+                                       size_t *length, int *color_space)
+{
+  return NULL;
+}
+
+void dt_mipmap_pack_read_release(struct dt_mipmap_pack_t *pack)
+{
+}
+
+int dt_mipmap_pack_write(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, const uint8_t *blob,
+                         const size_t length, const int color_space)
+{
+  return 1;
+}
+
+void dt_mipmap_pack_remove(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip)
+{
+}
+
+int dt_mipmap_pack_contains(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, int64_t *timestamp)
+{
+  return 0;
+}
+
+void dt_mipmap_pack_compact(struct dt_mipmap_pack_t *pack, const float min_garbage)
+{
+}
+
+#endif // _WIN32
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,60 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * alternative disk backend for the thumbnail cache: instead of one jpeg file per image and mip level,
+ * all compressed thumbnails are appended to one pack file and an index file records where each
+ * (imgid, mip) lives. the pack is read through mmap, removing a thumbnail only appends a tombstone
+ * to the index and dt_mipmap_pack_compact() rewrites the live thumbnails in (imgid, mip) order.
+ *
+ * all functions are thread safe.
+ */
+
+struct dt_mipmap_pack_t;
+
+/** open (or create) the pack in the given directory, returns NULL if that's not possible on this platform. */
+struct dt_mipmap_pack_t *dt_mipmap_pack_open(const char *dirname);
+/** close the pack, the index is on disk already. */
+void dt_mipmap_pack_close(struct dt_mipmap_pack_t *pack);
+
+/** look up a thumbnail. on success, returns a pointer into the mapped pack that stays valid until
+ * dt_mipmap_pack_read_release() is called, and fills length and color space. returns NULL if there is none. */
+const uint8_t *dt_mipmap_pack_read_get(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip,
+                                       size_t *length, int *color_space);
+/** release the mapping again, has to be called after every successful dt_mipmap_pack_read_get(). */
+void dt_mipmap_pack_read_release(struct dt_mipmap_pack_t *pack);
+
+/** append a compressed thumbnail, replacing an older one of the same image and level. returns 0 on success. */
+int dt_mipmap_pack_write(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, const uint8_t *blob,
+                         const size_t length, const int color_space);
+/** drop a thumbnail from the pack. */
+void dt_mipmap_pack_remove(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip);
+/** returns non-zero if the pack holds this thumbnail and fills in the time it was written, if timestamp is not NULL. */
+int dt_mipmap_pack_contains(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, int64_t *timestamp);
+
+/** rewrite the pack without removed or replaced thumbnails, if at least min_garbage of it is garbage. */
+void dt_mipmap_pack_compact(struct dt_mipmap_pack_t *pack, const float min_garbage);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,353 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/nlmeans_core.h"
+#include "common/avx.h"
+#include "common/darktable.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// size of the tiles handed to the threads. a tile and its apron of P + K pixels have to stay in the L2 cache
+// while all shift vectors run over it, the squared differences of a shift vector take another (64 + 2P)^2
+// floats.
+#define NLMEANS_TILE 64
+
+typedef union floatint_t
+{
+  float f;
+  uint32_t i;
+} floatint_t;
+
+// very fast approximation for 2^-x (returns 0 for x > 126)
+static inline float fast_mexp2f(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = i1 + x * (i2 - i1);
+  floatint_t k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+/** first column of the patch around x. patches are moved inside the image at the left and right border. */
+static inline int patch_left(const int x, const int P, const int width)
+{
+  return MAX(0, MIN(x - P, width - 1 - 2 * P));
+}
+
+typedef void((*nlmeans_dist_row_t)(float *const d, const float *a, const float *b, const int n,
+                                    const float *const norm));
+typedef void((*nlmeans_accum_row_t)(float *out, const float *ins, const float *const dist, const int n,
+                                     const float scale, const float offset));
+
+/** weighted squared differences of the n pixels in a and b. */
+static void dist_row(float *const d, const float *a, const float *b, const int n, const float *const norm)
+{
+  for(int i = 0; i < n; i++, a += 4, b += 4)
+  {
+    float sum = 0.0f;
+    for(int k = 0; k < 3; k++) sum += (a[k] - b[k]) * (a[k] - b[k]) * norm[k];
+    d[i] = sum;
+  }
+}
+
+/** add the neighbours ins of n pixels to out, weighted by their patch distances, and the weights to out[3]. */
+static void accum_row(float *out, const float *ins, const float *const dist, const int n, const float scale,
+                      const float offset)
+{
+  for(int i = 0; i < n; i++, out += 4, ins += 4)
+  {
+    const float w = fast_mexp2f(fmaxf(0.0f, dist[i] * scale - offset));
+    for(int c = 0; c < 3; c++) out[c] += ins[c] * w;
+    out[3] += w;
+  }
+}
+
+#if defined(__SSE2__)
+static inline __m128 fast_mexp2f_sse2(const __m128 x)
+{
+  const __m128 i1 = _mm_set1_ps((float)0x3f800000u); // 2^0
+  const __m128 i2 = _mm_set1_ps((float)0x3f000000u); // 2^-1
+  const __m128 k0 = i1 + x * (i2 - i1);
+  const __m128 valid = _mm_cmpge_ps(k0, _mm_set1_ps((float)0x800000u));
+  return _mm_and_ps(valid, _mm_castsi128_ps(_mm_cvttps_epi32(k0)));
+}
+
+static void dist_row_sse2(float *const d, const float *a, const float *b, const int n, const float *const norm)
+{
+  const __m128 n0 = _mm_set1_ps(norm[0]), n1 = _mm_set1_ps(norm[1]), n2 = _mm_set1_ps(norm[2]);
+  int i = 0;
+  for(; i + 4 <= n; i += 4, a += 16, b += 16)
+  {
+    const __m128 d1 = _mm_load_ps(a) - _mm_load_ps(b);
+    const __m128 d2 = _mm_load_ps(a + 4) - _mm_load_ps(b + 4);
+    const __m128 d3 = _mm_load_ps(a + 8) - _mm_load_ps(b + 8);
+    const __m128 d4 = _mm_load_ps(a + 12) - _mm_load_ps(b + 12);
+
+    // transpose, one channel of the four pixels per vector
+    const __m128 d12lo = _mm_unpacklo_ps(d1, d2);
+    const __m128 d34lo = _mm_unpacklo_ps(d3, d4);
+    const __m128 d12hi = _mm_unpackhi_ps(d1, d2);
+    const __m128 d34hi = _mm_unpackhi_ps(d3, d4);
+    const __m128 c0 = _mm_movelh_ps(d12lo, d34lo);
+    const __m128 c1 = _mm_movehl_ps(d34lo, d12lo);
+    const __m128 c2 = _mm_movelh_ps(d12hi, d34hi);
+
+    _mm_storeu_ps(d + i, c0 * c0 * n0 + c1 * c1 * n1 + c2 * c2 * n2);
+  }
+  dist_row(d + i, a, b, n - i, norm);
+}
+
+static inline void accum_px_sse2(float *const out, const float *const ins, const __m128 w)
+{
+  // the weight goes to out[3] as is
+  const __m128 rgb = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  const __m128 v = _mm_or_ps(_mm_and_ps(_mm_load_ps(ins), rgb), _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+  _mm_store_ps(out, _mm_load_ps(out) + v * w);
+}
+
+static void accum_row_sse2(float *out, const float *ins, const float *const dist, const int n, const float scale,
+                           const float offset)
+{
+  const __m128 sc = _mm_set1_ps(scale), off = _mm_set1_ps(offset);
+  int i = 0;
+  for(; i + 4 <= n; i += 4, out += 16, ins += 16)
+  {
+    const __m128 w = fast_mexp2f_sse2(_mm_max_ps(_mm_setzero_ps(), _mm_loadu_ps(dist + i) * sc - off));
+    accum_px_sse2(out, ins, _mm_shuffle_ps(w, w, _MM_SHUFFLE(0, 0, 0, 0)));
+    accum_px_sse2(out + 4, ins + 4, _mm_shuffle_ps(w, w, _MM_SHUFFLE(1, 1, 1, 1)));
+    accum_px_sse2(out + 8, ins + 8, _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 2, 2)));
+    accum_px_sse2(out + 12, ins + 12, _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 3, 3)));
+  }
+  accum_row(out, ins, dist + i, n - i, scale, offset);
+}
+#endif
+
+#if defined(HAVE_AVX_CODEPATHS)
+DT_TARGET_AVX2 static inline __m256 fast_mexp2f_avx2(const __m256 x)
+{
+  const __m256 i1 = _mm256_set1_ps((float)0x3f800000u); // 2^0
+  const __m256 i2 = _mm256_set1_ps((float)0x3f000000u); // 2^-1
+  const __m256 k0 = i1 + x * (i2 - i1);
+  const __m256 valid = _mm256_cmp_ps(k0, _mm256_set1_ps((float)0x800000u), _CMP_GE_OQ);
+  return _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cvttps_epi32(k0)));
+}
+
+/** same as dist_row_sse2(), eight pixels at a time. */
+DT_TARGET_AVX2 static void dist_row_avx2(float *const d, const float *a, const float *b, const int n,
+                                         const float *const norm)
+{
+  const __m256 n2 = _mm256_setr_ps(norm[0], norm[1], norm[2], 0.0f, norm[0], norm[1], norm[2], 0.0f);
+  // hadd leaves the pixels in order 0 2 4 6 1 3 5 7
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int i = 0;
+  for(; i + 8 <= n; i += 8, a += 32, b += 32)
+  {
+    const __m256 d01 = _mm256_loadu_ps(a) - _mm256_loadu_ps(b);
+    const __m256 d23 = _mm256_loadu_ps(a + 8) - _mm256_loadu_ps(b + 8);
+    const __m256 d45 = _mm256_loadu_ps(a + 16) - _mm256_loadu_ps(b + 16);
+    const __m256 d67 = _mm256_loadu_ps(a + 24) - _mm256_loadu_ps(b + 24);
+    const __m256 sum = _mm256_hadd_ps(_mm256_hadd_ps(d01 * d01 * n2, d23 * d23 * n2),
+                                      _mm256_hadd_ps(d45 * d45 * n2, d67 * d67 * n2));
+    _mm256_storeu_ps(d + i, _mm256_permutevar8x32_ps(sum, order));
+  }
+  // gcc doesn't clear the upper halves before the tail call, the sse code after it would pay for that
+  _mm256_zeroupper();
+  dist_row(d + i, a, b, n - i, norm);
+}
+
+DT_TARGET_AVX2 static inline void accum_px_avx2(float *const out, const float *const ins, const __m256 w)
+{
+  const __m256 v = _mm256_blend_ps(_mm256_loadu_ps(ins), _mm256_set1_ps(1.0f), 0x88);
+  _mm256_storeu_ps(out, _mm256_fmadd_ps(v, w, _mm256_loadu_ps(out)));
+}
+
+/** same as accum_row_sse2(), eight weights and two pixels at a time. */
+DT_TARGET_AVX2 static void accum_row_avx2(float *out, const float *ins, const float *const dist, const int n,
+                                          const float scale, const float offset)
+{
+  const __m256 sc = _mm256_set1_ps(scale), off = _mm256_set1_ps(offset);
+  int i = 0;
+  for(; i + 8 <= n; i += 8, out += 32, ins += 32)
+  {
+    const __m256 w = fast_mexp2f_avx2(_mm256_max_ps(_mm256_setzero_ps(), _mm256_loadu_ps(dist + i) * sc - off));
+    // spread the weights of pixels 2k and 2k + 1 over the two lanes
+    const __m256 w01 = _mm256_permutevar8x32_ps(w, _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1));
+    const __m256 w23 = _mm256_permutevar8x32_ps(w, _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3));
+    const __m256 w45 = _mm256_permutevar8x32_ps(w, _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5));
+    const __m256 w67 = _mm256_permutevar8x32_ps(w, _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7));
+    accum_px_avx2(out, ins, w01);
+    accum_px_avx2(out + 8, ins + 8, w23);
+    accum_px_avx2(out + 16, ins + 16, w45);
+    accum_px_avx2(out + 24, ins + 24, w67);
+  }
+  _mm256_zeroupper();
+  accum_row(out, ins, dist + i, n - i, scale, offset);
+}
+#endif
+
+/** run all shift vectors over the tile x0..x1, y0..y1. */
+static void nlmeans_tile(const float *const in, float *const out, const int width, const int height,
+                         const int x0, const int y0, const int x1, const int y1,
+                         const dt_nlmeans_param_t *const params, float *const scratch,
+                         nlmeans_dist_row_t dist_row_f, nlmeans_accum_row_t accum_row_f)
+{
+  const int P = params->patch_radius;
+  const int K = params->search_radius;
+  // columns touched by the patches of the tile
+  const int left = patch_left(x0, P, width);
+  const int right = MIN(width, patch_left(x1 - 1, P, width) + 2 * P + 1);
+  const int cols = right - left;
+  float *const D = scratch;                                      // squared differences, (tile + 2P) rows
+  float *const V = D + (size_t)(NLMEANS_TILE + 2 * P) * cols;   // sums over the patch rows
+  float *const dist = V + cols;                                  // patch distances of one row of the tile
+
+  for(int y = y0; y < y1; y++) memset(out + 4 * ((size_t)width * y + x0), 0, sizeof(float) * 4 * (x1 - x0));
+
+  for(int kj = -K; kj <= K; kj++)
+  {
+    // rows where the pixel and its neighbour are both inside
+    const int rmin = MAX(0, -kj), rmax = MIN(height, height - kj);
+    const int ya = MAX(y0, rmin), yb = MIN(y1, rmax);
+    if(ya >= yb) continue;
+    // rows of squared differences needed for those. patches are cut at the top and bottom
+    const int ra = MAX(ya - P, rmin), rb = MIN(yb - 1 + P, rmax - 1);
+
+    for(int ki = -K; ki <= K; ki++)
+    {
+      // same for columns. neighbours outside don't count, their squared differences are zero
+      const int xa = MAX(x0, -ki), xb = MIN(x1, width - ki);
+      if(xa >= xb) continue;
+      const int ca = MAX(left, -ki), cb = MIN(right, width - ki);
+
+      for(int r = ra; r <= rb; r++)
+      {
+        float *const d = D + (size_t)(r - ra) * cols;
+        memset(d, 0, sizeof(float) * (ca - left));
+        memset(d + cb - left, 0, sizeof(float) * (right - cb));
+        dist_row_f(d + ca - left, in + 4 * ((size_t)width * r + ca), in + 4 * ((size_t)width * (r + kj) + ca + ki),
+                   cb - ca, params->norm);
+      }
+
+      memset(V, 0, sizeof(float) * cols);
+      for(int r = ra; r <= MIN(ya + P, rb); r++)
+      {
+        const float *const d = D + (size_t)(r - ra) * cols;
+        for(int c = 0; c < cols; c++) V[c] += d[c];
+      }
+
+      for(int y = ya; y < yb; y++)
+      {
+        if(y > ya)
+        {
+          // move the patch rows down by one. this adds up rounding errors over one tile only
+          if(y + P <= rb)
+          {
+            const float *const d = D + (size_t)(y + P - ra) * cols;
+            for(int c = 0; c < cols; c++) V[c] += d[c];
+          }
+          if(y - 1 - P >= ra)
+          {
+            const float *const d = D + (size_t)(y - 1 - P - ra) * cols;
+            for(int c = 0; c < cols; c++) V[c] -= d[c];
+          }
+        }
+
+        // sum over the patch columns, sliding along the row
+        const int l = patch_left(xa, P, width);
+        float sum = 0.0f;
+        for(int c = l; c <= MIN(width - 1, l + 2 * P); c++) sum += V[c - left];
+        dist[0] = sum;
+        for(int x = xa + 1; x < xb; x++)
+        {
+          // the patch only moves away from the borders
+          if(x - P > 0 && x + P < width) sum += V[x + P - left] - V[x - P - 1 - left];
+          dist[x - xa] = sum;
+        }
+
+        accum_row_f(out + 4 * ((size_t)width * y + xa), in + 4 * ((size_t)width * (y + kj) + xa + ki), dist,
+                    xb - xa, params->scale, params->offset);
+      }
+    }
+  }
+}
+
+void dt_nlmeans_denoise(const float *const in, float *const out, const int width, const int height,
+                        const dt_nlmeans_param_t *const params)
+{
+  const int P = params->patch_radius;
+  const int tiles_x = (width + NLMEANS_TILE - 1) / NLMEANS_TILE;
+  const int tiles_y = (height + NLMEANS_TILE - 1) / NLMEANS_TILE;
+  // per thread: squared differences, patch row sums and distances, rounded up to whole cache lines
+  const size_t scratch_size
+      = ((size_t)(NLMEANS_TILE + 2 * P + 1) * (NLMEANS_TILE + 2 * P) + NLMEANS_TILE + 15) & ~(size_t)15;
+  float *const scratch = dt_alloc_align(64, sizeof(float) * scratch_size * dt_get_num_threads());
+  if(!scratch)
+  {
+    // leave the image as it is: every pixel only gets its own value, with weight one
+    fprintf(stderr, "[nlmeans] not able to allocate the scratch buffers\n");
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+    for(size_t k = 0; k < (size_t)width * height; k++)
+    {
+      for(int c = 0; c < 3; c++) out[4 * k + c] = in[4 * k + c];
+      out[4 * k + 3] = 1.0f;
+    }
+    return;
+  }
+
+  nlmeans_dist_row_t dist_row_f = dist_row;
+  nlmeans_accum_row_t accum_row_f = accum_row;
+#if defined(__SSE2__)
+  if(darktable.codepath.SSE2)
+  {
+    dist_row_f = dist_row_sse2;
+    accum_row_f = accum_row_sse2;
+  }
+#endif
+#if defined(HAVE_AVX_CODEPATHS)
+  if(darktable.codepath.AVX2)
+  {
+    dist_row_f = dist_row_avx2;
+    accum_row_f = accum_row_avx2;
+  }
+#endif
+
+  // tiles along the rows first, so neighbouring threads share the rows of their aprons
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(dist_row_f, accum_row_f)
+#endif
+  for(int t = 0; t < tiles_x * tiles_y; t++)
+  {
+    const int x0 = (t % tiles_x) * NLMEANS_TILE, y0 = (t / tiles_x) * NLMEANS_TILE;
+    nlmeans_tile(in, out, width, height, x0, y0, MIN(x0 + NLMEANS_TILE, width), MIN(y0 + NLMEANS_TILE, height),
+                 params, scratch + scratch_size * dt_get_thread_num(), dist_row_f, accum_row_f);
+  }
+
+  dt_free_align(scratch);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
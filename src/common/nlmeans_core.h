@@ -0,0 +1,51 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*
+ * the non-local means filter shared by the nlmeans and denoiseprofile iops (cpu path).
+ *
+ * every pixel is replaced by a weighted average of the pixels in its (2K+1)^2 neighbourhood. the weight of a
+ * neighbour depends on the distance between the (2P+1)^2 patches around the two pixels:
+ *
+ *   d = sum over the patch of  norm[0] * dL^2 + norm[1] * da^2 + norm[2] * db^2
+ *   w = 2^-max(0, d * scale - offset)
+ *
+ * the image is cut into tiles which are filtered by one thread each. a tile runs through all shift vectors
+ * while its part of the input and output is hot in the cache, the patch distances come from box sums over a
+ * per-tile buffer of squared pixel differences instead of one full image sliding window per shift.
+ */
+
+typedef struct dt_nlmeans_param_t
+{
+  int patch_radius;  // P, 0 degenerates to a bilateral filter
+  int search_radius; // K
+  float norm[3];     // weights of the squared channel differences
+  float scale;       // scale and offset map patch distances to weights, see above
+  float offset;
+} dt_nlmeans_param_t;
+
+/** filter the 4-channel buffer in into out, both width x height. out gets the weighted sums of the neighbours
+ * in channels 0..2 and the sum of the weights in channel 3, so callers can normalize and blend themselves. */
+void dt_nlmeans_denoise(const float *const in, float *const out, const int width, const int height,
+                        const dt_nlmeans_param_t *const params);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
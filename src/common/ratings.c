@@ -65,8 +65,8 @@ void dt_ratings_apply_to_image_or_group(int imgid, int rating)
     if(darktable.gui && darktable.gui->grouping && darktable.gui->expanded_group_id != img_group_id)
     {
       sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "SELECT id FROM main.images WHERE group_id = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "SELECT id FROM main.images WHERE group_id = ?1", &stmt);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img_group_id);
       int count = 0;
       while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -74,7 +74,7 @@ void dt_ratings_apply_to_image_or_group(int imgid, int rating)
         dt_ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
         count++;
       }
-      sqlite3_finalize(stmt);
+      dt_database_release_cached(darktable.db, stmt);
 
       if(count > 1)
       {
@@ -34,33 +34,30 @@ gboolean dt_tag_new(const char *name, guint *tagid)
 
   if(!name || name[0] == '\0') return FALSE; // no tagid name.
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1, &stmt,
-                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM data.tags WHERE name = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW)
   {
     // tagid already exists.
     if(tagid != NULL) *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return TRUE;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO data.tags (id, name) VALUES (NULL, ?1)",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "INSERT INTO data.tags (id, name) VALUES (NULL, ?1)", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if(tagid != NULL)
   {
     *tagid = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
-                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM data.tags WHERE name = ?1", &stmt);
     DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
     if(sqlite3_step(stmt) == SQLITE_ROW) *tagid = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 
   return TRUE;
@@ -119,12 +116,11 @@ gchar *dt_tag_get_name(const guint tagid)
   int rt;
   char *name = NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT name FROM data.tags WHERE id= ?1", -1, &stmt,
-                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT name FROM data.tags WHERE id= ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW) name = g_strdup((const char *)sqlite3_column_text(stmt, 0));
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   return name;
 }
@@ -176,20 +172,19 @@ gboolean dt_tag_exists(const char *name, guint *tagid)
 {
   int rt;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1, &stmt,
-                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM data.tags WHERE name = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
 
   if(rt == SQLITE_ROW)
   {
     if(tagid != NULL) *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return TRUE;
   }
 
   *tagid = -1;
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return FALSE;
 }
 
@@ -199,34 +194,42 @@ static void _attach_tag(guint tagid, gint imgid)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)", -1,
-                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)",
+                                    &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // insert into tagged_images if not there already.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
-                                "FROM main.selected_images",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
+                                    "FROM main.selected_images", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 }
 
+/* only the tagged images can join or leave the collection */
+static void _tag_update_collection(gint imgid)
+{
+  GList *imgids = imgid > 0 ? g_list_append(NULL, GINT_TO_POINTER(imgid))
+                            : dt_collection_get_selected(darktable.collection, -1);
+  dt_collection_update_images(darktable.collection, imgids);
+  g_list_free(imgids);
+}
+
 void dt_tag_attach(guint tagid, gint imgid)
 {
   _attach_tag(tagid, imgid);
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  _tag_update_collection(imgid);
 }
 
 void dt_tag_attach_list(GList *tags, gint imgid)
@@ -239,7 +242,7 @@ void dt_tag_attach_list(GList *tags, gint imgid)
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  _tag_update_collection(imgid);
 }
 
 void dt_tag_attach_string_list(const gchar *tags, gint imgid)
@@ -267,7 +270,7 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid)
 
     dt_tag_update_used_tags();
 
-    dt_collection_update_query(darktable.collection);
+    _tag_update_collection(imgid);
   }
   g_strfreev(tokens);
 }
@@ -278,45 +281,43 @@ void dt_tag_detach(guint tagid, gint imgid)
   if(imgid > 0)
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
-                                "(SELECT imgid FROM main.selected_images)",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
+                                    "(SELECT imgid FROM main.selected_images)", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  _tag_update_collection(imgid);
 }
 
 void dt_tag_detach_by_string(const char *name, gint imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
-                              "data.tags WHERE name LIKE ?1) AND imgid = ?2;",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
+                                  "data.tags WHERE name LIKE ?1) AND imgid = ?2;", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  _tag_update_collection(imgid);
 }
 
 
@@ -325,30 +326,34 @@ uint32_t dt_tag_get_attached(gint imgid, GList **result, gboolean ignore_dt_tags
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    char query[1024] = { 0 };
-    snprintf(query, sizeof(query), "SELECT DISTINCT T.id, T.name FROM main.tagged_images AS I "
-                                   "JOIN data.tags T on T.id = I.tagid "
-                                   "WHERE I.imgid = %d %s ORDER BY T.name",
-             imgid, ignore_dt_tags ? "AND NOT T.name LIKE \"darktable|%\"" : "");
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    if(ignore_dt_tags)
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "SELECT DISTINCT T.id, T.name FROM main.tagged_images AS I "
+                                      "JOIN data.tags T on T.id = I.tagid "
+                                      "WHERE I.imgid = ?1 AND NOT T.name LIKE \"darktable|%\" ORDER BY T.name",
+                                      &stmt);
+    else
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "SELECT DISTINCT T.id, T.name FROM main.tagged_images AS I "
+                                      "JOIN data.tags T on T.id = I.tagid "
+                                      "WHERE I.imgid = ?1 ORDER BY T.name", &stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   }
   else
   {
     if(ignore_dt_tags)
-      DT_DEBUG_SQLITE3_PREPARE_V2(
-          dt_database_get(darktable.db),
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(
+          darktable.db,
           "SELECT DISTINCT T.id, T.name "
           "FROM main.tagged_images AS I, data.tags AS T "
           "WHERE I.imgid IN (SELECT imgid FROM main.selected_images) "
-          "AND T.id = I.tagid AND NOT T.name LIKE \"darktable|%\" ORDER BY T.name",
-          -1, &stmt, NULL);
+          "AND T.id = I.tagid AND NOT T.name LIKE \"darktable|%\" ORDER BY T.name", &stmt);
     else
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "SELECT DISTINCT T.id, T.name "
-                                  "FROM main.tagged_images AS I, data.tags AS T "
-                                  "WHERE I.imgid IN (SELECT imgid FROM main.selected_images) "
-                                  "AND T.id = I.tagid ORDER BY T.name",
-                                  -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                      "SELECT DISTINCT T.id, T.name "
+                                      "FROM main.tagged_images AS I, data.tags AS T "
+                                      "WHERE I.imgid IN (SELECT imgid FROM main.selected_images) "
+                                      "AND T.id = I.tagid ORDER BY T.name", &stmt);
   }
 
   // Create result
@@ -361,7 +366,7 @@ uint32_t dt_tag_get_attached(gint imgid, GList **result, gboolean ignore_dt_tags
     *result = g_list_append(*result, t);
     count++;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return count;
 }
 
@@ -171,8 +171,9 @@ typedef struct dt_control_t
   gboolean export_scheduled;
   dt_pthread_mutex_t queue_mutex, cond_mutex, run_mutex;
   pthread_cond_t cond;
+  uint64_t job_generation; // bumped under cond_mutex whenever workers should look for jobs
   int32_t num_threads;
-  pthread_t *thread, kick_on_workers_thread;
+  pthread_t *thread;
   dt_job_t **job;
 
   GList *queues[DT_JOB_QUEUE_MAX];
@@ -24,9 +24,12 @@
 
 #include "common/darktable.h"
 #include "common/database.h"
+#include "common/debug.h"
 #include "common/history.h"
 #include "common/image.h"
+#include "common/image_cache.h"
 #include "control/conf.h"
+#include "control/jobs.h"
 #include "crawler.h"
 #include "gui/gtk.h"
 #ifdef GDK_WINDOWING_QUARTZ
@@ -54,133 +57,298 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
+// stat() mostly waits for the disk or the network, so we use more threads than cores
+#define DT_CRAWLER_THREADS 16
+#define DT_CRAWLER_CHUNK 64
+
+typedef struct dt_control_crawler_film_t
+{
+  int id;
+  char *folder;
+  time_t scan_mtime; // of the folder when we last looked at it, 0 if never
+  time_t mtime;      // of the folder now, 0 if it's not there
+  gboolean pending;  // we reported an image, look again next time
+} dt_control_crawler_film_t;
+
+typedef struct dt_control_crawler_image_t
+{
+  int id, version, flags, new_flags;
+  dt_control_crawler_film_t *film;
+  time_t timestamp, timestamp_xmp; // timestamp_xmp is 0 if there's no xmp file
+  char *image_path;
+} dt_control_crawler_image_t;
+
+typedef struct dt_control_crawler_t
+{
+  dt_pthread_mutex_t mutex;
+  int next, count;
+  void (*stat_one)(struct dt_control_crawler_t *crawler, const int k);
+  dt_control_crawler_film_t *films;
+  dt_control_crawler_image_t *images;
+  gboolean look_for_xmp;
+} dt_control_crawler_t;
+
+static void _crawler_stat_film(dt_control_crawler_t *crawler, const int k)
+{
+  dt_control_crawler_film_t *film = crawler->films + k;
+  struct stat statbuf;
+  film->mtime = stat(film->folder, &statbuf) ? 0 : statbuf.st_mtime;
+}
+
+static gboolean _crawler_extra_file_exists(char *extra_path, const size_t len, const char *ext, const char *EXT)
+{
+  memcpy(extra_path + len, ext, 3);
+  if(g_file_test(extra_path, G_FILE_TEST_EXISTS)) return TRUE;
+  memcpy(extra_path + len, EXT, 3);
+  return g_file_test(extra_path, G_FILE_TEST_EXISTS);
+}
+
+static void _crawler_stat_image(dt_control_crawler_t *crawler, const int k)
+{
+  dt_control_crawler_image_t *image = crawler->images + k;
+  image->new_flags = image->flags;
+
+  // no need to look for xmp files if none get written anyway.
+  if(crawler->look_for_xmp)
+  {
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, image->image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(image->version, xmp_path, sizeof(xmp_path));
+    const size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return;
+    g_strlcpy(xmp_path + len, ".xmp", sizeof(xmp_path) - len);
+
+    struct stat statbuf;
+    if(stat(xmp_path, &statbuf) == -1) return; // TODO: shall we report these?
+    image->timestamp_xmp = statbuf.st_mtime;
+  }
+
+  // step 2: check if the image has associated files (.txt, .wav)
+  const char *c = image->image_path + strlen(image->image_path);
+  while((c > image->image_path) && (*c != '.')) c--;
+  const size_t len = c - image->image_path + 1;
+
+  char *extra_path = g_strndup(image->image_path, len + 3);
+  const gboolean has_txt = _crawler_extra_file_exists(extra_path, len, "txt", "TXT");
+  const gboolean has_wav = _crawler_extra_file_exists(extra_path, len, "wav", "WAV");
+  g_free(extra_path);
+
+  // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
+  // else cases)
+  if(has_txt)
+    image->new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    image->new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    image->new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    image->new_flags &= ~DT_IMAGE_HAS_WAV;
+}
+
+static void *_crawler_worker(void *data)
+{
+  dt_control_crawler_t *crawler = (dt_control_crawler_t *)data;
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&crawler->mutex);
+    const int k = crawler->next;
+    crawler->next += DT_CRAWLER_CHUNK;
+    dt_pthread_mutex_unlock(&crawler->mutex);
+    if(k >= crawler->count) break;
+    for(int i = k; i < MIN(k + DT_CRAWLER_CHUNK, crawler->count); i++) crawler->stat_one(crawler, i);
+  }
+  return NULL;
+}
+
+// call stat_one(crawler, k) for k = 0..count-1 on a few threads
+static void _crawler_stat_all(dt_control_crawler_t *crawler, const int count,
+                              void (*stat_one)(dt_control_crawler_t *crawler, const int k))
+{
+  crawler->next = 0;
+  crawler->count = count;
+  crawler->stat_one = stat_one;
+  const int threads = MIN(DT_CRAWLER_THREADS, (count + DT_CRAWLER_CHUNK - 1) / DT_CRAWLER_CHUNK);
+  pthread_t thread[DT_CRAWLER_THREADS];
+  int started = 0;
+  for(int t = 1; t < threads; t++)
+    if(!dt_pthread_create(&thread[started], _crawler_worker, crawler)) started++;
+  _crawler_worker(crawler);
+  for(int t = 0; t < started; t++) pthread_join(thread[t], NULL);
+}
+
 GList *dt_control_crawler_run()
 {
-  sqlite3_stmt *stmt, *inner_stmt;
+  sqlite3_stmt *stmt;
   GList *result = NULL;
-  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  const double start = dt_get_wtime();
+  const time_t now = time(NULL);
+
+  dt_control_crawler_t crawler = { .look_for_xmp = dt_conf_get_bool("write_sidecar_files") };
+  dt_pthread_mutex_init(&crawler.mutex, NULL);
+
+  // step 0: folders that didn't change since the last run don't need to be looked at. no file in there was
+  // added, removed or replaced.
+  int num_films = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT COUNT(*) FROM main.film_rolls", -1, &stmt,
+                              NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) num_films = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
 
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, flags "
-                     "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
-                     -1, &stmt, NULL);
-  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
+  crawler.films = (dt_control_crawler_film_t *)calloc(num_films + 1, sizeof(dt_control_crawler_film_t));
+  GHashTable *film_ids = g_hash_table_new(NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id, folder, IFNULL(scan_mtime, 0) FROM main.film_rolls", -1, &stmt, NULL);
+  int f = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW && f < num_films)
+  {
+    crawler.films[f].id = sqlite3_column_int(stmt, 0);
+    crawler.films[f].folder = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+    crawler.films[f].scan_mtime = sqlite3_column_int64(stmt, 2);
+    f++;
+  }
+  sqlite3_finalize(stmt);
+  num_films = f;
 
-  // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  _crawler_stat_all(&crawler, num_films, _crawler_stat_film);
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  int skipped = 0;
+  for(f = 0; f < num_films; f++)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    gchar *image_path = (gchar *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
-    {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      if(stat(xmp_path, &statbuf) == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
-      {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
-      }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
-    }
+    dt_control_crawler_film_t *film = crawler.films + f;
+    // a missing folder is most likely an unmounted drive, don't touch its images
+    if(!film->mtime || film->mtime == film->scan_mtime)
+      skipped++;
+    else
+      g_hash_table_insert(film_ids, GINT_TO_POINTER(film->id), film);
+  }
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) *c-- = '\0';
-    len = c - image_path + 1;
+  // step 1: stat the xmp and extra files of the images in the remaining folders
+  int num_images = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT COUNT(*) FROM main.images", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) num_images = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
 
-    char *extra_path = g_strndup(image_path, len + 3);
+  crawler.images = (dt_control_crawler_image_t *)calloc(num_images + 1, sizeof(dt_control_crawler_image_t));
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, "
+                              "flags, f.id FROM main.images i, main.film_rolls f ON i.film_id = f.id "
+                              "ORDER BY f.id, filename",
+                              -1, &stmt, NULL);
+  int i = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW && i < num_images)
+  {
+    dt_control_crawler_film_t *film = g_hash_table_lookup(film_ids, GINT_TO_POINTER(sqlite3_column_int(stmt, 5)));
+    if(!film) continue;
+    dt_control_crawler_image_t *image = crawler.images + i++;
+    image->id = sqlite3_column_int(stmt, 0);
+    image->timestamp = sqlite3_column_int(stmt, 1);
+    image->version = sqlite3_column_int(stmt, 2);
+    image->image_path = g_strdup((const char *)sqlite3_column_text(stmt, 3));
+    image->flags = sqlite3_column_int(stmt, 4);
+    image->film = film;
+  }
+  sqlite3_finalize(stmt);
+  num_images = i;
 
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  _crawler_stat_all(&crawler, num_images, _crawler_stat_image);
 
-    if(!has_txt)
-    {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-    }
+  // step 2: report newer xmp files and store the extra file flags. no transaction around this, the crawler runs
+  // in the background and the flags rarely change.
 
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  for(i = 0; i < num_images; i++)
+  {
+    dt_control_crawler_image_t *image = crawler.images + i;
 
-    if(!has_wav)
+    // check if the xmp is newer than our db entry
+    // FIXME: allow for a few seconds difference?
+    if(image->timestamp < image->timestamp_xmp)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      gchar xmp_path[PATH_MAX] = { 0 };
+      g_strlcpy(xmp_path, image->image_path, sizeof(xmp_path));
+      dt_image_path_append_version_no_db(image->version, xmp_path, sizeof(xmp_path));
+      g_strlcat(xmp_path, ".xmp", sizeof(xmp_path));
+
+      dt_control_crawler_result_t *item
+          = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+      item->id = image->id;
+      item->timestamp_xmp = image->timestamp_xmp;
+      item->timestamp_db = image->timestamp;
+      item->image_path = image->image_path;
+      item->xmp_path = g_strdup(xmp_path);
+      image->image_path = NULL;
+      image->film->pending = TRUE;
+
+      result = g_list_append(result, item);
+      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, image->id);
     }
+    // older timestamps are the case for all images after the db upgrade. better not report these
 
-    // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
-    // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
+    if(image->flags != image->new_flags)
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
+      // the image might be in the cache already, so don't write behind its back
+      dt_image_t *img = dt_image_cache_get(darktable.image_cache, image->id, 'w');
+      if(img)
+      {
+        img->flags = (img->flags & ~(DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV))
+                     | (image->new_flags & (DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV));
+        dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+      }
     }
+    g_free(image->image_path);
+  }
 
-    g_free(extra_path);
+  // remember the folders we are done with. changes within the second we looked at it could go unnoticed.
+  // without the xmp files we only looked at part of the folder, the next run with sidecars on must not skip it.
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.film_rolls SET scan_mtime = ?1 WHERE id = ?2", -1, &stmt, NULL);
+  for(f = 0; f < num_films; f++)
+  {
+    dt_control_crawler_film_t *film = crawler.films + f;
+    if(crawler.look_for_xmp && film->mtime && film->mtime != film->scan_mtime && !film->pending
+       && film->mtime < now - 1)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 1, film->mtime);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, film->id);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
+    g_free(film->folder);
   }
+  sqlite3_finalize(stmt);
 
-  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF,
+           "[crawler] looked at %d images in %d of %d folders in %.3f secs\n", num_images,
+           num_films - skipped, num_films, dt_get_wtime() - start);
 
-  sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+  g_hash_table_destroy(film_ids);
+  free(crawler.films);
+  free(crawler.images);
+  dt_pthread_mutex_destroy(&crawler.mutex);
 
   return result;
 }
 
+static gboolean _crawler_show_image_list(gpointer data)
+{
+  dt_control_crawler_show_image_list((GList *)data);
+  return FALSE;
+}
+
+static int32_t _crawler_job_run(dt_job_t *job)
+{
+  GList *images = dt_control_crawler_run();
+  // the popup has to be built by the gui thread
+  if(images) g_main_context_invoke(NULL, _crawler_show_image_list, images);
+  return 0;
+}
+
+dt_job_t *dt_control_crawler_job_create()
+{
+  return dt_control_job_create(&_crawler_job_run, "%s", "look for updated xmp files");
+}
+
 
 /********************* the gui stuff *********************/
 
@@ -18,21 +18,20 @@
 
 #pragma once
 
+#include "control/jobs.h"
 #include <glib.h>
 
-/** this isn't a background job on purpose. it has to be really fast so it shouldn't
- *  require locking from image cache or anything like that.
- *  should we find out that we want to have a background job that crawls over all images
- *  we can maybe refactor this, but for now it's good the way it is.
- */
-
-// this function iterates over ALL images from the database and checks whether
+// this function iterates over the images from the database and checks whether
 // - the XMP file on disk is newer than the timestamp from db
 // - there is a .txt or .wav file associated with the image and mark so in the db
 //   or if such a file no longer exists
+// folders that didn't change since the last run are skipped, the files are looked at by a few threads.
 // it returns the list of images with a (supposedly) updated xmp file to let the user decide
 GList *dt_control_crawler_run();
 
+// a background job that runs the crawler and shows the popup if it found anything
+dt_job_t *dt_control_crawler_job_create();
+
 // show a popup with the images, let the user decide what to do and free the list afterwards
 void dt_control_crawler_show_image_list(GList *images);
 
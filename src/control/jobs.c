@@ -25,11 +25,9 @@
 
 #define DT_CONTROL_FG_PRIORITY 4
 #define DT_CONTROL_MAX_JOBS 30
+// with at least this many workers, the first one only runs foreground jobs
+#define DT_CONTROL_FG_LANE_MIN_THREADS 2
 
-/* the queue can have scheduled jobs but all
-    the workers are sleeping, so this kicks the workers
-    on timed interval.
-*/
 typedef struct worker_thread_parameters_t
 {
   dt_control_t *self;
@@ -228,6 +226,39 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
   return 0;
 }
 
+/* workers sleep until the job generation changes. it's bumped under cond_mutex whenever
+   something might have become schedulable (new job, reserved job, export finished),
+   so there are no lost wakeups and no need to kick the workers periodically. */
+static inline uint64_t dt_control_job_generation(dt_control_t *control)
+{
+  dt_pthread_mutex_lock(&control->cond_mutex);
+  const uint64_t generation = control->job_generation;
+  dt_pthread_mutex_unlock(&control->cond_mutex);
+  return generation;
+}
+
+static void dt_control_wait_for_jobs(dt_control_t *control, const uint64_t generation)
+{
+  dt_pthread_mutex_lock(&control->cond_mutex);
+  while(control->running && control->job_generation == generation)
+    dt_pthread_cond_wait(&control->cond, &control->cond_mutex);
+  dt_pthread_mutex_unlock(&control->cond_mutex);
+}
+
+static void dt_control_notify_workers(dt_control_t *control)
+{
+  dt_pthread_mutex_lock(&control->cond_mutex);
+  control->job_generation++;
+  pthread_cond_broadcast(&control->cond);
+  dt_pthread_mutex_unlock(&control->cond_mutex);
+}
+
+/* foreground queues are latency sensitive, the others carry bulk work. */
+static inline int dt_control_queue_is_foreground(const int queue_id)
+{
+  return queue_id == DT_JOB_QUEUE_USER_FG || queue_id == DT_JOB_QUEUE_SYSTEM_FG;
+}
+
 static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
 {
   /*
@@ -239,8 +270,13 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
    *   * user background
    *   * system background
    * - the jobs that didn't get picked this round get their priority incremented
+   * - the first worker is a foreground lane and never picks background jobs, so
+   *   gui actions and thumbnails never queue up behind imports and exports
    */
 
+  const int foreground_only
+      = dt_control_get_threadid() == 0 && control->num_threads >= DT_CONTROL_FG_LANE_MIN_THREADS;
+
   dt_pthread_mutex_lock(&control->queue_mutex);
 
   // find the job
@@ -251,6 +287,7 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
   {
     if(control->queues[i] == NULL) continue;
     if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
+    if(foreground_only && !dt_control_queue_is_foreground(i)) continue;
     _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
     if(_job->priority > max_priority)
     {
@@ -327,9 +364,13 @@ static int32_t dt_control_run_job(dt_control_t *control)
   // remove the job from scheduled job array (for job deduping)
   dt_pthread_mutex_lock(&control->queue_mutex);
   control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
+  const int export_finished = job->queue == DT_JOB_QUEUE_USER_EXPORT;
+  if(export_finished) control->export_scheduled = FALSE;
   dt_pthread_mutex_unlock(&control->queue_mutex);
 
+  // the next export may be waiting for this one
+  if(export_finished) dt_control_notify_workers(control);
+
   // and free it
   dt_control_job_dispose(job);
 
@@ -364,9 +405,7 @@ int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t re
 
   dt_pthread_mutex_unlock(&control->res_mutex);
 
-  dt_pthread_mutex_lock(&control->cond_mutex);
-  pthread_cond_broadcast(&control->cond);
-  dt_pthread_mutex_unlock(&control->cond_mutex);
+  dt_control_notify_workers(control);
 
   return 0;
 }
@@ -479,9 +518,7 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // notify workers
-  dt_pthread_mutex_lock(&control->cond_mutex);
-  pthread_cond_broadcast(&control->cond);
-  dt_pthread_mutex_unlock(&control->cond_mutex);
+  dt_control_notify_workers(control);
 
   // dispose of dropped job, if any
   dt_control_job_set_state(job_for_disposal, DT_JOB_STATE_DISCARDED);
@@ -520,14 +557,13 @@ static void *dt_control_work_res(void *ptr)
   while(dt_control_running())
   {
     // dt_print(DT_DEBUG_CONTROL, "[control_work] %d\n", threadid_res);
+    const uint64_t generation = dt_control_job_generation(s);
     if(dt_control_run_job_res(s, threadid_res) < 0)
     {
       // wait for a new job.
       int old;
       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old);
-      dt_pthread_mutex_lock(&s->cond_mutex);
-      dt_pthread_cond_wait(&s->cond, &s->cond_mutex);
-      dt_pthread_mutex_unlock(&s->cond_mutex);
+      dt_control_wait_for_jobs(s, generation);
       int tmp;
       pthread_setcancelstate(old, &tmp);
     }
@@ -535,20 +571,6 @@ static void *dt_control_work_res(void *ptr)
   return NULL;
 }
 
-static void *dt_control_worker_kicker(void *ptr)
-{
-  dt_control_t *control = (dt_control_t *)ptr;
-  dt_pthread_setname("kicker");
-  while(dt_control_running())
-  {
-    sleep(2);
-    dt_pthread_mutex_lock(&control->cond_mutex);
-    pthread_cond_broadcast(&control->cond);
-    dt_pthread_mutex_unlock(&control->cond_mutex);
-  }
-  return NULL;
-}
-
 static void *dt_control_work(void *ptr)
 {
 #ifdef _OPENMP // need to do this in every thread
@@ -565,12 +587,11 @@ static void *dt_control_work(void *ptr)
   while(dt_control_running())
   {
     // dt_print(DT_DEBUG_CONTROL, "[control_work] %d\n", threadid);
+    const uint64_t generation = dt_control_job_generation(control);
     if(dt_control_run_job(control) < 0)
     {
       // wait for a new job.
-      dt_pthread_mutex_lock(&control->cond_mutex);
-      dt_pthread_cond_wait(&control->cond, &control->cond_mutex);
-      dt_pthread_mutex_unlock(&control->cond_mutex);
+      dt_control_wait_for_jobs(control, generation);
     }
   }
   return NULL;
@@ -612,6 +633,7 @@ void dt_control_jobs_init(dt_control_t *control)
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
   control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  control->job_generation = 0;
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -624,9 +646,6 @@ void dt_control_jobs_init(dt_control_t *control)
     dt_pthread_create(&control->thread[k], dt_control_work, params);
   }
 
-  /* create queue kicker thread */
-  dt_pthread_create(&control->kick_on_workers_thread, dt_control_worker_kicker, control);
-
   for(int k = 0; k < DT_CTL_WORKER_RESERVED; k++)
   {
     control->job_res[k] = NULL;
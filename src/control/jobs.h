@@ -41,6 +41,8 @@ typedef enum dt_job_state_t
   DT_JOB_STATE_DISPOSED
 } dt_job_state_t;
 
+// the foreground queues (USER_FG, SYSTEM_FG) are latency sensitive: with two or more
+// workers, one of them is reserved for them and never picks up background work.
 typedef enum dt_job_queue_t
 {
   DT_JOB_QUEUE_USER_FG = 0,     // gui actions, ...
@@ -1171,6 +1171,125 @@ static int32_t dt_control_local_copy_images_job_run(dt_job_t *job)
   return 0;
 }
 
+// export a single image, returns non-zero if the storage failed and the export should stop
+static int _export_image(dt_control_export_t *settings, dt_imageio_module_storage_t *mstorage,
+                         dt_imageio_module_data_t *sdata, dt_imageio_module_format_t *mformat,
+                         dt_imageio_module_data_t *fdata, const int imgid, const guint num, const guint total,
+                         const guint tagid, const guint etagid)
+{
+  // remove 'changed' tag from image
+  dt_tag_detach(tagid, imgid);
+  // make sure the 'exported' tag is set on the image
+  dt_tag_attach(etagid, imgid);
+  // check if image still exists:
+  char imgfilename[PATH_MAX] = { 0 };
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
+  if(!image) return 0;
+
+  gboolean from_cache = TRUE;
+  dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
+  if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+  {
+    dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+    fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
+    // dt_image_remove(imgid);
+    dt_image_cache_read_release(darktable.image_cache, image);
+    return 0;
+  }
+  dt_image_cache_read_release(darktable.image_cache, image);
+  return mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality,
+                         settings->upscale, settings->icc_type, settings->icc_filename, settings->icc_intent);
+}
+
+static void _export_setup_fdata(dt_imageio_module_data_t *fdata, const dt_control_export_t *settings,
+                                const uint32_t w, const uint32_t h)
+{
+  fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
+  fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
+  g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
+  fdata->style_append = settings->style_append;
+}
+
+/* state shared by the threads of a parallel export. images are handed out in order, so
+   sequence numbers stay the same as in a serial export, and a new image is only started
+   if its estimated pipeline memory fits into the budget next to the ones in flight. */
+typedef struct dt_control_export_parallel_t
+{
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_format_t *mformat;
+  uint32_t w, h;
+  guint tagid, etagid;
+  int omp_threads;
+
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  GList *images;
+  guint num, total, done;
+  size_t memory_budget, memory_in_flight;
+  int in_flight;
+  int failed;
+} dt_control_export_parallel_t;
+
+static size_t _export_estimate_memory(const int imgid)
+{
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  if(!image) return 0;
+  // full input buffer plus the two cache lines of the export pipe, all 4 floats per pixel
+  const size_t memory = (size_t)image->width * image->height * 4 * sizeof(float) * 3;
+  dt_image_cache_read_release(darktable.image_cache, image);
+  return memory;
+}
+
+static void *_export_parallel_worker(void *ptr)
+{
+  dt_control_export_parallel_t *p = (dt_control_export_parallel_t *)ptr;
+#ifdef _OPENMP
+  // share the cores between the images in flight
+  omp_set_num_threads(p->omp_threads);
+#endif
+
+  // each thread needs its own format data (one jpeg struct per thread etc):
+  dt_imageio_module_data_t *fdata = p->mformat->get_params(p->mformat);
+  if(!fdata) return NULL;
+  _export_setup_fdata(fdata, p->settings, p->w, p->h);
+
+  dt_pthread_mutex_lock(&p->mutex);
+  while(p->images && !p->failed && dt_control_job_get_state(p->job) != DT_JOB_STATE_CANCELLED)
+  {
+    const int imgid = GPOINTER_TO_INT(p->images->data);
+    const size_t memory = _export_estimate_memory(imgid);
+    // always let at least one image through, no matter how large
+    if(p->in_flight > 0 && p->memory_in_flight + memory > p->memory_budget)
+    {
+      dt_pthread_cond_wait(&p->cond, &p->mutex);
+      continue;
+    }
+    p->images = g_list_delete_link(p->images, p->images);
+    const guint num = ++p->num;
+    p->in_flight++;
+    p->memory_in_flight += memory;
+    dt_pthread_mutex_unlock(&p->mutex);
+
+    const int err = _export_image(p->settings, p->mstorage, p->sdata, p->mformat, fdata, imgid, num, p->total,
+                                  p->tagid, p->etagid);
+
+    dt_pthread_mutex_lock(&p->mutex);
+    p->in_flight--;
+    p->memory_in_flight -= memory;
+    if(err) p->failed = 1;
+    p->done++;
+    dt_control_job_set_progress(p->job, MIN(1.0, (double)p->done / p->total));
+    pthread_cond_broadcast(&p->cond);
+  }
+  dt_pthread_mutex_unlock(&p->mutex);
+
+  p->mformat->free_params(p->mformat, fdata);
+  return NULL;
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   int imgid = -1;
@@ -1224,10 +1343,7 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   double fraction = 0;
 
   // set up the fdata struct
-  fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
-  fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
-  g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
-  fdata->style_append = settings->style_append;
+  _export_setup_fdata(fdata, settings, w, h);
   guint num = 0;
   // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
   // sensible assumption?
@@ -1235,48 +1351,59 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_tag_new("darktable|changed", &tagid);
   dt_tag_new("darktable|exported", &etagid);
 
+  // several images in flight at once, if the storage can deal with that
+  const int parallel = MIN(CLAMP(dt_conf_get_int("plugins/imageio/export/parallel_images"), 1, 64), (int)total);
+  if(parallel > 1 && mstorage->parallel_store(mstorage, sdata))
+  {
+    dt_control_export_parallel_t p = { 0 };
+    p.job = job;
+    p.settings = settings;
+    p.mstorage = mstorage;
+    p.sdata = sdata;
+    p.mformat = mformat;
+    p.w = w;
+    p.h = h;
+    p.tagid = tagid;
+    p.etagid = etagid;
+    p.omp_threads = MAX(1, darktable.num_openmp_threads / parallel);
+    p.images = t;
+    p.total = total;
+    p.memory_budget = (size_t)MAX(dt_conf_get_int("plugins/imageio/export/parallel_memory"), 0) << 20;
+    dt_pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.cond, NULL);
+
+    dt_print(DT_DEBUG_CONTROL, "[export_job] exporting %d images in parallel\n", parallel);
+
+    pthread_t *threads = (pthread_t *)calloc(parallel, sizeof(pthread_t));
+    int started = 0;
+    for(int k = 0; k < parallel; k++)
+      if(!dt_pthread_create(&threads[started], _export_parallel_worker, &p)) started++;
+    for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+    free(threads);
+
+    // in case no thread could be started, the rest is done serially below
+    t = p.images;
+    num = p.num;
+    fraction = (double)p.done / total;
+    if(p.failed) dt_control_job_cancel(job);
+    pthread_cond_destroy(&p.cond);
+    dt_pthread_mutex_destroy(&p.mutex);
+  }
+
   while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
   {
-    if(!t)
-      imgid = 0;
-    else
-    {
-      imgid = GPOINTER_TO_INT(t->data);
-      t = g_list_delete_link(t, t);
-      num = total - g_list_length(t);
-    }
+    imgid = GPOINTER_TO_INT(t->data);
+    t = g_list_delete_link(t, t);
+    num = total - g_list_length(t);
 
-    // remove 'changed' tag from image
-    dt_tag_detach(tagid, imgid);
-    // make sure the 'exported' tag is set on the image
-    dt_tag_attach(etagid, imgid);
-    // check if image still exists:
-    char imgfilename[PATH_MAX] = { 0 };
-    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
-    if(image)
-    {
-      gboolean from_cache = TRUE;
-      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
-      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-      {
-        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
-        // dt_image_remove(imgid);
-        dt_image_cache_read_release(darktable.image_cache, image);
-      }
-      else
-      {
-        dt_image_cache_read_release(darktable.image_cache, image);
-        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality,
-                           settings->upscale, settings->icc_type, settings->icc_filename, settings->icc_intent) != 0)
-          dt_control_job_cancel(job);
-      }
-    }
+    if(_export_image(settings, mstorage, sdata, mformat, fdata, imgid, num, total, tagid, etagid) != 0)
+      dt_control_job_cancel(job);
 
     fraction += 1.0 / total;
     if(fraction > 1.0) fraction = 1.0;
     dt_control_job_set_progress(job, fraction);
   }
+  g_list_free(t);
   params->index = NULL;
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
@@ -18,6 +18,7 @@
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
 #include "common/film.h"
+#include "common/image.h"
 #include <stdlib.h>
 
 typedef struct dt_film_import1_t
@@ -133,6 +134,63 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// how many files the readers may be ahead of the database writer
+#define DT_FILM_IMPORT_READ_AHEAD 64
+
+// the files to import are checked and their metadata is read by a few reader threads, while the job itself
+// writes them to the database, in the order of the list.
+typedef struct _film_import_queue_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  gchar **filenames;
+  dt_image_import_file_t *files;
+  uint8_t *ready;
+  int total;
+  int next;    // next file for the readers
+  int written; // file the writer is at
+} _film_import_queue_t;
+
+static void *_film_import_reader(void *data)
+{
+  _film_import_queue_t *q = (_film_import_queue_t *)data;
+  dt_pthread_setname("import");
+  dt_pthread_mutex_lock(&q->mutex);
+  while(q->next < q->total)
+  {
+    if(q->next >= q->written + DT_FILM_IMPORT_READ_AHEAD)
+    {
+      dt_pthread_cond_wait(&q->cond, &q->mutex);
+      continue;
+    }
+    const int k = q->next++;
+    dt_pthread_mutex_unlock(&q->mutex);
+    dt_image_import_file_read(q->files + k, q->filenames[k], FALSE);
+    dt_pthread_mutex_lock(&q->mutex);
+    q->ready[k] = 1;
+    pthread_cond_broadcast(&q->cond);
+  }
+  dt_pthread_mutex_unlock(&q->mutex);
+  return NULL;
+}
+
+// wait for the readers to finish file k, and let them go on
+static void _film_import_wait(_film_import_queue_t *q, const int k, dt_image_import_batch_t *batch)
+{
+  dt_pthread_mutex_lock(&q->mutex);
+  q->written = k;
+  pthread_cond_broadcast(&q->cond);
+  if(!q->ready[k])
+  {
+    // don't keep the database from others while waiting for the disk
+    dt_pthread_mutex_unlock(&q->mutex);
+    dt_image_import_batch_commit(batch);
+    dt_pthread_mutex_lock(&q->mutex);
+  }
+  while(!q->ready[k]) dt_pthread_cond_wait(&q->cond, &q->mutex);
+  dt_pthread_mutex_unlock(&q->mutex);
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -194,18 +252,37 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
   /* let's start import of images */
   gchar message[512] = { 0 };
-  double fraction = 0;
-  guint total = g_list_length(images);
+  const int total = g_list_length(images);
   g_snprintf(message, sizeof(message) - 1, ngettext("importing %d image", "importing %d images", total), total);
   dt_control_job_set_progress_message(job, message);
 
+  _film_import_queue_t q = { 0 };
+  q.total = total;
+  q.filenames = (gchar **)calloc(total, sizeof(gchar *));
+  q.files = (dt_image_import_file_t *)calloc(total, sizeof(dt_image_import_file_t));
+  q.ready = (uint8_t *)calloc(total, sizeof(uint8_t));
+  int k = 0;
+  for(GList *image = g_list_first(images); image; image = g_list_next(image)) q.filenames[k++] = image->data;
+  dt_pthread_mutex_init(&q.mutex, NULL);
+  pthread_cond_init(&q.cond, NULL);
+
+  // reading metadata waits for the disk more than for the cpu, so don't go below two readers
+  const int threads = MIN(MAX(darktable.num_openmp_threads, 2), total);
+  pthread_t *thread = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  int started = 0;
+  for(int t = 0; t < threads; t++)
+    if(!dt_pthread_create(&thread[started], _film_import_reader, &q)) started++;
+
+  dt_image_import_batch_t batch;
+  dt_image_import_batch_begin(&batch);
+  const double start = dt_get_wtime();
+  double last_message = start;
 
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  for(k = 0; k < total; k++)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    gchar *cdn = g_path_get_dirname(q.filenames[k]);
 
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
@@ -253,13 +330,36 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    if(started)
+      _film_import_wait(&q, k, &batch);
+    else
+      dt_image_import_file_read(q.files + k, q.filenames[k], FALSE);
+    dt_image_import_batch_add(&batch, cfr->id, q.files + k);
+
+    dt_control_job_set_progress(job, (k + 1.0) / total);
+    const double now = dt_get_wtime();
+    if(now - last_message > 0.5)
+    {
+      g_snprintf(message, sizeof(message) - 1,
+                 ngettext("importing %d/%d image, %.0f per second", "importing %d/%d images, %.0f per second",
+                          total),
+                 k + 1, total, (k + 1) / (now - start));
+      dt_control_job_set_progress_message(job, message);
+      last_message = now;
+    }
+  }
 
-    fraction += 1.0 / total;
-    dt_control_job_set_progress(job, fraction);
+  dt_image_import_batch_end(&batch);
 
+  for(int t = 0; t < started; t++) pthread_join(thread[t], NULL);
+  free(thread);
+  pthread_cond_destroy(&q.cond);
+  dt_pthread_mutex_destroy(&q.mutex);
+  free(q.filenames);
+  free(q.files);
+  free(q.ready);
 
-  } while((image = g_list_next(image)) != NULL);
+  dt_print(DT_DEBUG_PERF, "[film_import] %d images in %.3f secs\n", total, dt_get_wtime() - start);
 
   g_list_free_full(images, g_free);
 
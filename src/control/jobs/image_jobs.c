@@ -61,6 +61,29 @@ dt_job_t *dt_image_load_job_create(int32_t id, dt_mipmap_size_t mip)
   return job;
 }
 
+static int32_t dt_image_refine_thumbnail_job_run(dt_job_t *job)
+{
+  dt_image_load_t *params = dt_control_job_get_params(job);
+  dt_mipmap_cache_refine(darktable.mipmap_cache, params->imgid, params->mip);
+  return 0;
+}
+
+dt_job_t *dt_image_refine_thumbnail_job_create(int32_t id, dt_mipmap_size_t mip)
+{
+  dt_job_t *job = dt_control_job_create(&dt_image_refine_thumbnail_job_run, "refine thumbnail %d mip %d", id, mip);
+  if(!job) return NULL;
+  dt_image_load_t *params = (dt_image_load_t *)calloc(1, sizeof(dt_image_load_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  dt_control_job_set_params_with_size(job, params, sizeof(dt_image_load_t), free);
+  params->imgid = id;
+  params->mip = mip;
+  return job;
+}
+
 typedef struct dt_image_import_t
 {
   uint32_t film_id;
@@ -25,6 +25,9 @@
 
 dt_job_t *dt_image_load_job_create(int32_t imgid, dt_mipmap_size_t mip);
 
+/** develop the real thumbnail for a mip that only holds the embedded preview so far. */
+dt_job_t *dt_image_refine_thumbnail_job_create(int32_t imgid, dt_mipmap_size_t mip);
+
 dt_job_t *dt_image_import_job_create(uint32_t filmid, const char *filename);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
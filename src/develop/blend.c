@@ -17,6 +17,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "blend.h"
+#include "common/avx.h"
 #include "common/gaussian.h"
 #include "common/guided_filter.h"
 #include "common/math.h"
@@ -544,6 +545,64 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   }
 }
 
+#if defined(HAVE_AVX_CODEPATHS)
+/* normal blend of 4-channel Lab or rgb rows, two pixels at a time. anything else (raw, blending only L)
+ * is left to the plain versions above. */
+DT_TARGET_AVX2 static void _blend_normal_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                              const float *mask, const int clamp)
+{
+  const int Lab = (bd->cst == iop_cs_Lab);
+  const __m256 scale = Lab ? _mm256_setr_ps(1.0f / 100.0f, 1.0f / 128.0f, 1.0f / 128.0f, 1.0f,
+                                            1.0f / 100.0f, 1.0f / 128.0f, 1.0f / 128.0f, 1.0f)
+                           : _mm256_set1_ps(1.0f);
+  const __m256 rescale = Lab ? _mm256_setr_ps(100.0f, 128.0f, 128.0f, 1.0f, 100.0f, 128.0f, 128.0f, 1.0f)
+                             : _mm256_set1_ps(1.0f);
+  float min[4] = { 0 }, max[4] = { 0 };
+  _blend_colorspace_channel_range(bd->cst, min, max);
+  const __m256 vmin = _mm256_setr_ps(min[0], min[1], min[2], min[3], min[0], min[1], min[2], min[3]);
+  const __m256 vmax = _mm256_setr_ps(max[0], max[1], max[2], max[3], max[0], max[1], max[2], max[3]);
+
+  const size_t npixels = bd->stride / 4;
+  size_t i = 0;
+  for(; i + 1 < npixels; i += 2)
+  {
+    const __m256 opacity = dt_mm256_set2_ps(mask[i], mask[i + 1]);
+    const __m256 ta = _mm256_loadu_ps(a + 4 * i) * scale;
+    const __m256 tb = _mm256_loadu_ps(b + 4 * i) * scale;
+    __m256 res = ta * (_mm256_set1_ps(1.0f) - opacity) + tb * opacity;
+    if(clamp) res = _mm256_min_ps(_mm256_max_ps(res, vmin), vmax);
+    // the mask goes to the alpha channel
+    _mm256_storeu_ps(b + 4 * i, _mm256_blend_ps(res * rescale, opacity, 0x88));
+  }
+  if(i < npixels)
+  {
+    const _blend_buffer_desc_t bd1 = { .cst = bd->cst, .stride = 4, .ch = 4, .bch = bd->bch };
+    if(clamp)
+      _blend_normal_bounded(&bd1, a + 4 * i, b + 4 * i, mask + i, 0);
+    else
+      _blend_normal_unbounded(&bd1, a + 4 * i, b + 4 * i, mask + i, 0);
+  }
+}
+
+static void _blend_normal_bounded_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                       const float *mask, int flag)
+{
+  if(flag == 0 && bd->ch == 4 && (bd->cst == iop_cs_Lab || bd->cst == iop_cs_rgb))
+    _blend_normal_avx2(bd, a, b, mask, 1);
+  else
+    _blend_normal_bounded(bd, a, b, mask, flag);
+}
+
+static void _blend_normal_unbounded_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                         const float *mask, int flag)
+{
+  if(flag == 0 && bd->ch == 4 && (bd->cst == iop_cs_Lab || bd->cst == iop_cs_rgb))
+    _blend_normal_avx2(bd, a, b, mask, 0);
+  else
+    _blend_normal_unbounded(bd, a, b, mask, flag);
+}
+#endif
+
 /* lighten */
 static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                            int flag)
@@ -2818,6 +2877,17 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
       break;
   }
 
+#if defined(HAVE_AVX_CODEPATHS)
+  // only the most common operator has a wide version
+  if(darktable.codepath.AVX2)
+  {
+    if(blend == _blend_normal_bounded)
+      blend = _blend_normal_bounded_avx2;
+    else if(blend == _blend_normal_unbounded)
+      blend = _blend_normal_unbounded_avx2;
+  }
+#endif
+
   return blend;
 }
 
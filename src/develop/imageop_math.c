@@ -96,6 +96,39 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *
   }
 }
 
+void dt_iop_downsample_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *out, int32_t ow, int32_t oh,
+                         uint32_t *width, uint32_t *height)
+{
+  // same output size as dt_iop_flip_and_zoom_8(), but average the whole box of input pixels
+  // instead of four samples from it
+  const float scale = fmaxf(1.0, fmaxf(iw / (float)ow, ih / (float)oh));
+  const uint32_t wd = *width = MIN(ow, iw / scale);
+  const uint32_t ht = *height = MIN(oh, ih / scale);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(uint32_t j = 0; j < ht; j++)
+  {
+    const int32_t y0 = MIN(ih - 1, (int32_t)(scale * j));
+    const int32_t y1 = MIN(ih, MAX(y0 + 1, (int32_t)(scale * (j + 1))));
+    uint8_t *out2 = out + (size_t)4 * wd * j;
+    for(uint32_t i = 0; i < wd; i++)
+    {
+      const int32_t x0 = MIN(iw - 1, (int32_t)(scale * i));
+      const int32_t x1 = MIN(iw, MAX(x0 + 1, (int32_t)(scale * (i + 1))));
+      uint32_t sum[4] = { 0 };
+      for(int32_t y = y0; y < y1; y++)
+      {
+        const uint8_t *in2 = in + (size_t)4 * ((size_t)iw * y + x0);
+        for(int32_t x = x0; x < x1; x++, in2 += 4)
+          for(int k = 0; k < 4; k++) sum[k] += in2[k];
+      }
+      const uint32_t n = (y1 - y0) * (x1 - x0);
+      for(int k = 0; k < 4; k++) out2[4 * i + k] = (sum[k] + n / 2) / n;
+    }
+  }
+}
+
 void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw,
                             int32_t ibh, uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh,
                             int32_t obw, int32_t obh)
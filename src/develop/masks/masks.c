@@ -101,6 +101,11 @@ static void *_dup_masks_form_cb(const void *formdata, gpointer user_data)
   return (void *)_dup_masks_form(f);
 }
 
+dt_masks_form_t *dt_masks_dup_masks_form(const dt_masks_form_t *form)
+{
+  return _dup_masks_form(form);
+}
+
 // duplicate the list of forms, replace item in the list with form with the same formid
 GList *dt_masks_dup_forms_deep(GList *forms, dt_masks_form_t *form)
 {
@@ -17,10 +17,24 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/file_location.h"
+#include "control/conf.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
+#include <glib/gstdio.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#if !defined(_WIN32)
+#include <sys/statvfs.h>
+#else
+#include "win/statvfs.h"
+#endif
+
+#define DT_PIXELPIPE_DISK_CACHE_MAGIC 0xD7CAC4E
+#define DT_PIXELPIPE_DISK_CACHE_VERSION 2
+#define DT_PIXELPIPE_DISK_CACHE_DIR "pixelpipe"
 
 
 // TODO: make cache global (needs to be thread safe then)
@@ -32,33 +46,145 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+typedef struct dt_dev_pixelpipe_cache_line_t
+{
+  void *data;
+  size_t size;
+  dt_iop_buffer_dsc_t dsc;
+  uint64_t hash;           // -1 for invalid lines
+  int32_t module;          // pipe position which produced this line
+  uint64_t important_until; // query count until which this line is protected
+  uint64_t used;           // query count of the last access, for lru tie breaking
+  double cost;             // seconds it took to compute this line
+  double priority;         // greedy dual size priority, lowest is evicted first
+} dt_dev_pixelpipe_cache_line_t;
+
+static dt_dev_pixelpipe_cache_line_t *_line_new(dt_dev_pixelpipe_cache_t *cache, const size_t size)
 {
-  cache->entries = entries;
-  cache->data = (void **)calloc(entries, sizeof(void *));
-  cache->size = (size_t *)calloc(entries, sizeof(size_t));
-  cache->dsc = (dt_iop_buffer_dsc_t *)calloc(entries, sizeof(dt_iop_buffer_dsc_t));
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)calloc(1, sizeof(dt_dev_pixelpipe_cache_line_t));
+  if(!line) return NULL;
 #ifdef _DEBUG
-  memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * entries);
+  memset(&line->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t));
 #endif
-  cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
-  for(int k = 0; k < entries; k++)
-  {
-    cache->size[k] = size;
-    if(size)
-    { // allow 0 initial buffer size (yet unknown dimensions)
-      cache->data[k] = (void *)dt_alloc_align(16, size);
-      if(!cache->data[k]) goto alloc_memory_fail;
+  line->size = size;
+  if(size)
+  { // allow 0 initial buffer size (yet unknown dimensions)
+    line->data = (void *)dt_alloc_align(64, size);
+    if(!line->data)
+    {
+      free(line);
+      return NULL;
+    }
 #ifdef _DEBUG
-      memset(cache->data[k], 0x5d, size);
+    memset(line->data, 0x5d, size);
 #endif
-      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
-    }
-    else cache->data[k] = 0;
-    cache->hash[k] = -1;
-    cache->used[k] = 0;
+    ASAN_POISON_MEMORY_REGION(line->data, line->size);
+    g_hash_table_insert(cache->buffers, line->data, line);
+  }
+  line->hash = -1;
+  line->module = -1;
+  cache->lines = g_list_prepend(cache->lines, line);
+  cache->memory += size;
+  cache->entries++;
+  return line;
+}
+
+static void _line_invalidate(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  if(line->hash != (uint64_t)-1) g_hash_table_remove(cache->hashes, &line->hash);
+  line->hash = -1;
+  line->important_until = 0;
+  ASAN_POISON_MEMORY_REGION(line->data, line->size);
+}
+
+static void _line_free(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  _line_invalidate(cache, line);
+  if(line->data) g_hash_table_remove(cache->buffers, line->data);
+  dt_free_align(line->data);
+  cache->memory -= line->size;
+  cache->entries--;
+  cache->lines = g_list_remove(cache->lines, line);
+  if(cache->last == line) cache->last = NULL;
+  free(line);
+}
+
+static void _line_resize(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line, const size_t size)
+{
+  if(line->data) g_hash_table_remove(cache->buffers, line->data);
+  dt_free_align(line->data);
+  cache->memory -= line->size;
+  line->data = (void *)dt_alloc_align(64, size);
+  line->size = line->data ? size : 0;
+  cache->memory += line->size;
+  if(line->data) g_hash_table_insert(cache->buffers, line->data, line);
+}
+
+// cost of recomputation per megabyte, inflated by the clock: greedy dual size.
+static inline void _line_touch(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  line->used = cache->queries;
+  line->priority = cache->clock + line->cost / MAX(line->size / (1024.0 * 1024.0), 1e-3);
+}
+
+// a is a better candidate for eviction than b
+static inline int _line_evict_before(const dt_dev_pixelpipe_cache_t *cache,
+                                     const dt_dev_pixelpipe_cache_line_t *a,
+                                     const dt_dev_pixelpipe_cache_line_t *b)
+{
+  const int inv_a = a->hash == (uint64_t)-1, inv_b = b->hash == (uint64_t)-1;
+  if(inv_a != inv_b) return inv_a;
+  const int imp_a = a->important_until > cache->queries, imp_b = b->important_until > cache->queries;
+  if(imp_a != imp_b) return imp_b;
+  if(a->priority != b->priority) return a->priority < b->priority;
+  return a->used < b->used;
+}
+
+// finds the line to be replaced next. never returns the line which has been handed out last,
+// as that is the input buffer of the module currently being processed.
+static dt_dev_pixelpipe_cache_line_t *_get_victim(dt_dev_pixelpipe_cache_t *cache)
+{
+  dt_dev_pixelpipe_cache_line_t *victim = NULL;
+  for(GList *l = cache->lines; l; l = g_list_next(l))
+  {
+    dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+    if(line == cache->last) continue;
+    if(!victim || _line_evict_before(cache, line, victim)) victim = line;
   }
+  if(victim && victim->hash != (uint64_t)-1) cache->clock = MAX(cache->clock, victim->priority);
+  return victim;
+}
+
+// smallest invalid line which can hold size bytes without reallocation
+static dt_dev_pixelpipe_cache_line_t *_get_free_line(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  dt_dev_pixelpipe_cache_line_t *found = NULL;
+  for(GList *l = cache->lines; l; l = g_list_next(l))
+  {
+    dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
+    if(line == cache->last || line->hash != (uint64_t)-1 || line->size < size) continue;
+    if(!found || line->size < found->size) found = line;
+  }
+  return found;
+}
+
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit)
+{
+  cache->entries = 0;
+  cache->min_entries = entries;
+  cache->memory = 0;
+  cache->memory_limit = memory_limit;
+  cache->clock = 0.0;
+  cache->lines = NULL;
+  cache->last = NULL;
+  cache->hashes = g_hash_table_new(g_int64_hash, g_int64_equal);
+  cache->buffers = g_hash_table_new(g_direct_hash, g_direct_equal);
+  cache->num_modules = 0;
+  cache->module_queries = NULL;
+  cache->module_misses = NULL;
+  for(int k = 0; k < entries; k++)
+    if(!_line_new(cache, size)) goto alloc_memory_fail;
   cache->queries = cache->misses = 0;
   return 1;
 
@@ -69,12 +195,14 @@ alloc_memory_fail:
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
-  free(cache->data);
-  free(cache->dsc);
-  free(cache->hash);
-  free(cache->used);
-  free(cache->size);
+  while(cache->lines) _line_free(cache, (dt_dev_pixelpipe_cache_line_t *)cache->lines->data);
+  g_hash_table_destroy(cache->hashes);
+  g_hash_table_destroy(cache->buffers);
+  cache->hashes = cache->buffers = NULL;
+  free(cache->module_queries);
+  free(cache->module_misses);
+  cache->module_queries = cache->module_misses = NULL;
+  cache->num_modules = 0;
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
@@ -115,125 +243,352 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
-  for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
-  return 0;
+  return g_hash_table_contains(cache->hashes, &hash);
 }
 
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                                         void **data, dt_iop_buffer_dsc_t **dsc)
+                                         void **data, dt_iop_buffer_dsc_t **dsc, const int module)
 {
-  return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, dsc, -cache->entries);
+  return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, dsc, -MAX(cache->entries, cache->min_entries),
+                                             module);
 }
 
 int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                               void **data, dt_iop_buffer_dsc_t **dsc)
+                               void **data, dt_iop_buffer_dsc_t **dsc, const int module)
 {
-  return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, dsc, 0);
+  return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, dsc, 0, module);
+}
+
+static void _count_query(dt_dev_pixelpipe_cache_t *cache, const int module, const int miss)
+{
+  if(module < 0) return;
+  if(module >= cache->num_modules)
+  {
+    const int num = module + 16;
+    uint64_t *queries = (uint64_t *)realloc(cache->module_queries, sizeof(uint64_t) * num);
+    if(queries) cache->module_queries = queries;
+    uint64_t *misses = (uint64_t *)realloc(cache->module_misses, sizeof(uint64_t) * num);
+    if(misses) cache->module_misses = misses;
+    if(!queries || !misses) return;
+    memset(cache->module_queries + cache->num_modules, 0, sizeof(uint64_t) * (num - cache->num_modules));
+    memset(cache->module_misses + cache->num_modules, 0, sizeof(uint64_t) * (num - cache->num_modules));
+    cache->num_modules = num;
+  }
+  cache->module_queries[module]++;
+  if(miss) cache->module_misses[module]++;
 }
 
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                                        void **data, dt_iop_buffer_dsc_t **dsc, int weight)
+                                        void **data, dt_iop_buffer_dsc_t **dsc, int weight, const int module)
 {
   cache->queries++;
   *data = NULL;
-  int max_used = -1, max = 0;
-  size_t sz = 0;
-  for(int k = 0; k < cache->entries; k++)
-  {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
-    {
-      max_used = cache->used[k];
-      max = k;
-    }
-    cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
-    {
-      assert(cache->size[k] >= size);
 
-      *data = cache->data[k];
-      *dsc = &cache->dsc[k];
-      sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->hashes, &hash);
+  if(line && line->size >= size)
+  {
+    *data = line->data;
+    *dsc = &line->dsc;
+    if(weight < 0) line->important_until = cache->queries - weight; // this is the MRU entry
+    _line_touch(cache, line);
+    cache->last = line;
 
-      ASAN_POISON_MEMORY_REGION(*data, sz);
-      ASAN_UNPOISON_MEMORY_REGION(*data, size);
-    }
+    ASAN_POISON_MEMORY_REGION(*data, line->size);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    _count_query(cache, module, 0);
+    return 0;
   }
 
-  if(!*data || sz < size)
+  // if the hash was found but the line is too small, reuse it: it is stale anyways.
+  if(!line) line = _get_free_line(cache, size);
+
+  if(!line && cache->memory_limit)
   {
-    // kill LRU entry
-    // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
-    // weight);
-    if(cache->size[max] < size)
+    // evict the lines which are cheapest to recompute until the new one fits the budget.
+    // if a victim is large enough, take it over instead of freeing and allocating again.
+    while(cache->memory + size > cache->memory_limit && cache->entries > cache->min_entries)
     {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(16, size);
-      cache->size[max] = size;
+      dt_dev_pixelpipe_cache_line_t *victim = _get_victim(cache);
+      if(!victim) break;
+      if(victim->size >= size)
+      {
+        line = victim;
+        break;
+      }
+      _line_free(cache, victim);
     }
-    *data = cache->data[max];
-    sz = cache->size[max];
+  }
+  else if(!line && cache->entries >= cache->min_entries)
+  {
+    // fixed number of lines: kill the least valuable one
+    line = _get_victim(cache);
+  }
 
-    ASAN_POISON_MEMORY_REGION(*data, sz);
-    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+  if(!line) line = _line_new(cache, 0);
+  if(!line) return 1;
 
-    // first, update our copy, then update the pointer to point at our copy
-    cache->dsc[max] = **dsc;
-    *dsc = &cache->dsc[max];
+  // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", ..., cache->entries,
+  // weight);
+  _line_invalidate(cache, line);
+  if(line->size < size) _line_resize(cache, line, size);
+  *data = line->data;
 
-    cache->hash[max] = hash;
-    cache->used[max] = weight;
-    cache->misses++;
-    return 1;
-  }
-  else
-    return 0;
+  ASAN_POISON_MEMORY_REGION(*data, line->size);
+  ASAN_UNPOISON_MEMORY_REGION(*data, size);
+
+  // first, update our copy, then update the pointer to point at our copy
+  line->dsc = **dsc;
+  *dsc = &line->dsc;
+
+  line->hash = hash;
+  line->module = module;
+  line->cost = 0.0;
+  line->important_until = weight < 0 ? cache->queries - weight : 0;
+  g_hash_table_insert(cache->hashes, &line->hash, line);
+  _line_touch(cache, line);
+  cache->last = line;
+  cache->misses++;
+  _count_query(cache, module, 1);
+  return 1;
 }
 
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k = 0; k < cache->entries; k++)
+  for(GList *l = cache->lines; l; l = g_list_next(l))
+    _line_invalidate(cache, (dt_dev_pixelpipe_cache_line_t *)l->data);
+  cache->last = NULL;
+}
+
+void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+  if(line) line->important_until = cache->queries + MAX(cache->entries, cache->min_entries);
+}
+
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, const double cost)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+  if(!line) return;
+  line->cost = cost;
+  _line_touch(cache, line);
+}
+
+void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+  if(line) _line_invalidate(cache, line);
+}
+
+int dt_dev_pixelpipe_cache_rekey(dt_dev_pixelpipe_cache_t *cache, const uint64_t old_hash, const uint64_t new_hash)
+{
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->hashes, &old_hash);
+  if(!line) return 1;
+  if(old_hash == new_hash) return 0;
+  // whatever had the new hash before is outdated now
+  dt_dev_pixelpipe_cache_line_t *other
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->hashes, &new_hash);
+  if(other) _line_invalidate(cache, other);
+  g_hash_table_remove(cache->hashes, &line->hash);
+  line->hash = new_hash;
+  g_hash_table_insert(cache->hashes, &line->hash, line);
+  _line_touch(cache, line);
+  return 0;
+}
+
+typedef struct dt_dev_pixelpipe_disk_cache_header_t
+{
+  int32_t magic;
+  int32_t version;
+  char package_version[64]; // modules may change output between releases
+  uint64_t hash;
+  dt_dev_pixelpipe_disk_cache_source_t source; // so a hash collision can't mix up two images
+  int32_t width, height;
+  uint64_t size;
+  dt_iop_buffer_dsc_t dsc;
+} dt_dev_pixelpipe_disk_cache_header_t;
+
+static void _disk_cache_filename(char *filename, const size_t bufsize, const uint64_t hash)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(filename, bufsize, "%s/%s/%016" PRIx64 ".dtpc", cachedir, DT_PIXELPIPE_DISK_CACHE_DIR, hash);
+}
+
+int dt_dev_pixelpipe_cache_disk_read(const uint64_t hash, const dt_dev_pixelpipe_disk_cache_source_t *source,
+                                     const int width, const int height, void *data, const size_t size,
+                                     dt_iop_buffer_dsc_t *dsc)
+{
+  char filename[PATH_MAX] = { 0 };
+  _disk_cache_filename(filename, sizeof(filename), hash);
+
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 1;
+
+  dt_dev_pixelpipe_disk_cache_header_t header;
+  int ret = 1;
+  if(fread(&header, sizeof(header), 1, f) != 1) goto read_error;
+  if(header.magic != DT_PIXELPIPE_DISK_CACHE_MAGIC || header.version != DT_PIXELPIPE_DISK_CACHE_VERSION
+     || strncmp(header.package_version, darktable_package_version, sizeof(header.package_version))
+     || header.hash != hash || header.width != width || header.height != height || header.size != size
+     || strncmp(header.source.filename, source->filename, sizeof(header.source.filename))
+     || strncmp(header.source.library, source->library, sizeof(header.source.library))
+     || header.source.mtime != source->mtime || header.source.size != source->size)
+    goto read_error;
+  if(fread(data, 1, size, f) != size) goto read_error;
+
+  *dsc = header.dsc;
+  ret = 0;
+  // touch the file, so the user can clean up old ones based on mtime
+  g_utime(filename, NULL);
+
+read_error:
+  fclose(f);
+  if(ret)
   {
-    cache->hash[k] = -1;
-    cache->used[k] = 0;
-    ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_cache] discarding stale on-disk cache line `%s'\n", filename);
+    g_unlink(filename);
   }
+  return ret;
 }
 
-void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
+typedef struct _disk_cache_file_t
 {
-  for(int k = 0; k < cache->entries; k++)
+  gchar *name;
+  off_t size;
+  time_t mtime;
+} _disk_cache_file_t;
+
+static gint _disk_cache_file_older(gconstpointer a, gconstpointer b)
+{
+  const time_t ma = ((const _disk_cache_file_t *)a)->mtime, mb = ((const _disk_cache_file_t *)b)->mtime;
+  return (ma > mb) - (ma < mb);
+}
+
+static void _disk_cache_file_free(gpointer data)
+{
+  g_free(((_disk_cache_file_t *)data)->name);
+  g_free(data);
+}
+
+// delete the least recently used lines until `size' more bytes fit below the disk_cache_size limit.
+// returns 0 if they fit then.
+static int _disk_cache_make_room(const char *dirname, const size_t size)
+{
+  const int limit_mb = dt_conf_get_int("plugins/imageio/export/disk_cache_size");
+  if(limit_mb <= 0) return 0;
+  const uint64_t limit = (uint64_t)limit_mb << 20;
+  if(size > limit) return 1;
+
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  if(!dir) return 0;
+  GList *files = NULL;
+  uint64_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
   {
-    if(cache->data[k] == data)
+    if(!g_str_has_suffix(name, ".dtpc")) continue;
+    gchar *path = g_build_filename(dirname, name, NULL);
+    GStatBuf st;
+    if(g_stat(path, &st))
     {
-      cache->used[k] = -cache->entries;
+      g_free(path);
+      continue;
     }
+    _disk_cache_file_t *file = g_malloc(sizeof(_disk_cache_file_t));
+    file->name = path;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    files = g_list_prepend(files, file);
+    total += st.st_size;
   }
+  g_dir_close(dir);
+
+  // reads touch the files, so the oldest mtime is the line used least recently
+  files = g_list_sort(files, _disk_cache_file_older);
+  for(GList *l = files; l && total + size > limit; l = g_list_next(l))
+  {
+    _disk_cache_file_t *file = (_disk_cache_file_t *)l->data;
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_cache] evicting on-disk cache line `%s'\n", file->name);
+    // another export might have removed it already, it's gone either way
+    g_unlink(file->name);
+    total -= MIN(total, (uint64_t)file->size);
+  }
+  g_list_free_full(files, _disk_cache_file_free);
+  return 0;
 }
 
-void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
+void dt_dev_pixelpipe_cache_disk_write(const uint64_t hash, const dt_dev_pixelpipe_disk_cache_source_t *source,
+                                       const int width, const int height, const void *data, const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc)
 {
-  for(int k = 0; k < cache->entries; k++)
+  char filename[PATH_MAX] = { 0 };
+  char dirname[PATH_MAX] = { 0 };
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(dirname, sizeof(dirname), "%s/%s", cachedir, DT_PIXELPIPE_DISK_CACHE_DIR);
+  if(g_mkdir_with_parents(dirname, 0750)) return;
+
+  // these buffers are large, don't fill up the disk with them
+  struct statvfs vfsbuf;
+  if(statvfs(dirname, &vfsbuf) || ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20) < 1024 + (size >> 20))
   {
-    if(cache->data[k] == data)
-    {
-      cache->hash[k] = -1;
-      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
-    }
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_cache] not enough disk space for on-disk cache line\n");
+    return;
+  }
+  if(_disk_cache_make_room(dirname, sizeof(dt_dev_pixelpipe_disk_cache_header_t) + size))
+  {
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_cache] on-disk cache line larger than disk_cache_size\n");
+    return;
   }
+
+  dt_dev_pixelpipe_disk_cache_header_t header = { 0 };
+  header.magic = DT_PIXELPIPE_DISK_CACHE_MAGIC;
+  header.version = DT_PIXELPIPE_DISK_CACHE_VERSION;
+  g_strlcpy(header.package_version, darktable_package_version, sizeof(header.package_version));
+  header.hash = hash;
+  header.source = *source;
+  header.width = width;
+  header.height = height;
+  header.size = size;
+  header.dsc = *dsc;
+
+  // write to a temporary file first, so concurrent exports never see half written lines
+  _disk_cache_filename(filename, sizeof(filename), hash);
+  gchar *tmpname = g_strdup_printf("%s.%p.tmp", filename, (void *)g_thread_self());
+  FILE *f = g_fopen(tmpname, "wb");
+  if(!f)
+  {
+    g_free(tmpname);
+    return;
+  }
+  const int written = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(data, 1, size, f) == size;
+  if(fclose(f) || !written || g_rename(tmpname, filename))
+    g_unlink(tmpname);
+  g_free(tmpname);
 }
 
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k = 0; k < cache->entries; k++)
+  int k = 0;
+  for(GList *l = cache->lines; l; l = g_list_next(l), k++)
   {
+    dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)l->data;
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
+    printf("module %d size %zu cost %.3fs priority %.3f by %" PRIu64 "", line->module, line->size, line->cost,
+           line->priority, line->hash);
     printf("\n");
   }
-  printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
+  for(int m = 0; m < cache->num_modules; m++)
+  {
+    if(!cache->module_queries[m]) continue;
+    printf("pixelpipe cache module %d: %" PRIu64 " queries, %" PRIu64 " misses\n", m, cache->module_queries[m],
+           cache->module_misses[m]);
+  }
+  printf("cache hit rate so far: %.3f, %d lines using %.1f/%.1f MB\n",
+         (cache->queries - cache->misses) / (float)cache->queries, cache->entries,
+         cache->memory / (1024.0 * 1024.0), cache->memory_limit / (1024.0 * 1024.0));
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
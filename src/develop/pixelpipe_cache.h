@@ -18,38 +18,51 @@
 
 #pragma once
 
+#include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
 
 struct dt_dev_pixelpipe_t;
 struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
+struct dt_dev_pixelpipe_cache_line_t;
 
 /**
- * implements a simple pixel cache suitable for caching float images
+ * implements a pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ * cache lines have variable size and are found by hash in O(1). the number of
+ * lines is only bounded by a memory budget, and when it is exceeded lines are
+ * evicted based on how expensive they were to compute per byte (greedy dual size),
+ * so costly upstream modules like demosaic or denoise stay around.
+ * a memory budget of 0 keeps a fixed number of lines, growing them on demand.
  */
 
 typedef struct dt_dev_pixelpipe_cache_t
 {
-  int32_t entries;
-  void **data;
-  size_t *size;
-  struct dt_iop_buffer_dsc_t *dsc;
-  uint64_t *hash;
-  int32_t *used;
-#ifdef HAVE_OPENCL
-  void **gpu_mem;
-#endif
+  int32_t entries;      // number of cache lines currently allocated
+  int32_t min_entries;  // never evict below this number of lines
+  size_t memory;        // bytes currently allocated by all lines
+  size_t memory_limit;  // budget in bytes, 0 for fixed line count
+  double clock;         // inflation value of the greedy dual size eviction
+  GList *lines;         // all dt_dev_pixelpipe_cache_line_t, valid or not
+  GHashTable *hashes;   // hash -> valid line
+  GHashTable *buffers;  // data pointer -> line
+  struct dt_dev_pixelpipe_cache_line_t *last; // line handed out last, is the input of the next module
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  // per module profiling, indexed by pipe position:
+  int32_t num_modules;
+  uint64_t *module_queries;
+  uint64_t *module_misses;
 } dt_dev_pixelpipe_cache_t;
 
-/** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+/** constructs a new cache with given minimum cache line count (entries), float buffer entry size in bytes
+  and memory budget in bytes (0 to keep exactly entries lines).
   \param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
@@ -57,14 +70,15 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
                                      struct dt_dev_pixelpipe_t *pipe, int module);
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
-  * cache line, the least recently used cache line will be cleared and an empty buffer is returned
-  * together with a non-zero return value. */
+  * cache line, the cheapest cache line to recompute will be cleared and an empty buffer is returned
+  * together with a non-zero return value. module is the position in the pipe, used for statistics. */
 int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                               void **data, struct dt_iop_buffer_dsc_t **dsc);
+                               void **data, struct dt_iop_buffer_dsc_t **dsc, const int module);
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                                         void **data, struct dt_iop_buffer_dsc_t **dsc);
+                                         void **data, struct dt_iop_buffer_dsc_t **dsc, const int module);
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
-                                        void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
+                                        void **data, struct dt_iop_buffer_dsc_t **dsc, int weight,
+                                        const int module);
 
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
@@ -75,10 +89,37 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** remember how long it took (in seconds) to compute the given buffer, used for eviction. */
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, const double cost);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
-/** print out cache lines/hashes (debug). */
+/** hands the line of old_hash over to new_hash, after its buffer has been brought up to date in place.
+  * returns non-zero if there is no line for old_hash. */
+int dt_dev_pixelpipe_cache_rekey(dt_dev_pixelpipe_cache_t *cache, const uint64_t old_hash, const uint64_t new_hash);
+
+/** what an on-disk cache line was computed from, besides the history. image ids are only unique within one
+  * library, and not even there once images are removed, so the source file itself has to match. */
+typedef struct dt_dev_pixelpipe_disk_cache_source_t
+{
+  char filename[PATH_MAX]; // full path of the source file
+  char library[PATH_MAX];  // library the history was read from
+  int64_t mtime, size;     // of the source file
+} dt_dev_pixelpipe_disk_cache_source_t;
+
+/** optional on-disk tier, used by export pipes to persist the output of one checkpoint module across runs.
+  * the file is found by the cache hash, so it depends on source, history up to the module and roi.
+  * returns 0 on success and fills data and dsc, non-zero if no matching file exists. */
+int dt_dev_pixelpipe_cache_disk_read(const uint64_t hash, const dt_dev_pixelpipe_disk_cache_source_t *source,
+                                     const int width, const int height, void *data, const size_t size,
+                                     struct dt_iop_buffer_dsc_t *dsc);
+/** writes the buffer for the given hash to the on-disk tier. failures are not fatal, the file is just missing. */
+void dt_dev_pixelpipe_cache_disk_write(const uint64_t hash, const dt_dev_pixelpipe_disk_cache_source_t *source,
+                                       const int width, const int height, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc);
+
+/** print out cache lines/hashes and per module hit rates (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -19,6 +19,7 @@
 */
 #include "common/color_picker.h"
 #include "common/colorspaces.h"
+#include "common/database.h"
 #include "common/histogram.h"
 #include "common/imageio.h"
 #include "common/opencl.h"
@@ -61,11 +62,64 @@ typedef enum dt_pixelpipe_picker_source_t
   PIXELPIPE_PICKER_OUTPUT = 1
 } dt_pixelpipe_picker_source_t;
 
+// longer side of the pre-pass of strip-wise processing, in pixels
+#define DT_DEV_PIXELPIPE_STRIPS_PREPASS_SIZE 1024
+
+// size of the bands of fused point-wise modules: two float4 buffers of this fit into 512k of L2 cache
+#define DT_DEV_PIXELPIPE_FUSED_PIXELS_PER_THREAD (1 << 14)
+
+// patching the cached output after a local edit is only worth it if less than this fraction of it changed
+#define DT_DEV_PIXELPIPE_PATCH_MAX_AREA 0.5f
+
+// a shape used by a piece, as it was synched last
+typedef struct dt_dev_pixelpipe_form_state_t
+{
+  int formid;
+  int state;
+  float opacity;
+  uint64_t hash;         // of the shape itself
+  dt_masks_form_t *form; // copy of the shape, to find out where it was
+} dt_dev_pixelpipe_form_state_t;
+
 #include "develop/pixelpipe_cache.c"
 
 static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
                               dt_develop_t *dev, dt_iop_buffer_dsc_t *dsc);
 
+// the source file and library of the image, the on-disk cache must not confuse images of different libraries
+static void _disk_cache_source(const dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_disk_cache_source_t *source)
+{
+  memset(source, 0, sizeof(*source));
+  gboolean from_cache = FALSE;
+  dt_image_full_path(pipe->image.id, source->filename, sizeof(source->filename), &from_cache);
+  GStatBuf st;
+  if(!g_stat(source->filename, &st))
+  {
+    source->mtime = st.st_mtime;
+    source->size = st.st_size;
+  }
+  const gchar *library = dt_database_get_path(darktable.db);
+  if(library) g_strlcpy(source->library, library, sizeof(source->library));
+}
+
+// the in-memory cache hash only lives as long as the pipe. on disk, also the output
+// color settings of the pipe need to be taken into account, they are not part of the history,
+// and the source, the image id alone means nothing outside the library.
+static uint64_t _disk_cache_hash(const dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_disk_cache_source_t *source,
+                                 uint64_t hash)
+{
+  hash = ((hash << 5) + hash) ^ pipe->icc_type;
+  hash = ((hash << 5) + hash) ^ pipe->icc_intent;
+  hash = ((hash << 5) + hash) ^ pipe->levels;
+  if(pipe->icc_filename)
+    for(const char *c = pipe->icc_filename; *c; c++) hash = ((hash << 5) + hash) ^ *c;
+  for(const char *c = source->filename; *c; c++) hash = ((hash << 5) + hash) ^ *c;
+  for(const char *c = source->library; *c; c++) hash = ((hash << 5) + hash) ^ *c;
+  hash = ((hash << 5) + hash) ^ source->mtime;
+  hash = ((hash << 5) + hash) ^ source->size;
+  return hash;
+}
+
 static char *_pipe_type_to_str(int pipe_type)
 {
   char *r;
@@ -90,24 +144,35 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+// memory budget for the intermediate buffers of the interactive darkroom pipes
+static size_t _pixelpipe_cache_memory_limit()
+{
+  const int megabytes = dt_conf_get_int("pixelpipe_cache_memory");
+  return (size_t)MAX(megabytes, 0) << 20;
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_EXPORT;
   pipe->levels = levels;
+  // repeated exports of the same images may resume from a module output stored on disk:
+  gchar *checkpoint = dt_conf_get_string("plugins/imageio/export/disk_cache_checkpoint");
+  if(checkpoint) g_strlcpy(pipe->disk_cache_checkpoint, checkpoint, sizeof(pipe->disk_cache_checkpoint));
+  g_free(checkpoint);
   return res;
 }
 
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
 
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
@@ -116,7 +181,7 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
   int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+      pipe, 0, 5, _pixelpipe_cache_memory_limit());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
   return res;
 }
@@ -125,12 +190,12 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
   int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+      pipe, 0, 5, _pixelpipe_cache_memory_limit());
   pipe->type = DT_DEV_PIXELPIPE_FULL;
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -138,7 +203,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size, memory_limit)) return 0;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
@@ -155,6 +220,9 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->icc_intent = DT_INTENT_LAST;
   pipe->iop = NULL;
   pipe->forms = NULL;
+  pipe->disk_cache_checkpoint[0] = '\0';
+  pipe->strip_pass = DT_DEV_PIXELPIPE_STRIPS_NONE;
+  pipe->patch_last_hash = 0;
 
   return 1;
 }
@@ -201,6 +269,194 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   }
 }
 
+static void _pixelpipe_form_state_free(void *data)
+{
+  dt_dev_pixelpipe_form_state_t *state = (dt_dev_pixelpipe_form_state_t *)data;
+  dt_masks_free_form(state->form);
+  free(state);
+}
+
+// forget the shapes which changed since the last run, after the output has been brought up to date
+static void _pixelpipe_patch_clean(dt_dev_pixelpipe_iop_t *piece)
+{
+  g_list_free_full(piece->patch_dirty_forms, (void (*)(void *))dt_masks_free_form);
+  piece->patch_dirty_forms = NULL;
+  piece->patch_dirty_full = 0;
+}
+
+static uint64_t _pixelpipe_form_hash(dt_masks_form_t *form)
+{
+  const int length = dt_masks_group_get_hash_buffer_length(form);
+  char *str = malloc(length);
+  if(!str) return 0;
+  dt_masks_group_get_hash_buffer(form, str);
+  uint64_t hash = 5381;
+  for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  free(str);
+  return hash;
+}
+
+// snapshot of the shapes in the mask group of the given blend params
+static GList *_pixelpipe_form_states(dt_develop_t *dev, const dt_develop_blend_params_t *blend_params)
+{
+  dt_masks_form_t *grp = blend_params ? dt_masks_get_from_id(dev, blend_params->mask_id) : NULL;
+  if(!grp || !(grp->type & DT_MASKS_GROUP)) return NULL;
+
+  GList *states = NULL;
+  for(GList *points = g_list_first(grp->points); points; points = g_list_next(points))
+  {
+    const dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)points->data;
+    dt_masks_form_t *form = dt_masks_get_from_id(dev, grpt->formid);
+    if(!form) continue;
+    dt_dev_pixelpipe_form_state_t *state
+        = (dt_dev_pixelpipe_form_state_t *)calloc(1, sizeof(dt_dev_pixelpipe_form_state_t));
+    state->formid = grpt->formid;
+    state->state = grpt->state;
+    state->opacity = grpt->opacity;
+    state->hash = _pixelpipe_form_hash(form);
+    state->form = dt_masks_dup_masks_form(form);
+    states = g_list_append(states, state);
+  }
+  return states;
+}
+
+static dt_dev_pixelpipe_form_state_t *_pixelpipe_form_state_find(GList *states, const int formid)
+{
+  for(; states; states = g_list_next(states))
+  {
+    dt_dev_pixelpipe_form_state_t *state = (dt_dev_pixelpipe_form_state_t *)states->data;
+    if(state->formid == formid) return state;
+  }
+  return NULL;
+}
+
+// does adding or removing a shape in this state only change the mask inside of it?
+static inline int _pixelpipe_form_state_local(const int state)
+{
+  return !(state & (DT_MASKS_STATE_INVERSE | DT_MASKS_STATE_INTERSECTION));
+}
+
+static void _pixelpipe_patch_add_dirty(dt_dev_pixelpipe_iop_t *piece, const dt_masks_form_t *form)
+{
+  piece->patch_dirty_forms = g_list_append(piece->patch_dirty_forms, dt_masks_dup_masks_form(form));
+}
+
+// remember the shapes which changed between two snapshots. a shape which moved only changes the mask where
+// it was and where it is now, whatever its state. adding or removing one may change it everywhere.
+static void _pixelpipe_patch_diff_forms(dt_dev_pixelpipe_iop_t *piece, GList *old_states, GList *new_states)
+{
+  int local = 1;
+  for(GList *l = old_states; l; l = g_list_next(l))
+    local &= _pixelpipe_form_state_local(((dt_dev_pixelpipe_form_state_t *)l->data)->state);
+  for(GList *l = new_states; l; l = g_list_next(l))
+    local &= _pixelpipe_form_state_local(((dt_dev_pixelpipe_form_state_t *)l->data)->state);
+
+  for(GList *l = new_states; l; l = g_list_next(l))
+  {
+    const dt_dev_pixelpipe_form_state_t *new_state = (dt_dev_pixelpipe_form_state_t *)l->data;
+    const dt_dev_pixelpipe_form_state_t *old_state = _pixelpipe_form_state_find(old_states, new_state->formid);
+    if(old_state && old_state->state == new_state->state && old_state->opacity == new_state->opacity)
+    {
+      if(old_state->hash == new_state->hash) continue;
+      _pixelpipe_patch_add_dirty(piece, old_state->form);
+      _pixelpipe_patch_add_dirty(piece, new_state->form);
+    }
+    else if(local)
+    {
+      if(old_state) _pixelpipe_patch_add_dirty(piece, old_state->form);
+      _pixelpipe_patch_add_dirty(piece, new_state->form);
+    }
+    else
+      piece->patch_dirty_full = 1;
+  }
+  for(GList *l = old_states; l; l = g_list_next(l))
+  {
+    const dt_dev_pixelpipe_form_state_t *old_state = (dt_dev_pixelpipe_form_state_t *)l->data;
+    if(_pixelpipe_form_state_find(new_states, old_state->formid)) continue;
+    if(local)
+      _pixelpipe_patch_add_dirty(piece, old_state->form);
+    else
+      piece->patch_dirty_full = 1;
+  }
+}
+
+// compares what has just been committed to the piece with what was synched before. if only shapes moved,
+// the next run may patch the cached output in their area, anything else needs it recomputed.
+static void _pixelpipe_patch_track(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece,
+                                   const void *params, const dt_develop_blend_params_t *blend_params,
+                                   const int enabled)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL) return;
+
+  uint64_t hash = 5381 + enabled;
+  const char *str = (const char *)params;
+  for(int i = 0; i < piece->module->params_size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)blend_params;
+  for(size_t i = 0; blend_params && i < sizeof(dt_develop_blend_params_t); i++)
+    hash = ((hash << 5) + hash) ^ str[i];
+
+  GList *states = _pixelpipe_form_states(dev, blend_params);
+  if(hash != piece->patch_params_hash)
+    piece->patch_dirty_full = 1;
+  else if(piece->patch_hash && !piece->patch_dirty_full)
+    _pixelpipe_patch_diff_forms(piece, piece->patch_forms, states);
+
+  g_list_free_full(piece->patch_forms, _pixelpipe_form_state_free);
+  piece->patch_forms = states;
+  piece->patch_params_hash = hash;
+}
+
+// same for all pieces, with the params the history ends up with
+static void _pixelpipe_patch_track_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL) return;
+
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    const void *params = module->default_params;
+    const dt_develop_blend_params_t *blend_params = module->default_blendop_params;
+    int enabled = module->default_enabled;
+    GList *history = dev->history;
+    for(int k = 0; k < dev->history_end && history; k++, history = g_list_next(history))
+    {
+      const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+      if(hist->module != module) continue;
+      params = hist->params;
+      blend_params = hist->blend_params;
+      enabled = hist->enabled;
+    }
+    _pixelpipe_patch_track(pipe, dev, piece, params, blend_params, enabled);
+  }
+}
+
+// remember what a piece has just put into the cache, to patch it after the next local edit
+static void _pixelpipe_patch_record(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                                    const dt_iop_roi_t *roi, const uint64_t hash, const int pos,
+                                    const int input_processed)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL) return;
+
+  if(hash != dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, pos))
+  {
+    // the history changed while this piece was processed, the buffer is outdated already
+    piece->patch_hash = 0;
+  }
+  else
+  {
+    // a buffer found in the cache still has the input it was recorded with, if it is the same one
+    if(input_processed)
+      piece->patch_in_hash = pipe->patch_last_hash;
+    else if(hash != piece->patch_hash)
+      piece->patch_in_hash = 0;
+    piece->patch_hash = hash;
+    piece->patch_roi = *roi;
+  }
+  _pixelpipe_patch_clean(piece);
+  pipe->patch_last_hash = hash;
+}
+
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
 {
   // FIXME: either this or all process() -> gdk mutices have to be changed!
@@ -218,6 +474,9 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
     piece->blendop_data = NULL;
     free(piece->histogram);
     piece->histogram = NULL;
+    dt_dev_pixelpipe_set_global_data(piece, NULL, NULL);
+    _pixelpipe_patch_clean(piece);
+    g_list_free_full(piece->patch_forms, _pixelpipe_form_state_free);
     free(piece);
     nodes = g_list_next(nodes);
   }
@@ -264,6 +523,8 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->hash = 0;
       piece->process_cl_ready = 0;
       piece->process_tiling_ready = 0;
+      piece->process_pointwise_ready = 0;
+      piece->process_patch_ready = 0;
       dt_iop_init_pipe(piece->module, pipe, piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -313,6 +574,7 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     dt_dev_pixelpipe_synch(pipe, dev, history);
     history = g_list_next(history);
   }
+  _pixelpipe_patch_track_all(pipe, dev);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -320,7 +582,17 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   GList *history = g_list_nth(dev->history, dev->history_end - 1);
-  if(history) dt_dev_pixelpipe_synch(pipe, dev, history);
+  if(history)
+  {
+    dt_dev_pixelpipe_synch(pipe, dev, history);
+    const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+    {
+      dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+      if(piece->module == hist->module)
+        _pixelpipe_patch_track(pipe, dev, piece, hist->params, hist->blend_params, hist->enabled);
+    }
+  }
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -594,6 +866,524 @@ error:
 #endif
 
 
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// is this piece left out of the pipe run?
+static int _pixelpipe_skip_piece(const dt_develop_t *dev, dt_iop_module_t *module,
+                                 const dt_dev_pixelpipe_iop_t *piece)
+{
+  return !piece->enabled
+         || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags());
+}
+
+// requests for whole rows of the input at full scale are served with a view into the input buffer (the
+// full mipmap), which stays valid and unchanged while the pipe runs. no copy, no cache line.
+static inline int _pixelpipe_input_view(const dt_dev_pixelpipe_t *pipe, const dt_iop_roi_t *roi)
+{
+  return roi->scale == 1.0f && roi->x == 0 && roi->width == pipe->iwidth && roi->y >= 0
+         && roi->y + roi->height <= pipe->iheight;
+}
+
+// a module flagged IOP_FLAGS_INPUT_VIEW right after the input gets whole rows instead of the cropped copy it
+// asked for in roi_in, if it is processed on the cpu without tiling. returns whether roi_in was widened.
+static int _pixelpipe_widen_to_input_view(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                                          dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                          GList *modules, GList *pieces, const dt_iop_roi_t *roi_out,
+                                          dt_iop_roi_t *roi_in)
+{
+  if(!(module->flags() & IOP_FLAGS_INPUT_VIEW) || roi_in->scale != 1.0f || _pixelpipe_input_view(pipe, roi_in)
+     || roi_in->x < 0 || roi_in->x + roi_in->width > pipe->iwidth || roi_in->y < 0
+     || roi_in->y + roi_in->height > pipe->iheight)
+    return 0;
+  for(modules = g_list_previous(modules), pieces = g_list_previous(pieces); modules;
+      modules = g_list_previous(modules), pieces = g_list_previous(pieces))
+    if(!_pixelpipe_skip_piece(dev, (dt_iop_module_t *)modules->data, (dt_dev_pixelpipe_iop_t *)pieces->data))
+      return 0;
+#ifdef HAVE_OPENCL
+  // the input is copied to the device anyways, keep that small
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0 && module->process_cl
+     && piece->process_cl_ready)
+    return 0;
+#endif
+  dt_iop_roi_t wide = *roi_in;
+  wide.x = 0;
+  wide.width = pipe->iwidth;
+  dt_develop_tiling_t tiling = { 0 };
+  module->tiling_callback(module, piece, &wide, roi_out, &tiling);
+  if(!dt_tiling_piece_fits_host_memory(MAX(wide.width, roi_out->width), MAX(wide.height, roi_out->height),
+                                       4 * sizeof(float), tiling.factor, tiling.overhead))
+    return 0;
+  *roi_in = wide;
+  return 1;
+}
+
+// can this piece be processed band by band, together with its point-wise neighbours?
+static int _pixelpipe_piece_fusable(const dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module,
+                                    const dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!(module->flags() & IOP_FLAGS_POINTWISE) || !piece->process_pointwise_ready) return 0;
+  // histograms are collected from the whole input
+  if(piece->request_histogram & DT_REQUEST_ON) return 0;
+  // the checkpoint needs the whole output of its module
+  if(pipe->disk_cache_checkpoint[0] && !strcmp(module->op, pipe->disk_cache_checkpoint)) return 0;
+  // drawn masks, feathering and mask blur look at the neighbourhood
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(d && (d->mask_mode & DEVELOP_MASK_ENABLED)
+     && ((d->mask_mode & DEVELOP_MASK_MASK) || d->feathering_radius > 0.1f || d->blur_radius > 0.1f))
+    return 0;
+  return 1;
+}
+
+// number of point-wise modules that can be processed in one go, starting at the given one and going down
+static int _pixelpipe_fused_length(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev, GList *modules,
+                                   GList *pieces)
+{
+  // the darkroom pipes want the output of every module in the cache, so the next change of history only
+  // reprocesses what comes after it. debugging wants to see every module, too.
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL)) || pipe->mask_display
+     || (darktable.unmuted & DT_DEBUG_NAN))
+    return 0;
+#ifdef HAVE_OPENCL
+  // the gpu has its own memory, no need to spare the bandwidth to host memory
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return 0;
+#endif
+
+  int length = 0;
+  for(; modules; modules = g_list_previous(modules), pieces = g_list_previous(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(_pixelpipe_skip_piece(dev, module, piece)) continue;
+    if(!_pixelpipe_piece_fusable(pipe, module, piece)) break;
+    length++;
+  }
+  return length;
+}
+
+// runs length point-wise modules, ending with the given one, band by band instead of module by module. the
+// bands are sized to stay in the cpu cache between the modules, only the input and output of the whole run
+// go through memory.
+static int _pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                    dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                    GList *modules, GList *pieces, int pos, const int length,
+                                    const uint64_t hash, const size_t bufsize)
+{
+  dt_iop_module_t **run_modules = malloc(sizeof(dt_iop_module_t *) * length);
+  dt_dev_pixelpipe_iop_t **run_pieces = malloc(sizeof(dt_dev_pixelpipe_iop_t *) * length);
+  dt_iop_buffer_dsc_t *run_dsc = malloc(sizeof(dt_iop_buffer_dsc_t) * length);
+  float *band[2] = { NULL, NULL };
+  const int last_pos = pos;
+  int err = 1;
+
+  // collect the run in processing order. afterwards, modules and pieces point to what is in front of it.
+  for(int k = length; k > 0; modules = g_list_previous(modules), pieces = g_list_previous(pieces), pos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(_pixelpipe_skip_piece(dev, module, piece)) continue;
+    k--;
+    run_modules[k] = module;
+    run_pieces[k] = piece;
+  }
+  dt_iop_module_t *last = run_modules[length - 1];
+
+  // point-wise modules need just the same region of interest
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out, modules, pieces,
+                                  pos))
+    goto error;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown) goto error_locked;
+
+  if(!strcmp(last->op, "gamma"))
+    (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output, out_format, last_pos);
+  else
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format, last_pos);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // bands of full rows, so they are contiguous in the input and output buffers. the modules split them
+  // between the threads the same way every time, so each thread finds its part in its own cache.
+  const int width = roi_out->width;
+  const int band_rows
+      = CLAMP(DT_DEV_PIXELPIPE_FUSED_PIXELS_PER_THREAD * dt_get_num_threads() / MAX(width, 1), 1,
+              MAX(roi_out->height, 1));
+  for(int i = 0; i < 2; i++)
+  {
+    band[i] = dt_alloc_align(64, sizeof(float) * 4 * width * band_rows);
+    if(!band[i]) goto error_locked;
+  }
+
+  const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
+  dt_iop_buffer_dsc_t format = *input_format;
+  for(int y = 0; y < roi_out->height; y += band_rows)
+  {
+    dt_iop_roi_t roi = *roi_out;
+    roi.y += y;
+    roi.height = MIN(band_rows, roi_out->height - y);
+
+    const void *in = (const char *)input + in_bpp * width * y;
+    for(int k = 0; k < length; k++)
+    {
+      dt_iop_module_t *module = run_modules[k];
+      dt_dev_pixelpipe_iop_t *piece = run_pieces[k];
+
+      // formats as if the module ran on the whole image. the first band decides the input of the next module.
+      if(y == 0)
+      {
+        piece->dsc_out = piece->dsc_in = format;
+        module->output_format(module, pipe, piece, &piece->dsc_out);
+        run_dsc[k] = piece->dsc_out;
+      }
+      pipe->dsc = run_dsc[k];
+
+      void *out = band[k & 1];
+      if(k == length - 1) out = (char *)*output + dt_iop_buffer_dsc_to_bpp(&piece->dsc_out) * width * y;
+
+      module->process(module, piece, in, out, &roi, &roi);
+      dt_develop_blend_process(module, piece, in, out, &roi, &roi);
+
+      if(y == 0) format = piece->dsc_out = pipe->dsc;
+      in = out;
+    }
+
+    if(pipe->shutdown) goto error_locked;
+  }
+
+  **out_format = pipe->dsc = run_pieces[length - 1]->dsc_out;
+  dt_dev_pixelpipe_cache_set_cost(&(pipe->cache), *output, dt_get_wtime() - start.clock);
+
+  dt_show_times(&start, "[dev_pixelpipe]", "processed %d point-wise modules `%s' to `%s' fused on CPU [%s]",
+                length, run_modules[0]->op, last->op, _pipe_type_to_str(pipe->type));
+  err = 0;
+
+error_locked:
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+error:
+  dt_free_align(band[0]);
+  dt_free_align(band[1]);
+  free(run_dsc);
+  free(run_pieces);
+  free(run_modules);
+  return err;
+}
+
+// rectangles of pixels as x0, y0, x1, y1, excluding x1 and y1
+static inline int _pixelpipe_rect_empty(const int r[4])
+{
+  return r[2] <= r[0] || r[3] <= r[1];
+}
+
+static inline void _pixelpipe_rect_union(int r[4], const int a[4])
+{
+  if(_pixelpipe_rect_empty(a)) return;
+  if(_pixelpipe_rect_empty(r))
+  {
+    for(int k = 0; k < 4; k++) r[k] = a[k];
+    return;
+  }
+  r[0] = MIN(r[0], a[0]);
+  r[1] = MIN(r[1], a[1]);
+  r[2] = MAX(r[2], a[2]);
+  r[3] = MAX(r[3], a[3]);
+}
+
+// how far the output of a piece looks around in its input (overlap, in input pixels) and how far blurred or
+// feathered masks reach (blend_margin, in output pixels). returns non-zero if the piece can't be processed on
+// a part of the region of interest, or changes of its input can't be followed through it.
+static int _pixelpipe_patch_context(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                    const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                                    const int input_dirty, int *overlap, int *blend_margin)
+{
+  *overlap = *blend_margin = 0;
+  if(piece->process_tiling_ready && !piece->process_pointwise_ready)
+  {
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, roi_in, roi_out, &tiling);
+    *overlap = tiling.overlap;
+  }
+  // shapes of these may take their pixels from anywhere, so a changed input changes anything
+  else if(!piece->process_pointwise_ready && (input_dirty || !piece->process_patch_ready))
+    return 1;
+
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(d && (d->mask_mode & DEVELOP_MASK_ENABLED))
+    *blend_margin
+        = ceilf((3.0f * d->blur_radius + 2.0f * d->feathering_radius) * roi_out->scale / piece->iscale);
+  return 0;
+}
+
+// follows a rectangle of input pixels through the distortion of the module to its output pixels
+static void _pixelpipe_patch_transform(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                       const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in[4],
+                                       int out[4])
+{
+  // corners and middles of the edges, in full resolution coordinates
+  const float x[3] = { in[0], 0.5f * (in[0] + in[2]), in[2] };
+  const float y[3] = { in[1], 0.5f * (in[1] + in[3]), in[3] };
+  float points[16];
+  int n = 0;
+  for(int j = 0; j < 3; j++)
+    for(int i = 0; i < 3; i++)
+    {
+      if(i == 1 && j == 1) continue;
+      points[2 * n] = (x[i] + roi_in->x) / roi_in->scale;
+      points[2 * n + 1] = (y[j] + roi_in->y) / roi_in->scale;
+      n++;
+    }
+  module->distort_transform(module, piece, points, n);
+
+  float xmin = FLT_MAX, ymin = FLT_MAX, xmax = -FLT_MAX, ymax = -FLT_MAX;
+  for(int k = 0; k < n; k++)
+  {
+    xmin = fminf(xmin, points[2 * k]);
+    xmax = fmaxf(xmax, points[2 * k]);
+    ymin = fminf(ymin, points[2 * k + 1]);
+    ymax = fmaxf(ymax, points[2 * k + 1]);
+  }
+  out[0] = floorf(xmin * roi_out->scale - roi_out->x) - 1;
+  out[1] = floorf(ymin * roi_out->scale - roi_out->y) - 1;
+  out[2] = ceilf(xmax * roi_out->scale - roi_out->x) + 1;
+  out[3] = ceilf(ymax * roi_out->scale - roi_out->y) + 1;
+}
+
+// reprocesses the dirty rectangle of roi_out, plus context pixels around it to get the borders right, and
+// copies it over the cached output of the last run.
+static int _pixelpipe_patch_process(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module,
+                                    dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                                    const dt_iop_roi_t *roi_out, const int dirty[4], const int context,
+                                    const uint64_t in_hash, const uint64_t out_hash)
+{
+  const int x0 = MAX(dirty[0] - context, 0), y0 = MAX(dirty[1] - context, 0);
+  const int x1 = MIN(dirty[2] + context, roi_out->width), y1 = MIN(dirty[3] + context, roi_out->height);
+  dt_iop_roi_t sub_out = *roi_out;
+  sub_out.x += x0;
+  sub_out.y += y0;
+  sub_out.width = x1 - x0;
+  sub_out.height = y1 - y0;
+  dt_iop_roi_t sub_in = sub_out;
+
+  void *input = NULL, *output = NULL, *tile_in = NULL, *tile_out = NULL;
+  dt_iop_buffer_dsc_t _dsc = { 0 };
+  dt_iop_buffer_dsc_t *in_dsc = &_dsc, *out_dsc = &_dsc;
+  size_t in_bpp = 0, out_bpp = 0;
+  dt_times_t start;
+  int err = 1;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown) goto error_locked;
+  module->modify_roi_in(module, piece, &sub_out, &sub_in);
+  // the region has to be found in the input at hand
+  if(sub_in.scale != roi_in->scale || sub_in.x < roi_in->x || sub_in.y < roi_in->y
+     || sub_in.x + sub_in.width > roi_in->x + roi_in->width
+     || sub_in.y + sub_in.height > roi_in->y + roi_in->height)
+    goto error_locked;
+  if(!dt_dev_pixelpipe_cache_available(&(pipe->cache), in_hash)
+     || !dt_dev_pixelpipe_cache_available(&(pipe->cache), out_hash))
+    goto error_locked;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), in_hash, 0, &input, &in_dsc, -1);
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), out_hash, 0, &output, &out_dsc, -1);
+  if(in_dsc->channels != piece->dsc_in.channels || in_dsc->datatype != piece->dsc_in.datatype) goto error_locked;
+  in_bpp = dt_iop_buffer_dsc_to_bpp(in_dsc);
+  out_bpp = dt_iop_buffer_dsc_to_bpp(out_dsc);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  tile_in = dt_alloc_align(64, in_bpp * sub_in.width * sub_in.height);
+  tile_out = dt_alloc_align(64, out_bpp * sub_out.width * sub_out.height);
+  if(!tile_in || !tile_out) goto error;
+
+  dt_get_times(&start);
+
+  {
+    const int in_x = sub_in.x - roi_in->x, in_y = sub_in.y - roi_in->y;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(sub_in, roi_in, input, tile_in, in_bpp)
+#endif
+    for(int j = 0; j < sub_in.height; j++)
+      memcpy((char *)tile_in + in_bpp * j * sub_in.width,
+             (const char *)input + in_bpp * ((size_t)(in_y + j) * roi_in->width + in_x), in_bpp * sub_in.width);
+  }
+
+  pipe->dsc = piece->dsc_out;
+  module->process(module, piece, tile_in, tile_out, &sub_in, &sub_out);
+  dt_develop_blend_process(module, piece, tile_in, tile_out, &sub_in, &sub_out);
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown) goto error_locked;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(roi_out, output, tile_out, sub_out, out_bpp, dirty)
+#endif
+  for(int j = dirty[1]; j < dirty[3]; j++)
+    memcpy((char *)output + out_bpp * ((size_t)j * roi_out->width + dirty[0]),
+           (const char *)tile_out + out_bpp * ((size_t)(j - y0) * sub_out.width + dirty[0] - x0),
+           out_bpp * (dirty[2] - dirty[0]));
+
+  dt_show_times(&start, "[dev_pixelpipe]", "patched %dx%d pixels of `%s' [%s]", dirty[2] - dirty[0],
+                dirty[3] - dirty[1], module->op, _pipe_type_to_str(pipe->type));
+  err = 0;
+
+error_locked:
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+error:
+  dt_free_align(tile_in);
+  dt_free_align(tile_out);
+  return err;
+}
+
+// recursive helper for _pixelpipe_patch(): brings the cached output of the piece at pos up to date and
+// rekeys it to its new hash. returns the new and the old hash and the rectangle of pixels that changed, or
+// non-zero if the piece has to be processed as usual.
+static int _pixelpipe_patch_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi_out,
+                                GList *modules, GList *pieces, int pos, uint64_t *hash, uint64_t *old_hash,
+                                int dirty[4])
+{
+  dt_iop_module_t *module = NULL;
+  dt_dev_pixelpipe_iop_t *piece = NULL;
+  if(modules)
+  {
+    module = (dt_iop_module_t *)modules->data;
+    piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(_pixelpipe_skip_piece(dev, module, piece))
+      return _pixelpipe_patch_rec(pipe, dev, roi_out, g_list_previous(modules), g_list_previous(pieces), pos - 1,
+                                  hash, old_hash, dirty);
+  }
+  dirty[0] = dirty[1] = dirty[2] = dirty[3] = 0;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  *hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
+  *old_hash = piece ? piece->patch_hash : *hash;
+  const int cached = dt_dev_pixelpipe_cache_available(&(pipe->cache), *hash);
+  const int old_cached = piece && dt_dev_pixelpipe_cache_available(&(pipe->cache), *old_hash);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  // the input of the pipe doesn't change with local edits
+  if(!modules) return !cached && !_pixelpipe_input_view(pipe, roi_out);
+  if(!piece->patch_hash || memcmp(&piece->patch_roi, roi_out, sizeof(dt_iop_roi_t))) return 1;
+  // a buffer of an other history state may differ anywhere
+  if(cached) return *hash != piece->patch_hash;
+  if(piece->patch_dirty_full || !old_cached) return 1;
+  if(dt_iop_breakpoint(dev, pipe)) return 1;
+
+  dt_iop_roi_t roi_in = *roi_out;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  _pixelpipe_widen_to_input_view(pipe, dev, module, piece, modules, pieces, roi_out, &roi_in);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  uint64_t in_hash = 0, in_old_hash = 0;
+  int in_dirty[4];
+  if(_pixelpipe_patch_rec(pipe, dev, &roi_in, g_list_previous(modules), g_list_previous(pieces), pos - 1,
+                          &in_hash, &in_old_hash, in_dirty))
+    return 1;
+  // the cached output has to be computed from what the input was before
+  if(in_old_hash != piece->patch_in_hash) return 1;
+
+  const int input_dirty = !_pixelpipe_rect_empty(in_dirty);
+  int overlap = 0, blend_margin = 0;
+  if(input_dirty || piece->patch_dirty_forms)
+  {
+    // the histogram is taken from the whole input
+    if(piece->request_histogram & DT_REQUEST_ON) return 1;
+    if(_pixelpipe_patch_context(module, piece, &roi_in, roi_out, input_dirty, &overlap, &blend_margin))
+      return 1;
+  }
+
+  if(input_dirty)
+  {
+    const int grown[4]
+        = { in_dirty[0] - overlap, in_dirty[1] - overlap, in_dirty[2] + overlap, in_dirty[3] + overlap };
+    _pixelpipe_patch_transform(module, piece, &roi_in, roi_out, grown, dirty);
+    dirty[0] -= blend_margin;
+    dirty[1] -= blend_margin;
+    dirty[2] += blend_margin;
+    dirty[3] += blend_margin;
+  }
+
+  // the shapes of this piece that changed, where they were and where they are now
+  for(GList *forms = piece->patch_dirty_forms; forms; forms = g_list_next(forms))
+  {
+    int w = 0, h = 0, x = 0, y = 0;
+    if(!dt_masks_get_area(module, piece, (dt_masks_form_t *)forms->data, &w, &h, &x, &y)) return 1;
+    const int area[4] = { floorf(x * roi_out->scale - roi_out->x) - blend_margin - 1,
+                          floorf(y * roi_out->scale - roi_out->y) - blend_margin - 1,
+                          ceilf((x + w) * roi_out->scale - roi_out->x) + blend_margin + 1,
+                          ceilf((y + h) * roi_out->scale - roi_out->y) + blend_margin + 1 };
+    _pixelpipe_rect_union(dirty, area);
+  }
+
+  dirty[0] = MAX(dirty[0], 0);
+  dirty[1] = MAX(dirty[1], 0);
+  dirty[2] = MIN(dirty[2], roi_out->width);
+  dirty[3] = MIN(dirty[3], roi_out->height);
+  if(_pixelpipe_rect_empty(dirty))
+    dirty[0] = dirty[1] = dirty[2] = dirty[3] = 0;
+  else
+  {
+    // processing all of it is faster than patching most of it
+    if((float)(dirty[2] - dirty[0]) * (dirty[3] - dirty[1])
+       > DT_DEV_PIXELPIPE_PATCH_MAX_AREA * roi_out->width * roi_out->height)
+      return 1;
+    const int context = ceilf(overlap * roi_out->scale / roi_in.scale) + blend_margin + 2;
+    if(_pixelpipe_patch_process(pipe, module, piece, &roi_in, roi_out, dirty, context, in_hash, *old_hash))
+      return 1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown || dt_dev_pixelpipe_cache_rekey(&(pipe->cache), *old_hash, *hash))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  piece->patch_hash = *hash;
+  piece->patch_in_hash = in_hash;
+  _pixelpipe_patch_clean(piece);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+// after a local edit like moving a spot or painting a mask, brings the cached output of the last run up to
+// date by reprocessing just the area around the changed shapes in every piece after it. if that works out
+// the following run finds everything in the cache, otherwise it uses what has been patched so far.
+static void _pixelpipe_patch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi,
+                             GList *modules, GList *pieces, const int pos)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL || !dt_conf_get_bool("plugins/darkroom/patch_local_edits")) return;
+  // displayed masks need the whole pipe, and the device wouldn't compute the seams the same way
+  if(dev->gui_module && dev->gui_module->request_mask_display) return;
+  if(pipe->opencl_enabled && pipe->devid >= 0) return;
+  if(darktable.unmuted & DT_DEBUG_NAN) return;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const int cached = dt_dev_pixelpipe_cache_available(
+      &(pipe->cache), dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, pos));
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(cached) return;
+
+  uint64_t hash = 0, old_hash = 0;
+  int dirty[4];
+  dt_times_t start;
+  dt_get_times(&start);
+  if(!_pixelpipe_patch_rec(pipe, dev, roi, modules, pieces, pos, &hash, &old_hash, dirty))
+    dt_show_times(&start, "[dev_pixelpipe]", "patched local edits [%s]", _pipe_type_to_str(pipe->type));
+}
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -636,7 +1426,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     // if(module) printf("found valid buf pos %d in cache for module %s %s %lu\n", pos, module->op, pipe ==
     // dev->preview_pipe ? "[preview]" : "", hash);
 
-    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format, pos);
+    if(!modules) pipe->patch_last_hash = hash;
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(!modules) return 0;
@@ -654,6 +1445,31 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   if(pipe == dev->preview_pipe && dev->preview_loading) return 1;
   if(dev->gui_leaving) return 1;
 
+  // 2b) export pipes may resume from the output of the checkpoint module, persisted by an earlier run
+  if(module && pipe->disk_cache_checkpoint[0] && !strcmp(module->op, pipe->disk_cache_checkpoint))
+  {
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    if(pipe->shutdown)
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format, pos);
+    dt_dev_pixelpipe_disk_cache_source_t source;
+    _disk_cache_source(pipe, &source);
+    if(!dt_dev_pixelpipe_cache_disk_read(_disk_cache_hash(pipe, &source, hash), &source, roi_out->width,
+                                         roi_out->height, *output, bufsize, *out_format))
+    {
+      piece->dsc_out = pipe->dsc = **out_format;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] resumed from on-disk output of `%s' [%s]\n", module->op,
+               _pipe_type_to_str(pipe->type));
+      goto post_process_collect_info;
+    }
+    // not there, compute it as usual below:
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
 
   // 3) input -> output
   if(!modules)
@@ -669,12 +1485,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     dt_get_times(&start);
     // we're looking for the full buffer
     {
-      if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width
-         && pipe->iheight == roi_out->height)
+      if(_pixelpipe_input_view(pipe, roi_out))
       {
-        *output = pipe->input;
+        *output = (char *)pipe->input + (size_t)bpp * roi_out->y * pipe->iwidth;
       }
-      else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format))
+      else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format, pos))
       {
         memset(*output, 0, bufsize);
         if(roi_in.scale == 1.0f)
@@ -710,12 +1525,23 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
 
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    pipe->patch_last_hash = hash;
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
   {
     // 3b) recurse and obtain output array in &input
 
+    // 3b') a run of point-wise modules is processed in one go
+    const int fused_length = _pixelpipe_fused_length(pipe, dev, modules, pieces);
+    if(fused_length > 1)
+    {
+      if(_pixelpipe_process_fused(pipe, dev, output, out_format, roi_out, modules, pieces, pos, fused_length,
+                                  hash, bufsize))
+        return 1;
+      goto post_process_collect_info;
+    }
+
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -724,6 +1550,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       return 1;
     }
     module->modify_roi_in(module, piece, roi_out, &roi_in);
+    _pixelpipe_widen_to_input_view(pipe, dev, module, piece, modules, pieces, roi_out, &roi_in);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
     // recurse to get actual data of input buffer
@@ -756,9 +1583,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
 
     if(!strcmp(module->op, "gamma"))
-      (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output, out_format);
+      (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output, out_format, pos);
     else
-      (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+      (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format, pos);
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -1712,6 +2539,21 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
+    // and remember how expensive it was to compute, so the cache can decide what to keep:
+    dt_dev_pixelpipe_cache_set_cost(&(pipe->cache), *output, dt_get_wtime() - start.clock);
+
+    // persist the checkpoint, so the next export of this image can start here
+    if(pipe->disk_cache_checkpoint[0] && !strcmp(module->op, pipe->disk_cache_checkpoint))
+    {
+#ifdef HAVE_OPENCL
+      if(*cl_mem_output != NULL)
+        dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height, bpp);
+#endif
+      dt_dev_pixelpipe_disk_cache_source_t source;
+      _disk_cache_source(pipe, &source);
+      dt_dev_pixelpipe_cache_disk_write(_disk_cache_hash(pipe, &source, hash), &source, roi_out->width,
+                                        roi_out->height, *output, bufsize, *out_format);
+    }
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
@@ -1817,6 +2659,8 @@ post_process_collect_info:
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
     }
+    _pixelpipe_patch_record(pipe, piece, roi_out, hash, pos, input != NULL);
+
     // Picking RGB for the live samples and converting to Lab
     if(dev->gui_attached && pipe == dev->preview_pipe && (strcmp(module->op, "gamma") == 0)
        && darktable.lib->proxy.colorpicker.live_samples) // samples to pick
@@ -2185,6 +3029,102 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *de
   return ret;
 }
 
+void dt_dev_pixelpipe_set_global_data(dt_dev_pixelpipe_iop_t *piece, void *data, void (*free_func)(void *data))
+{
+  if(piece->global_data)
+  {
+    if(piece->global_data_free)
+      piece->global_data_free(piece->global_data);
+    else
+      free(piece->global_data);
+  }
+  piece->global_data = data;
+  piece->global_data_free = free_func;
+}
+
+void *dt_dev_pixelpipe_get_global_data(const dt_dev_pixelpipe_iop_t *piece)
+{
+  return piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_STRIP ? piece->global_data : NULL;
+}
+
+// the rows a strip needs in addition to its own: the sum of the overlaps the enabled modules ask for when
+// tiling, which default_process_tiling() adds around a tile for the same reason.
+static int _strips_overlap(dt_dev_pixelpipe_t *pipe, const int width, const int height, const float scale)
+{
+  dt_iop_roi_t roi = { 0, 0, width, height, scale };
+  int overlap = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    dt_develop_tiling_t tiling = { 0 };
+    piece->module->tiling_callback(piece->module, piece, &roi, &roi, &tiling);
+    overlap += tiling.overlap;
+  }
+  return MIN(overlap, height);
+}
+
+int dt_dev_pixelpipe_process_strips(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int width, int height,
+                                    float scale, int strip_height, int no_gamma,
+                                    dt_dev_pixelpipe_strip_done_t strip_done, void *user_data)
+{
+  int (*process)(dt_dev_pixelpipe_t *, dt_develop_t *, int, int, int, int, float)
+      = no_gamma ? dt_dev_pixelpipe_process_no_gamma : dt_dev_pixelpipe_process;
+
+  // the pre-pass only has to be good enough for statistics, about the size of the darkroom preview
+  const int max_dim = MAX(pipe->processed_width, pipe->processed_height);
+  const float prepass_scale = fminf(scale, DT_DEV_PIXELPIPE_STRIPS_PREPASS_SIZE / (float)MAX(max_dim, 1));
+  const int prepass_width = MAX(1, prepass_scale * pipe->processed_width);
+  const int prepass_height = MAX(1, prepass_scale * pipe->processed_height);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  pipe->strip_pass = DT_DEV_PIXELPIPE_STRIPS_PREPASS;
+  int err = process(pipe, dev, 0, 0, prepass_width, prepass_height, prepass_scale);
+  dt_show_times(&start, "[dev_pixelpipe_process_strips] pre-pass", NULL);
+
+  // a module looking at the histogram of its input would see a different one in every strip. unless it took
+  // what it needs from the pre-pass, the image has to be run at once.
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece->enabled && (piece->request_histogram & DT_REQUEST_ON)
+       && (dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI)) && !piece->global_data)
+    {
+      dt_print(DT_DEBUG_DEV, "[dev_pixelpipe_process_strips] `%s' needs the histogram of the whole image, "
+                             "processing it at once\n", piece->module->op);
+      strip_height = height;
+      break;
+    }
+  }
+
+  // modules only grow their input through modify_roi_in() where they change the geometry. the reach of
+  // blurs and other neighbourhood filters is only known from their tiling requirements, so every strip is
+  // run with that much more output above and below, and cropped afterwards.
+  const int overlap = _strips_overlap(pipe, width, height, scale);
+  const size_t bpp = no_gamma ? 4 * sizeof(float) : 4 * sizeof(uint8_t);
+  pipe->strip_pass = DT_DEV_PIXELPIPE_STRIPS_STRIP;
+  for(int y = 0; !err && y < height; y += strip_height)
+  {
+    const int h = MIN(strip_height, height - y);
+    const int y0 = MAX(0, y - overlap);
+    const int y1 = MIN(height, y + h + overlap);
+    err = process(pipe, dev, 0, y0, width, y1 - y0, scale);
+    if(err) break;
+    if(y > y0) memmove(pipe->backbuf, pipe->backbuf + bpp * width * (y - y0), bpp * width * h);
+    strip_done(pipe, y, h, user_data);
+    dt_print(DT_DEBUG_PERF, "[dev_pixelpipe_process_strips] rows %d..%d of %d done (overlap %d)\n", y, y + h,
+             height, overlap);
+  }
+
+  // statistics of this image are of no use to the next run
+  pipe->strip_pass = DT_DEV_PIXELPIPE_STRIPS_NONE;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+    dt_dev_pixelpipe_set_global_data((dt_dev_pixelpipe_iop_t *)nodes->data, NULL, NULL);
+
+  return err;
+}
+
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op)
 {
   GList *nodes = g_list_last(pipe->nodes);
@@ -2302,6 +3242,9 @@ restart:
   // mask display off as a starting point
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
 
+  // after a local edit, patch the cached buffers instead of processing the whole view again
+  _pixelpipe_patch(pipe, dev, &roi, modules, pieces, pos);
+
   void *buf = NULL;
   void *cl_mem_out = NULL;
 
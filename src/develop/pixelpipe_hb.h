@@ -55,9 +55,25 @@ typedef struct dt_dev_pixelpipe_iop_t
       buf_out;                // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   int process_tiling_ready;   // set this to 0 in commit_params to temporarily disable tiling
+  int process_pointwise_ready; // set this to 0 in commit_params if the params make the output depend on more
+                               // than the input pixel at the same position
+  int process_patch_ready;     // set this to 0 in commit_params if changed shapes can't be reprocessed alone
 
   // the following are used  internally for caching:
   dt_iop_buffer_dsc_t dsc_in, dsc_out;
+
+  // statistics of the whole image, collected in the pre-pass of strip-wise processing:
+  void *global_data;
+  void (*global_data_free)(void *data);
+
+  // the following are used internally to patch the cached output after local edits in darkroom:
+  uint64_t patch_hash;        // cache hash of the output of the last run, 0 if unknown
+  uint64_t patch_in_hash;     // cache hash of the input it was computed from
+  dt_iop_roi_t patch_roi;     // region of interest of that output
+  uint64_t patch_params_hash; // params, blend params and enabled as last synched, without the shapes
+  GList *patch_forms;         // state of the shapes used by this piece as last synched
+  GList *patch_dirty_forms;   // old and new versions of the shapes changed since the last run
+  int patch_dirty_full;       // something else changed since the last run
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -70,6 +86,18 @@ typedef enum dt_dev_pixelpipe_change_t
   DT_DEV_PIPE_ZOOMED = 1 << 3 // zoom event, preview pipe does not need changes
 } dt_dev_pixelpipe_change_t;
 
+/**
+ * the pipe can be run over an image in horizontal strips, to bound the memory needed for huge exports.
+ * before the strips, a cheap downscaled pre-pass over the whole image gives modules that need global
+ * statistics (a maximum, a histogram, ..) the chance to collect them, see dt_dev_pixelpipe_set_global_data().
+ */
+typedef enum dt_dev_pixelpipe_strip_pass_t
+{
+  DT_DEV_PIXELPIPE_STRIPS_NONE = 0,    // the pipe sees the whole image, or a viewport in darkroom
+  DT_DEV_PIXELPIPE_STRIPS_PREPASS = 1, // downscaled run over the whole image
+  DT_DEV_PIXELPIPE_STRIPS_STRIP = 2    // one strip of the final image
+} dt_dev_pixelpipe_strip_pass_t;
+
 /**
  * this encapsulates the pixelpipe.
  * a develop module will need several of these:
@@ -134,10 +162,20 @@ typedef struct dt_dev_pixelpipe_t
   GList *iop;
   // snapshot of mask list
   GList *forms;
+  // output of this module is persisted to/resumed from the on-disk cache, empty to disable.
+  dt_dev_operation_t disk_cache_checkpoint;
+  // which pass of strip-wise processing is running, if any.
+  dt_dev_pixelpipe_strip_pass_t strip_pass;
+  // cache hash of the output of the piece processed last, to link the pieces for patching after local edits.
+  uint64_t patch_last_hash;
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
 
+// gets called with every finished strip at the start of pipe->backbuf, y is the first row of the strip in
+// the output.
+typedef void (*dt_dev_pixelpipe_strip_done_t)(dt_dev_pixelpipe_t *pipe, int y, int height, void *user_data);
+
 // inits the pixelpipe with plain passthrough input/output and empty input and default caching settings.
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe);
 // inits the preview pixelpipe with plain passthrough input/output and empty input and default caching
@@ -150,8 +188,9 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 // inits all but the pixel caches, so you can't actually process an image (just get dimensions and
 // distortions)
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
-// inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// inits the pixelpipe with given cacheline size, minimum number of entries and memory budget in bytes
+// (0 keeps the number of entries fixed).
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -188,6 +227,17 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
 
+// process the whole image of size width x height (at the given scale) in horizontal strips of at most
+// strip_height rows, after a pre-pass over the downscaled image. returns non-zero on error.
+int dt_dev_pixelpipe_process_strips(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width, int height,
+                                    float scale, int strip_height, int no_gamma,
+                                    dt_dev_pixelpipe_strip_done_t strip_done, void *user_data);
+// in the pre-pass of strip-wise processing, a module can hand over statistics of the whole image. they
+// are freed with free_func after the strips are done.
+void dt_dev_pixelpipe_set_global_data(dt_dev_pixelpipe_iop_t *piece, void *data, void (*free_func)(void *data));
+// while processing strips, returns what the module stored in the pre-pass, NULL otherwise.
+void *dt_dev_pixelpipe_get_global_data(const dt_dev_pixelpipe_iop_t *piece);
+
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
 // disable given op and all that comes before it in the pipe:
@@ -18,7 +18,9 @@
 */
 
 #include <glib.h>    // for g_mkdir_with_parents, _
+#include <glib/gstdio.h> // for g_unlink, g_fopen
 #include <gtk/gtk.h> // for gtk_init_check
+#include <inttypes.h> // for PRIu64, SCNu64
 #include <libintl.h> // for bind_textdomain_codeset, etc
 #include <limits.h>  // for PATH_MAX
 #include <sqlite3.h> // for sqlite3_column_int, etc
@@ -27,7 +29,13 @@
 #include <stdio.h>   // for fprintf, stderr, snprintf, NULL, etc
 #include <stdlib.h>  // for exit, EXIT_FAILURE
 #include <string.h>  // for strcmp
-#include <unistd.h>  // for access, R_OK
+#include <unistd.h>  // for syscall
+#ifndef _WIN32
+#include <sys/resource.h> // for setpriority
+#endif
+#ifdef __linux__
+#include <sys/syscall.h> // for SYS_ioprio_set
+#endif
 
 #include "common/darktable.h"    // for darktable, darktable_t, dt_cleanup, etc
 #include "common/database.h"     // for dt_database_get
@@ -40,7 +48,186 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+typedef struct dt_generate_cache_t
+{
+  dt_mipmap_size_t min_mip, max_mip;
+  int sleep_ms;
+  int omp_threads;
+
+  dt_pthread_mutex_t mutex;
+  int32_t *ids;
+  // hash of the history of each image, 0 if it was never edited
+  uint64_t *hashes;
+  uint8_t *done;
+  size_t image_count, next, counter, skipped;
+  // all images before this index are done, ids[checkpoint - 1] goes to the checkpoint file
+  size_t checkpoint;
+  char checkpoint_filename[PATH_MAX];
+  // imgid -> history hash the thumbnails on disc were generated from, appended to as images get done
+  GHashTable *recorded;
+  FILE *history;
+  char history_filename[PATH_MAX];
+} dt_generate_cache_t;
+
+static void _checkpoint_write(const dt_generate_cache_t *g)
+{
+  if(g->checkpoint == 0) return;
+  FILE *f = g_fopen(g->checkpoint_filename, "wb");
+  if(!f) return;
+  fprintf(f, "%d\n", g->ids[g->checkpoint - 1]);
+  fclose(f);
+}
+
+// returns the id of the last image a previous, interrupted run completed, or -1
+static int32_t _checkpoint_read(const char *filename)
+{
+  int32_t imgid = -1;
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return -1;
+  if(fscanf(f, "%d", &imgid) != 1) imgid = -1;
+  fclose(f);
+  return imgid;
+}
+
+// images.write_timestamp only moves when a sidecar gets written, and the history has no timestamps. so the
+// thumbnails are checked against a hash of the history they were generated from.
+static uint64_t _history_hash(sqlite3_stmt *stmt, const int32_t imgid)
+{
+  uint64_t hash = 5381;
+  int rows = 0;
+  DT_DEBUG_SQLITE3_RESET(stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    rows++;
+    for(int col = 0; col < sqlite3_column_count(stmt); col++)
+    {
+      const unsigned char *data = sqlite3_column_blob(stmt, col);
+      const int size = sqlite3_column_bytes(stmt, col);
+      for(int i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ data[i];
+      // keep the columns apart
+      hash = ((hash << 5) + hash) ^ size;
+    }
+  }
+  return rows ? hash : 0;
+}
+
+static GHashTable *_history_read(const char *filename)
+{
+  GHashTable *recorded = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return recorded;
+  int32_t imgid;
+  uint64_t hash;
+  // later lines win, they come from later runs
+  while(fscanf(f, "%d %" SCNu64, &imgid, &hash) == 2)
+    g_hash_table_insert(recorded, GINT_TO_POINTER(imgid), g_memdup(&hash, sizeof(hash)));
+  fclose(f);
+  return recorded;
+}
+
+// rewrite the record without the lines appended over the runs
+static void _history_compact(const dt_generate_cache_t *g)
+{
+  char tmp[PATH_MAX] = { 0 };
+  snprintf(tmp, sizeof(tmp), "%s.tmp", g->history_filename);
+  FILE *f = g_fopen(tmp, "wb");
+  if(!f) return;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, g->recorded);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+    fprintf(f, "%d %" PRIu64 "\n", GPOINTER_TO_INT(key), *(uint64_t *)value);
+  if(fclose(f) == 0)
+    g_rename(tmp, g->history_filename);
+  else
+    g_unlink(tmp);
+}
+
+static void _generate_image(dt_generate_cache_t *g, const int32_t imgid, const gboolean stale)
+{
+  // edited since its thumbnails were written? then drop all levels, the disk cache would hand them out again
+  if(stale) dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+
+  // generate the largest missing level first and keep it locked, so the smaller ones are downsampled from it
+  // instead of running the pixelpipe again.
+  dt_mipmap_buffer_t largest = { 0 };
+  largest.size = DT_MIPMAP_NONE;
+  for(int k = g->max_mip; k >= g->min_mip && k >= 0; k--)
+  {
+    // if the thumbnail is already on disc - do nothing
+    if(dt_mipmap_cache_on_disk(darktable.mipmap_cache, imgid, k, NULL)) continue;
+
+    // else, generate thumbnail and store in mipmap cache.
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+    if(largest.size == DT_MIPMAP_NONE)
+      largest = buf;
+    else
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+  dt_mipmap_cache_release(darktable.mipmap_cache, &largest);
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+}
+
+static void *_generate_worker(void *ptr)
+{
+  dt_generate_cache_t *g = (dt_generate_cache_t *)ptr;
+#ifdef _OPENMP
+  // share the cores between the images in flight
+  omp_set_num_threads(g->omp_threads);
+#endif
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&g->mutex);
+    if(g->next >= g->image_count)
+    {
+      dt_pthread_mutex_unlock(&g->mutex);
+      break;
+    }
+    const size_t i = g->next++;
+    const int32_t imgid = g->ids[i];
+    const uint64_t hash = g->hashes[i];
+    const uint64_t *recorded = g_hash_table_lookup(g->recorded, GINT_TO_POINTER(imgid));
+    dt_pthread_mutex_unlock(&g->mutex);
+
+    // thumbnails of an edited image that weren't generated here can't be trusted
+    const gboolean stale = recorded ? *recorded != hash : hash != 0;
+    gboolean current = !stale;
+    for(int k = g->max_mip; k >= g->min_mip && k >= 0 && current; k--)
+      current = dt_mipmap_cache_on_disk(darktable.mipmap_cache, imgid, k, NULL);
+
+    if(!current) _generate_image(g, imgid, stale);
+
+    dt_pthread_mutex_lock(&g->mutex);
+    if(g->history && (!recorded || *recorded != hash))
+    {
+      fprintf(g->history, "%d %" PRIu64 "\n", imgid, hash);
+      fflush(g->history);
+    }
+    g->done[i] = 1;
+    g->counter++;
+    if(current) g->skipped++;
+    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)%s\n", g->counter, g->image_count,
+            100.0 * g->counter / (float)g->image_count, imgid, current ? " up to date" : "");
+    const size_t old_checkpoint = g->checkpoint;
+    while(g->checkpoint < g->image_count && g->done[g->checkpoint]) g->checkpoint++;
+    // don't hit the disc for every image
+    if(g->checkpoint / 64 != old_checkpoint / 64) _checkpoint_write(g);
+    dt_pthread_mutex_unlock(&g->mutex);
+
+    // leave some room for interactive users of the disc
+    if(!current && g->sleep_ms > 0) g_usleep(g->sleep_ms * 1000);
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    int32_t min_imgid, const int32_t max_imgid, const int jobs,
+                                    const int sleep_ms, const gboolean resume)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
@@ -56,16 +243,34 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
+  dt_generate_cache_t g = { 0 };
+  g.min_mip = min_mip;
+  g.max_mip = max_mip;
+  g.sleep_ms = sleep_ms;
+  snprintf(g.checkpoint_filename, sizeof(g.checkpoint_filename), "%s.d/generate-cache-%d-%d.checkpoint",
+           darktable.mipmap_cache->cachedir, min_mip, max_mip);
+  snprintf(g.history_filename, sizeof(g.history_filename), "%s.d/generate-cache.history",
+           darktable.mipmap_cache->cachedir);
+
+  if(resume)
+  {
+    const int32_t last = _checkpoint_read(g.checkpoint_filename);
+    if(last >= min_imgid)
+    {
+      fprintf(stderr, _("resuming after image id %d\n"), last);
+      min_imgid = last + 1;
+    }
+  }
+
   // some progress counter
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    image_count = sqlite3_column_int(stmt, 0);
+    g.image_count = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
   }
   else
@@ -73,7 +278,7 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     return 1;
   }
 
-  if(!image_count)
+  if(!g.image_count)
   {
     fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
     if(min_imgid > max_imgid)
@@ -82,42 +287,87 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // go through all images:
+  // collect all images up front, the workers shouldn't fight over the database
+  g.ids = (int32_t *)calloc(g.image_count + 1, sizeof(int32_t));
+  g.hashes = (uint64_t *)calloc(g.image_count + 1, sizeof(uint64_t));
+  g.done = (uint8_t *)calloc(g.image_count + 1, sizeof(uint8_t));
+  sqlite3_stmt *history_stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT operation, op_params, module, enabled, blendop_params, blendop_version, "
+                              "multi_priority, multi_name FROM main.history WHERE imgid = ?1 AND num < "
+                              "(SELECT history_end FROM main.images WHERE id = ?1) ORDER BY num",
+                              -1, &history_stmt, 0);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2 ORDER BY id", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  size_t count = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW && count < g.image_count)
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    g.ids[count] = sqlite3_column_int(stmt, 0);
+    g.hashes[count] = _history_hash(history_stmt, g.ids[count]);
+    count++;
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(history_stmt);
+  g.image_count = count;
 
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid);
+  g.recorded = _history_read(g.history_filename);
+  g.history = g_fopen(g.history_filename, "ab");
 
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
-    {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
+  const int threads = CLAMP(jobs, 1, MAX((int)g.image_count, 1));
+  g.omp_threads = MAX(1, darktable.num_openmp_threads / threads);
+  dt_pthread_mutex_init(&g.mutex, NULL);
 
-      // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
+  // go through all images:
+  if(threads == 1)
+    _generate_worker(&g);
+  else
+  {
+    pthread_t *thread = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    int started = 0;
+    for(int k = 0; k < threads; k++)
+      if(!dt_pthread_create(&thread[started], _generate_worker, &g)) started++;
+    if(!started) _generate_worker(&g);
+    for(int k = 0; k < started; k++) pthread_join(thread[k], NULL);
+    free(thread);
+  }
 
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    }
+  // everything went through, the next run starts from scratch
+  if(g.checkpoint == g.image_count)
+    g_unlink(g.checkpoint_filename);
+  else
+    _checkpoint_write(&g);
 
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
-  }
+  if(g.history) fclose(g.history);
+  for(size_t i = 0; i < g.image_count; i++)
+    if(g.done[i])
+      g_hash_table_insert(g.recorded, GINT_TO_POINTER(g.ids[i]), g_memdup(&g.hashes[i], sizeof(uint64_t)));
+  _history_compact(&g);
+  g_hash_table_destroy(g.recorded);
 
-  sqlite3_finalize(stmt);
-  fprintf(stderr, "done\n");
+  dt_pthread_mutex_destroy(&g.mutex);
+  free(g.ids);
+  free(g.hashes);
+  free(g.done);
+
+  fprintf(stderr, "done, %zu images were already up to date\n", g.skipped);
 
   return 0;
 }
 
+// run in the background: lowest cpu priority and, on linux, the idle i/o class. threads started later inherit both
+static void _lower_priority()
+{
+#ifndef _WIN32
+  if(setpriority(PRIO_PROCESS, 0, 19)) fprintf(stderr, "[generate-cache] could not lower the cpu priority\n");
+#endif
+#if defined(__linux__) && defined(SYS_ioprio_set)
+  // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+  if(syscall(SYS_ioprio_set, 1, 0, 3 << 13)) fprintf(stderr, "[generate-cache] could not lower the i/o priority\n");
+#endif
+}
+
 static void usage(const char *progname)
 {
   fprintf(
@@ -125,13 +375,18 @@ static void usage(const char *progname)
       "usage: %s [-h, --help; --version]\n"
       "  [--min-mip <0-7> (default = 0)] [-m, --max-mip <0-7> (default = 2)]\n"
       "  [--min-imgid <N>] [--max-imgid <N>]\n"
+      "  [-j, --jobs <N>] [--resume] [--nice] [--sleep <ms>]\n"
       "  [--core <darktable options>]\n"
       "\n"
       "When multiple mipmap sizes are requested, the biggest one is computed\n"
       "while the rest are quickly downsampled.\n"
       "\n"
       "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-      "numbers to work on.\n",
+      "numbers to work on.\n"
+      "\n"
+      "--jobs sets the number of images processed in parallel, --resume continues\n"
+      "an interrupted run. --nice lowers the cpu and i/o priority and --sleep\n"
+      "pauses each worker after every generated image.\n",
       progname);
 }
 
@@ -148,6 +403,8 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  int jobs = 1, sleep_ms = 0;
+  gboolean resume = FALSE, be_nice = FALSE;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -182,6 +439,24 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      jobs = MIN(MAX(atoi(arg[k]), 1), 256);
+    }
+    else if(!strcmp(arg[k], "--sleep") && argc > k + 1)
+    {
+      k++;
+      sleep_ms = MAX(atoi(arg[k]), 0);
+    }
+    else if(!strcmp(arg[k], "--resume"))
+    {
+      resume = TRUE;
+    }
+    else if(!strcmp(arg[k], "--nice"))
+    {
+      be_nice = TRUE;
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -223,9 +498,11 @@ int main(int argc, char *arg[])
     exit(EXIT_FAILURE);
   }
 
+  if(be_nice) _lower_priority();
+
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, jobs, sleep_ms, resume))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
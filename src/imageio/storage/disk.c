@@ -36,6 +36,8 @@
 #include "osx/osx.h"
 #endif
 #include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -275,12 +277,22 @@ try_again:
 
     if(!fail && !d->overwrite)
     {
+      // reserve the name by creating the file, other exports running in parallel must not pick it as well
       int seq = 1;
-      while(g_file_test(filename, G_FILE_TEST_EXISTS))
+      int fd;
+      while((fd = g_open(filename, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1 && errno == EEXIST)
       {
         snprintf(c, filename_free_space, "_%.2d.%s", seq, ext);
         seq++;
       }
+      if(fd == -1)
+      {
+        fprintf(stderr, "[imageio_storage_disk] could not create file: `%s'!\n", filename);
+        dt_control_log(_("could not export to file `%s'!"), filename);
+        fail = 1;
+      }
+      else
+        close(fd);
     }
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
@@ -292,6 +304,8 @@ try_again:
   {
     fprintf(stderr, "[imageio_storage_disk] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    // don't leave the reserved, empty file behind
+    if(!d->overwrite) g_unlink(filename);
     return 1;
   }
 
@@ -301,6 +315,12 @@ try_again:
   return 0;
 }
 
+int parallel_store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data)
+{
+  // file names are reserved under plugin_threadsafe by creating the file, everything else is per image
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_disk_t) - sizeof(void *);
@@ -70,6 +70,8 @@ int store(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_dat
           const int num, const int total, const gboolean high_quality, const gboolean upscale,
           enum dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
           enum dt_iop_color_intent_t icc_intent);
+/* return non-zero if store() may be called from several threads at once, if implemented. */
+int parallel_store(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *data);
 /* called once at the end (after exporting all images), if implemented. */
 void finalize_store(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *data);
 
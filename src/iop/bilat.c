@@ -170,6 +170,8 @@ error:
   }
   else // mode == s_mode_local_laplacian
   {
+    // the boundary conditions of exports in strips are only implemented on the cpu
+    if(piece->pipe->strip_pass != DT_DEV_PIXELPIPE_STRIPS_NONE) return FALSE;
     dt_local_laplacian_cl_t *b = dt_local_laplacian_init_cl(piece->pipe->devid, roi_in->width, roi_in->height,
         d->midtone, d->sigma_s, d->sigma_r, d->detail);
     if(!b) goto error_ll;
@@ -262,6 +264,12 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 
 
 #if defined(__SSE2__)
+static void _strips_boundary_free(void *data)
+{
+  local_laplacian_boundary_free((local_laplacian_boundary_t *)data);
+  free(data);
+}
+
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -286,10 +294,18 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   else // s_mode_local_laplacian
   {
     local_laplacian_boundary_t b = {0};
-    if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+    const local_laplacian_boundary_t *strips_b = dt_dev_pixelpipe_get_global_data(piece);
+    if((self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+       || piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
     {
       b.mode = 1;
     }
+    else if(strips_b)
+    {
+      // strips of an export read the coarse pyramid of their pre-pass, which stays owned by the piece
+      b = *strips_b;
+      if(b.wd > 0 && b.ht > 0) b.mode = 2;
+    }
     else if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
     {
       // full pipeline working on ROI needs boundary conditions from preview pipe
@@ -344,6 +360,13 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
       g->hash = hash;
       dt_pthread_mutex_unlock(&g->lock);
     }
+    else if(piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
+    {
+      local_laplacian_boundary_t *pb = malloc(sizeof(local_laplacian_boundary_t));
+      *pb = b;
+      pb->roi = pb->buf = NULL;
+      dt_dev_pixelpipe_set_global_data(piece, pb, _strips_boundary_free);
+    }
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_in->width, roi_in->height);
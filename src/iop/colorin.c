@@ -34,6 +34,7 @@
 #include "common/imageio_jpeg.h"
 #include "common/imageio_png.h"
 #include "common/imageio_tiff.h"
+#include "common/avx.h"
 #include "develop/imageop_math.h"
 #include "iop/iop_api.h"
 #include "common/iop_group.h"
@@ -120,7 +121,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -1251,6 +1252,209 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+#if defined(HAVE_AVX_CODEPATHS)
+DT_TARGET_AVX2 static void process_avx2_cmatrix_fastpath_simple(struct dt_iop_module_t *self,
+                                                                dt_dev_pixelpipe_iop_t *piece,
+                                                                const void *const ivoid, void *const ovoid,
+                                                                const dt_iop_roi_t *const roi_in,
+                                                                const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const float *const cmat = d->cmatrix;
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+
+  // two pixels at a time, one per lane
+  const __m256 cm0 = _mm256_setr_ps(cmat[0], cmat[3], cmat[6], 0.0f, cmat[0], cmat[3], cmat[6], 0.0f);
+  const __m256 cm1 = _mm256_setr_ps(cmat[1], cmat[4], cmat[7], 0.0f, cmat[1], cmat[4], cmat[7], 0.0f);
+  const __m256 cm2 = _mm256_setr_ps(cmat[2], cmat[5], cmat[8], 0.0f, cmat[2], cmat[5], cmat[8], 0.0f);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels / 2; k++)
+  {
+    const float *in = (const float *)ivoid + (size_t)8 * k;
+    float *out = (float *)ovoid + (size_t)8 * k;
+
+    const __m256 input = _mm256_loadu_ps(in);
+    const __m256 xyz = cm0 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(0, 0, 0, 0))
+                       + cm1 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(1, 1, 1, 1))
+                       + cm2 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm256_storeu_ps(out, dt_XYZ_to_Lab_avx2(xyz));
+  }
+
+  if(npixels & 1)
+  {
+    const float *in = (const float *)ivoid + (size_t)4 * (npixels - 1);
+    float *out = (float *)ovoid + (size_t)4 * (npixels - 1);
+    const __m128 input = _mm_load_ps(in);
+    const __m128 xyz = _mm256_castps256_ps128(cm0) * _mm_shuffle_ps(input, input, _MM_SHUFFLE(0, 0, 0, 0))
+                       + _mm256_castps256_ps128(cm1) * _mm_shuffle_ps(input, input, _MM_SHUFFLE(1, 1, 1, 1))
+                       + _mm256_castps256_ps128(cm2) * _mm_shuffle_ps(input, input, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm_store_ps(out, dt_XYZ_to_Lab_sse2(xyz));
+  }
+}
+
+DT_TARGET_AVX2 static void process_avx2_cmatrix_fastpath_clipping(struct dt_iop_module_t *self,
+                                                                  dt_dev_pixelpipe_iop_t *piece,
+                                                                  const void *const ivoid, void *const ovoid,
+                                                                  const dt_iop_roi_t *const roi_in,
+                                                                  const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const float *const nmat = d->nmatrix;
+  const float *const lmat = d->lmatrix;
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+
+  const __m256 nm0 = _mm256_setr_ps(nmat[0], nmat[3], nmat[6], 0.0f, nmat[0], nmat[3], nmat[6], 0.0f);
+  const __m256 nm1 = _mm256_setr_ps(nmat[1], nmat[4], nmat[7], 0.0f, nmat[1], nmat[4], nmat[7], 0.0f);
+  const __m256 nm2 = _mm256_setr_ps(nmat[2], nmat[5], nmat[8], 0.0f, nmat[2], nmat[5], nmat[8], 0.0f);
+
+  const __m256 lm0 = _mm256_setr_ps(lmat[0], lmat[3], lmat[6], 0.0f, lmat[0], lmat[3], lmat[6], 0.0f);
+  const __m256 lm1 = _mm256_setr_ps(lmat[1], lmat[4], lmat[7], 0.0f, lmat[1], lmat[4], lmat[7], 0.0f);
+  const __m256 lm2 = _mm256_setr_ps(lmat[2], lmat[5], lmat[8], 0.0f, lmat[2], lmat[5], lmat[8], 0.0f);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < (npixels + 1) / 2; k++)
+  {
+    const float *in = (const float *)ivoid + (size_t)8 * k;
+    float *out = (float *)ovoid + (size_t)8 * k;
+
+    // the odd pixel at the end goes through the same code, just masked
+    const __m256i mask = (2 * k + 1 < npixels) ? _mm256_set1_epi32(-1) : _mm256_setr_epi32(-1, -1, -1, -1, 0, 0, 0, 0);
+    const __m256 input = _mm256_maskload_ps(in, mask);
+    const __m256 nrgb = nm0 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(0, 0, 0, 0))
+                        + nm1 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(1, 1, 1, 1))
+                        + nm2 * _mm256_shuffle_ps(input, input, _MM_SHUFFLE(2, 2, 2, 2));
+    const __m256 crgb = _mm256_min_ps(_mm256_max_ps(nrgb, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    const __m256 xyz = lm0 * _mm256_shuffle_ps(crgb, crgb, _MM_SHUFFLE(0, 0, 0, 0))
+                       + lm1 * _mm256_shuffle_ps(crgb, crgb, _MM_SHUFFLE(1, 1, 1, 1))
+                       + lm2 * _mm256_shuffle_ps(crgb, crgb, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm256_maskstore_ps(out, mask, dt_XYZ_to_Lab_avx2(xyz));
+  }
+}
+
+DT_TARGET_AVX512 static void process_avx512_cmatrix_fastpath_simple(struct dt_iop_module_t *self,
+                                                                    dt_dev_pixelpipe_iop_t *piece,
+                                                                    const void *const ivoid, void *const ovoid,
+                                                                    const dt_iop_roi_t *const roi_in,
+                                                                    const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const float *const cmat = d->cmatrix;
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+
+  // four pixels at a time, one per lane
+  const __m512 cm0 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[0], cmat[3], cmat[6], 0.0f));
+  const __m512 cm1 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[1], cmat[4], cmat[7], 0.0f));
+  const __m512 cm2 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[2], cmat[5], cmat[8], 0.0f));
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < (npixels + 3) / 4; k++)
+  {
+    const float *in = (const float *)ivoid + (size_t)16 * k;
+    float *out = (float *)ovoid + (size_t)16 * k;
+
+    const __mmask16 mask = (4 * k + 4 <= npixels) ? 0xffff : dt_mm512_pixel_mask(npixels - 4 * k);
+    const __m512 input = _mm512_maskz_loadu_ps(mask, in);
+    const __m512 xyz = cm0 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(0, 0, 0, 0))
+                       + cm1 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(1, 1, 1, 1))
+                       + cm2 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm512_mask_storeu_ps(out, mask, dt_XYZ_to_Lab_avx512(xyz));
+  }
+}
+
+DT_TARGET_AVX512 static void process_avx512_cmatrix_fastpath_clipping(struct dt_iop_module_t *self,
+                                                                      dt_dev_pixelpipe_iop_t *piece,
+                                                                      const void *const ivoid, void *const ovoid,
+                                                                      const dt_iop_roi_t *const roi_in,
+                                                                      const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const float *const nmat = d->nmatrix;
+  const float *const lmat = d->lmatrix;
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+
+  const __m512 nm0 = _mm512_broadcast_f32x4(_mm_setr_ps(nmat[0], nmat[3], nmat[6], 0.0f));
+  const __m512 nm1 = _mm512_broadcast_f32x4(_mm_setr_ps(nmat[1], nmat[4], nmat[7], 0.0f));
+  const __m512 nm2 = _mm512_broadcast_f32x4(_mm_setr_ps(nmat[2], nmat[5], nmat[8], 0.0f));
+
+  const __m512 lm0 = _mm512_broadcast_f32x4(_mm_setr_ps(lmat[0], lmat[3], lmat[6], 0.0f));
+  const __m512 lm1 = _mm512_broadcast_f32x4(_mm_setr_ps(lmat[1], lmat[4], lmat[7], 0.0f));
+  const __m512 lm2 = _mm512_broadcast_f32x4(_mm_setr_ps(lmat[2], lmat[5], lmat[8], 0.0f));
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < (npixels + 3) / 4; k++)
+  {
+    const float *in = (const float *)ivoid + (size_t)16 * k;
+    float *out = (float *)ovoid + (size_t)16 * k;
+
+    const __mmask16 mask = (4 * k + 4 <= npixels) ? 0xffff : dt_mm512_pixel_mask(npixels - 4 * k);
+    const __m512 input = _mm512_maskz_loadu_ps(mask, in);
+    const __m512 nrgb = nm0 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(0, 0, 0, 0))
+                        + nm1 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(1, 1, 1, 1))
+                        + nm2 * _mm512_shuffle_ps(input, input, _MM_SHUFFLE(2, 2, 2, 2));
+    const __m512 crgb = _mm512_min_ps(_mm512_max_ps(nrgb, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+    const __m512 xyz = lm0 * _mm512_shuffle_ps(crgb, crgb, _MM_SHUFFLE(0, 0, 0, 0))
+                       + lm1 * _mm512_shuffle_ps(crgb, crgb, _MM_SHUFFLE(1, 1, 1, 1))
+                       + lm2 * _mm512_shuffle_ps(crgb, crgb, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm512_mask_storeu_ps(out, mask, dt_XYZ_to_Lab_avx512(xyz));
+  }
+}
+
+// only the plain matrix fast path is worth widening, everything else goes through lcms2 or the luts anyways
+static int process_wide_fastpath(const dt_iop_colorin_data_t *const d, const dt_dev_pixelpipe_iop_t *const piece)
+{
+  const int blue_mapping = d->blue_mapping && piece->pipe->image.flags & DT_IMAGE_RAW;
+  return d->type != DT_COLORSPACE_LAB && !isnan(d->cmatrix[0]) && !blue_mapping && d->nonlinearlut == 0
+         && piece->colors == 4;
+}
+
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+
+  if(!process_wide_fastpath(d, piece))
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  if(d->nrgb == NULL)
+    process_avx2_cmatrix_fastpath_simple(self, piece, ivoid, ovoid, roi_in, roi_out);
+  else
+    process_avx2_cmatrix_fastpath_clipping(self, piece, ivoid, ovoid, roi_in, roi_out);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+
+void process_avx512(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                    void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+
+  if(!process_wide_fastpath(d, piece))
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  if(d->nrgb == NULL)
+    process_avx512_cmatrix_fastpath_simple(self, piece, ivoid, ovoid, roi_in, roi_out);
+  else
+    process_avx512_cmatrix_fastpath_clipping(self, piece, ivoid, ovoid, roi_in, roi_out);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+#endif
+
 static void mat3mul(float *dst, const float *const m1, const float *const m2)
 {
   for(int k = 0; k < 3; k++)
@@ -20,6 +20,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/avx.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/opencl.h"
@@ -87,7 +88,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -393,6 +394,76 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+#if defined(HAVE_AVX_CODEPATHS)
+DT_TARGET_AVX2 static void process_avx2_matrix(const dt_iop_colorout_data_t *const d, const void *const ivoid,
+                                               void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                               const dt_iop_roi_t *const roi_out)
+{
+  const float *const cmat = d->cmatrix;
+  const int width = roi_out->width;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const float *in = (const float *)ivoid + (size_t)4 * roi_in->width * j;
+    float *out = (float *)ovoid + (size_t)4 * roi_out->width * j;
+    const __m256 m0 = _mm256_setr_ps(cmat[0], cmat[3], cmat[6], 0.0f, cmat[0], cmat[3], cmat[6], 0.0f);
+    const __m256 m1 = _mm256_setr_ps(cmat[1], cmat[4], cmat[7], 0.0f, cmat[1], cmat[4], cmat[7], 0.0f);
+    const __m256 m2 = _mm256_setr_ps(cmat[2], cmat[5], cmat[8], 0.0f, cmat[2], cmat[5], cmat[8], 0.0f);
+
+    int i = 0;
+    for(; i < (width & ~1); i += 2, in += 8, out += 8)
+    {
+      const __m256 xyz = dt_Lab_to_XYZ_avx2(_mm256_loadu_ps(in));
+      const __m256 t = m0 * _mm256_shuffle_ps(xyz, xyz, _MM_SHUFFLE(0, 0, 0, 0))
+                       + m1 * _mm256_shuffle_ps(xyz, xyz, _MM_SHUFFLE(1, 1, 1, 1))
+                       + m2 * _mm256_shuffle_ps(xyz, xyz, _MM_SHUFFLE(2, 2, 2, 2));
+      _mm256_storeu_ps(out, t);
+    }
+    if(i < width)
+    {
+      const __m128 xyz = dt_Lab_to_XYZ_sse2(_mm_load_ps(in));
+      const __m128 t = _mm256_castps256_ps128(m0) * _mm_shuffle_ps(xyz, xyz, _MM_SHUFFLE(0, 0, 0, 0))
+                       + _mm256_castps256_ps128(m1) * _mm_shuffle_ps(xyz, xyz, _MM_SHUFFLE(1, 1, 1, 1))
+                       + _mm256_castps256_ps128(m2) * _mm_shuffle_ps(xyz, xyz, _MM_SHUFFLE(2, 2, 2, 2));
+      _mm_store_ps(out, t);
+    }
+  }
+}
+
+DT_TARGET_AVX512 static void process_avx512_matrix(const dt_iop_colorout_data_t *const d, const void *const ivoid,
+                                                   void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                                   const dt_iop_roi_t *const roi_out)
+{
+  const float *const cmat = d->cmatrix;
+  const int width = roi_out->width;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const float *in = (const float *)ivoid + (size_t)4 * roi_in->width * j;
+    float *out = (float *)ovoid + (size_t)4 * roi_out->width * j;
+    const __m512 m0 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[0], cmat[3], cmat[6], 0.0f));
+    const __m512 m1 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[1], cmat[4], cmat[7], 0.0f));
+    const __m512 m2 = _mm512_broadcast_f32x4(_mm_setr_ps(cmat[2], cmat[5], cmat[8], 0.0f));
+
+    for(int i = 0; i < width; i += 4, in += 16, out += 16)
+    {
+      const __mmask16 mask = (i + 4 <= width) ? 0xffff : dt_mm512_pixel_mask(width - i);
+      const __m512 xyz = dt_Lab_to_XYZ_avx512(_mm512_maskz_loadu_ps(mask, in));
+      const __m512 t = m0 * _mm512_shuffle_ps(xyz, xyz, _MM_SHUFFLE(0, 0, 0, 0))
+                       + m1 * _mm512_shuffle_ps(xyz, xyz, _MM_SHUFFLE(1, 1, 1, 1))
+                       + m2 * _mm512_shuffle_ps(xyz, xyz, _MM_SHUFFLE(2, 2, 2, 2));
+      _mm512_mask_storeu_ps(out, mask, t);
+    }
+  }
+}
+#endif
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -473,6 +544,45 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+#if defined(HAVE_AVX_CODEPATHS)
+// only the matrix path is widened, lcms2 does the rest in process_sse2()
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
+  const int ch = piece->colors;
+
+  if(d->type == DT_COLORSPACE_LAB || isnan(d->cmatrix[0]) || ch != 4)
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  process_avx2_matrix(d, ivoid, ovoid, roi_in, roi_out);
+  process_fastpath_apply_tonecurves(self, piece, ivoid, ovoid, roi_in, roi_out);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+
+void process_avx512(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                    void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
+  const int ch = piece->colors;
+
+  if(d->type == DT_COLORSPACE_LAB || isnan(d->cmatrix[0]) || ch != 4)
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  process_avx512_matrix(d, ivoid, ovoid, roi_in, roi_out);
+  process_fastpath_apply_tonecurves(self, piece, ivoid, ovoid, roi_in, roi_out);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+#endif
+
 static cmsHPROFILE _make_clipping_profile(cmsHPROFILE profile)
 {
   cmsUInt32Number size;
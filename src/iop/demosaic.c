@@ -18,6 +18,7 @@
 */
 
 #include "bauhaus/bauhaus.h"
+#include "common/avx.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
 #include "common/interpolation.h"
@@ -244,117 +245,79 @@ static const char* method2string(dt_iop_demosaic_method_t method)
     (a) = tmp;                                                                                               \
   }
 
-static void pre_median_b(float *out, const float *const in, const dt_iop_roi_t *const roi, const uint32_t filters,
-                         const int num_passes, const float threshold)
+/** median of the green pixels around the green pixel pixi points to, for the ppg prefilter. */
+static inline float pre_median_green(const float *const pixi, const size_t width, const float threshold)
 {
-#if 1
-  memcpy(out, in, (size_t)roi->width * roi->height * sizeof(float));
-#else
-  // colors:
-  const float thrsc = 2 * threshold;
-  for(int pass = 0; pass < num_passes; pass++)
+  static const int lim[5] = { 0, 1, 2, 1, 0 };
+  float med[9];
+  int cnt = 0;
+  for(int k = 0, i = 0; i < 5; i++)
   {
-    for(int c = 0; c < 3; c += 2)
+    for(int j = -lim[i]; j <= lim[i]; j += 2)
     {
-      int rows = 3;
-      if(FC(rows, 3, filters) != c && FC(rows, 4, filters) != c) rows++;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(rows, c, out) schedule(static)
-#endif
-      for(int row = rows; row < roi->height - 3; row += 2)
+      const float p = pixi[(ptrdiff_t)width * (i - 2) + j];
+      if(fabsf(p - pixi[0]) < threshold)
       {
-        float med[9];
-        int col = 3;
-        if(FC(row, col, filters) != c) col++;
-        float *pixo = out + (size_t)roi->width * row + col;
-        const float *pixi = in + (size_t)roi->width * row + col;
-        for(; col < roi->width - 3; col += 2)
-        {
-          int cnt = 0;
-          for(int k = 0, i = -2 * roi->width; i <= 2 * roi->width; i += 2 * roi->width)
-          {
-            for(int j = i - 2; j <= i + 2; j += 2)
-            {
-              if(fabsf(pixi[j] - pixi[0]) < thrsc)
-              {
-                med[k++] = pixi[j];
-                cnt++;
-              }
-              else
-                med[k++] = 64.0f + pixi[j];
-            }
-          }
-          for(int i = 0; i < 8; i++)
-            for(int ii = i + 1; ii < 9; ii++)
-              if(med[i] > med[ii]) SWAP(med[i], med[ii]);
-#if 0
-          // cnt == 1 and no small edge in greens.
-          if(fabsf(pixi[-roi->width] - pixi[+roi->width]) + fabsf(pixi[-1] - pixi[+1])
-              + fabsf(pixi[-roi->width] - pixi[+1]) + fabsf(pixi[-1] - pixi[+roi->width])
-              + fabsf(pixi[+roi->width] - pixi[+1]) + fabsf(pixi[-1] - pixi[-roi->width])
-              > 0.06)
-            pixo[0] = med[(cnt-1)/2];
-          else
-#endif
-          pixo[0] = (cnt == 1 ? med[4] - 64.0f : med[(cnt - 1) / 2]);
-          pixo += 2;
-          pixi += 2;
-        }
-      }
-    }
-  }
-#endif
-
-  // now green:
-  const int lim[5] = { 0, 1, 2, 1, 0 };
-  for(int pass = 0; pass < num_passes; pass++)
-  {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out) schedule(static)
-#endif
-    for(int row = 3; row < roi->height - 3; row++)
-    {
-      float med[9];
-      int col = 3;
-      if(FC(row, col, filters) != 1 && FC(row, col, filters) != 3) col++;
-      float *pixo = out + (size_t)roi->width * row + col;
-      const float *pixi = in + (size_t)roi->width * row + col;
-      for(; col < roi->width - 3; col += 2)
-      {
-        int cnt = 0;
-        for(int k = 0, i = 0; i < 5; i++)
-        {
-          for(int j = -lim[i]; j <= lim[i]; j += 2)
-          {
-            if(fabsf(pixi[roi->width * (i - 2) + j] - pixi[0]) < threshold)
-            {
-              med[k++] = pixi[roi->width * (i - 2) + j];
-              cnt++;
-            }
-            else
-              med[k++] = 64.0f + pixi[roi->width * (i - 2) + j];
-          }
-        }
-        for(int i = 0; i < 8; i++)
-          for(int ii = i + 1; ii < 9; ii++)
-            if(med[i] > med[ii]) SWAP(med[i], med[ii]);
-        pixo[0] = (cnt == 1 ? med[4] - 64.0f : med[(cnt - 1) / 2]);
-        // pixo[0] = med[(cnt-1)/2];
-        pixo += 2;
-        pixi += 2;
+        med[k++] = p;
+        cnt++;
       }
+      else
+        med[k++] = 64.0f + p;
     }
   }
+  for(int i = 0; i < 8; i++)
+    for(int ii = i + 1; ii < 9; ii++)
+      if(med[i] > med[ii]) SWAP(med[i], med[ii]);
+  return (cnt == 1 ? med[4] - 64.0f : med[(cnt - 1) / 2]);
 }
 
-static void pre_median(float *out, const float *const in, const dt_iop_roi_t *const roi, const uint32_t filters,
-                       const int num_passes, const float threshold)
+#define SWAPmed(I, J)                                                                                        \
+  if(med[I] > med[J]) SWAP(med[I], med[J])
+
+/* optimal 9-element median search, leaves the median in med[4]. S is the compare and swap to use. */
+#define MEDIAN9(S)                                                                                           \
+  S(1, 2);                                                                                                   \
+  S(4, 5);                                                                                                   \
+  S(7, 8);                                                                                                   \
+  S(0, 1);                                                                                                   \
+  S(3, 4);                                                                                                   \
+  S(6, 7);                                                                                                   \
+  S(1, 2);                                                                                                   \
+  S(4, 5);                                                                                                   \
+  S(7, 8);                                                                                                   \
+  S(0, 3);                                                                                                   \
+  S(5, 8);                                                                                                   \
+  S(4, 7);                                                                                                   \
+  S(3, 6);                                                                                                   \
+  S(1, 4);                                                                                                   \
+  S(2, 5);                                                                                                   \
+  S(4, 7);                                                                                                   \
+  S(4, 2);                                                                                                   \
+  S(6, 4);                                                                                                   \
+  S(4, 2)
+
+/** one color smoothing step for channel c of the pixel outp points to. channel 3 holds a copy of c. */
+static inline void color_smoothing_px(float *const outp, const ptrdiff_t width4, const int c)
 {
-  pre_median_b(out, in, roi, filters, num_passes, threshold);
+  float med[9] = {
+    outp[-width4 - 4 + 3] - outp[-width4 - 4 + 1], outp[-width4 + 0 + 3] - outp[-width4 + 0 + 1],
+    outp[-width4 + 4 + 3] - outp[-width4 + 4 + 1], outp[-4 + 3] - outp[-4 + 1],
+    outp[+0 + 3] - outp[+0 + 1], outp[+4 + 3] - outp[+4 + 1],
+    outp[+width4 - 4 + 3] - outp[+width4 - 4 + 1], outp[+width4 + 0 + 3] - outp[+width4 + 0 + 1],
+    outp[+width4 + 4 + 3] - outp[+width4 + 4 + 1],
+  };
+  MEDIAN9(SWAPmed);
+  outp[c] = fmaxf(med[4] + outp[1], 0.0f);
 }
 
-#define SWAPmed(I, J)                                                                                        \
-  if(med[I] > med[J]) SWAP(med[I], med[J])
+/** the median of the same nine values, kept in a plane of their own with stride pixels per row. */
+static inline float color_smoothing_median(const float *const diff, const ptrdiff_t stride)
+{
+  float med[9] = { diff[-stride - 1], diff[-stride], diff[-stride + 1], diff[-1], diff[0], diff[1],
+                   diff[stride - 1],  diff[stride],  diff[stride + 1] };
+  MEDIAN9(SWAPmed);
+  return med[4];
+}
 
 static void color_smoothing(float *out, const dt_iop_roi_t *const roi_out, const int num_passes)
 {
@@ -375,52 +338,59 @@ static void color_smoothing(float *out, const dt_iop_roi_t *const roi_out, const
       for(int j = 1; j < roi_out->height - 1; j++)
       {
         float *outp = out + (size_t)4 * j * roi_out->width + 4;
-        for(int i = 1; i < roi_out->width - 1; i++, outp += 4)
-        {
-          float med[9] = {
-            outp[-width4 - 4 + 3] - outp[-width4 - 4 + 1], outp[-width4 + 0 + 3] - outp[-width4 + 0 + 1],
-            outp[-width4 + 4 + 3] - outp[-width4 + 4 + 1], outp[-4 + 3] - outp[-4 + 1],
-            outp[+0 + 3] - outp[+0 + 1], outp[+4 + 3] - outp[+4 + 1],
-            outp[+width4 - 4 + 3] - outp[+width4 - 4 + 1], outp[+width4 + 0 + 3] - outp[+width4 + 0 + 1],
-            outp[+width4 + 4 + 3] - outp[+width4 + 4 + 1],
-          };
-          /* optimal 9-element median search */
-          SWAPmed(1, 2);
-          SWAPmed(4, 5);
-          SWAPmed(7, 8);
-          SWAPmed(0, 1);
-          SWAPmed(3, 4);
-          SWAPmed(6, 7);
-          SWAPmed(1, 2);
-          SWAPmed(4, 5);
-          SWAPmed(7, 8);
-          SWAPmed(0, 3);
-          SWAPmed(5, 8);
-          SWAPmed(4, 7);
-          SWAPmed(3, 6);
-          SWAPmed(1, 4);
-          SWAPmed(2, 5);
-          SWAPmed(4, 7);
-          SWAPmed(4, 2);
-          SWAPmed(6, 4);
-          SWAPmed(4, 2);
-          outp[c] = fmaxf(med[4] + outp[1], 0.0f);
-        }
+        for(int i = 1; i < roi_out->width - 1; i++, outp += 4) color_smoothing_px(outp, width4, c);
       }
     }
   }
 }
 #undef SWAP
 
-static void green_equilibration_lavg(float *out, const float *const in, const int width, const int height,
-                                     const uint32_t filters, const int x, const int y, const float thr)
+/** first green pixel the local green equilibration touches, it leaves a border of two pixels. */
+static inline void green_equilibration_lavg_offsets(const uint32_t filters, const int x, const int y, int *oi,
+                                                    int *oj)
+{
+  *oj = 2;
+  *oi = 2;
+  if(FC(*oj + y, *oi + x, filters) != 1) (*oj)++;
+  if(FC(*oj + y, *oi + x, filters) != 1) (*oi)++;
+  if(FC(*oj + y, *oi + x, filters) != 1) (*oj)--;
+}
+
+/** local green equilibration of the pixel in points to. */
+static inline float green_equilibration_lavg_px(const float *const in, const ptrdiff_t width, const float thr)
 {
   const float maximum = 1.0f;
 
-  int oj = 2, oi = 2;
-  if(FC(oj + y, oi + x, filters) != 1) oj++;
-  if(FC(oj + y, oi + x, filters) != 1) oi++;
-  if(FC(oj + y, oi + x, filters) != 1) oj--;
+  const float o1_1 = in[-width - 1];
+  const float o1_2 = in[-width + 1];
+  const float o1_3 = in[width - 1];
+  const float o1_4 = in[width + 1];
+  const float o2_1 = in[-2 * width];
+  const float o2_2 = in[2 * width];
+  const float o2_3 = in[-2];
+  const float o2_4 = in[2];
+
+  const float m1 = (o1_1 + o1_2 + o1_3 + o1_4) / 4.0f;
+  const float m2 = (o2_1 + o2_2 + o2_3 + o2_4) / 4.0f;
+
+  // prevent divide by zero and ...
+  // guard against m1/m2 becoming too large (due to m2 being too small) which results in hot pixels
+  if(m2 > 0.0f && m1 / m2 < maximum * 2.0f)
+  {
+    const float c1 = (fabsf(o1_1 - o1_2) + fabsf(o1_1 - o1_3) + fabsf(o1_1 - o1_4) + fabsf(o1_2 - o1_3)
+                      + fabsf(o1_3 - o1_4) + fabsf(o1_2 - o1_4)) / 6.0f;
+    const float c2 = (fabsf(o2_1 - o2_2) + fabsf(o2_1 - o2_3) + fabsf(o2_1 - o2_4) + fabsf(o2_2 - o2_3)
+                      + fabsf(o2_3 - o2_4) + fabsf(o2_2 - o2_4)) / 6.0f;
+    if((in[0] < maximum * 0.95f) && (c1 < maximum * thr) && (c2 < maximum * thr)) return in[0] * m1 / m2;
+  }
+  return in[0];
+}
+
+static void green_equilibration_lavg(float *out, const float *const in, const int width, const int height,
+                                     const uint32_t filters, const int x, const int y, const float thr)
+{
+  int oi, oj;
+  green_equilibration_lavg_offsets(filters, x, y, &oi, &oj);
 
   memcpy(out, in, height * width * sizeof(float));
 
@@ -431,47 +401,21 @@ static void green_equilibration_lavg(float *out, const float *const in, const in
   {
     for(size_t i = oi; i < width - 2; i += 2)
     {
-      const float o1_1 = in[(j - 1) * width + i - 1];
-      const float o1_2 = in[(j - 1) * width + i + 1];
-      const float o1_3 = in[(j + 1) * width + i - 1];
-      const float o1_4 = in[(j + 1) * width + i + 1];
-      const float o2_1 = in[(j - 2) * width + i];
-      const float o2_2 = in[(j + 2) * width + i];
-      const float o2_3 = in[j * width + i - 2];
-      const float o2_4 = in[j * width + i + 2];
-
-      const float m1 = (o1_1 + o1_2 + o1_3 + o1_4) / 4.0f;
-      const float m2 = (o2_1 + o2_2 + o2_3 + o2_4) / 4.0f;
-
-      // prevent divide by zero and ...
-      // guard against m1/m2 becoming too large (due to m2 being too small) which results in hot pixels
-      if(m2 > 0.0f && m1 / m2 < maximum * 2.0f)
-      {
-        const float c1 = (fabsf(o1_1 - o1_2) + fabsf(o1_1 - o1_3) + fabsf(o1_1 - o1_4) + fabsf(o1_2 - o1_3)
-                          + fabsf(o1_3 - o1_4) + fabsf(o1_2 - o1_4)) / 6.0f;
-        const float c2 = (fabsf(o2_1 - o2_2) + fabsf(o2_1 - o2_3) + fabsf(o2_1 - o2_4) + fabsf(o2_2 - o2_3)
-                          + fabsf(o2_3 - o2_4) + fabsf(o2_2 - o2_4)) / 6.0f;
-        if((in[j * width + i] < maximum * 0.95f) && (c1 < maximum * thr) && (c2 < maximum * thr))
-        {
-          out[j * width + i] = in[j * width + i] * m1 / m2;
-        }
-      }
+      out[j * width + i] = green_equilibration_lavg_px(in + j * width + i, width, thr);
     }
   }
 }
 
-static void green_equilibration_favg(float *out, const float *const in, const int width, const int height,
-                                     const uint32_t filters, const int x, const int y)
+/** ratio of the two green channels for the full green equilibration, 0 if there is none. the first green is
+ * in even rows at the even (oi == 0) or odd (oi == 1) columns, the second one g2_offset next to it below. */
+static double green_equilibration_favg_ratio(const float *const in, const int width, const int height,
+                                             const int oi, const int g2_offset)
 {
-  int oj = 0, oi = 0;
-  // const float ratio_max = 1.1f;
-  double sum1 = 0.0, sum2 = 0.0, gr_ratio;
+  const int oj = 0;
+  double sum1 = 0.0, sum2 = 0.0;
 
-  if((FC(oj + y, oi + x, filters) & 1) != 1) oi++;
-  const int g2_offset = oi ? -1 : 1;
-  memcpy(out, in, (size_t)height * width * sizeof(float));
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) reduction(+ : sum1, sum2) shared(oi, oj)
+#pragma omp parallel for schedule(static) default(none) reduction(+ : sum1, sum2)
 #endif
   for(size_t j = oj; j < (height - 1); j += 2)
   {
@@ -482,13 +426,25 @@ static void green_equilibration_favg(float *out, const float *const in, const in
     }
   }
 
-  if(sum1 > 0.0 && sum2 > 0.0)
-    gr_ratio = sum2 / sum1;
-  else
-    return;
+  if(sum1 > 0.0 && sum2 > 0.0) return sum2 / sum1;
+  return 0.0;
+}
+
+static void green_equilibration_favg(float *out, const float *const in, const int width, const int height,
+                                     const uint32_t filters, const int x, const int y)
+{
+  int oj = 0, oi = 0;
+  // const float ratio_max = 1.1f;
+
+  if((FC(oj + y, oi + x, filters) & 1) != 1) oi++;
+  const int g2_offset = oi ? -1 : 1;
+  memcpy(out, in, (size_t)height * width * sizeof(float));
+
+  const double gr_ratio = green_equilibration_favg_ratio(in, width, height, oi, g2_offset);
+  if(gr_ratio == 0.0) return;
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(out, oi, oj, gr_ratio)
+#pragma omp parallel for schedule(static) default(none) shared(out, oi, oj)
 #endif
   for(int j = oj; j < (height - 1); j += 2)
   {
@@ -2391,226 +2347,582 @@ static void passthrough_monochrome(float *out, const float *const in, dt_iop_roi
   }
 }
 
-/** 1:1 demosaic from in to out, in is full buf, out is translated/cropped (scale == 1.0!) */
-static void demosaic_ppg(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
-                         const dt_iop_roi_t *const roi_in, const uint32_t filters, const float thrs)
+// the bayer ppg path runs green equilibration, the median prefilter, both ppg passes and color smoothing on
+// one tile after the other, instead of making a pass over the whole image for each of them. with the halo
+// these stages need around it, a tile of this size stays in L2.
+#define PPG_TS 128
+
+/** a single channel image or part of it, in input coordinates. */
+typedef struct ppg_plane_t
 {
-  // offsets only where the buffer ends:
-  const int offx = 3; // MAX(0, 3 - roi_out->x);
-  const int offy = 3; // MAX(0, 3 - roi_out->y);
-  const int offX = 3; // MAX(0, 3 - (roi_in->width  - (roi_out->x + roi_out->width)));
-  const int offY = 3; // MAX(0, 3 - (roi_in->height - (roi_out->y + roi_out->height)));
+  const float *p; // pixel (x, y) is at p[0]
+  size_t stride;
+  int x, y;
+} ppg_plane_t;
 
-  // these may differ a little, if you're unlucky enough to split a bayer block with cropping or similar.
-  // we never want to access the input out of bounds though:
-  assert(roi_in->width >= roi_out->width);
-  assert(roi_in->height >= roi_out->height);
-  // border interpolate
-  float sum[8];
-  for(int j = 0; j < roi_out->height; j++)
-    for(int i = 0; i < roi_out->width; i++)
+typedef struct ppg_data_t
+{
+  const float *in;
+  const dt_iop_roi_t *roi_in, *roi_out;
+  uint32_t filters;
+  dt_iop_demosaic_greeneq_t green_eq;
+  double gr_ratio; // of the full green equilibration, 0 if it doesn't apply
+  int favg_oi, favg_g2;
+  int lavg_oi, lavg_oj;
+  float lavg_thrs;
+  float median_thrs;
+  int smoothing;
+} ppg_data_t;
+
+static inline const float *ppg_px(const ppg_plane_t *const pl, const int j, const int i)
+{
+  return pl->p + (size_t)(j - pl->y) * pl->stride + (i - pl->x);
+}
+
+#if defined(__SSE2__)
+#define SWAP_PS(I, J)                                                                                        \
+  {                                                                                                          \
+    const __m128 t = _mm_min_ps(med[I], med[J]);                                                             \
+    med[J] = _mm_max_ps(med[I], med[J]);                                                                     \
+    med[I] = t;                                                                                              \
+  }
+
+/** p[0], p[2], p[4] and p[6]. */
+static inline __m128 ppg_load_even(const float *const p)
+{
+  return _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static inline __m128 ppg_select(const __m128 mask, const __m128 a, const __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/** pre_median_green() for the four green pixels at pixi[0], pixi[2], pixi[4] and pixi[6].
+ * reads up to pixi[9] in the row. */
+static inline __m128 pre_median_green_sse2(const float *const pixi, const size_t width, const float threshold)
+{
+  static const int lim[5] = { 0, 1, 2, 1, 0 };
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 thrs = _mm_set1_ps(threshold);
+  const __m128 p0 = ppg_load_even(pixi);
+  __m128 med[9];
+  __m128 cnt = _mm_setzero_ps();
+  for(int k = 0, i = 0; i < 5; i++)
+  {
+    for(int j = -lim[i]; j <= lim[i]; j += 2, k++)
     {
-      if(i == offx && j >= offy && j < roi_out->height - offY) i = roi_out->width - offX;
-      if(i == roi_out->width) break;
-      memset(sum, 0, sizeof(float) * 8);
-      for(int y = j - 1; y != j + 2; y++)
-        for(int x = i - 1; x != i + 2; x++)
-        {
-          const int yy = y + roi_out->y, xx = x + roi_out->x;
-          if(yy >= 0 && xx >= 0 && yy < roi_in->height && xx < roi_in->width)
-          {
-            int f = FC(y, x, filters);
-            sum[f] += in[(size_t)yy * roi_in->width + xx];
-            sum[f + 4]++;
-          }
-        }
-      int f = FC(j, i, filters);
-      for(int c = 0; c < 3; c++)
-      {
-        if(c != f && sum[c + 4] > 0.0f)
-          out[4 * ((size_t)j * roi_out->width + i) + c] = sum[c] / sum[c + 4];
-        else
-          out[4 * ((size_t)j * roi_out->width + i) + c]
-              = in[((size_t)j + roi_out->y) * roi_in->width + i + roi_out->x];
-      }
+      const __m128 p = ppg_load_even(pixi + (ptrdiff_t)width * (i - 2) + j);
+      const __m128 close = _mm_cmplt_ps(_mm_andnot_ps(sign, _mm_sub_ps(p, p0)), thrs);
+      med[k] = _mm_add_ps(p, _mm_andnot_ps(close, _mm_set1_ps(64.0f)));
+      cnt = _mm_add_ps(cnt, _mm_and_ps(close, _mm_set1_ps(1.0f)));
     }
-  const int median = thrs > 0.0f;
-  // if(median) fbdd_green(out, in, roi_out, roi_in, filters);
-  const float *input = in;
-  if(median)
+  }
+  // sorting network for nine values, then pick med[(cnt - 1) / 2] in each lane
+  SWAP_PS(0, 3);
+  SWAP_PS(1, 7);
+  SWAP_PS(2, 5);
+  SWAP_PS(4, 8);
+  SWAP_PS(0, 7);
+  SWAP_PS(2, 4);
+  SWAP_PS(3, 8);
+  SWAP_PS(5, 6);
+  SWAP_PS(0, 2);
+  SWAP_PS(1, 3);
+  SWAP_PS(4, 5);
+  SWAP_PS(7, 8);
+  SWAP_PS(1, 4);
+  SWAP_PS(3, 6);
+  SWAP_PS(5, 7);
+  SWAP_PS(0, 1);
+  SWAP_PS(2, 4);
+  SWAP_PS(3, 5);
+  SWAP_PS(6, 8);
+  SWAP_PS(2, 3);
+  SWAP_PS(4, 5);
+  SWAP_PS(6, 7);
+  SWAP_PS(1, 2);
+  SWAP_PS(3, 4);
+  SWAP_PS(5, 6);
+  __m128 m = med[0];
+  for(int k = 1; k < 5; k++) m = ppg_select(_mm_cmpge_ps(cnt, _mm_set1_ps(2 * k + 1)), med[k], m);
+  return ppg_select(_mm_cmpeq_ps(cnt, _mm_set1_ps(1.0f)), _mm_sub_ps(med[4], _mm_set1_ps(64.0f)), m);
+}
+
+/** color smoothing step for channel c of n pixels of a row, with their differences to green in diff. */
+static inline void color_smoothing_row_sse2(float *const out, const float *const diff, const ptrdiff_t stride,
+                                            const int c, const int n)
+{
+  int i = 0;
+  for(; i + 4 <= n; i += 4)
   {
-    float *med_in = (float *)dt_alloc_align(16, (size_t)roi_in->height * roi_in->width * sizeof(float));
-    pre_median(med_in, in, roi_in, filters, 1, thrs);
-    input = med_in;
+    const float *const d = diff + i;
+    __m128 med[9] = { _mm_loadu_ps(d - stride - 1), _mm_loadu_ps(d - stride), _mm_loadu_ps(d - stride + 1),
+                      _mm_loadu_ps(d - 1),          _mm_loadu_ps(d),          _mm_loadu_ps(d + 1),
+                      _mm_loadu_ps(d + stride - 1), _mm_loadu_ps(d + stride), _mm_loadu_ps(d + stride + 1) };
+    MEDIAN9(SWAP_PS);
+    float m[4] __attribute__((aligned(16)));
+    _mm_store_ps(m, med[4]);
+    for(int k = 0; k < 4; k++) out[4 * (i + k) + c] = fmaxf(m[k] + out[4 * (i + k) + 1], 0.0f);
   }
-// for all pixels: interpolate green into float array, or copy color.
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input) schedule(static)
+  for(; i < n; i++) out[4 * i + c] = fmaxf(color_smoothing_median(diff + i, stride) + out[4 * i + 1], 0.0f);
+}
+#undef SWAP_PS
 #endif
-  for(int j = offy; j < roi_out->height - offY; j++)
+
+/** the part of the input a stage needs to process for the tile, with the given halo around it. */
+static inline void ppg_input_region(const ppg_data_t *const d, const int ty, const int tx, const int th,
+                                    const int tw, const int halo, int *y0, int *y1, int *x0, int *x1)
+{
+  *y0 = MAX(0, ty + d->roi_out->y - halo);
+  *y1 = MIN(d->roi_in->height, ty + d->roi_out->y + th + halo);
+  *x0 = MAX(0, tx + d->roi_out->x - halo);
+  *x1 = MIN(d->roi_in->width, tx + d->roi_out->x + tw + halo);
+}
+
+static void ppg_tile_favg(float *const buf, const ppg_plane_t *const src, const ppg_data_t *const d,
+                          const int y0, const int y1, const int x0, const int x1)
+{
+  const int width = d->roi_in->width, height = d->roi_in->height;
+  const int end = MIN(x1, width - 1 - d->favg_g2);
+  for(int j = y0; j < y1; j++)
+  {
+    const float *const s = ppg_px(src, j, x0);
+    float *const o = buf + (size_t)(j - y0) * (x1 - x0);
+    memcpy(o, s, sizeof(float) * (x1 - x0));
+    if((j & 1) || j >= height - 1) continue;
+    int i = MAX(x0, d->favg_oi);
+    if((i - d->favg_oi) & 1) i++;
+    for(; i < end; i += 2) o[i - x0] = s[i - x0] * d->gr_ratio;
+  }
+}
+
+static void ppg_tile_lavg(float *const buf, const ppg_plane_t *const src, const ppg_data_t *const d,
+                          const int y0, const int y1, const int x0, const int x1)
+{
+  const int width = d->roi_in->width, height = d->roi_in->height;
+  const int end = MIN(x1, width - 2);
+  for(int j = y0; j < y1; j++)
   {
-    float *buf = out + (size_t)4 * roi_out->width * j + 4 * offx;
-    const float *buf_in = input + (size_t)roi_in->width * (j + roi_out->y) + offx + roi_out->x;
-    for(int i = offx; i < roi_out->width - offX; i++)
+    const float *const s = ppg_px(src, j, x0);
+    float *const o = buf + (size_t)(j - y0) * (x1 - x0);
+    memcpy(o, s, sizeof(float) * (x1 - x0));
+    if(j < d->lavg_oj || j >= height - 2 || ((j - d->lavg_oj) & 1)) continue;
+    int i = MAX(x0, d->lavg_oi);
+    if((i - d->lavg_oi) & 1) i++;
+    for(; i < end; i += 2) o[i - x0] = green_equilibration_lavg_px(s + (i - x0), src->stride, d->lavg_thrs);
+  }
+}
+
+static void ppg_tile_median(float *const buf, const ppg_plane_t *const src, const ppg_data_t *const d,
+                            const int y0, const int y1, const int x0, const int x1)
+{
+  const int width = d->roi_in->width, height = d->roi_in->height;
+  const int end = MIN(x1, width - 3);
+  for(int j = y0; j < y1; j++)
+  {
+    const float *const s = ppg_px(src, j, x0);
+    float *const o = buf + (size_t)(j - y0) * (x1 - x0);
+    memcpy(o, s, sizeof(float) * (x1 - x0));
+    if(j < 3 || j >= height - 3) continue;
+    // greens only, every other pixel
+    int i = MAX(x0, 3);
+    if(!(FC(j, i, d->filters) & 1)) i++;
+#if defined(__SSE2__)
+    for(; i + 8 <= end; i += 8)
     {
-      const int c = FC(j, i, filters);
-#if defined(__SSE__)
-      // prefetch what we need soon (load to cpu caches)
-      _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
-      _mm_prefetch((char *)buf_in + roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 2 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 3 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 2 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 3 * roi_in->width + 256, _MM_HINT_NTA);
+      float m[4] __attribute__((aligned(16)));
+      _mm_store_ps(m, pre_median_green_sse2(s + (i - x0), src->stride, d->median_thrs));
+      for(int k = 0; k < 4; k++) o[i - x0 + 2 * k] = m[k];
+    }
 #endif
+    for(; i < end; i += 2) o[i - x0] = pre_median_green(s + (i - x0), src->stride, d->median_thrs);
+  }
+}
 
-#if defined(__SSE__)
-      __m128 col = _mm_load_ps(buf);
-      float *color = (float *)&col;
-#else
-      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
-#endif
-      const float pc = buf_in[0];
-      // if(__builtin_expect(c == 0 || c == 2, 1))
-      if(c == 0 || c == 2)
+/** plain average of the 3x3 neighbourhood, for the three pixels along the image border ppg doesn't reach. */
+static inline void ppg_border_px(float *const out, const ppg_plane_t *const in, const ppg_data_t *const d,
+                                 const int j, const int i)
+{
+  const dt_iop_roi_t *const roi_in = d->roi_in;
+  const dt_iop_roi_t *const roi_out = d->roi_out;
+  float sum[8] = { 0.0f };
+  for(int y = j - 1; y != j + 2; y++)
+    for(int x = i - 1; x != i + 2; x++)
+    {
+      const int yy = y + roi_out->y, xx = x + roi_out->x;
+      if(yy >= 0 && xx >= 0 && yy < roi_in->height && xx < roi_in->width)
       {
-        color[c] = pc;
-        // get stuff (hopefully from cache)
-        const float pym = buf_in[-roi_in->width * 1];
-        const float pym2 = buf_in[-roi_in->width * 2];
-        const float pym3 = buf_in[-roi_in->width * 3];
-        const float pyM = buf_in[+roi_in->width * 1];
-        const float pyM2 = buf_in[+roi_in->width * 2];
-        const float pyM3 = buf_in[+roi_in->width * 3];
-        const float pxm = buf_in[-1];
-        const float pxm2 = buf_in[-2];
-        const float pxm3 = buf_in[-3];
-        const float pxM = buf_in[+1];
-        const float pxM2 = buf_in[+2];
-        const float pxM3 = buf_in[+3];
-
-        const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
-        const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
-                            + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
-        const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
-        const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
-                            + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
-        if(diffx > diffy)
-        {
-          // use guessy
-          const float m = fminf(pym, pyM);
-          const float M = fmaxf(pym, pyM);
-          color[1] = fmaxf(fminf(guessy * .25f, M), m);
-        }
-        else
-        {
-          const float m = fminf(pxm, pxM);
-          const float M = fmaxf(pxm, pxM);
-          color[1] = fmaxf(fminf(guessx * .25f, M), m);
-        }
+        const int f = FC(y, x, d->filters);
+        sum[f] += *ppg_px(in, yy, xx);
+        sum[f + 4]++;
       }
-      else
-        color[1] = pc;
+    }
+  const int f = FC(j, i, d->filters);
+  for(int c = 0; c < 3; c++)
+  {
+    if(c != f && sum[c + 4] > 0.0f)
+      out[c] = sum[c] / sum[c + 4];
+    else
+      out[c] = *ppg_px(in, j + roi_out->y, i + roi_out->x);
+  }
+  out[3] = 0.0f;
+}
 
-      // write using MOVNTPS (write combine omitting caches)
-      // _mm_stream_ps(buf, col);
-      memcpy(buf, color, 4 * sizeof(float));
-      buf += 4;
-      buf_in++;
+/** green pass of ppg for pixels [i0, i1) of row j: interpolate green, or copy color. */
+static inline void demosaic_ppg_green_row(float *const out, const float *const in, const size_t w,
+                                          const uint32_t filters, const int j, const int i0, const int i1)
+{
+  float *buf = out;
+  const float *buf_in = in;
+  for(int i = i0; i < i1; i++, buf += 4, buf_in++)
+  {
+    const int c = FC(j, i, filters);
+    const float pc = buf_in[0];
+    float green = pc;
+    if(c == 0 || c == 2)
+    {
+      const float pym = buf_in[-w * 1];
+      const float pym2 = buf_in[-w * 2];
+      const float pym3 = buf_in[-w * 3];
+      const float pyM = buf_in[+w * 1];
+      const float pyM2 = buf_in[+w * 2];
+      const float pyM3 = buf_in[+w * 3];
+      const float pxm = buf_in[-1];
+      const float pxm2 = buf_in[-2];
+      const float pxm3 = buf_in[-3];
+      const float pxM = buf_in[+1];
+      const float pxM2 = buf_in[+2];
+      const float pxM3 = buf_in[+3];
+
+      const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
+      const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
+                          + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
+      const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
+      const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
+                          + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
+      if(diffx > diffy)
+      {
+        // use guessy
+        const float m = fminf(pym, pyM);
+        const float M = fmaxf(pym, pyM);
+        green = fmaxf(fminf(guessy * .25f, M), m);
+      }
+      else
+      {
+        const float m = fminf(pxm, pxM);
+        const float M = fmaxf(pxm, pxM);
+        green = fmaxf(fminf(guessx * .25f, M), m);
+      }
     }
+
+    // whole pixels, the color pass reads them as such
+    buf[0] = c == 0 ? pc : 0.0f;
+    buf[1] = green;
+    buf[2] = c == 2 ? pc : 0.0f;
+    buf[3] = 0.0f;
   }
-// SFENCE (make sure stuff is stored now)
-// _mm_sfence();
+}
 
-// for all pixels: interpolate colors into float array
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-  for(int j = 1; j < roi_out->height - 1; j++)
+#if defined(HAVE_AVX_CODEPATHS)
+/* the same, eight pixels at a time. all eight are interpolated and the bayer pattern only decides what is
+ * written back. needs at least 8 pixels. */
+DT_TARGET_AVX2 static void demosaic_ppg_green_row_avx2(float *const out, const float *const in, const size_t w,
+                                                       const uint32_t filters, const int j, const int i0,
+                                                       const int i1)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+
+  for(int b = i0; b < i1; b += 8)
   {
-    float *buf = out + (size_t)4 * roi_out->width * j + 4;
-    for(int i = 1; i < roi_out->width - 1; i++)
+    // the last block of a row overlaps the one before, that's cheaper than a scalar tail
+    const int i = MIN(b, i1 - 8);
+    const float *buf_in = in + (i - i0);
+
+    const __m256 pc = _mm256_loadu_ps(buf_in);
+    const __m256 pym = _mm256_loadu_ps(buf_in - w);
+    const __m256 pym2 = _mm256_loadu_ps(buf_in - 2 * w);
+    const __m256 pym3 = _mm256_loadu_ps(buf_in - 3 * w);
+    const __m256 pyM = _mm256_loadu_ps(buf_in + w);
+    const __m256 pyM2 = _mm256_loadu_ps(buf_in + 2 * w);
+    const __m256 pyM3 = _mm256_loadu_ps(buf_in + 3 * w);
+    const __m256 pxm = _mm256_loadu_ps(buf_in - 1);
+    const __m256 pxm2 = _mm256_loadu_ps(buf_in - 2);
+    const __m256 pxm3 = _mm256_loadu_ps(buf_in - 3);
+    const __m256 pxM = _mm256_loadu_ps(buf_in + 1);
+    const __m256 pxM2 = _mm256_loadu_ps(buf_in + 2);
+    const __m256 pxM3 = _mm256_loadu_ps(buf_in + 3);
+
+#define ABS(x) _mm256_andnot_ps(sign, (x))
+    const __m256 guessx = (pxm + pc + pxM) * _mm256_set1_ps(2.0f) - pxM2 - pxm2;
+    const __m256 diffx = (ABS(pxm2 - pc) + ABS(pxM2 - pc) + ABS(pxm - pxM)) * _mm256_set1_ps(3.0f)
+                         + (ABS(pxM3 - pxM) + ABS(pxm3 - pxm)) * _mm256_set1_ps(2.0f);
+    const __m256 guessy = (pym + pc + pyM) * _mm256_set1_ps(2.0f) - pyM2 - pym2;
+    const __m256 diffy = (ABS(pym2 - pc) + ABS(pyM2 - pc) + ABS(pym - pyM)) * _mm256_set1_ps(3.0f)
+                         + (ABS(pyM3 - pyM) + ABS(pym3 - pym)) * _mm256_set1_ps(2.0f);
+#undef ABS
+
+    const __m256 gy = _mm256_max_ps(_mm256_min_ps(guessy * _mm256_set1_ps(.25f), _mm256_max_ps(pym, pyM)),
+                                    _mm256_min_ps(pym, pyM));
+    const __m256 gx = _mm256_max_ps(_mm256_min_ps(guessx * _mm256_set1_ps(.25f), _mm256_max_ps(pxm, pxM)),
+                                    _mm256_min_ps(pxm, pxM));
+    const __m256 green = _mm256_blendv_ps(gx, gy, _mm256_cmp_ps(diffx, diffy, _CMP_GT_OQ));
+
+    float g[8] __attribute__((aligned(32)));
+    float p[8] __attribute__((aligned(32)));
+    _mm256_store_ps(g, green);
+    _mm256_store_ps(p, pc);
+    float *buf = out + 4 * (i - i0);
+    for(int k = 0; k < 8; k++, buf += 4)
     {
-      // also prefetch direct nbs top/bottom
-#if defined(__SSE__)
-      _mm_prefetch((char *)buf + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf - roi_out->width * 4 * sizeof(float) + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf + roi_out->width * 4 * sizeof(float) + 256, _MM_HINT_NTA);
+      const int c = FC(j, i + k, filters);
+      buf[0] = c == 0 ? p[k] : 0.0f;
+      buf[1] = c & 1 ? p[k] : g[k];
+      buf[2] = c == 2 ? p[k] : 0.0f;
+      buf[3] = 0.0f;
+    }
+  }
+}
 #endif
 
-      const int c = FC(j, i, filters);
-#if defined(__SSE__)
-      __m128 col = _mm_load_ps(buf);
-      float *color = (float *)&col;
-#else
-      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
-#endif
-      // fill all four pixels with correctly interpolated stuff: r/b for green1/2
-      // b for r and r for b
-      if(__builtin_expect(c & 1, 1)) // c == 1 || c == 3)
+/** color pass of ppg for pixels [i0, i1) of row j, in place. it only reads channels it doesn't write. */
+static inline void demosaic_ppg_colors_row(float *const out, const ptrdiff_t w4, const uint32_t filters,
+                                           const int j, const int i0, const int i1)
+{
+  float *buf = out;
+  for(int i = i0; i < i1; i++, buf += 4)
+  {
+    const int c = FC(j, i, filters);
+    // the two missing channels are written one by one: loading the whole pixel right after that would stall
+    const float green = buf[1];
+    // fill all four pixels with correctly interpolated stuff: r/b for green1/2
+    // b for r and r for b
+    if(__builtin_expect(c & 1, 1)) // c == 1 || c == 3)
+    {
+      // calculate red and blue for green pixels:
+      // need 4-nbhood:
+      const float *nt = buf - w4;
+      const float *nb = buf + w4;
+      const float *nl = buf - 4;
+      const float *nr = buf + 4;
+      if(FC(j, i + 1, filters) == 0) // red nb in same row
       {
-        // calculate red and blue for green pixels:
-        // need 4-nbhood:
-        const float *nt = buf - 4 * roi_out->width;
-        const float *nb = buf + 4 * roi_out->width;
-        const float *nl = buf - 4;
-        const float *nr = buf + 4;
-        if(FC(j, i + 1, filters) == 0) // red nb in same row
-        {
-          color[2] = (nt[2] + nb[2] + 2.0f * color[1] - nt[1] - nb[1]) * .5f;
-          color[0] = (nl[0] + nr[0] + 2.0f * color[1] - nl[1] - nr[1]) * .5f;
-        }
-        else
-        {
-          // blue nb
-          color[0] = (nt[0] + nb[0] + 2.0f * color[1] - nt[1] - nb[1]) * .5f;
-          color[2] = (nl[2] + nr[2] + 2.0f * color[1] - nl[1] - nr[1]) * .5f;
-        }
+        buf[2] = (nt[2] + nb[2] + 2.0f * green - nt[1] - nb[1]) * .5f;
+        buf[0] = (nl[0] + nr[0] + 2.0f * green - nl[1] - nr[1]) * .5f;
       }
       else
       {
-        // get 4-star-nbhood:
-        const float *ntl = buf - 4 - 4 * roi_out->width;
-        const float *ntr = buf + 4 - 4 * roi_out->width;
-        const float *nbl = buf - 4 + 4 * roi_out->width;
-        const float *nbr = buf + 4 + 4 * roi_out->width;
+        // blue nb
+        buf[0] = (nt[0] + nb[0] + 2.0f * green - nt[1] - nb[1]) * .5f;
+        buf[2] = (nl[2] + nr[2] + 2.0f * green - nl[1] - nr[1]) * .5f;
+      }
+    }
+    else
+    {
+      // get 4-star-nbhood:
+      const float *ntl = buf - 4 - w4;
+      const float *ntr = buf + 4 - w4;
+      const float *nbl = buf - 4 + w4;
+      const float *nbr = buf + 4 + w4;
 
-        if(c == 0)
-        {
-          // red pixel, fill blue:
-          const float diff1 = fabsf(ntl[2] - nbr[2]) + fabsf(ntl[1] - color[1]) + fabsf(nbr[1] - color[1]);
-          const float guess1 = ntl[2] + nbr[2] + 2.0f * color[1] - ntl[1] - nbr[1];
-          const float diff2 = fabsf(ntr[2] - nbl[2]) + fabsf(ntr[1] - color[1]) + fabsf(nbl[1] - color[1]);
-          const float guess2 = ntr[2] + nbl[2] + 2.0f * color[1] - ntr[1] - nbl[1];
-          if(diff1 > diff2)
-            color[2] = guess2 * .5f;
-          else if(diff1 < diff2)
-            color[2] = guess1 * .5f;
-          else
-            color[2] = (guess1 + guess2) * .25f;
-        }
-        else // c == 2, blue pixel, fill red:
-        {
-          const float diff1 = fabsf(ntl[0] - nbr[0]) + fabsf(ntl[1] - color[1]) + fabsf(nbr[1] - color[1]);
-          const float guess1 = ntl[0] + nbr[0] + 2.0f * color[1] - ntl[1] - nbr[1];
-          const float diff2 = fabsf(ntr[0] - nbl[0]) + fabsf(ntr[1] - color[1]) + fabsf(nbl[1] - color[1]);
-          const float guess2 = ntr[0] + nbl[0] + 2.0f * color[1] - ntr[1] - nbl[1];
-          if(diff1 > diff2)
-            color[0] = guess2 * .5f;
-          else if(diff1 < diff2)
-            color[0] = guess1 * .5f;
-          else
-            color[0] = (guess1 + guess2) * .25f;
-        }
+      if(c == 0)
+      {
+        // red pixel, fill blue:
+        const float diff1 = fabsf(ntl[2] - nbr[2]) + fabsf(ntl[1] - green) + fabsf(nbr[1] - green);
+        const float guess1 = ntl[2] + nbr[2] + 2.0f * green - ntl[1] - nbr[1];
+        const float diff2 = fabsf(ntr[2] - nbl[2]) + fabsf(ntr[1] - green) + fabsf(nbl[1] - green);
+        const float guess2 = ntr[2] + nbl[2] + 2.0f * green - ntr[1] - nbl[1];
+        if(diff1 > diff2)
+          buf[2] = guess2 * .5f;
+        else if(diff1 < diff2)
+          buf[2] = guess1 * .5f;
+        else
+          buf[2] = (guess1 + guess2) * .25f;
+      }
+      else // c == 2, blue pixel, fill red:
+      {
+        const float diff1 = fabsf(ntl[0] - nbr[0]) + fabsf(ntl[1] - green) + fabsf(nbr[1] - green);
+        const float guess1 = ntl[0] + nbr[0] + 2.0f * green - ntl[1] - nbr[1];
+        const float diff2 = fabsf(ntr[0] - nbl[0]) + fabsf(ntr[1] - green) + fabsf(nbl[1] - green);
+        const float guess2 = ntr[0] + nbl[0] + 2.0f * green - ntr[1] - nbl[1];
+        if(diff1 > diff2)
+          buf[0] = guess2 * .5f;
+        else if(diff1 < diff2)
+          buf[0] = guess1 * .5f;
+        else
+          buf[0] = (guess1 + guess2) * .25f;
       }
-      // _mm_stream_ps(buf, col);
-      memcpy(buf, color, 4 * sizeof(float));
-      buf += 4;
     }
   }
-  // _mm_sfence();
-  if(median) dt_free_align((float *)input);
+}
+
+/** floats in each of the three planes of the input side and pixels on the output side of a tile. */
+static inline void ppg_tile_sizes(const int smoothing, size_t *in_plane, size_t *out_plane)
+{
+  const size_t in_size = PPG_TS + 2 * (2 * smoothing + 8), out_size = PPG_TS + 2 * (2 * smoothing + 1);
+  *in_plane = (in_size * in_size + 15) & ~(size_t)15;
+  *out_plane = (out_size * out_size + 15) & ~(size_t)15;
+}
+
+/** floats each thread needs: raw data after favg, lavg and the median, then rgb and the differences for
+ * color smoothing. */
+static inline size_t ppg_buffer_size(const int smoothing)
+{
+  size_t in_plane, out_plane;
+  ppg_tile_sizes(smoothing, &in_plane, &out_plane);
+  return 3 * in_plane + 5 * out_plane;
+}
+
+static void demosaic_ppg_tile(float *const out, const ppg_data_t *const d, float *const buffer, const int ty,
+                              const int tx)
+{
+  const dt_iop_roi_t *const roi_out = d->roi_out;
+  const int width = roi_out->width, height = roi_out->height;
+  const int th = MIN(PPG_TS, height - ty), tw = MIN(PPG_TS, width - tx);
+  const int hs = 2 * d->smoothing; // one pixel per color smoothing step
+  size_t plane_size, out_plane;
+  ppg_tile_sizes(d->smoothing, &plane_size, &out_plane);
+
+  // input side: the raw data, after green equilibration and after the median prefilter. each stage covers
+  // the halo the later ones read around the tile: lavg 2, median 2, ppg green 3, ppg colors 1.
+  const ppg_plane_t raw = { d->in, d->roi_in->width, 0, 0 };
+  ppg_plane_t eq = raw;
+  int y0, y1, x0, x1;
+  if(d->gr_ratio != 0.0)
+  {
+    ppg_input_region(d, ty, tx, th, tw, hs + (d->green_eq == DT_IOP_GREEN_EQ_BOTH ? 8 : 6), &y0, &y1, &x0, &x1);
+    ppg_tile_favg(buffer, &raw, d, y0, y1, x0, x1);
+    eq = (ppg_plane_t){ buffer, x1 - x0, x0, y0 };
+  }
+  if(d->green_eq == DT_IOP_GREEN_EQ_LOCAL || d->green_eq == DT_IOP_GREEN_EQ_BOTH)
+  {
+    ppg_input_region(d, ty, tx, th, tw, hs + 6, &y0, &y1, &x0, &x1);
+    ppg_tile_lavg(buffer + plane_size, &eq, d, y0, y1, x0, x1);
+    eq = (ppg_plane_t){ buffer + plane_size, x1 - x0, x0, y0 };
+  }
+  ppg_plane_t med = eq;
+  if(d->median_thrs > 0.0f)
+  {
+    ppg_input_region(d, ty, tx, th, tw, hs + 4, &y0, &y1, &x0, &x1);
+    ppg_tile_median(buffer + 2 * plane_size, &eq, d, y0, y1, x0, x1);
+    med = (ppg_plane_t){ buffer + 2 * plane_size, x1 - x0, x0, y0 };
+  }
+
+  // output side: border interpolation and the green pass into rgb, then colors and color smoothing in place
+  float *const rgb = buffer + 3 * plane_size;
+  float *const diff = rgb + 4 * out_plane;
+  const int gy0 = MAX(0, ty - hs - 1), gy1 = MIN(height, ty + th + hs + 1);
+  const int gx0 = MAX(0, tx - hs - 1), gx1 = MIN(width, tx + tw + hs + 1);
+  const ptrdiff_t w4 = 4 * (gx1 - gx0);
+  for(int j = gy0; j < gy1; j++)
+  {
+    float *const row = rgb + w4 * (j - gy0);
+    const int inner = j >= 3 && j < height - 3;
+    for(int i = gx0; i < gx1; i++)
+      if(!inner || i < 3 || i >= width - 3) ppg_border_px(row + 4 * (i - gx0), &eq, d, j, i);
+    const int i0 = MAX(gx0, 3), i1 = MIN(gx1, width - 3);
+    if(!inner || i1 <= i0) continue;
+    const float *const in = ppg_px(&med, j + roi_out->y, i0 + roi_out->x);
+#if defined(HAVE_AVX_CODEPATHS)
+    if(darktable.codepath.AVX2 && i1 - i0 >= 8)
+      demosaic_ppg_green_row_avx2(row + 4 * (i0 - gx0), in, med.stride, d->filters, j, i0, i1);
+    else
+#endif
+      demosaic_ppg_green_row(row + 4 * (i0 - gx0), in, med.stride, d->filters, j, i0, i1);
+  }
+
+  for(int k = 0; k <= hs; k++)
+  {
+    // region this step has to cover, the outermost pixels of the image stay as they are
+    const int sy0 = MAX(1, ty - hs + k), sy1 = MIN(height - 1, ty + th + hs - k);
+    const int sx0 = MAX(1, tx - hs + k), sx1 = MIN(width - 1, tx + tw + hs - k);
+    if(k == 0)
+    {
+      for(int j = sy0; j < sy1; j++)
+        demosaic_ppg_colors_row(rgb + w4 * (j - gy0) + 4 * (sx0 - gx0), w4, d->filters, j, sx0, sx1);
+      continue;
+    }
+    // color smoothing, first red then blue of each pass. the differences to green this step reads go to a
+    // plane of their own, the last step leaves the values before it in channel 3 like color_smoothing().
+    const int c = (k & 1) ? 0 : 2;
+    const ptrdiff_t dw = gx1 - gx0;
+    for(int j = MAX(0, sy0 - 1); j < MIN(height, sy1 + 1); j++)
+    {
+      const float *outp = rgb + w4 * (j - gy0) + 4 * (MAX(0, sx0 - 1) - gx0);
+      float *dp = diff + dw * (j - gy0) + (MAX(0, sx0 - 1) - gx0);
+      for(int i = MAX(0, sx0 - 1); i < MIN(width, sx1 + 1); i++, outp += 4) *dp++ = outp[c] - outp[1];
+    }
+    if(k == hs)
+      for(int j = ty; j < ty + th; j++)
+      {
+        float *outp = rgb + w4 * (j - gy0) + 4 * (tx - gx0);
+        for(int i = 0; i < tw; i++, outp += 4) outp[3] = outp[c];
+      }
+    for(int j = sy0; j < sy1; j++)
+    {
+      float *const outp = rgb + w4 * (j - gy0) + 4 * (sx0 - gx0);
+      const float *const dp = diff + dw * (j - gy0) + (sx0 - gx0);
+#if defined(__SSE2__)
+      color_smoothing_row_sse2(outp, dp, dw, c, sx1 - sx0);
+#else
+      for(int i = 0; i < sx1 - sx0; i++)
+        outp[4 * i + c] = fmaxf(color_smoothing_median(dp + i, dw) + outp[4 * i + 1], 0.0f);
+#endif
+    }
+  }
+
+  for(int j = ty; j < ty + th; j++)
+    memcpy(out + 4 * ((size_t)j * width + tx), rgb + w4 * (j - gy0) + 4 * (tx - gx0), sizeof(float) * 4 * tw);
+}
+
+/** 1:1 demosaic from in to out, in is full buf, out is translated/cropped (scale == 1.0!).
+ * green equilibration and color smoothing (pass 0 for none) are done along with it, tile by tile. */
+static void demosaic_ppg(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                         const dt_iop_roi_t *const roi_in, const uint32_t filters, const float thrs,
+                         const dt_iop_demosaic_greeneq_t green_eq, const float eq_thrs, const int smoothing)
+{
+  // these may differ a little, if you're unlucky enough to split a bayer block with cropping or similar.
+  // we never want to access the input out of bounds though:
+  assert(roi_in->width >= roi_out->width);
+  assert(roi_in->height >= roi_out->height);
+
+  ppg_data_t d = { .in = in,
+                   .roi_in = roi_in,
+                   .roi_out = roi_out,
+                   .filters = filters,
+                   .green_eq = green_eq,
+                   .gr_ratio = 0.0,
+                   .lavg_thrs = eq_thrs,
+                   .median_thrs = thrs,
+                   .smoothing = smoothing };
+  if(green_eq == DT_IOP_GREEN_EQ_FULL || green_eq == DT_IOP_GREEN_EQ_BOTH)
+  {
+    // the green ratio is global, that's the one pass over the whole image left
+    d.favg_oi = (FC(roi_in->y, roi_in->x, filters) & 1) != 1;
+    d.favg_g2 = d.favg_oi ? -1 : 1;
+    d.gr_ratio = green_equilibration_favg_ratio(in, roi_in->width, roi_in->height, d.favg_oi, d.favg_g2);
+  }
+  if(green_eq == DT_IOP_GREEN_EQ_LOCAL || green_eq == DT_IOP_GREEN_EQ_BOTH)
+    green_equilibration_lavg_offsets(filters, roi_in->x, roi_in->y, &d.lavg_oi, &d.lavg_oj);
+
+  const size_t buffer_size = ppg_buffer_size(smoothing);
+  float *const buffers = (float *)dt_alloc_align(64, dt_get_num_threads() * buffer_size * sizeof(float));
+  if(!buffers)
+  {
+    fprintf(stderr, "[demosaic] not able to allocate PPG buffers\n");
+    return;
+  }
+
+  const int tiles_x = (roi_out->width + PPG_TS - 1) / PPG_TS;
+  const int tiles = tiles_x * ((roi_out->height + PPG_TS - 1) / PPG_TS);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(d)
+#endif
+  for(int t = 0; t < tiles; t++)
+    demosaic_ppg_tile(out, &d, buffers + dt_get_thread_num() * buffer_size, (t / tiles_x) * PPG_TS,
+                      (t % tiles_x) * PPG_TS);
+
+  dt_free_align(buffers);
 }
 
 void modify_roi_out(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, dt_iop_roi_t *roi_out,
@@ -2777,6 +3089,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     demosaicing_method = (piece->pipe->dsc.filters != 9u) ? DT_IOP_DEMOSAIC_PPG : DT_IOP_DEMOSAIC_MARKESTEIJN;
 
   const float *const pixels = (float *)i;
+  int smoothed = 0;
 
   if(qual_flags & DEMOSAIC_FULL_SCALE)
   {
@@ -2808,6 +3121,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       else
         vng_interpolate(tmp, pixels, &roo, &roi, piece->pipe->dsc.filters, xtrans, qual_flags & DEMOSAIC_ONLY_VNG_LINEAR);
     }
+    else if(demosaicing_method != DT_IOP_DEMOSAIC_VNG4 && demosaicing_method != DT_IOP_DEMOSAIC_AMAZE
+            && !(img->flags & DT_IMAGE_4BAYER))
+    {
+      // wanted ppg or zoomed out a lot and quality is limited to 1. green equilibration and, if there's no
+      // scaling after it, color smoothing run tile by tile along with it.
+      demosaic_ppg(tmp, pixels, &roo, &roi, piece->pipe->dsc.filters, data->median_thrs, data->green_eq,
+                   threshold, scaled ? 0 : data->color_smoothing);
+      smoothed = !scaled;
+    }
     else
     {
       float *in = (float *)pixels;
@@ -2846,9 +3168,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           dt_colorspaces_cygm_to_rgb(piece->pipe->dsc.processed_maximum, 1, data->CAM_to_RGB);
         }
       }
-      else if(demosaicing_method != DT_IOP_DEMOSAIC_AMAZE)
-        demosaic_ppg(tmp, in, &roo, &roi, piece->pipe->dsc.filters,
-                     data->median_thrs); // wanted ppg or zoomed out a lot and quality is limited to 1
       else
         amaze_demosaic_RT(self, piece, in, tmp, &roi, &roo, piece->pipe->dsc.filters);
 
@@ -2874,7 +3193,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       dt_iop_clip_and_zoom_demosaic_half_size_f((float *)o, pixels, &roo, &roi, roo.width, roi.width,
                                                 piece->pipe->dsc.filters);
   }
-  if(data->color_smoothing) color_smoothing(o, roi_out, data->color_smoothing);
+  if(data->color_smoothing && !smoothed) color_smoothing(o, roi_out, data->color_smoothing);
 }
 
 #ifdef HAVE_OPENCL
@@ -4580,6 +4899,9 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   // check if output buffer has same dimension as input buffer (thus avoiding one
   // additional temporary buffer)
   const int unscaled = (roi_out->width == roi_in->width && roi_out->height == roi_in->height);
+  // the tile based path, see process()
+  const int ppg = demosaicing_method == DT_IOP_DEMOSAIC_PPG
+                  && !(self->dev->image_storage.flags & DT_IMAGE_4BAYER);
 
   if((demosaicing_method == DT_IOP_DEMOSAIC_PPG) ||
       (demosaicing_method == DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME) ||
@@ -4587,8 +4909,14 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   {
     // Bayer pattern with PPG, Monochrome and Amaze
     tiling->factor = 1.0f + ioratio;         // in + out
+    tiling->overhead = 0;
 
-    if(full_scale_demosaicing && unscaled)
+    if(full_scale_demosaicing && ppg)
+    {
+      tiling->factor += unscaled ? 0.0f : 1.0f;        // + tmp, all the rest works on small tiles
+      tiling->overhead = dt_get_num_threads() * ppg_buffer_size(data->color_smoothing) * sizeof(float);
+    }
+    else if(full_scale_demosaicing && unscaled)
       tiling->factor += fmax(1.0f + greeneq, smooth);  // + tmp + geeneq | + smooth
     else if(full_scale_demosaicing)
       tiling->factor += fmax(2.0f + greeneq, smooth);  // + tmp + aux + greeneq | + smooth
@@ -4596,7 +4924,6 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
       tiling->factor += smooth;                        // + smooth
 
     tiling->maxbuf = 1.0f;
-    tiling->overhead = 0;
     tiling->xalign = 2;
     tiling->yalign = 2;
     tiling->overlap = 5; // take care of border handling
@@ -30,6 +30,7 @@
 #endif
 
 #include "bauhaus/bauhaus.h"
+#include "common/avx.h"
 #include "common/histogram.h"
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
@@ -113,7 +114,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_POINTWISE;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -216,7 +217,7 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
 
 void init_presets (dt_iop_module_so_t *self)
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
 
   dt_gui_presets_add_generic(_("magic lantern defaults"), self->op, self->version(),
                              &(dt_iop_exposure_params_t){.mode = EXPOSURE_MODE_DEFLICKER,
@@ -226,7 +227,7 @@ void init_presets (dt_iop_module_so_t *self)
                                                          .deflicker_target_level = -4.0f },
                              sizeof(dt_iop_exposure_params_t), 1);
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 static void deflicker_prepare_histogram(dt_iop_module_t *self, uint32_t **histogram,
@@ -441,6 +442,70 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+#if defined(HAVE_AVX_CODEPATHS)
+DT_TARGET_AVX2 void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                                 void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_exposure_data_t *const d = (const dt_iop_exposure_data_t *const)piece->data;
+
+  process_common_setup(self, piece);
+
+  const int ch = piece->colors;
+  const __m256 blackv = _mm256_set1_ps(d->black);
+  const __m256 scalev = _mm256_set1_ps(d->scale);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    const float *in = ((float *)i) + (size_t)ch * k * roi_out->width;
+    float *out = ((float *)o) + (size_t)ch * k * roi_out->width;
+    int j = 0;
+    for(; j < roi_out->width - 1; j += 2, in += 8, out += 8)
+      _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in), blackv), scalev));
+    if(j < roi_out->width)
+      _mm_store_ps(out, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(in), _mm256_castps256_ps128(blackv)),
+                                   _mm256_castps256_ps128(scalev)));
+  }
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
+
+  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
+}
+
+DT_TARGET_AVX512 void process_avx512(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                     const void *const i, void *const o, const dt_iop_roi_t *const roi_in,
+                                     const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_exposure_data_t *const d = (const dt_iop_exposure_data_t *const)piece->data;
+
+  process_common_setup(self, piece);
+
+  const int ch = piece->colors;
+  const __m512 blackv = _mm512_set1_ps(d->black);
+  const __m512 scalev = _mm512_set1_ps(d->scale);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    const float *in = ((float *)i) + (size_t)ch * k * roi_out->width;
+    float *out = ((float *)o) + (size_t)ch * k * roi_out->width;
+    int j = 0;
+    for(; j < roi_out->width - 3; j += 4, in += 16, out += 16)
+      _mm512_storeu_ps(out, _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(in), blackv), scalev));
+    const __mmask16 rest = dt_mm512_pixel_mask(roi_out->width - j);
+    _mm512_mask_storeu_ps(out, rest, _mm512_mul_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(rest, in), blackv), scalev));
+  }
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
+
+  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
+}
+#endif
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -455,6 +520,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
      && self->dev->image_storage.buf_dsc.channels == 1 && self->dev->image_storage.buf_dsc.datatype == TYPE_UINT16)
   {
     d->deflicker = 1;
+    // the correction is computed from the raw histogram on every call
+    piece->process_pointwise_ready = 0;
   }
 }
 
@@ -187,6 +187,10 @@ static inline void process_drago(struct dt_iop_module_t *self, dt_dev_pixelpipe_
     dt_pthread_mutex_unlock(&g->lock);
   }
 
+  // an export processed in strips got lwmax from its pre-pass
+  const float *global_lwmax = dt_dev_pixelpipe_get_global_data(piece);
+  if(global_lwmax) tmp_lwmax = *global_lwmax;
+
   // in all other cases we calculate lwmax here
   if(isnan(tmp_lwmax))
   {
@@ -212,6 +216,9 @@ static inline void process_drago(struct dt_iop_module_t *self, dt_dev_pixelpipe_
     dt_pthread_mutex_unlock(&g->lock);
   }
 
+  if(piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
+    dt_dev_pixelpipe_set_global_data(piece, g_memdup(&lwmax, sizeof(float)), g_free);
+
   const float ldc = data->drago.max_light * 0.01 / log10f(lwmax + 1);
   const float bl = logf(fmaxf(eps, data->drago.bias)) / logf(0.5);
 
@@ -348,6 +355,9 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
       dt_pthread_mutex_unlock(&g->lock);
     }
 
+    const float *global_lwmax = dt_dev_pixelpipe_get_global_data(piece);
+    if(global_lwmax) tmp_lwmax = *global_lwmax;
+
     if(isnan(tmp_lwmax))
     {
       dt_opencl_local_buffer_t flocopt
@@ -448,6 +458,9 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
       g->hash = hash;
       dt_pthread_mutex_unlock(&g->lock);
     }
+
+    if(piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
+      dt_dev_pixelpipe_set_global_data(piece, g_memdup(&lwmax, sizeof(float)), g_free);
   }
 
   const float scale = piece->iscale / roi_in->scale;
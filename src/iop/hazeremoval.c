@@ -77,6 +77,13 @@ typedef struct dt_iop_hazeremoval_gui_data_t
   dt_pthread_mutex_t lock;
 } dt_iop_hazeremoval_gui_data_t;
 
+// what the pre-pass of an export in strips hands over to the strips
+typedef struct dt_iop_hazeremoval_strips_data_t
+{
+  rgb_pixel A0;
+  float distance_max;
+} dt_iop_hazeremoval_strips_data_t;
+
 typedef struct dt_iop_hazeremoval_global_data_t
 {
 } dt_iop_hazeremoval_global_data_t;
@@ -868,6 +875,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     distance_max = g->distance_max;
     dt_pthread_mutex_unlock(&g->lock);
   }
+  // An export processed in strips got them from its pre-pass.
+  const dt_iop_hazeremoval_strips_data_t *strips_data = dt_dev_pixelpipe_get_global_data(piece);
+  if(strips_data)
+  {
+    A0[0] = strips_data->A0[0];
+    A0[1] = strips_data->A0[1];
+    A0[2] = strips_data->A0[2];
+    distance_max = strips_data->distance_max;
+  }
   // In all other cases we calculate distance_max and A0 here.
   if(isnan(distance_max))
   {
@@ -885,6 +901,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     g->hash = hash;
     dt_pthread_mutex_unlock(&g->lock);
   }
+  if(piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
+  {
+    dt_iop_hazeremoval_strips_data_t *sd = malloc(sizeof(dt_iop_hazeremoval_strips_data_t));
+    sd->A0[0] = A0[0];
+    sd->A0[1] = A0[1];
+    sd->A0[2] = A0[2];
+    sd->distance_max = distance_max;
+    dt_dev_pixelpipe_set_global_data(piece, sd, NULL);
+  }
 
   // calculate the transition map
   gray_image trans_map = new_gray_image(width, height);
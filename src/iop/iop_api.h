@@ -155,6 +155,12 @@ void masks_selection_changed(struct dt_iop_module_t *self, const int form_select
   * formats may be filled by this callback, if the pipeline can handle it. */
 /** the simplest variant of process(). you can only use OpenMP SIMD here, no intrinsics */
 /** must be provided by each IOP. */
+/** modules flagged IOP_FLAGS_POINTWISE may get called several times per pipe run, once per band of rows,
+  * with roi_in == roi_out. changes to piece->pipe->dsc are only kept from the first call. */
+/** in darkroom, modules that allow tiling, are point-wise or flagged IOP_FLAGS_LOCAL_MASKS may get called
+  * for a small region around a changed shape, with roi_in as requested by modify_roi_in() for it. */
+/** modules flagged IOP_FLAGS_INPUT_VIEW may get i pointing straight into the pipe input, with a roi_in of whole
+  * rows at scale 1 that contains the one requested by modify_roi_in(). i must not be written to. */
 void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
              void *const o, const struct dt_iop_roi_t *const roi_in,
              const struct dt_iop_roi_t *const roi_out);
@@ -171,6 +177,18 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                   const struct dt_iop_roi_t *const roi_out);
 #endif
 
+#if defined(HAVE_AVX_CODEPATHS)
+/** variants of process() that can contain AVX2 (with FMA) or AVX-512F intrinsics. */
+/** can be provided by each IOP, define them with DT_TARGET_AVX2 / DT_TARGET_AVX512 from common/avx.h. */
+/** if there is no process_avx512(), process_avx2() is used and so on. */
+void process_avx2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                  void *const o, const struct dt_iop_roi_t *const roi_in,
+                  const struct dt_iop_roi_t *const roi_out);
+void process_avx512(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                    void *const o, const struct dt_iop_roi_t *const roi_in,
+                    const struct dt_iop_roi_t *const roi_out);
+#endif
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 int process_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
@@ -127,7 +127,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -269,13 +269,26 @@ static void commit_params_late(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
       compute_lut(piece);
     }
 
-    if(piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW || isnan(d->levels[0]) || isnan(d->levels[1])
-       || isnan(d->levels[2]))
+    // an export processed in strips got its levels from the histogram of the pre-pass, a strip's own
+    // histogram would give every strip different ones
+    const float *global_levels = dt_dev_pixelpipe_get_global_data(piece);
+    if(global_levels)
+    {
+      d->levels[0] = global_levels[0];
+      d->levels[1] = global_levels[1];
+      d->levels[2] = global_levels[2];
+      compute_lut(piece);
+    }
+    else if(piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW || isnan(d->levels[0]) || isnan(d->levels[1])
+            || isnan(d->levels[2]) || piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
     {
       dt_iop_levels_compute_levels_automatic(piece);
       compute_lut(piece);
     }
 
+    if(piece->pipe->strip_pass == DT_DEV_PIXELPIPE_STRIPS_PREPASS)
+      dt_dev_pixelpipe_set_global_data(piece, g_memdup(d->levels, sizeof(d->levels)), g_free);
+
     if(g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW && d->mode == LEVELS_MODE_AUTOMATIC)
     {
       uint64_t hash = dt_dev_hash_plus(self->dev, piece->pipe, 0, self->priority);
@@ -105,7 +105,7 @@ int operation_tags()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_INPUT_VIEW;
 }
 
 int groups()
@@ -115,7 +115,7 @@ int groups()
 
 void init_presets(dt_iop_module_so_t *self)
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
 
   dt_gui_presets_add_generic(_("passthrough"), self->op, self->version(),
                              &(dt_iop_rawprepare_params_t){.crop.array = { 0, 0, 0, 0 },
@@ -126,7 +126,7 @@ void init_presets(dt_iop_module_so_t *self)
                                                            .raw_white_point = UINT16_MAX },
                              sizeof(dt_iop_rawprepare_params_t), 1);
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -293,6 +293,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   // fprintf(stderr, "roi out %d %d %d %d\n", roi_out->x, roi_out->y, roi_out->width, roi_out->height);
 
   const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
+  // roi_in may be whole rows of the pipe input (IOP_FLAGS_INPUT_VIEW), starting left of roi_out
+  const int ix = csx + roi_out->x - roi_in->x;
 
   if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16)
   { // raw mosaic
@@ -307,7 +309,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       for(int i = 0; i < roi_out->width; i++)
       {
-        const size_t pin = (size_t)(roi_in->width * (j + csy) + csx) + i;
+        const size_t pin = (size_t)(roi_in->width * (j + csy) + ix) + i;
         const size_t pout = (size_t)j * roi_out->width + i;
 
         const int id = BL(roi_out, d, j, i);
@@ -331,7 +333,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       for(int i = 0; i < roi_out->width; i++)
       {
-        const size_t pin = (size_t)(roi_in->width * (j + csy) + csx) + i;
+        const size_t pin = (size_t)(roi_in->width * (j + csy) + ix) + i;
         const size_t pout = (size_t)j * roi_out->width + i;
 
         const int id = BL(roi_out, d, j, i);
@@ -361,7 +363,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       {
         for(int c = 0; c < ch; c++)
         {
-          const size_t pin = (size_t)ch * (roi_in->width * (j + csy) + csx + i) + c;
+          const size_t pin = (size_t)ch * (roi_in->width * (j + csy) + ix + i) + c;
           const size_t pout = (size_t)ch * (j * roi_out->width + i) + c;
 
           out[pout] = (in[pin] - sub) / div;
@@ -383,6 +385,8 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
   // fprintf(stderr, "roi out %d %d %d %d\n", roi_out->x, roi_out->y, roi_out->width, roi_out->height);
 
   const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
+  // roi_in may be whole rows of the pipe input (IOP_FLAGS_INPUT_VIEW), starting left of roi_out
+  const int ix = csx + roi_out->x - roi_in->x;
 
   if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16)
   { // raw mosaic
@@ -391,7 +395,7 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
 #endif
     for(int j = 0; j < roi_out->height; j++)
     {
-      const uint16_t *in = ((uint16_t *)ivoid) + ((size_t)roi_in->width * (j + csy) + csx);
+      const uint16_t *in = ((uint16_t *)ivoid) + ((size_t)roi_in->width * (j + csy) + ix);
       float *out = ((float *)ovoid) + (size_t)roi_out->width * j;
 
       int i = 0;
@@ -450,7 +454,7 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
 #endif
     for(int j = 0; j < roi_out->height; j++)
     {
-      const float *in = ((float *)ivoid) + ((size_t)roi_in->width * (j + csy) + csx);
+      const float *in = ((float *)ivoid) + ((size_t)roi_in->width * (j + csy) + ix);
       float *out = ((float *)ovoid) + (size_t)roi_out->width * j;
 
       int i = 0;
@@ -502,7 +506,7 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
 #endif
     for(int j = 0; j < roi_out->height; j++)
     {
-      const float *in = ((float *)ivoid) + (size_t)4 * (roi_in->width * (j + csy) + csx);
+      const float *in = ((float *)ivoid) + (size_t)4 * (roi_in->width * (j + csy) + ix);
       float *out = ((float *)ovoid) + (size_t)4 * roi_out->width * j;
 
       // process aligned pixels with SSE
@@ -198,7 +198,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_MASKS;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_MASKS | IOP_FLAGS_LOCAL_MASKS;
 }
 
 //---------------------------------------------------------------------------------
@@ -2458,6 +2458,10 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
                    dt_dev_pixelpipe_iop_t *piece)
 {
   memcpy(piece->data, params, sizeof(dt_iop_retouch_params_t));
+
+  // the wavelet decomposition depends on the whole region of interest
+  const dt_iop_retouch_params_t *p = (const dt_iop_retouch_params_t *)params;
+  if(p->num_scales > 0) piece->process_patch_ready = 0;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -910,6 +910,7 @@ static void tree_view(dt_lib_collect_rule_t *dr)
             where_ext);
 
     g_free(where_ext);
+    dt_database_explain_query_plan(darktable.db, query);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
 
     char **last_tokens = NULL;
@@ -1282,6 +1283,7 @@ static void list_view(dt_lib_collect_rule_t *dr)
 
     if(strlen(query) > 0)
     {
+      dt_database_explain_query_plan(darktable.db, query);
       DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
       while(sqlite3_step(stmt) == SQLITE_ROW)
       {
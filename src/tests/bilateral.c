@@ -0,0 +1,210 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// microbenchmark for the cpu bilateral grid: splat, blur and slice a synthetic Lab image at some common
+// sigmas, with and without the sse2 code, and print megapixels per second for each step.
+// before timing, the sliced splat is checked against the old splat with atomics. the sums are done in a
+// different order, so they are compared with a tolerance. exits with 1 if they don't match.
+//
+//   darktable-bench-bilateral [width height [runs]]
+
+#include "common/bilateral.h"
+#include "common/darktable.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct sigmas_t
+{
+  float s, r;
+} sigmas_t;
+
+static const sigmas_t sigmas[] = { { 8.0f, 10.0f }, { 20.0f, 20.0f }, { 50.0f, 20.0f }, { 100.0f, 50.0f } };
+
+// the splat as it was before it was cut into slices, every pixel does eight atomic adds into the grid
+static void reference_splat(dt_bilateral_t *b, const float *const in)
+{
+  const int ox = 1;
+  const int oy = b->size_x;
+  const int oz = b->size_y * b->size_x;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(b)
+#endif
+  for(int j = 0; j < b->height; j++)
+  {
+    size_t index = (size_t)4 * j * b->width;
+    for(int i = 0; i < b->width; i++)
+    {
+      const float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
+      const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+      const float z = CLAMPS(in[index] / b->sigma_r, 0, b->size_z - 1);
+      const int xi = MIN((int)x, b->size_x - 2);
+      const int yi = MIN((int)y, b->size_y - 2);
+      const int zi = MIN((int)z, b->size_z - 2);
+      const float xf = x - xi;
+      const float yf = y - yi;
+      const float zf = z - zi;
+      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+      for(int k = 0; k < 8; k++)
+      {
+        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
+        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        b->buf[ii] += contrib;
+      }
+      index += 4;
+    }
+  }
+}
+
+// smooth gradients with some edges and noise, L in 0..100
+static void fill(float *const in, const int width, const int height)
+{
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *const px = in + 4 * ((size_t)j * width + i);
+      px[0] = 50.0f + 40.0f * sinf(i * 0.003f) * cosf(j * 0.005f) + ((i / 300 + j / 200) & 1 ? 5.0f : -5.0f)
+              + 2.0f * (rand() / (float)RAND_MAX);
+      px[1] = 10.0f * sinf(j * 0.001f);
+      px[2] = -10.0f * cosf(i * 0.001f);
+      px[3] = 0.0f;
+    }
+}
+
+// splat with dt_bilateral_splat() and reference_splat(), compare the grids and what is sliced from them
+// after the blur. returns 1 if they are too far apart.
+static int check(const float *const in, const int width, const int height, const sigmas_t *const sigma)
+{
+  dt_bilateral_t *b = dt_bilateral_init(width, height, sigma->s, sigma->r);
+  dt_bilateral_t *ref = dt_bilateral_init(width, height, sigma->s, sigma->r);
+  float *const out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *const out_ref = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  dt_bilateral_splat(b, in);
+  reference_splat(ref, in);
+
+  const size_t size = b->size_x * b->size_y * b->size_z;
+  float max = 0.0f, grid_err = 0.0f;
+  for(size_t k = 0; k < size; k++)
+  {
+    max = fmaxf(max, fabsf(ref->buf[k]));
+    grid_err = fmaxf(grid_err, fabsf(b->buf[k] - ref->buf[k]));
+  }
+  grid_err /= fmaxf(max, 1e-6f);
+
+  dt_bilateral_blur(b);
+  dt_bilateral_blur(ref);
+  dt_bilateral_slice(b, in, out, -1.0f);
+  dt_bilateral_slice(ref, in, out_ref, -1.0f);
+  float out_err = 0.0f;
+  for(size_t k = 0; k < (size_t)4 * width * height; k++) out_err = fmaxf(out_err, fabsf(out[k] - out_ref[k]));
+
+  // relative to the largest grid cell, and in L units for the output
+  const int fail = !(grid_err < 1e-4f) || !(out_err < 1e-2f);
+  printf("  %dx%d sigma_s %5.1f sigma_r %5.1f: grid error %.2e, output error %.2e%s\n", width, height,
+         sigma->s, sigma->r, grid_err, out_err, fail ? "  FAILED" : "");
+
+  dt_free_align(out);
+  dt_free_align(out_ref);
+  dt_bilateral_free(b);
+  dt_bilateral_free(ref);
+  return fail;
+}
+
+static void bench(const float *const in, float *const out, const int width, const int height, const int runs,
+                  const sigmas_t *const sigma)
+{
+  double splat = 0.0, blur = 0.0, slice = 0.0;
+  for(int run = 0; run < runs; run++)
+  {
+    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma->s, sigma->r);
+    const double t0 = dt_get_wtime();
+    dt_bilateral_splat(b, in);
+    const double t1 = dt_get_wtime();
+    dt_bilateral_blur(b);
+    const double t2 = dt_get_wtime();
+    dt_bilateral_slice(b, in, out, -1.0f);
+    const double t3 = dt_get_wtime();
+    splat += t1 - t0;
+    blur += t2 - t1;
+    slice += t3 - t2;
+    dt_bilateral_free(b);
+  }
+  const double mpix = 1e-6 * width * height * runs;
+  printf("  sigma_s %5.1f sigma_r %5.1f: splat %8.1f  blur %8.1f  slice %8.1f  all %8.1f Mpix/s\n", sigma->s,
+         sigma->r, mpix / splat, mpix / blur, mpix / slice, mpix / (splat + blur + slice));
+}
+
+int main(int argc, char *argv[])
+{
+  const int width = argc > 2 ? atoi(argv[1]) : 6000;
+  const int height = argc > 2 ? atoi(argv[2]) : 4000;
+  const int runs = argc > 3 ? atoi(argv[3]) : 5;
+
+  char *dt_argv[]
+      = { "darktable-bench-bilateral", "--library", ":memory:", "--conf", "write_sidecar_files=FALSE", NULL };
+  // init dt without gui and without data.db:
+  if(dt_init(sizeof(dt_argv) / sizeof(*dt_argv) - 1, dt_argv, FALSE, FALSE, NULL)) exit(1);
+
+  float *const in = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *const out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  fill(in, width, height);
+  // a width that is no multiple of four, for the leftover pixels of the sse2 rows
+  const int small_width = 1001, small_height = 667;
+  float *const small = dt_alloc_align(64, sizeof(float) * 4 * small_width * small_height);
+  fill(small, small_width, small_height);
+
+  printf("%dx%d, %d runs, %d threads\n", width, height, runs, dt_get_num_threads());
+
+  const dt_codepath_t codepath = darktable.codepath;
+  int failed = 0;
+  for(int sse2 = 0; sse2 <= codepath.SSE2; sse2++)
+  {
+    darktable.codepath.SSE2 = sse2;
+    printf("check against the splat with atomics, %s:\n", sse2 ? "sse2" : "plain");
+    for(size_t k = 0; k < sizeof(sigmas) / sizeof(*sigmas); k++)
+    {
+      failed |= check(in, width, height, sigmas + k);
+      failed |= check(small, small_width, small_height, sigmas + k);
+    }
+  }
+  dt_free_align(small);
+
+  darktable.codepath.SSE2 = 0;
+  printf("plain:\n");
+  for(size_t k = 0; k < sizeof(sigmas) / sizeof(*sigmas); k++) bench(in, out, width, height, runs, sigmas + k);
+  darktable.codepath = codepath;
+  if(darktable.codepath.SSE2)
+  {
+    printf("sse2:\n");
+    for(size_t k = 0; k < sizeof(sigmas) / sizeof(*sigmas); k++) bench(in, out, width, height, runs, sigmas + k);
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_cleanup();
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
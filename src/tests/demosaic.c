@@ -0,0 +1,463 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark and check for the tiled bayer ppg path of demosaic: run it on a synthetic mosaic for all four
+// bayer patterns and every green equilibration, median and color smoothing setting, next to the old code
+// that makes one pass over the whole image per step. prints the time of both and fails if the rgb differs.
+// the tiled path runs without and, if the cpu has it, with the avx2 green pass. by default it goes through
+// 24, 45 and 100 megapixels, the largest needs about 4GB of memory. x-trans doesn't go through ppg and is
+// not covered.
+//
+//   darktable-bench-demosaic [width height [runs]]
+
+// the ppg code is static, so pull in the module itself
+#include "iop/demosaic.c"
+
+#include "common/cpuid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REF_SWAP(a, b)                                                                                       \
+  {                                                                                                          \
+    const float tmp = (b);                                                                                   \
+    (b) = (a);                                                                                               \
+    (a) = tmp;                                                                                               \
+  }
+
+// the median prefilter as it was before the tiling, green only
+static void ref_pre_median(float *out, const float *const in, const dt_iop_roi_t *const roi,
+                           const uint32_t filters, const float threshold)
+{
+  memcpy(out, in, (size_t)roi->width * roi->height * sizeof(float));
+  const int num_passes = 1;
+  // now green:
+  const int lim[5] = { 0, 1, 2, 1, 0 };
+  for(int pass = 0; pass < num_passes; pass++)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out) schedule(static)
+#endif
+    for(int row = 3; row < roi->height - 3; row++)
+    {
+      float med[9];
+      int col = 3;
+      if(FC(row, col, filters) != 1 && FC(row, col, filters) != 3) col++;
+      float *pixo = out + (size_t)roi->width * row + col;
+      const float *pixi = in + (size_t)roi->width * row + col;
+      for(; col < roi->width - 3; col += 2)
+      {
+        int cnt = 0;
+        for(int k = 0, i = 0; i < 5; i++)
+        {
+          for(int j = -lim[i]; j <= lim[i]; j += 2)
+          {
+            if(fabsf(pixi[roi->width * (i - 2) + j] - pixi[0]) < threshold)
+            {
+              med[k++] = pixi[roi->width * (i - 2) + j];
+              cnt++;
+            }
+            else
+              med[k++] = 64.0f + pixi[roi->width * (i - 2) + j];
+          }
+        }
+        for(int i = 0; i < 8; i++)
+          for(int ii = i + 1; ii < 9; ii++)
+            if(med[i] > med[ii]) REF_SWAP(med[i], med[ii]);
+        pixo[0] = (cnt == 1 ? med[4] - 64.0f : med[(cnt - 1) / 2]);
+        // pixo[0] = med[(cnt-1)/2];
+        pixo += 2;
+        pixi += 2;
+      }
+    }
+  }
+}
+
+// ppg as it was before the tiling, without the avx2 green pass
+static void ref_ppg(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                    const dt_iop_roi_t *const roi_in, const uint32_t filters, const float thrs)
+{
+  // offsets only where the buffer ends:
+  const int offx = 3; // MAX(0, 3 - roi_out->x);
+  const int offy = 3; // MAX(0, 3 - roi_out->y);
+  const int offX = 3; // MAX(0, 3 - (roi_in->width  - (roi_out->x + roi_out->width)));
+  const int offY = 3; // MAX(0, 3 - (roi_in->height - (roi_out->y + roi_out->height)));
+
+  // these may differ a little, if you're unlucky enough to split a bayer block with cropping or similar.
+  // we never want to access the input out of bounds though:
+  assert(roi_in->width >= roi_out->width);
+  assert(roi_in->height >= roi_out->height);
+  // border interpolate
+  float sum[8];
+  for(int j = 0; j < roi_out->height; j++)
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      if(i == offx && j >= offy && j < roi_out->height - offY) i = roi_out->width - offX;
+      if(i == roi_out->width) break;
+      memset(sum, 0, sizeof(float) * 8);
+      for(int y = j - 1; y != j + 2; y++)
+        for(int x = i - 1; x != i + 2; x++)
+        {
+          const int yy = y + roi_out->y, xx = x + roi_out->x;
+          if(yy >= 0 && xx >= 0 && yy < roi_in->height && xx < roi_in->width)
+          {
+            int f = FC(y, x, filters);
+            sum[f] += in[(size_t)yy * roi_in->width + xx];
+            sum[f + 4]++;
+          }
+        }
+      int f = FC(j, i, filters);
+      for(int c = 0; c < 3; c++)
+      {
+        if(c != f && sum[c + 4] > 0.0f)
+          out[4 * ((size_t)j * roi_out->width + i) + c] = sum[c] / sum[c + 4];
+        else
+          out[4 * ((size_t)j * roi_out->width + i) + c]
+              = in[((size_t)j + roi_out->y) * roi_in->width + i + roi_out->x];
+      }
+    }
+  const int median = thrs > 0.0f;
+  // if(median) fbdd_green(out, in, roi_out, roi_in, filters);
+  const float *input = in;
+  if(median)
+  {
+    float *med_in = (float *)dt_alloc_align(16, (size_t)roi_in->height * roi_in->width * sizeof(float));
+    ref_pre_median(med_in, in, roi_in, filters, thrs);
+    input = med_in;
+  }
+// for all pixels: interpolate green into float array, or copy color.
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(input) schedule(static)
+#endif
+  for(int j = offy; j < roi_out->height - offY; j++)
+  {
+    float *buf = out + (size_t)4 * roi_out->width * j + 4 * offx;
+    const float *buf_in = input + (size_t)roi_in->width * (j + roi_out->y) + offx + roi_out->x;
+    for(int i = offx; i < roi_out->width - offX; i++)
+    {
+      const int c = FC(j, i, filters);
+#if defined(__SSE__)
+      // prefetch what we need soon (load to cpu caches)
+      _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
+      _mm_prefetch((char *)buf_in + roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in + 2 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in + 3 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - 2 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - 3 * roi_in->width + 256, _MM_HINT_NTA);
+#endif
+
+#if defined(__SSE__)
+      __m128 col = _mm_load_ps(buf);
+      float *color = (float *)&col;
+#else
+      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
+#endif
+      const float pc = buf_in[0];
+      // if(__builtin_expect(c == 0 || c == 2, 1))
+      if(c == 0 || c == 2)
+      {
+        color[c] = pc;
+        // get stuff (hopefully from cache)
+        const float pym = buf_in[-roi_in->width * 1];
+        const float pym2 = buf_in[-roi_in->width * 2];
+        const float pym3 = buf_in[-roi_in->width * 3];
+        const float pyM = buf_in[+roi_in->width * 1];
+        const float pyM2 = buf_in[+roi_in->width * 2];
+        const float pyM3 = buf_in[+roi_in->width * 3];
+        const float pxm = buf_in[-1];
+        const float pxm2 = buf_in[-2];
+        const float pxm3 = buf_in[-3];
+        const float pxM = buf_in[+1];
+        const float pxM2 = buf_in[+2];
+        const float pxM3 = buf_in[+3];
+
+        const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
+        const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
+                            + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
+        const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
+        const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
+                            + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
+        if(diffx > diffy)
+        {
+          // use guessy
+          const float m = fminf(pym, pyM);
+          const float M = fmaxf(pym, pyM);
+          color[1] = fmaxf(fminf(guessy * .25f, M), m);
+        }
+        else
+        {
+          const float m = fminf(pxm, pxM);
+          const float M = fmaxf(pxm, pxM);
+          color[1] = fmaxf(fminf(guessx * .25f, M), m);
+        }
+      }
+      else
+        color[1] = pc;
+
+      // write using MOVNTPS (write combine omitting caches)
+      // _mm_stream_ps(buf, col);
+      memcpy(buf, color, 4 * sizeof(float));
+      buf += 4;
+      buf_in++;
+    }
+  }
+// SFENCE (make sure stuff is stored now)
+// _mm_sfence();
+
+// for all pixels: interpolate colors into float array
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 1; j < roi_out->height - 1; j++)
+  {
+    float *buf = out + (size_t)4 * roi_out->width * j + 4;
+    for(int i = 1; i < roi_out->width - 1; i++)
+    {
+      // also prefetch direct nbs top/bottom
+#if defined(__SSE__)
+      _mm_prefetch((char *)buf + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf - roi_out->width * 4 * sizeof(float) + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf + roi_out->width * 4 * sizeof(float) + 256, _MM_HINT_NTA);
+#endif
+
+      const int c = FC(j, i, filters);
+#if defined(__SSE__)
+      __m128 col = _mm_load_ps(buf);
+      float *color = (float *)&col;
+#else
+      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
+#endif
+      // fill all four pixels with correctly interpolated stuff: r/b for green1/2
+      // b for r and r for b
+      if(__builtin_expect(c & 1, 1)) // c == 1 || c == 3)
+      {
+        // calculate red and blue for green pixels:
+        // need 4-nbhood:
+        const float *nt = buf - 4 * roi_out->width;
+        const float *nb = buf + 4 * roi_out->width;
+        const float *nl = buf - 4;
+        const float *nr = buf + 4;
+        if(FC(j, i + 1, filters) == 0) // red nb in same row
+        {
+          color[2] = (nt[2] + nb[2] + 2.0f * color[1] - nt[1] - nb[1]) * .5f;
+          color[0] = (nl[0] + nr[0] + 2.0f * color[1] - nl[1] - nr[1]) * .5f;
+        }
+        else
+        {
+          // blue nb
+          color[0] = (nt[0] + nb[0] + 2.0f * color[1] - nt[1] - nb[1]) * .5f;
+          color[2] = (nl[2] + nr[2] + 2.0f * color[1] - nl[1] - nr[1]) * .5f;
+        }
+      }
+      else
+      {
+        // get 4-star-nbhood:
+        const float *ntl = buf - 4 - 4 * roi_out->width;
+        const float *ntr = buf + 4 - 4 * roi_out->width;
+        const float *nbl = buf - 4 + 4 * roi_out->width;
+        const float *nbr = buf + 4 + 4 * roi_out->width;
+
+        if(c == 0)
+        {
+          // red pixel, fill blue:
+          const float diff1 = fabsf(ntl[2] - nbr[2]) + fabsf(ntl[1] - color[1]) + fabsf(nbr[1] - color[1]);
+          const float guess1 = ntl[2] + nbr[2] + 2.0f * color[1] - ntl[1] - nbr[1];
+          const float diff2 = fabsf(ntr[2] - nbl[2]) + fabsf(ntr[1] - color[1]) + fabsf(nbl[1] - color[1]);
+          const float guess2 = ntr[2] + nbl[2] + 2.0f * color[1] - ntr[1] - nbl[1];
+          if(diff1 > diff2)
+            color[2] = guess2 * .5f;
+          else if(diff1 < diff2)
+            color[2] = guess1 * .5f;
+          else
+            color[2] = (guess1 + guess2) * .25f;
+        }
+        else // c == 2, blue pixel, fill red:
+        {
+          const float diff1 = fabsf(ntl[0] - nbr[0]) + fabsf(ntl[1] - color[1]) + fabsf(nbr[1] - color[1]);
+          const float guess1 = ntl[0] + nbr[0] + 2.0f * color[1] - ntl[1] - nbr[1];
+          const float diff2 = fabsf(ntr[0] - nbl[0]) + fabsf(ntr[1] - color[1]) + fabsf(nbl[1] - color[1]);
+          const float guess2 = ntr[0] + nbl[0] + 2.0f * color[1] - ntr[1] - nbl[1];
+          if(diff1 > diff2)
+            color[0] = guess2 * .5f;
+          else if(diff1 < diff2)
+            color[0] = guess1 * .5f;
+          else
+            color[0] = (guess1 + guess2) * .25f;
+        }
+      }
+      // _mm_stream_ps(buf, col);
+      memcpy(buf, color, 4 * sizeof(float));
+      buf += 4;
+    }
+  }
+  // _mm_sfence();
+  if(median) dt_free_align((float *)input);
+}
+
+// the old order of the steps: green equilibration over the whole image, ppg, then color smoothing
+static void ref_demosaic(float *const out, const float *const in, const dt_iop_roi_t *const roi,
+                         const uint32_t filters, const float thrs, const dt_iop_demosaic_greeneq_t green_eq,
+                         const float eq_thrs, const int smoothing)
+{
+  const size_t size = (size_t)roi->width * roi->height;
+  float *eq = NULL, *aux = NULL;
+  switch(green_eq)
+  {
+    case DT_IOP_GREEN_EQ_FULL:
+      eq = dt_alloc_align(16, size * sizeof(float));
+      green_equilibration_favg(eq, in, roi->width, roi->height, filters, roi->x, roi->y);
+      break;
+    case DT_IOP_GREEN_EQ_LOCAL:
+      eq = dt_alloc_align(16, size * sizeof(float));
+      green_equilibration_lavg(eq, in, roi->width, roi->height, filters, roi->x, roi->y, eq_thrs);
+      break;
+    case DT_IOP_GREEN_EQ_BOTH:
+      eq = dt_alloc_align(16, size * sizeof(float));
+      aux = dt_alloc_align(16, size * sizeof(float));
+      green_equilibration_favg(aux, in, roi->width, roi->height, filters, roi->x, roi->y);
+      green_equilibration_lavg(eq, aux, roi->width, roi->height, filters, roi->x, roi->y, eq_thrs);
+      dt_free_align(aux);
+      break;
+    default:
+      break;
+  }
+  ref_ppg(out, eq ? eq : in, roi, roi, filters, thrs);
+  if(smoothing) color_smoothing(out, roi, smoothing);
+  dt_free_align(eq);
+}
+
+static const uint32_t patterns[] = { 0x94949494, 0x16161616, 0x61616161, 0x49494949 };
+static const char *const green_eq_names[] = { "none", "local", "full", "both" };
+
+// pixels where any of r, g and b differ
+static size_t compare(const float *const a, const float *const b, const size_t size)
+{
+  size_t bad = 0;
+  for(size_t k = 0; k < size; k++)
+    if(memcmp(a + 4 * k, b + 4 * k, sizeof(float) * 3)) bad++;
+  return bad;
+}
+
+static int bench(const int width, const int height, const int runs, const int has_avx2)
+{
+  const size_t size = (size_t)width * height;
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  float *const in = dt_alloc_align(64, sizeof(float) * size);
+  float *const out = dt_alloc_align(64, sizeof(float) * 4 * size);
+  float *const ref = dt_alloc_align(64, sizeof(float) * 4 * size);
+  if(!in || !out || !ref)
+  {
+    fprintf(stderr, "could not allocate the buffers for %dx%d\n", width, height);
+    dt_free_align(in);
+    dt_free_align(out);
+    dt_free_align(ref);
+    return 1;
+  }
+
+  // smooth gradients, hard edges, some noise and a slight imbalance between the two greens, 0..1
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+      in[(size_t)j * width + i] = CLAMP(0.4f + 0.3f * sinf(i * 0.004f) * cosf(j * 0.006f)
+                                            + ((i / 200 + j / 150) & 1 ? 0.15f : -0.15f)
+                                            + ((j & 1) && !(i & 1) ? 0.02f : 0.0f)
+                                            + 0.05f * (rand() / (float)RAND_MAX),
+                                        0.0f, 1.0f);
+
+  printf("%dx%d (%.0f MP), %d runs, %d threads\n", width, height, size / 1e6, runs, dt_get_num_threads());
+
+  int failed = 0;
+  for(size_t p = 0; p < sizeof(patterns) / sizeof(*patterns); p++)
+    for(int green_eq = DT_IOP_GREEN_EQ_NO; green_eq <= DT_IOP_GREEN_EQ_BOTH; green_eq++)
+      for(int median = 0; median < 2; median++)
+        for(int smoothing = 0; smoothing <= 5; smoothing += 2)
+        {
+          const float thrs = median ? 0.1f : 0.0f, eq_thrs = 0.0001f * 400;
+          double t_ref = 0.0;
+          for(int run = 0; run < runs; run++)
+          {
+            const double t0 = dt_get_wtime();
+            ref_demosaic(ref, in, &roi, patterns[p], thrs, green_eq, eq_thrs, smoothing);
+            t_ref += dt_get_wtime() - t0;
+          }
+
+          for(int avx2 = 0; avx2 <= has_avx2; avx2++)
+          {
+            darktable.codepath.AVX2 = avx2;
+            double t_tiled = 0.0;
+            for(int run = 0; run < runs; run++)
+            {
+              const double t0 = dt_get_wtime();
+              demosaic_ppg(out, in, &roi, &roi, patterns[p], thrs, green_eq, eq_thrs, smoothing);
+              t_tiled += dt_get_wtime() - t0;
+            }
+            const size_t bad = compare(out, ref, size);
+            if(bad) failed++;
+            printf("  filters %08x green eq %-5s median %d smoothing %d avx2 %-3s: ", patterns[p],
+                   green_eq_names[green_eq], median, smoothing, avx2 ? "on" : "off");
+            printf("untiled %7.3f s  tiled %7.3f s  %5.2fx  %s", t_ref / runs, t_tiled / runs, t_ref / t_tiled,
+                   bad ? "DIFFERS" : "ok");
+            if(bad) printf(" (%zu pixels)", bad);
+            printf("\n");
+          }
+        }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(ref);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  // 24, 45 and 100 megapixels, unless a size is given
+  int sizes[][2] = { { 6000, 4000 }, { 8256, 5504 }, { 11648, 8736 } };
+  int num_sizes = sizeof(sizes) / sizeof(*sizes);
+  if(argc > 2)
+  {
+    sizes[0][0] = atoi(argv[1]);
+    sizes[0][1] = atoi(argv[2]);
+    num_sizes = 1;
+  }
+  const int runs = argc > 3 ? atoi(argv[3]) : 3;
+
+  char *dt_argv[]
+      = { "darktable-bench-demosaic", "--library", ":memory:", "--conf", "write_sidecar_files=FALSE", NULL };
+  // init dt without gui and without data.db:
+  if(dt_init(sizeof(dt_argv) / sizeof(*dt_argv) - 1, dt_argv, FALSE, FALSE, NULL)) exit(1);
+
+  // the avx2 green pass is compared whenever the cpu can run it, whatever the config says
+  int has_avx2 = 0;
+#ifdef HAVE_AVX_CODEPATHS
+  const dt_cpu_flags_t flags = dt_detect_cpu_features();
+  has_avx2 = darktable.codepath.SSE2 && (flags & CPU_FLAG_AVX2) && (flags & CPU_FLAG_FMA);
+#endif
+  if(!has_avx2) printf("the avx2 green pass is not available, checking the tiled path without it\n");
+
+  int failed = 0;
+  for(int k = 0; k < num_sizes; k++) failed += bench(sizes[k][0], sizes[k][1], runs, has_avx2);
+
+  printf("%d settings differ\n", failed);
+
+  dt_cleanup();
+  return failed ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,143 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// test for the thumbnail pack: writes and removals have to be the same after reopening it.
+//
+//   darktable-test-mipmap-pack
+
+#include "common/darktable.h"
+#include "common/mipmap_pack.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_tests = 0, n_failed = 0;
+
+// the blob written for imgid in generation gen
+static void blob(uint8_t *buf, const size_t length, const uint32_t imgid, const int gen)
+{
+  for(size_t k = 0; k < length; k++) buf[k] = (uint8_t)(imgid * 31 + gen * 7 + k);
+}
+
+static void write_thumb(struct dt_mipmap_pack_t *pack, const uint32_t imgid, const int gen)
+{
+  uint8_t buf[1000];
+  blob(buf, sizeof(buf), imgid, gen);
+  if(dt_mipmap_pack_write(pack, imgid, 0, buf, sizeof(buf) - imgid, 0))
+    fprintf(stderr, "[mipmap_pack] could not write image %u\n", imgid);
+}
+
+// gen < 0 means the image must not be there
+static void check(struct dt_mipmap_pack_t *pack, const char *when, const uint32_t imgid, const int gen)
+{
+  n_tests++;
+  size_t length = 0;
+  int color_space = 0;
+  const uint8_t *data = dt_mipmap_pack_read_get(pack, imgid, 0, &length, &color_space);
+  int ok;
+  if(gen < 0)
+    ok = data == NULL;
+  else
+  {
+    uint8_t buf[1000];
+    blob(buf, sizeof(buf), imgid, gen);
+    ok = data && length == sizeof(buf) - imgid && !memcmp(data, buf, length);
+  }
+  if(data) dt_mipmap_pack_read_release(pack);
+  if(!ok) n_failed++;
+  printf("  [%s] %s: image %u %s\n", ok ? "OK" : "FAIL", when, imgid,
+         gen < 0 ? "is removed" : "has its latest thumbnail");
+}
+
+int main()
+{
+  char *argv[] = { "darktable-test-mipmap-pack", "--library", ":memory:", "--conf", "write_sidecar_files=FALSE",
+                   NULL };
+  int argc = sizeof(argv) / sizeof(*argv) - 1;
+
+  // init dt without gui and without data.db:
+  if(dt_init(argc, argv, FALSE, FALSE, NULL)) exit(1);
+
+  gchar *dirname = g_dir_make_tmp("darktable-test-mipmap-pack-XXXXXX", NULL);
+  if(!dirname) exit(1);
+
+  struct dt_mipmap_pack_t *pack = dt_mipmap_pack_open(dirname);
+  if(!pack) exit(1);
+  for(uint32_t imgid = 1; imgid <= 4; imgid++) write_thumb(pack, imgid, 0);
+  dt_mipmap_pack_remove(pack, 2, 0);
+  // records after a removal must survive the reopening, too
+  write_thumb(pack, 1, 1);
+  write_thumb(pack, 5, 0);
+  check(pack, "written", 1, 1);
+  check(pack, "written", 2, -1);
+  check(pack, "written", 5, 0);
+  dt_mipmap_pack_close(pack);
+
+  pack = dt_mipmap_pack_open(dirname);
+  if(!pack) exit(1);
+  check(pack, "reopened", 1, 1);
+  check(pack, "reopened", 2, -1);
+  check(pack, "reopened", 3, 0);
+  check(pack, "reopened", 4, 0);
+  check(pack, "reopened", 5, 0);
+  // a removed image written again
+  write_thumb(pack, 2, 1);
+  dt_mipmap_pack_remove(pack, 4, 0);
+  dt_mipmap_pack_close(pack);
+
+  pack = dt_mipmap_pack_open(dirname);
+  if(!pack) exit(1);
+  check(pack, "reopened twice", 1, 1);
+  check(pack, "reopened twice", 2, 1);
+  check(pack, "reopened twice", 3, 0);
+  check(pack, "reopened twice", 4, -1);
+  check(pack, "reopened twice", 5, 0);
+  // compaction keeps what is live and nothing else
+  dt_mipmap_pack_compact(pack, 0.0f);
+  dt_mipmap_pack_close(pack);
+
+  pack = dt_mipmap_pack_open(dirname);
+  if(!pack) exit(1);
+  check(pack, "compacted", 1, 1);
+  check(pack, "compacted", 2, 1);
+  check(pack, "compacted", 3, 0);
+  check(pack, "compacted", 4, -1);
+  check(pack, "compacted", 5, 0);
+  dt_mipmap_pack_close(pack);
+
+  printf("%d / %d tests failed\n", n_failed, n_tests);
+
+  gchar *filename = g_build_filename(dirname, "thumbnails.pack", NULL);
+  g_unlink(filename);
+  g_free(filename);
+  filename = g_build_filename(dirname, "thumbnails.idx", NULL);
+  g_unlink(filename);
+  g_free(filename);
+  g_rmdir(dirname);
+  g_free(dirname);
+
+  dt_cleanup();
+  return n_failed > 0 ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -108,6 +108,8 @@ typedef struct dt_library_t
   int32_t last_mouse_over_id;
 
   int32_t collection_count;
+  // version of the collection result copied into collected_images
+  uint32_t collected_version;
 
   // stuff for the audio player
   GPid audio_player_pid;   // the pid of the child process
@@ -117,8 +119,6 @@ typedef struct dt_library_t
   /* prepared and reusable statements */
   struct
   {
-    /* main query statement, should be update on listener signal of collection */
-    sqlite3_stmt *main_query;
     /* select imgid from selected_images */
     sqlite3_stmt *select_imgid_in_selection;
     /* delete from selected_images where imgid != ?1 */
@@ -284,18 +284,56 @@ static void _view_lighttable_collection_listener_callback(gpointer instance, gpo
   _update_collected_images(self);
 }
 
+// the image in full preview may have left the collection, show its neighbour then
+static void _full_preview_follow_collection(dt_library_t *lib)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT imgid FROM memory.collected_images WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, lib->full_preview_id);
+  const gboolean present = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  if(present) return;
+
+  const char *queries[] = { "SELECT imgid, rowid FROM memory.collected_images WHERE rowid > ?1 "
+                            "ORDER BY rowid LIMIT 1",
+                            "SELECT imgid, rowid FROM memory.collected_images WHERE rowid < ?1 "
+                            "ORDER BY rowid DESC LIMIT 1" };
+  for(int k = 0; k < 2; k++)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), queries[k], -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, lib->full_preview_rowid);
+    const gboolean found = sqlite3_step(stmt) == SQLITE_ROW;
+    if(found)
+    {
+      lib->full_preview_id = sqlite3_column_int(stmt, 0);
+      lib->full_preview_rowid = sqlite3_column_int(stmt, 1);
+      dt_control_set_mouse_over_id(lib->full_preview_id);
+    }
+    sqlite3_finalize(stmt);
+    if(found) break;
+  }
+}
+
 static void _update_collected_images(dt_view_t *self)
 {
   dt_library_t *lib = (dt_library_t *)self->data;
   sqlite3_stmt *stmt;
   int32_t min_before = 0, min_after = 0;
 
-  /* check if we can get a query from collection */
-  gchar *query = g_strdup(dt_collection_get_query(darktable.collection));
-  if(!query) return;
+  // the collection removes the images leaving it from collected_images itself, only refill the table when
+  // the result was built again.
+  const uint32_t version = dt_collection_get_version(darktable.collection);
+  if(version == lib->collected_version)
+  {
+    if(lib->full_preview_id != -1) _full_preview_follow_collection(lib);
+    dt_control_queue_redraw_center();
+    return;
+  }
+  lib->collected_version = version;
 
-  // we have a new query for the collection of images to display. For speed reason we collect all images into
-  // a temporary (in-memory) table (collected_images).
+  // the collection keeps its result in collection order, the lighttable reads the images to display from
+  // there. a copy goes into a temporary (in-memory) table (collected_images) for the queries joining it.
   //
   // 0. get current lower rowid
   if (lib->full_preview_id != -1)
@@ -317,19 +355,23 @@ static void _update_collected_images(dt_view_t *self)
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.sqlite_sequence WHERE "
                                                        "name='collected_images'", NULL, NULL, NULL);
 
-  // 2. insert collected images into the temporary table
-
-  gchar *ins_query = NULL;
-  ins_query = dt_util_dstrcat(ins_query, "INSERT INTO memory.collected_images (imgid) %s", query);
+  // 2. insert collected images into the temporary table, no need to run the collection query again
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), ins_query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-  sqlite3_step(stmt);
+  const uint32_t count = dt_collection_get_count(darktable.collection);
+  int32_t *ids = g_malloc(sizeof(int32_t) * MAX(count, 1));
+  const uint32_t num = dt_collection_get_ids(darktable.collection, ids, 0, count);
+  dt_database_start_transaction(darktable.db);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO memory.collected_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(uint32_t k = 0; k < num; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, ids[k]);
+    sqlite3_step(stmt);
+    DT_DEBUG_SQLITE3_RESET(stmt);
+  }
   sqlite3_finalize(stmt);
-
-  g_free(query);
-  g_free(ins_query);
+  dt_database_release_transaction(darktable.db);
+  g_free(ids);
 
   // 3. get new low-bound, then update the full preview rowid accordingly
   if (lib->full_preview_id != -1)
@@ -362,14 +404,6 @@ static void _update_collected_images(dt_view_t *self)
     sqlite3_finalize(stmt);
   }
 
-  /* if we have a statement lets clean it */
-  if(lib->statements.main_query) sqlite3_finalize(lib->statements.main_query);
-
-  /* prepare a new main query statement for collection */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid FROM memory.collected_images ORDER BY rowid LIMIT ?1, ?2", -1,
-                              &lib->statements.main_query, NULL);
-
   dt_control_queue_redraw_center();
 }
 
@@ -432,7 +466,7 @@ void init(dt_view_t *self)
   lib->full_res_thumb_id = -1;
   lib->audio_player_id = -1;
 
-  /* setup collection listener and initialize main_query statement */
+  /* setup collection listener and fill the collected images */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
                             G_CALLBACK(_view_lighttable_collection_listener_callback), (gpointer)self);
 
@@ -579,9 +613,6 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
     return 0;
   }
 
-  /* do we have a main query collection statement */
-  if(!lib->statements.main_query) return 0;
-
   /* safety check added to be able to work with zoom slider. The
   * communication between zoom slider and lighttable should be handled
   * differently (i.e. this is a clumsy workaround) */
@@ -603,14 +634,6 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   if(iir > 1) shown_rows += max_rows - 2;
   dt_view_set_scrollbar(self, 0, 0, 1, 1, offset, 0, shown_rows * iir, (max_rows - 1) * iir);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* setup offset and row for the main query */
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_rows * iir);
-
   if(mouse_over_id != -1)
   {
     const dt_image_t *mouse_over_image = dt_image_cache_get(darktable.image_cache, mouse_over_id, 'r');
@@ -627,18 +650,9 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   // group.
   int *query_ids = (int *)calloc(max_rows * max_cols, sizeof(int));
   if(!query_ids) goto after_drawing;
-  for(int row = 0; row < max_rows; row++)
-  {
-    for(int col = 0; col < max_cols; col++)
-    {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
-        query_ids[row * iir + col] = sqlite3_column_int(lib->statements.main_query, 0);
-      else
-        goto end_query_cache;
-    }
-  }
+  // the images to show, in collection order. max_cols == iir, so that's one run of ids
+  dt_collection_get_ids(darktable.collection, query_ids, offset, max_rows * max_cols);
 
-end_query_cache:
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image = 0;
@@ -915,17 +929,8 @@ after_drawing:
     const int prefetchrows = .5 * max_rows + 1;
     int32_t *imgids = malloc(prefetchrows * iir * sizeof(int32_t));
 
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows * iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows * iir);
-
     // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows * iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
+    imgids_num = dt_collection_get_ids(darktable.collection, imgids, offset + max_rows * iir, prefetchrows * iir);
 
     float imgwd = iir == 1 ? 0.97 : 0.8;
     dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, imgwd * wd,
@@ -1005,8 +1010,6 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
     zoom_y = lib->select_offset_y - /* (zoom == 1 ? 2. : 1.)*/ pointery;
   }
 
-  if(!lib->statements.main_query) return 0;
-
   if(track == 0)
     ;
   else if(track > 1)
@@ -1149,6 +1152,7 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
     lib->offset = offset;
 
   int id;
+  int32_t row_ids[DT_LIBRARY_MAX_ZOOM];
 
   dt_view_set_scrollbar(self,
                         zoom_x, -width + wd, wd * DT_LIBRARY_MAX_ZOOM - wd + width, width,
@@ -1167,17 +1171,12 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
       continue;
     }
 
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_cols);
+    const int row_count = dt_collection_get_ids(darktable.collection, row_ids, offset, max_cols);
     for(int col = 0; col < max_cols; col++)
     {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      if(col < row_count)
       {
-        id = sqlite3_column_int(lib->statements.main_query, 0);
+        id = row_ids[col];
 
         // set mouse over id
         if((zoom == 1 && mouse_over_id < 0) || ((!pan || track) && seli == col && selj == row && pointerx > 0
@@ -1332,7 +1331,7 @@ static int expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int3
       if(!dt_imageio_large_thumbnail(filename, &lib->full_res_thumb,
                                                &lib->full_res_thumb_wd,
                                                &lib->full_res_thumb_ht,
-                                               &color_space)) {
+                                               &color_space, 0, 0)) {
         lib->full_res_thumb_orientation = ORIENTATION_NONE;
         lib->full_res_thumb_id = lib->full_preview_id;
       }
@@ -1561,7 +1560,7 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
   dt_view_t *self = darktable.view_manager->proxy.lighttable.view;
   int num = GPOINTER_TO_INT(data);
   int32_t mouse_over_id;
-  int next_image_rowid = -1;
+  int next_image_pos = -1;
 
   dt_library_t *lib = (dt_library_t *)self->data;
   if(lib->using_arrows)
@@ -1575,7 +1574,6 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
                                 "SELECT MIN(imgid) FROM main.selected_images", -1, &stmt, NULL);
     if(sqlite3_step(stmt) == SQLITE_ROW)
     {
-      sqlite3_stmt *inner_stmt;
       imgid_for_offset = sqlite3_column_int(stmt, 0);
       if(!imgid_for_offset)
       {
@@ -1583,26 +1581,30 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
         imgid_for_offset = dt_control_get_mouse_over_id();
       }
 
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-          //"SELECT imgid FROM memory.collected_images", -1, &inner_stmt,
-          "SELECT rowid FROM memory.collected_images WHERE imgid=?1", -1, &inner_stmt,
-          NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(inner_stmt, 1, imgid_for_offset);
-      if(sqlite3_step(inner_stmt) == SQLITE_ROW)
-        next_image_rowid = sqlite3_column_int(inner_stmt, 0);
-      sqlite3_finalize(inner_stmt);
+      const int pos = dt_collection_image_offset(imgid_for_offset);
+      if(dt_collection_get_nth(darktable.collection, pos) == imgid_for_offset) next_image_pos = pos;
     }
     sqlite3_finalize(stmt);
   }
 
   mouse_over_id = dt_view_get_image_to_act_on();
+  GList *imgids = NULL;
   if(mouse_over_id <= 0)
+  {
+    imgids = dt_collection_get_selected(darktable.collection, -1);
     dt_ratings_apply_to_selection(num);
+  }
   else
+  {
+    imgids = g_list_append(imgids, GINT_TO_POINTER(mouse_over_id));
     dt_ratings_apply_to_image_or_group(mouse_over_id, num);
-  _update_collected_images(self);
+  }
+
+  // only the rated images can leave the collection, no need to run the whole query again. this also
+  // refills collected_images through the collection listener.
+  dt_collection_update_images(darktable.collection, imgids);
+  g_list_free(imgids);
 
-  dt_collection_update_query(darktable.collection); // update the counter
   if(lib->collection_count != dt_collection_get_count(darktable.collection))
   {
     // some images disappeared from collection. Selection is now invisible.
@@ -1611,16 +1613,10 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
     dt_selection_clear(darktable.selection);
     if(lib->using_arrows)
     {
-      // Jump where stored before
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "SELECT imgid FROM memory.collected_images WHERE rowid=?1 OR rowid=?1 - 1 "
-                                  "ORDER BY rowid DESC LIMIT 1", -1, &stmt,
-                                  NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, next_image_rowid);
-      if(sqlite3_step(stmt) == SQLITE_ROW)
-        mouse_over_id = sqlite3_column_int(stmt, 0);
-      sqlite3_finalize(stmt);
+      // Jump where stored before, or to the image before it if that was the last one
+      int imgid = dt_collection_get_nth(darktable.collection, next_image_pos);
+      if(imgid < 0 && next_image_pos > 0) imgid = dt_collection_get_nth(darktable.collection, next_image_pos - 1);
+      if(imgid > 0) mouse_over_id = imgid;
       dt_control_set_mouse_over_id(mouse_over_id);
     }
   }
@@ -1937,7 +1933,10 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
       {
         int32_t mouse_over_id = dt_control_get_mouse_over_id();
         dt_ratings_apply_to_image_or_group(mouse_over_id, lib->image_over);
-        _update_collected_images(self);
+        // refills collected_images through the collection listener if needed
+        GList *imgids = g_list_append(NULL, GINT_TO_POINTER(mouse_over_id));
+        dt_collection_update_images(darktable.collection, imgids);
+        g_list_free(imgids);
         break;
       }
       case DT_VIEW_GROUP: